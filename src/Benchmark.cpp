@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include "Benchmark.h"
+#include "Terrain.h"
+
+using namespace std::chrono;
+
+namespace {
+	const uint32_t SCOPE_COUNT = static_cast<uint32_t>(ProfilerScope::Count);
+
+	void PrintUsage(const char* program) {
+		printf("Usage: %s [options]\n", program);
+		printf("  --benchmark                 Replay a camera path, write statistics and exit\n");
+		printf("  --seed <n>                  Tree placement seed (benchmark default: 1)\n");
+		printf("  --warmup <frames>           Frames rendered before measuring (default: 200)\n");
+		printf("  --frames <frames>           Measured frames (default: 1000)\n");
+		printf("  --camera-path <file>        Camera path to replay (default: built-in flyover)\n");
+		printf("  --record-camera-path <file> Record the interactive camera to a path file\n");
+		printf("  --output <file>             Benchmark report (default: benchmark.json)\n");
+		printf("  --headless                  Render offscreen without a window, runs --frames frames without --benchmark\n");
+		printf("  --dump-frame <n>            Save frame n to frame_<n>.png, headless only, may be repeated\n");
+		printf("  --lod-target <ms>           Start with adaptive LOD holding this GPU frame time\n");
+		printf("  --compaction-benchmark      Time culling stream compaction variants headless, write the report and exit\n");
+		printf("  --terrain-benchmark         Time terrain heightmap processing over map sizes, write the report and exit\n");
+		printf("  --verify-lod                Check the GPU LOD selection against the CPU reference every frame\n");
+		printf("  --build-lods <model>        Simplify the model into its cached LOD chain and exit, may be repeated\n");
+	}
+
+	bool ParseInt(const char* text, int minimum, int& value) {
+		char* end;
+		long parsed = strtol(text, &end, 10);
+		if (*end != '\0' || parsed < minimum) {
+			return false;
+		}
+		value = static_cast<int>(parsed);
+		return true;
+	}
+
+	bool ParsePositiveFloat(const char* text, float& value) {
+		char* end;
+		float parsed = strtof(text, &end);
+		if (*end != '\0' || !(parsed > 0.0f)) {
+			return false;
+		}
+		value = parsed;
+		return true;
+	}
+
+	// Nearest rank percentile of sorted values
+	float Percentile(const std::vector<float>& sorted, float percent) {
+		size_t rank = static_cast<size_t>(ceil(percent / 100.0f * sorted.size()));
+		return sorted[rank > 0 ? rank - 1 : 0];
+	}
+
+	void WriteSummary(FILE* file, const char* indent, const char* name, std::vector<float> values, bool last) {
+		fprintf(file, "%s\"%s\": ", indent, name);
+		if (values.empty()) {
+			fprintf(file, "null%s\n", last ? "" : ",");
+			return;
+		}
+
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (float v : values) {
+			sum += v;
+		}
+		fprintf(file, "{ \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f }%s\n",
+			sum / values.size(), Percentile(values, 50.0f), Percentile(values, 95.0f), Percentile(values, 99.0f), values.front(), values.back(), last ? "" : ",");
+	}
+
+	std::string EscapeJson(const std::string& text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	void WriteArray(FILE* file, const char* name, const std::vector<float>& values, bool last) {
+		fprintf(file, "    \"%s\": [", name);
+		for (size_t i = 0; i < values.size(); i++) {
+			fprintf(file, "%s%.4f", i == 0 ? "" : ", ", values[i]);
+		}
+		fprintf(file, "]%s\n", last ? "" : ",");
+	}
+}
+
+bool ParseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options) {
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool valid = true;
+
+		if (!strcmp(arg, "--benchmark")) {
+			options.enabled = true;
+			continue;
+		}
+		if (!strcmp(arg, "--headless")) {
+			options.headless = true;
+			continue;
+		}
+		if (!strcmp(arg, "--compaction-benchmark")) {
+			options.compactionBenchmark = true;
+			continue;
+		}
+		if (!strcmp(arg, "--terrain-benchmark")) {
+			options.terrainBenchmark = true;
+			continue;
+		}
+		if (!strcmp(arg, "--verify-lod")) {
+			options.verifyLod = true;
+			continue;
+		}
+		if (!strcmp(arg, "--help") || !strcmp(arg, "-h")) {
+			PrintUsage(argv[0]);
+			return false;
+		}
+
+		if (!value) {
+			valid = false;
+		}
+		else if (!strcmp(arg, "--seed")) {
+			int seed;
+			valid = ParseInt(value, 0, seed);
+			options.seed = static_cast<unsigned int>(seed);
+			options.fixedSeed = true;
+		}
+		else if (!strcmp(arg, "--warmup")) {
+			valid = ParseInt(value, 0, options.warmupFrames);
+		}
+		else if (!strcmp(arg, "--frames")) {
+			valid = ParseInt(value, 1, options.frames);
+		}
+		else if (!strcmp(arg, "--camera-path")) {
+			options.cameraPath = value;
+		}
+		else if (!strcmp(arg, "--record-camera-path")) {
+			options.recordCameraPath = value;
+		}
+		else if (!strcmp(arg, "--output")) {
+			options.output = value;
+		}
+		else if (!strcmp(arg, "--dump-frame")) {
+			int frame;
+			valid = ParseInt(value, 0, frame);
+			options.dumpFrames.push_back(frame);
+		}
+		else if (!strcmp(arg, "--lod-target")) {
+			valid = ParsePositiveFloat(value, options.lodTargetMs);
+		}
+		else if (!strcmp(arg, "--build-lods")) {
+			options.buildLods.push_back(value);
+		}
+		else {
+			valid = false;
+		}
+
+		if (!valid) {
+			printf("Invalid argument %s\n", arg);
+			PrintUsage(argv[0]);
+			return false;
+		}
+		i++;
+	}
+
+	if (!options.dumpFrames.empty() && !options.headless) {
+		printf("--dump-frame requires --headless\n");
+		return false;
+	}
+
+	// Benchmarks and frame dumps are only comparable on the same forest
+	if ((options.enabled || options.headless) && !options.fixedSeed) {
+		options.fixedSeed = true;
+		options.seed = 1;
+	}
+	return true;
+}
+
+Benchmark::Benchmark(const BenchmarkOptions& options, const CameraPath& path) : options(options), path(path) {
+	samples.resize(options.frames);
+	lastFrameEnd = high_resolution_clock::now();
+}
+
+void Benchmark::ApplyCamera(Camera* camera, const Terrain* terrain) {
+	float time = 0.0f;
+	int measured = frameIndex - options.warmupFrames;
+	if (measured > 0 && options.frames > 1) {
+		time = path.GetDuration() * std::min(measured, options.frames - 1) / (options.frames - 1);
+	}
+
+	glm::vec3 eye, ref;
+	path.Evaluate(time, eye, ref);
+	// Splines can overshoot into hills
+	eye.y = std::max(eye.y, terrain->GetHeight(eye.x, eye.z) + 1.0f);
+	camera->SetLookAt(eye, ref);
+}
+
+void Benchmark::EndFrame(const Renderer* renderer, const GpuProfiler* profiler) {
+	high_resolution_clock::time_point now = high_resolution_clock::now();
+	int measured = frameIndex - options.warmupFrames;
+	if (measured >= 0 && measured < options.frames) {
+		samples[measured].cpuMs = duration_cast<duration<float, std::milli>>(now - lastFrameEnd).count();
+	}
+	lastFrameEnd = now;
+	frameIndex++;
+
+	// Submits are counted from the first frame, so the collected submit is the frame index it was rendered at
+	int64_t collected = profiler->GetLastCollectedSubmit();
+	if (collected != lastCollected) {
+		lastCollected = collected;
+		int64_t sample = collected - options.warmupFrames;
+		if (sample >= 0 && sample < options.frames) {
+			FrameSample& s = samples[static_cast<size_t>(sample)];
+			s.collected = true;
+			for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+				s.passMs[i] = profiler->GetLastTime(static_cast<ProfilerScope>(i));
+			}
+			s.visible = renderer->GetVisibleInstanceCounts();
+			s.transitioning = renderer->GetCullingStats().transitioning;
+			s.meshlets = renderer->GetCullingStats().meshlets;
+			s.meshletsCulled = renderer->GetCullingStats().meshletsCulled;
+		}
+	}
+}
+
+bool Benchmark::IsFinished() const {
+	int lastFrame = options.warmupFrames + options.frames;
+	if (lastCollected >= lastFrame - 1) {
+		return true;
+	}
+	// Nothing is collected if the device cannot write timestamps, give up a little after the last frame
+	return frameIndex >= lastFrame + static_cast<int>(MAX_FRAMES_IN_FLIGHT) + 8;
+}
+
+bool Benchmark::WriteReport(const char* reportPath) const {
+	FILE* file = fopen(reportPath, "w");
+	if (!file) {
+		printf("Failed to open %s for writing\n", reportPath);
+		return false;
+	}
+
+	std::vector<float> cpu, gpu, full, billboard, fake, total, transitioning, meshletsCulled;
+	std::vector<float> passes[SCOPE_COUNT];
+	std::vector<float> groupFull[MAX_TREE_GROUPS], groupBillboard[MAX_TREE_GROUPS];
+	std::vector<float> groupLevels[MAX_TREE_GROUPS][MAX_TREE_LODS];
+	uint32_t species = 0, groups = 0;
+	uint32_t levelCounts[MAX_TREE_GROUPS] = {};
+	for (const FrameSample& s : samples) {
+		cpu.push_back(s.cpuMs);
+		if (!s.collected) {
+			continue;
+		}
+		for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+			if (s.passMs[i] >= 0.0f) {
+				passes[i].push_back(s.passMs[i]);
+			}
+		}
+		full.push_back(float(s.visible.full));
+		billboard.push_back(float(s.visible.billboard));
+		fake.push_back(float(s.visible.fake));
+		total.push_back(float(s.visible.full + s.visible.billboard + s.visible.fake));
+		transitioning.push_back(float(s.transitioning));
+		// Frames without near trees test no meshlets
+		if (s.meshlets > 0) {
+			meshletsCulled.push_back(float(s.meshletsCulled) / float(s.meshlets));
+		}
+		species = s.visible.species;
+		groups = s.visible.groups;
+		for (uint32_t g = 0; g < groups; g++) {
+			groupFull[g].push_back(float(s.visible.groupFull[g]));
+			groupBillboard[g].push_back(float(s.visible.groupBillboard[g]));
+			levelCounts[g] = s.visible.groupLevelCount[g];
+			for (uint32_t l = 0; l < levelCounts[g]; l++) {
+				groupLevels[g][l].push_back(float(s.visible.groupLevels[g][l]));
+			}
+		}
+	}
+	gpu = passes[static_cast<uint32_t>(ProfilerScope::Frame)];
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"seed\": %u,\n", options.seed);
+	fprintf(file, "  \"warmup_frames\": %d,\n", options.warmupFrames);
+	fprintf(file, "  \"frames\": %d,\n", options.frames);
+	fprintf(file, "  \"collected_frames\": %d,\n", static_cast<int>(full.size()));
+	fprintf(file, "  \"camera_path\": \"%s\",\n", options.cameraPath.empty() ? "flyover" : EscapeJson(options.cameraPath).c_str());
+	WriteSummary(file, "  ", "cpu_frame_ms", cpu, false);
+	WriteSummary(file, "  ", "gpu_frame_ms", gpu, false);
+	// Share of the tested meshlets that were culled
+	WriteSummary(file, "  ", "meshlets_culled", meshletsCulled, false);
+
+	fprintf(file, "  \"gpu_pass_ms\": {\n");
+	for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+		WriteSummary(file, "    ", GpuProfiler::GetScopeName(static_cast<ProfilerScope>(i)), passes[i], i + 1 == SCOPE_COUNT);
+	}
+	fprintf(file, "  },\n");
+
+	fprintf(file, "  \"visible_instances\": {\n");
+	WriteSummary(file, "    ", "full", full, false);
+	WriteSummary(file, "    ", "billboard", billboard, false);
+	WriteSummary(file, "    ", "fake", fake, false);
+	WriteSummary(file, "    ", "transitioning", transitioning, false);
+	WriteSummary(file, "    ", "total", total, true);
+	fprintf(file, "  },\n");
+
+	// Species report their full trees, the first pass' share of them at each mesh level and their billboards, fake tree
+	// groups only billboards
+	fprintf(file, "  \"visible_per_group\": [\n");
+	for (uint32_t g = 0; g < groups; g++) {
+		fprintf(file, "    {\n");
+		if (g < species) {
+			fprintf(file, "      \"species\": %u,\n", g);
+			WriteSummary(file, "      ", "full", groupFull[g], false);
+			for (uint32_t l = 0; l < levelCounts[g]; l++) {
+				std::string name = "level" + std::to_string(l);
+				WriteSummary(file, "      ", name.c_str(), groupLevels[g][l], false);
+			}
+			WriteSummary(file, "      ", "billboard", groupBillboard[g], true);
+		}
+		else {
+			fprintf(file, "      \"fake_group\": %u,\n", g - species);
+			WriteSummary(file, "      ", "fake", groupBillboard[g], true);
+		}
+		fprintf(file, "    }%s\n", g + 1 < groups ? "," : "");
+	}
+	fprintf(file, "  ],\n");
+
+	fprintf(file, "  \"per_frame\": {\n");
+	WriteArray(file, "cpu_ms", cpu, false);
+	WriteArray(file, "gpu_ms", gpu, false);
+	WriteArray(file, "visible", total, true);
+	fprintf(file, "  }\n");
+	fprintf(file, "}\n");
+	fclose(file);
+
+	printf("Benchmark: cpu %.3f ms, gpu %.3f ms average over %d frames, report written to %s\n",
+		cpu.empty() ? 0.0f : float(std::accumulate(cpu.begin(), cpu.end(), 0.0) / cpu.size()),
+		gpu.empty() ? 0.0f : float(std::accumulate(gpu.begin(), gpu.end(), 0.0) / gpu.size()),
+		options.frames, reportPath);
+	return true;
+}
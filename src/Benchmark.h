@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "CameraPath.h"
+#include "GpuProfiler.h"
+#include "Renderer.h"
+
+struct BenchmarkOptions {
+	bool enabled = false;
+	// Tree placement seed, the wall clock is used when not fixed
+	bool fixedSeed = false;
+	unsigned int seed = 0;
+	int warmupFrames = 200;
+	int frames = 1000;
+	// Simulation time per frame, keeps wind and day & night identical between runs
+	float timeStep = 1.0f / 60.0f;
+	std::string cameraPath;
+	std::string recordCameraPath;
+	std::string output = "benchmark.json";
+	// Render into offscreen images without a window, surface or present
+	bool headless = false;
+	// Frames written to frame_<n>.png, headless only
+	std::vector<int> dumpFrames;
+	// GPU frame time the adaptive LOD starts out holding, 0 leaves it off
+	float lodTargetMs = 0.0f;
+	// Run the culling compaction microbenchmark instead of the renderer, writes its report to output
+	bool compactionBenchmark = false;
+	// Run the terrain load microbenchmark instead of the renderer, writes its report to output
+	bool terrainBenchmark = false;
+	// Compare the LOD decisions of every collected frame with the CPU reference, the exit code reports mismatches
+	bool verifyLod = false;
+	// Models whose LOD caches are built before exiting, without starting the renderer
+	std::vector<std::string> buildLods;
+};
+
+// Returns false when the program should exit, e.g. after --help or on a bad argument
+bool ParseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options);
+
+// Drives the camera along a path for a fixed number of frames and reports frame time statistics.
+// The camera holds the first key during warmup, then the measured frames sample the path evenly. GPU times and
+// visible counts show up MAX_FRAMES_IN_FLIGHT frames after their submit, so the run continues until the last
+// measured frame has been collected.
+class Benchmark {
+public:
+	Benchmark() = delete;
+	Benchmark(const BenchmarkOptions& options, const CameraPath& path);
+
+	// Call before the frame is rendered
+	void ApplyCamera(Camera* camera, const Terrain* terrain);
+	// Call after a Renderer::Frame that submitted
+	void EndFrame(const Renderer* renderer, const GpuProfiler* profiler);
+
+	bool IsFinished() const;
+	bool WriteReport(const char* path) const;
+
+private:
+	// CPU time is known when the frame ends, the rest is filled in once the frame has been collected
+	struct FrameSample {
+		float cpuMs = 0.0f;
+		bool collected = false;
+		float passMs[static_cast<uint32_t>(ProfilerScope::Count)];
+		VisibleInstanceCounts visible;
+		// Instances in the middle of a LOD cross-fade, drawn with both LODs
+		uint32_t transitioning = 0;
+		// Meshlets of the level 0 instances the meshlet culling pass tested and culled
+		uint32_t meshlets = 0;
+		uint32_t meshletsCulled = 0;
+	};
+
+	BenchmarkOptions options;
+	CameraPath path;
+
+	int frameIndex = 0;
+	int64_t lastCollected = -1;
+	std::chrono::high_resolution_clock::time_point lastFrameEnd;
+	std::vector<FrameSample> samples;
+};
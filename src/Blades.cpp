@@ -6,7 +6,7 @@ float generateRandomFloat() {
     return rand() / (float)RAND_MAX;
 }
 
-Blades::Blades(Device* device, VkCommandPool commandPool, float terrainDim, Terrain* terrain) : Model(device, commandPool, {}, {}) {
+Blades::Blades(Device* device, UploadContext* uploadContext, float terrainDim, Terrain* terrain) : Model(device, uploadContext, {}, {}) {
     std::vector<Blade> blades;
     blades.reserve(NUM_BLADES);
 
@@ -44,9 +44,9 @@ Blades::Blades(Device* device, VkCommandPool commandPool, float terrainDim, Terr
     indirectDraw.firstVertex = 0;
     indirectDraw.firstInstance = 0;
 
-    BufferUtils::CreateBufferFromData(device, commandPool, blades.data(), NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bladesBuffer, bladesBufferMemory);
+    BufferUtils::CreateBufferFromData(device, uploadContext, blades.data(), NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bladesBuffer, bladesBufferMemory);
     BufferUtils::CreateBuffer(device, NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, culledBladesBuffer, culledBladesBufferMemory);
-    BufferUtils::CreateBufferFromData(device, commandPool, &indirectDraw, sizeof(BladeDrawIndirect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numBladesBuffer, numBladesBufferMemory);
+    BufferUtils::CreateBufferFromData(device, uploadContext, &indirectDraw, sizeof(BladeDrawIndirect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numBladesBuffer, numBladesBufferMemory);
 }
 
 VkBuffer Blades::GetBladesBuffer() const {
@@ -62,10 +62,7 @@ VkBuffer Blades::GetNumBladesBuffer() const {
 }
 
 Blades::~Blades() {
-    vkDestroyBuffer(device->GetVkDevice(), bladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), bladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), culledBladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), culledBladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), numBladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), numBladesBufferMemory, nullptr);
+    BufferUtils::DestroyBuffer(device, bladesBuffer);
+    BufferUtils::DestroyBuffer(device, culledBladesBuffer);
+    BufferUtils::DestroyBuffer(device, numBladesBuffer);
 }
@@ -81,7 +81,7 @@ private:
     VkDeviceMemory numBladesBufferMemory;
 
 public:
-    Blades(Device* device, VkCommandPool commandPool, float terrainDim, Terrain* terrain);
+    Blades(Device* device, UploadContext* uploadContext, float terrainDim, Terrain* terrain);
     VkBuffer GetBladesBuffer() const;
     VkBuffer GetCulledBladesBuffer() const;
     VkBuffer GetNumBladesBuffer() const;
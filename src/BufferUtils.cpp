@@ -1,7 +1,8 @@
 #include "BufferUtils.h"
 #include "Instance.h"
 
-void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+    BufferSharing sharing) {
     // Create buffer
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -9,83 +10,57 @@ void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageF
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    // Concurrent sharing needs two different families, with one family for both there is nothing to transfer
+    const uint32_t queueFamilies[] = { device->GetQueueIndex(QueueFlags::Graphics), device->GetQueueIndex(QueueFlags::Compute) };
+    if (sharing == BUFFER_SHARING_GRAPHICS_COMPUTE && queueFamilies[0] != queueFamilies[1]) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = queueFamilies;
+    }
+
     if (vkCreateBuffer(device->GetVkDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create vertex buffer");
     }
 
-    // Query buffer's memory requirements
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device->GetVkDevice(), buffer, &memRequirements);
-
-    // Allocate memory in device
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(memRequirements.memoryTypeBits, properties);
+    // Sub-allocate memory from the device's pools and bind it
+    bufferMemory = device->GetAllocator()->BindBuffer(buffer, properties).memory;
+}
 
-    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to allocate vertex buffer");
+VkIndexType BufferUtils::GetIndexType(const std::vector<uint32_t>& indices) {
+    for (uint32_t index : indices) {
+        if (index > 0xFFFFu) {
+            return VK_INDEX_TYPE_UINT32;
+        }
     }
-
-    // Associate allocated memory with vertex buffer
-    vkBindBufferMemory(device->GetVkDevice(), buffer, bufferMemory, 0);
+    return VK_INDEX_TYPE_UINT16;
 }
 
-void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    VkBufferCopy copyRegion = {};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
-    vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
+void BufferUtils::CreateIndexBuffer(Device* device, UploadContext* uploadContext, const std::vector<uint32_t>& indices, VkIndexType indexType, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    if (indexType == VK_INDEX_TYPE_UINT32) {
+        CreateBufferFromData(device, uploadContext, const_cast<uint32_t*>(indices.data()), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, buffer, bufferMemory);
+        return;
+    }
+    // Staged right away, the narrowed copy does not have to outlive the call
+    std::vector<uint16_t> narrowIndices(indices.begin(), indices.end());
+    CreateBufferFromData(device, uploadContext, narrowIndices.data(), narrowIndices.size() * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, buffer, bufferMemory);
 }
 
-void BufferUtils::CreateBufferFromData(Device* device, VkCommandPool commandPool, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    // Create the staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    BufferUtils::CreateBuffer(device, bufferSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
+void* BufferUtils::MapBuffer(Device* device, VkBuffer buffer) {
+    return device->GetAllocator()->MapBuffer(buffer);
+}
 
-    // Fill the staging buffer
-    void *data;
-    vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, bufferData, static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
+void BufferUtils::DestroyBuffer(Device* device, VkBuffer buffer) {
+    device->GetAllocator()->FreeBuffer(buffer);
+    vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
+}
 
+void BufferUtils::CreateBufferFromData(Device* device, UploadContext* uploadContext, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+    BufferSharing sharing) {
     // Create the buffer
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | bufferUsage;
     VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    BufferUtils::CreateBuffer(device, bufferSize, usage, flags, buffer, bufferMemory);
-
-    // Copy data from staging to buffer
-    BufferUtils::CopyBuffer(device, commandPool, stagingBuffer, buffer, bufferSize);
+    BufferUtils::CreateBuffer(device, bufferSize, usage, flags, buffer, bufferMemory, sharing);
 
-    // No need for the staging buffer anymore
-    vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+    // Stage the data and record the copy, it lands once the upload context is flushed
+    uploadContext->UploadBuffer(bufferData, bufferSize, buffer);
 }
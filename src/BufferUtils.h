@@ -1,10 +1,27 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <vector>
 #include "Device.h"
+#include "UploadContext.h"
 
 namespace BufferUtils {
-    void CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    void CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void CreateBufferFromData(Device* device, VkCommandPool commandPool, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    // Exclusive buffers belong to one queue family at a time and need ownership transfers between the graphics and
+    // compute queues. Static data the async compute queue reads is shared by both families instead
+    enum BufferSharing {
+        BUFFER_SHARING_EXCLUSIVE = 0,
+        BUFFER_SHARING_GRAPHICS_COMPUTE,
+    };
+
+    void CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+        BufferSharing sharing = BUFFER_SHARING_EXCLUSIVE);
+    void CreateBufferFromData(Device* device, UploadContext* uploadContext, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+        BufferSharing sharing = BUFFER_SHARING_EXCLUSIVE);
+    // 16 bit unless an index does not fit, so meshes under 65536 vertices get half the index memory and bandwidth
+    VkIndexType GetIndexType(const std::vector<uint32_t>& indices);
+    // Uploads the indices at the width of indexType
+    void CreateIndexBuffer(Device* device, UploadContext* uploadContext, const std::vector<uint32_t>& indices, VkIndexType indexType, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    // bufferMemory is shared with other resources, use these instead of vkMapMemory / vkFreeMemory
+    void* MapBuffer(Device* device, VkBuffer buffer);
+    void DestroyBuffer(Device* device, VkBuffer buffer);
 }
@@ -6,10 +6,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Camera.h"
-#include "BufferUtils.h"
+#include "Culling.h"
 #include <iostream>
 
-Camera::Camera(Device* device, float aspectRatio,int w,int h) : device(device), 
+Camera::Camera(Device* device, UniformRing* uniformRing, float aspectRatio,int w,int h) : device(device), 
 	width(w),
 	height(h),
 	fovy(45.0f),
@@ -29,14 +29,16 @@ Camera::Camera(Device* device, float aspectRatio,int w,int h) : device(device),
     cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
 	cameraBufferObject.camPos = glm::vec4(eye, far_near_dis);
 	cameraBufferObject.camDir = glm::vec4(right, 1.0f);
+	UpdateScreen();
 
-    BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
-    vkMapMemory(device->GetVkDevice(), bufferMemory, 0, sizeof(CameraBufferObject), 0, &mappedData);
+    bufferOffset = uniformRing->Allocate(sizeof(CameraBufferObject));
+    mappedData = uniformRing->GetShadow(bufferOffset);
+    UpdateFrustumPlanes();
     memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
-VkBuffer Camera::GetBuffer() const {
-    return buffer;
+VkDeviceSize Camera::GetBufferOffset() const {
+    return bufferOffset;
 }
 
 void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
@@ -54,6 +56,7 @@ void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
 	cameraBufferObject.viewMatrix = glm::lookAt(eye, ref, up);
 	cameraBufferObject.camPos = glm::vec4(eye, far_near_dis);
 	cameraBufferObject.camDir = glm::vec4(right, 1.0f);
+    UpdateFrustumPlanes();
     memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
@@ -68,8 +71,16 @@ void Camera::UpdateViewMatrix() {
 	//bool s = (right.x > right.z);
 	//float theta = glm::mix(3.1415926f / 2.0f - glm::atan(right.x, right.z), glm::atan(right.z, right.x), s);
 	//std::cout << theta <<std::endl;
+	UpdateFrustumPlanes();
 	memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
+void Camera::SetLookAt(glm::vec3 eye, glm::vec3 ref) {
+	this->eye = eye;
+	this->ref = ref;
+	RecomputeAttributes();
+	UpdateViewMatrix();
+}
+
 void Camera::RecomputeAttributes()
 {
 	look = glm::normalize(ref - eye);
@@ -92,6 +103,8 @@ void Camera::UpdateAspectRatio(float aspectRatio,int w,int h) {
 	cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
 	float far_near_dis = (far_clip - near_clip)*abs(glm::dot(look, glm::normalize(glm::vec3(look.x, 0, look.z))));
 	printf("far_near_dis: %f \n", far_near_dis);
+	UpdateFrustumPlanes();
+	UpdateScreen();
 	memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
@@ -172,8 +185,28 @@ void Camera::CameraScale(float amt) {
 	RecomputeAttributes();
 	UpdateViewMatrix();
 }
+
+void Camera::UpdateFrustumPlanes() {
+	Culling::ExtractFrustumPlanes(cameraBufferObject.projectionMatrix * cameraBufferObject.viewMatrix, cameraBufferObject.frustumPlanes);
+}
+
+void Camera::UpdateScreen() {
+	// proj[1][1] is cot(fovy / 2), negative with the flipped y
+	float pixelsPerUnit = 0.5f * float(height) * glm::abs(cameraBufferObject.projectionMatrix[1][1]);
+	cameraBufferObject.screen = glm::vec4(float(width), float(height), pixelsPerUnit, 0.0f);
+}
+
+float Camera::GetPixelsPerUnit() const {
+	return cameraBufferObject.screen.z;
+}
+
+const glm::vec4* Camera::GetFrustumPlanes() const {
+	return cameraBufferObject.frustumPlanes;
+}
+
+glm::mat4 Camera::GetViewProj() const {
+	return cameraBufferObject.projectionMatrix * cameraBufferObject.viewMatrix;
+}
+
 Camera::~Camera() {
-  vkUnmapMemory(device->GetVkDevice(), bufferMemory);
-  vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
-  vkFreeMemory(device->GetVkDevice(), bufferMemory, nullptr);
 }
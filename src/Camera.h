@@ -3,12 +3,18 @@
 
 #include <glm/glm.hpp>
 #include "Device.h"
+#include "UniformRing.h"
 
 struct CameraBufferObject {
   glm::mat4 viewMatrix;
   glm::mat4 projectionMatrix;
   glm::vec4 camPos;
   glm::vec4 camDir;
+  // World space planes of the view frustum for the culling shaders, see Culling::ExtractFrustumPlanes
+  glm::vec4 frustumPlanes[6];
+  // 0: viewport width 1: viewport height in pixels 2: pixels per world unit at distance 1 along the view axis, the LOD
+  // selection projects bounding spheres with it, see Culling::ProjectedDiameter
+  glm::vec4 screen;
 };
 
 class Camera {
@@ -17,11 +23,16 @@ private:
     
     CameraBufferObject cameraBufferObject;
     
-    VkBuffer buffer;
-    VkDeviceMemory bufferMemory;
+    // Slot in the per-frame uniform ring
+    VkDeviceSize bufferOffset;
 
     void* mappedData;
 
+	// Call whenever the view or projection changes, before the buffer object is copied
+	void UpdateFrustumPlanes();
+	// Call whenever the projection or the viewport changes
+	void UpdateScreen();
+
 
 	float fovy;
 	unsigned int width, height;  // Window dimensions
@@ -43,10 +54,10 @@ private:
     float r, theta, phi;
 
 public:
-    Camera(Device* device, float aspectRatio,int w,int h);
+    Camera(Device* device, UniformRing* uniformRing, float aspectRatio,int w,int h);
     ~Camera();
 
-    VkBuffer GetBuffer() const;
+    VkDeviceSize GetBufferOffset() const;
     
 	void RecomputeAttributes();
 	
@@ -64,5 +75,11 @@ public:
     void UpdateOrbit(float deltaX, float deltaY, float deltaZ);
 	void UpdateAspectRatio(float aspectRatio,int w,int h);
 	void UpdateViewMatrix();
+	// Place the camera directly, used to replay camera paths
+	void SetLookAt(glm::vec3 eye, glm::vec3 ref);
 	glm::vec3 GetEyePos() { return eye; }
+	glm::vec3 GetRefPos() { return ref; }
+	const glm::vec4* GetFrustumPlanes() const;
+	float GetPixelsPerUnit() const;
+	glm::mat4 GetViewProj() const;
 };
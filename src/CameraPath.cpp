@@ -0,0 +1,111 @@
+#include <cstdio>
+#include "CameraPath.h"
+#include "Terrain.h"
+
+namespace {
+	glm::vec3 CatmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+		float t2 = t * t;
+		float t3 = t2 * t;
+		return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+}
+
+CameraPath CameraPath::Flyover(const Terrain* terrain) {
+	CameraPath path;
+	float center = terrain->GetTerrainDim() * 0.5f;
+	float time = 0.0f;
+
+	// Orbit, looking a little ahead of the center
+	const int orbitKeys = 8;
+	for (int i = 0; i <= orbitKeys; i++) {
+		float angle = 2.0f * 3.1415926f * i / orbitKeys;
+		glm::vec3 eye(center + 100.0f * cos(angle), 0.0f, center + 100.0f * sin(angle));
+		eye.y = terrain->GetHeight(eye.x, eye.z) + 30.0f;
+		glm::vec3 ref(center + 30.0f * cos(angle + 1.0f), 0.0f, center + 30.0f * sin(angle + 1.0f));
+		ref.y = terrain->GetHeight(ref.x, ref.z);
+		path.AddKey(time, eye, ref);
+		time += 2.0f;
+	}
+
+	// Low pass straight through the forest
+	const int passKeys = 6;
+	for (int i = 0; i <= passKeys; i++) {
+		float x = center - 90.0f + 180.0f * i / passKeys;
+		glm::vec3 eye(x, 0.0f, center);
+		eye.y = terrain->GetHeight(eye.x, eye.z) + 4.0f;
+		glm::vec3 ref(x + 20.0f, 0.0f, center + 5.0f);
+		ref.y = terrain->GetHeight(ref.x, ref.z) + 3.0f;
+		path.AddKey(time, eye, ref);
+		time += 2.0f;
+	}
+	return path;
+}
+
+bool CameraPath::Load(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		return false;
+	}
+
+	keys.clear();
+	CameraKey key;
+	while (fscanf(file, "%f %f %f %f %f %f %f", &key.time, &key.eye.x, &key.eye.y, &key.eye.z, &key.ref.x, &key.ref.y, &key.ref.z) == 7) {
+		keys.push_back(key);
+	}
+	fclose(file);
+	return !keys.empty();
+}
+
+bool CameraPath::Save(const char* path) const {
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		return false;
+	}
+
+	for (const CameraKey& key : keys) {
+		fprintf(file, "%f %f %f %f %f %f %f\n", key.time, key.eye.x, key.eye.y, key.eye.z, key.ref.x, key.ref.y, key.ref.z);
+	}
+	fclose(file);
+	return true;
+}
+
+void CameraPath::AddKey(float time, glm::vec3 eye, glm::vec3 ref) {
+	CameraKey key = { time, eye, ref };
+	keys.push_back(key);
+}
+
+bool CameraPath::IsEmpty() const {
+	return keys.empty();
+}
+
+float CameraPath::GetDuration() const {
+	return keys.empty() ? 0.0f : keys.back().time - keys.front().time;
+}
+
+void CameraPath::Evaluate(float time, glm::vec3& eye, glm::vec3& ref) const {
+	if (keys.size() == 1 || time <= keys.front().time) {
+		eye = keys.front().eye;
+		ref = keys.front().ref;
+		return;
+	}
+	if (time >= keys.back().time) {
+		eye = keys.back().eye;
+		ref = keys.back().ref;
+		return;
+	}
+
+	size_t i = 1;
+	while (keys[i].time < time) {
+		i++;
+	}
+	// Segment keys[i - 1] -> keys[i], end points are repeated at both ends of the path
+	const CameraKey& k0 = keys[i > 1 ? i - 2 : 0];
+	const CameraKey& k1 = keys[i - 1];
+	const CameraKey& k2 = keys[i];
+	const CameraKey& k3 = keys[i + 1 < keys.size() ? i + 1 : i];
+
+	float length = k2.time - k1.time;
+	float t = length > 0.0f ? (time - k1.time) / length : 1.0f;
+	eye = CatmullRom(k0.eye, k1.eye, k2.eye, k3.eye, t);
+	ref = CatmullRom(k0.ref, k1.ref, k2.ref, k3.ref, t);
+}
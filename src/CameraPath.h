@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class Terrain;
+
+struct CameraKey {
+	float time;
+	glm::vec3 eye;
+	glm::vec3 ref;
+};
+
+// Timed eye / reference point keys, played back with a Catmull-Rom spline.
+// Stored as text, one "time eyeX eyeY eyeZ refX refY refZ" line per key.
+class CameraPath {
+public:
+	// Orbit over the forest that ends in a low pass through the trees
+	static CameraPath Flyover(const Terrain* terrain);
+
+	bool Load(const char* path);
+	bool Save(const char* path) const;
+
+	void AddKey(float time, glm::vec3 eye, glm::vec3 ref);
+	bool IsEmpty() const;
+	float GetDuration() const;
+	void Evaluate(float time, glm::vec3& eye, glm::vec3& ref) const;
+
+private:
+	std::vector<CameraKey> keys;
+};
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "CompactionBenchmark.h"
+#include "BufferUtils.h"
+#include "Instance.h"
+#include "InstanceData.h"
+#include "ShaderModule.h"
+
+namespace {
+	const uint32_t INSTANCE_COUNTS[] = { 1 << 12, 1 << 14, 1 << 16, 1 << 18, 1 << 20 };
+	const uint32_t MAX_INSTANCES = 1 << 20;
+	const uint32_t ITERATIONS = 16;
+	const float VISIBLE_FRACTION = 0.3f;
+
+	struct Variant {
+		bool workgroupCompaction;
+		uint32_t workgroupSize;
+	};
+
+	// The old global atomics at the renderer's old workgroup size, then the scan at growing sizes
+	const Variant VARIANTS[] = {
+		{ false, 32 },
+		{ true, 32 },
+		{ true, 64 },
+		{ true, 128 },
+		{ true, 256 },
+	};
+	const uint32_t VARIANT_COUNT = sizeof(VARIANTS) / sizeof(VARIANTS[0]);
+
+	struct Parameters {
+		uint32_t instanceCount;
+		uint32_t groupSize;
+		float visibleFraction;
+	};
+
+	struct Result {
+		uint32_t instanceCount;
+		Variant variant;
+		float milliseconds;
+	};
+
+	// Same as hash() in compactionBenchmark.comp
+	uint32_t Hash(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	// Visible LOD0 and LOD1 instances per group, the same test as the shader
+	void ExpectedCounts(uint32_t instanceCount, uint32_t groupSize, std::vector<uint32_t>& lod0, std::vector<uint32_t>& lod1) {
+		lod0.assign(MAX_TREE_GROUPS, 0);
+		lod1.assign(MAX_TREE_GROUPS, 0);
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			float random = float(Hash(i) & 0xFFFFu) / 65536.0f;
+			if (random < VISIBLE_FRACTION) {
+				lod0[i / groupSize]++;
+			}
+			else if (random < 2.0f * VISIBLE_FRACTION) {
+				lod1[i / groupSize]++;
+			}
+		}
+	}
+
+	const char* VariantName(const Variant& variant) {
+		return variant.workgroupCompaction ? "workgroup" : "global_atomics";
+	}
+}
+
+bool RunCompactionBenchmark(Device* device, const char* reportPath) {
+	VkDevice logicalDevice = device->GetVkDevice();
+	Instance* instance = device->GetInstance();
+	const VkPhysicalDeviceLimits& limits = instance->GetPhysicalDeviceProperties().limits;
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(instance->GetPhysicalDevice(), &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(instance->GetPhysicalDevice(), &familyCount, families.data());
+	uint32_t validBits = families[device->GetQueueIndex(QueueFlags::Compute)].timestampValidBits;
+	if (validBits == 0) {
+		printf("Timestamps not supported on the compute queue\n");
+		return false;
+	}
+	uint64_t timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	// Instance contents do not matter, visibility only depends on the index
+	const VkDeviceSize instancesSize = MAX_INSTANCES * sizeof(InstanceData);
+	const VkDeviceSize commandsSize = TREE_DRAW_KIND_COUNT * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand);
+	VkBuffer instanceBuffer, commandBuffer, culledBuffers[2], readbackBuffer;
+	VkDeviceMemory memory;
+	BufferUtils::CreateBuffer(device, instancesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer, memory);
+	BufferUtils::CreateBuffer(device, commandsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, commandBuffer, memory);
+	for (int j = 0; j < 2; j++) {
+		BufferUtils::CreateBuffer(device, instancesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledBuffers[j], memory);
+	}
+	BufferUtils::CreateBuffer(device, commandsSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, memory);
+	const VkDrawIndexedIndirectCommand* readback = static_cast<const VkDrawIndexedIndirectCommand*>(BufferUtils::MapBuffer(device, readbackBuffer));
+
+	// Descriptor set with the four storage buffers
+	std::vector<VkDescriptorSetLayoutBinding> bindings(4);
+	for (uint32_t j = 0; j < bindings.size(); j++) {
+		bindings[j].binding = j;
+		bindings[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[j].descriptorCount = 1;
+		bindings[j].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[j].pImmutableSamplers = nullptr;
+	}
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+	VkDescriptorSetLayout descriptorSetLayout;
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+
+	VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 };
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = 1;
+	VkDescriptorPool descriptorPool;
+	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &descriptorSetLayout;
+	VkDescriptorSet descriptorSet;
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	VkDescriptorBufferInfo bufferInfos[4] = {};
+	bufferInfos[0] = { instanceBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { commandBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { culledBuffers[0], 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { culledBuffers[1], 0, VK_WHOLE_SIZE };
+	std::vector<VkWriteDescriptorSet> descriptorWrites(4);
+	for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+		descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[j].dstSet = descriptorSet;
+		descriptorWrites[j].dstBinding = j;
+		descriptorWrites[j].dstArrayElement = 0;
+		descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[j].descriptorCount = 1;
+		descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+	}
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	// Pipeline layout with the benchmark parameters as push constants
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(Parameters);
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	VkPipelineLayout pipelineLayout;
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	// One pipeline per variant, sizes the device cannot run are skipped
+	VkShaderModule computeShaderModule = ShaderModule::Create("shaders/compactionBenchmark.comp.spv", logicalDevice);
+	std::vector<Variant> variants;
+	std::vector<VkPipeline> pipelines;
+	for (uint32_t v = 0; v < VARIANT_COUNT; v++) {
+		const Variant& variant = VARIANTS[v];
+		if (variant.workgroupSize > limits.maxComputeWorkGroupSize[0] || variant.workgroupSize > limits.maxComputeWorkGroupInvocations) {
+			continue;
+		}
+
+		struct {
+			uint32_t workgroupSize;
+			VkBool32 workgroupCompaction;
+		} specializationData = { variant.workgroupSize, static_cast<VkBool32>(variant.workgroupCompaction ? VK_TRUE : VK_FALSE) };
+		VkSpecializationMapEntry specializationEntries[2] = {
+			{ 0, 0, sizeof(uint32_t) },
+			{ 1, sizeof(uint32_t), sizeof(VkBool32) },
+		};
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = 2;
+		specializationInfo.pMapEntries = specializationEntries;
+		specializationInfo.dataSize = sizeof(specializationData);
+		specializationInfo.pData = &specializationData;
+
+		VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+		computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeShaderStageInfo.module = computeShaderModule;
+		computeShaderStageInfo.pName = "main";
+		computeShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage = computeShaderStageInfo;
+		pipelineInfo.layout = pipelineLayout;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		pipelineInfo.basePipelineIndex = -1;
+
+		VkPipeline pipeline;
+		if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create compute pipeline");
+		}
+		variants.push_back(variant);
+		pipelines.push_back(pipeline);
+	}
+	vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+
+	VkCommandPoolCreateInfo commandPoolInfo = {};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.queueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	VkCommandPool commandPool;
+	if (vkCreateCommandPool(logicalDevice, &commandPoolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create command pool");
+	}
+	VkCommandBufferAllocateInfo commandBufferInfo = {};
+	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferInfo.commandPool = commandPool;
+	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferInfo.commandBufferCount = 1;
+	VkCommandBuffer cmd;
+	if (vkAllocateCommandBuffers(logicalDevice, &commandBufferInfo, &cmd) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffers");
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2 * ITERATIONS;
+	VkQueryPool queryPool;
+	if (vkCreateQueryPool(logicalDevice, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create timestamp query pool");
+	}
+
+	bool correct = true;
+	std::vector<Result> results;
+	std::vector<uint32_t> expectedLOD0, expectedLOD1;
+	printf("%10s  %-15s %6s  %10s  %12s\n", "instances", "compaction", "size", "ms", "Minst/s");
+	for (uint32_t instanceCount : INSTANCE_COUNTS) {
+		Parameters parameters = { instanceCount, (instanceCount + MAX_TREE_GROUPS - 1) / MAX_TREE_GROUPS, VISIBLE_FRACTION };
+		ExpectedCounts(instanceCount, parameters.groupSize, expectedLOD0, expectedLOD1);
+
+		for (size_t v = 0; v < variants.size(); v++) {
+			const Variant& variant = variants[v];
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			vkBeginCommandBuffer(cmd, &beginInfo);
+			vkCmdResetQueryPool(cmd, queryPool, 0, 2 * ITERATIONS);
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[v]);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+			vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Parameters), &parameters);
+
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			for (uint32_t i = 0; i < ITERATIONS; i++) {
+				// Counts start from zero like in the renderer, only the dispatch is timed
+				barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+				vkCmdFillBuffer(cmd, commandBuffer, 0, VK_WHOLE_SIZE, 0);
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+				vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2 * i);
+				vkCmdDispatch(cmd, (instanceCount + variant.workgroupSize - 1) / variant.workgroupSize, 1, 1);
+				vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * i + 1);
+			}
+
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			VkBufferCopy region = { 0, 0, commandsSize };
+			vkCmdCopyBuffer(cmd, commandBuffer, readbackBuffer, 1, &region);
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			vkEndCommandBuffer(cmd);
+
+			VkSubmitInfo submitInfo = {};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &cmd;
+			vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &submitInfo, VK_NULL_HANDLE);
+			vkQueueWaitIdle(device->GetQueue(QueueFlags::Compute));
+
+			std::vector<uint64_t> timestamps(2 * ITERATIONS);
+			vkGetQueryPoolResults(logicalDevice, queryPool, 0, 2 * ITERATIONS, timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+			double milliseconds = 0.0;
+			for (uint32_t i = 0; i < ITERATIONS; i++) {
+				milliseconds += double((timestamps[2 * i + 1] - timestamps[2 * i]) & timestampMask) * limits.timestampPeriod * 1e-6;
+			}
+			milliseconds /= ITERATIONS;
+
+			// The last iteration's counts have to match the CPU
+			for (uint32_t g = 0; g < MAX_TREE_GROUPS; g++) {
+				if (readback[TREE_DRAW_BARK * MAX_TREE_GROUPS + g].instanceCount != expectedLOD0[g] ||
+					readback[TREE_DRAW_LEAF * MAX_TREE_GROUPS + g].instanceCount != expectedLOD0[g] ||
+					readback[TREE_DRAW_BILLBOARD * MAX_TREE_GROUPS + g].instanceCount != expectedLOD1[g]) {
+					printf("Wrong visible counts for group %u with %s compaction at workgroup size %u\n", g, VariantName(variant), variant.workgroupSize);
+					correct = false;
+					break;
+				}
+			}
+
+			Result result = { instanceCount, variant, float(milliseconds) };
+			results.push_back(result);
+			printf("%10u  %-15s %6u  %10.4f  %12.1f\n", instanceCount, VariantName(variant), variant.workgroupSize, milliseconds,
+				milliseconds > 0.0 ? instanceCount / (milliseconds * 1e3) : 0.0);
+		}
+	}
+
+	vkDestroyQueryPool(logicalDevice, queryPool, nullptr);
+	vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+	for (VkPipeline pipeline : pipelines) {
+		vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+	}
+	vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+	BufferUtils::DestroyBuffer(device, instanceBuffer);
+	BufferUtils::DestroyBuffer(device, commandBuffer);
+	BufferUtils::DestroyBuffer(device, culledBuffers[0]);
+	BufferUtils::DestroyBuffer(device, culledBuffers[1]);
+	BufferUtils::DestroyBuffer(device, readbackBuffer);
+
+	FILE* file = fopen(reportPath, "w");
+	if (!file) {
+		printf("Failed to open %s for writing\n", reportPath);
+		return false;
+	}
+	fprintf(file, "{\n");
+	fprintf(file, "  \"iterations\": %u,\n", ITERATIONS);
+	fprintf(file, "  \"visible_fraction\": %.3f,\n", VISIBLE_FRACTION);
+	fprintf(file, "  \"correct\": %s,\n", correct ? "true" : "false");
+	fprintf(file, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		fprintf(file, "    { \"instances\": %u, \"compaction\": \"%s\", \"workgroup_size\": %u, \"ms\": %.5f }%s\n",
+			r.instanceCount, VariantName(r.variant), r.variant.workgroupSize, r.milliseconds, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+	fclose(file);
+	printf("Compaction benchmark written to %s\n", reportPath);
+	return correct;
+}
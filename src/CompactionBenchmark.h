@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Device.h"
+
+// Times shaders/compactionBenchmark.comp on synthetic forests of growing size, once with a global atomic per visible
+// instance and once with workgroup compaction at several workgroup sizes. Each result is checked against the
+// expected visible count, the table is printed and written to reportPath as JSON.
+// Returns false if a variant produced wrong counts or the report could not be written.
+bool RunCompactionBenchmark(Device* device, const char* reportPath);
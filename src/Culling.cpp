@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cmath>
+#include "Culling.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE 1
+#else
+#define CULLING_SSE 0
+#endif
+
+namespace {
+	// Relative distance to a LOD threshold or frustum plane below which the GPU may decide differently
+	const float LOD_CHECK_EPSILON = 1e-4f;
+
+	enum class Decision {
+		No,
+		Maybe,
+		Yes,
+	};
+
+	Decision Decide(float value, float threshold, float scale) {
+		float margin = LOD_CHECK_EPSILON * std::max(std::abs(scale), 1e-6f);
+		return value > threshold + margin ? Decision::Yes : value < threshold - margin ? Decision::No : Decision::Maybe;
+	}
+
+	// Sphere of one instance in world space
+	void InstanceSphere(const InstanceData& instance, const Culling::BoundingSphere& sphere, glm::vec3& center, float& radius) {
+		float scale = sphere.scaled ? instance.pos_scale.w : 1.0f;
+		center = glm::vec3(instance.pos_scale.x, instance.pos_scale.y + sphere.centerY * scale, instance.pos_scale.z);
+		radius = sphere.radius * scale;
+	}
+}
+
+void Culling::ExtractFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]) {
+	// Rows of the matrix, glm stores columns
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	// Depth range is [0, 1]
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	for (int i = 0; i < 6; i++) {
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+Culling::BoundingSphere Culling::ComputeBoundingSphere(const std::vector<const Model*>& models, bool scaled, float margin) {
+	float minY = INFINITY;
+	float maxY = -INFINITY;
+	for (const Model* model : models) {
+		for (const Vertex& vertex : model->getVertices()) {
+			minY = std::min(minY, vertex.pos.y);
+			maxY = std::max(maxY, vertex.pos.y);
+		}
+	}
+
+	BoundingSphere sphere;
+	sphere.scaled = scaled;
+	if (minY > maxY) {
+		return sphere;
+	}
+
+	sphere.centerY = 0.5f * (minY + maxY);
+	float radiusSquared = 0.0f;
+	for (const Model* model : models) {
+		for (const Vertex& vertex : model->getVertices()) {
+			glm::vec3 offset = vertex.pos - glm::vec3(0.0f, sphere.centerY, 0.0f);
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+	}
+	sphere.radius = sqrt(radiusSquared) * (1.0f + margin);
+	return sphere;
+}
+
+bool Culling::SphereInFrustum(const glm::vec4 planes[6], glm::vec3 center, float radius) {
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Culling::BoxInFrustum(const glm::vec4 planes[6], glm::vec3 low, glm::vec3 high) {
+	for (int i = 0; i < 6; i++) {
+		const glm::vec3 normal = glm::vec3(planes[i]);
+		const glm::vec3 corner = glm::vec3(normal.x >= 0.0f ? high.x : low.x, normal.y >= 0.0f ? high.y : low.y, normal.z >= 0.0f ? high.z : low.z);
+		if (glm::dot(normal, corner) + planes[i].w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32_t Culling::CullInstances(const glm::vec4 planes[6], const InstanceData* instances, uint32_t count, const BoundingSphere& sphere, uint8_t* visible) {
+	uint32_t visibleCount = 0;
+	uint32_t i = 0;
+
+#if CULLING_SSE
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 centerY = _mm_set1_ps(sphere.centerY);
+	const __m128 radius = _mm_set1_ps(sphere.radius);
+	for (; i + 4 <= count; i += 4) {
+		// Transpose the pos_scale of four instances into x, y, z, scale lanes
+		__m128 x = _mm_loadu_ps(&instances[i].pos_scale.x);
+		__m128 y = _mm_loadu_ps(&instances[i + 1].pos_scale.x);
+		__m128 z = _mm_loadu_ps(&instances[i + 2].pos_scale.x);
+		__m128 s = _mm_loadu_ps(&instances[i + 3].pos_scale.x);
+		_MM_TRANSPOSE4_PS(x, y, z, s);
+		if (!sphere.scaled) {
+			s = one;
+		}
+
+		y = _mm_add_ps(y, _mm_mul_ps(centerY, s));
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(radius, s));
+		__m128 inside = _mm_cmpeq_ps(one, one);
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), x), _mm_mul_ps(_mm_set1_ps(planes[p].y), y)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), z), _mm_set1_ps(planes[p].w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = (mask >> k) & 1;
+			visibleCount += visible[i + k];
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		glm::vec3 center;
+		float r;
+		InstanceSphere(instances[i], sphere, center, r);
+		visible[i] = SphereInFrustum(planes, center, r) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
+
+uint32_t Culling::CountCullMismatches(const glm::vec4 planes[6], const InstanceData* instances, uint32_t count, const BoundingSphere& sphere) {
+	std::vector<uint8_t> visible(count);
+	CullInstances(planes, instances, count, sphere, visible.data());
+
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		glm::vec3 center;
+		float radius;
+		InstanceSphere(instances[i], sphere, center, radius);
+		if ((visible[i] != 0) == SphereInFrustum(planes, center, radius)) {
+			continue;
+		}
+
+		Decision inside = Decision::Yes;
+		for (int p = 0; p < 6 && inside != Decision::No; p++) {
+			float distance = glm::dot(glm::vec3(planes[p]), center) + planes[p].w;
+			Decision plane = Decide(distance, -radius, std::max(std::abs(distance), radius));
+			inside = plane == Decision::No ? Decision::No : plane == Decision::Maybe ? Decision::Maybe : inside;
+		}
+		mismatches += inside != Decision::Maybe ? 1 : 0;
+	}
+	return mismatches;
+}
+
+float Culling::ProjectedDiameter(glm::vec3 eye, float pixelsPerUnit, glm::vec3 center, float radius) {
+	float distance = std::max(glm::length(center - eye), radius);
+	return distance > 0.0f ? 2.0f * radius * pixelsPerUnit / distance : 0.0f;
+}
+
+Culling::LodCounts Culling::CountLods(const glm::vec4 planes[6], glm::vec3 eye, float pixelsPerUnit, const InstanceData* instances, uint32_t count,
+	const BoundingSphere& lodSphere, const BoundingSphere& billboardSphere, bool fullTrees, float lod0Pixels, float lod1Pixels) {
+	LodCounts counts;
+	for (uint32_t i = 0; i < count; i++) {
+		glm::vec3 center;
+		float radius;
+		InstanceSphere(instances[i], lodSphere, center, radius);
+		float size = ProjectedDiameter(eye, pixelsPerUnit, center, radius);
+
+		// Settled on the billboard, Maybe in the hysteresis band
+		float billboardBelow = std::min(lod0Pixels, lod1Pixels * TREE_LOD_HYSTERESIS);
+		Decision below = Decide(billboardBelow, size, billboardBelow);
+		Decision above = Decide(size, lod1Pixels, lod1Pixels);
+		Decision settled = below == Decision::Yes ? Decision::Yes : above == Decision::Yes ? Decision::No : Decision::Maybe;
+		if (fullTrees) {
+			counts.lodCulled += settled == Decision::Yes ? 1 : 0;
+			counts.lodCulledAmbiguous += settled == Decision::Maybe ? 1 : 0;
+		}
+
+		// Settled on the billboard and inside every plane
+		Decision billboard = settled;
+		InstanceSphere(instances[i], billboardSphere, center, radius);
+		for (int p = 0; p < 6 && billboard != Decision::No; p++) {
+			float distance = glm::dot(glm::vec3(planes[p]), center) + planes[p].w;
+			Decision inside = Decide(distance, -radius, std::max(std::abs(distance), radius));
+			billboard = inside == Decision::No ? Decision::No : inside == Decision::Maybe ? Decision::Maybe : billboard;
+		}
+		counts.billboards += billboard == Decision::Yes ? 1 : 0;
+		counts.billboardsAmbiguous += billboard == Decision::Maybe ? 1 : 0;
+	}
+	return counts;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "InstanceData.h"
+#include "Model.h"
+
+// CPU side of the tree culling. The compute shaders run the same sphere / plane test, so everything here doubles as
+// a reference to check their results against.
+namespace Culling {
+	// Sphere on the instance's vertical axis, so it stays conservative for any rotation about y.
+	// With scaled set, the center height and radius are multiplied by the instance scale (pos_scale.w).
+	struct BoundingSphere {
+		float centerY = 0.0f;
+		float radius = 0.0f;
+		bool scaled = false;
+	};
+
+	// Planes as (normal, distance) with normals pointing inside, normalized so plane distances are in world units.
+	// Order: left, right, bottom, top, near, far (bottom and top swap with a flipped projection, which is harmless)
+	void ExtractFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]);
+
+	// Encloses every vertex of the models, grown by margin (relative) to leave room for vertex animation
+	BoundingSphere ComputeBoundingSphere(const std::vector<const Model*>& models, bool scaled, float margin);
+
+	bool SphereInFrustum(const glm::vec4 planes[6], glm::vec3 center, float radius);
+	// Axis aligned box between low and high, tested by the corner furthest along each plane's normal
+	bool BoxInFrustum(const glm::vec4 planes[6], glm::vec3 low, glm::vec3 high);
+	// Writes 1 to visible[i] for every instance whose sphere touches the frustum and returns how many did.
+	// Four instances per iteration with SSE when available.
+	uint32_t CullInstances(const glm::vec4 planes[6], const InstanceData* instances, uint32_t count, const BoundingSphere& sphere, uint8_t* visible);
+	// Instances CullInstances decides differently from SphereInFrustum, except those within a relative epsilon of a
+	// plane where the two sums may round apart
+	uint32_t CountCullMismatches(const glm::vec4 planes[6], const InstanceData* instances, uint32_t count, const BoundingSphere& sphere);
+
+	// Diameter in pixels of the sphere seen from eye, pixelsPerUnit as in CameraBufferObject::screen. Never larger than
+	// at a distance of one radius, so a camera inside the sphere stays finite. LOD thresholds are compared against this
+	float ProjectedDiameter(glm::vec3 eye, float pixelsPerUnit, glm::vec3 center, float radius);
+
+	// LOD decisions cullingCompute.comp makes for the instances of one tree group once their cross-fades are done. The
+	// LOD sphere is the full model's for species and the billboard's for fake trees. Instances smaller than
+	// min(lod0Pixels, lod1Pixels * TREE_LOD_HYSTERESIS) settle on their billboard: the full tree counts as lodCulled and
+	// the billboard counts when its sphere touches the frustum. Larger than lod1Pixels they settle on the full tree. In
+	// between they keep the LOD they had and count as ambiguous, as do instances within a relative epsilon of a
+	// threshold or plane, which can go either way on the GPU
+	struct LodCounts {
+		uint32_t lodCulled = 0;
+		uint32_t lodCulledAmbiguous = 0;
+		uint32_t billboards = 0;
+		uint32_t billboardsAmbiguous = 0;
+	};
+	LodCounts CountLods(const glm::vec4 planes[6], glm::vec3 eye, float pixelsPerUnit, const InstanceData* instances, uint32_t count,
+		const BoundingSphere& lodSphere, const BoundingSphere& billboardSphere, bool fullTrees, float lod0Pixels, float lod1Pixels);
+}
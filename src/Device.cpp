@@ -1,8 +1,9 @@
 #include "Device.h"
 #include "Instance.h"
 
-Device::Device(Instance* instance, VkDevice vkDevice, Queues queues)
-  : instance(instance), vkDevice(vkDevice), queues(queues) {
+Device::Device(Instance* instance, VkDevice vkDevice, Queues queues, VkPhysicalDeviceFeatures enabledFeatures, const std::vector<const char*>& enabledExtensions)
+  : instance(instance), vkDevice(vkDevice), queues(queues), enabledFeatures(enabledFeatures), enabledExtensions(enabledExtensions.begin(), enabledExtensions.end()) {
+    allocator = new MemoryAllocator(this);
 }
 
 Instance* Device::GetInstance() {
@@ -21,10 +22,32 @@ unsigned int Device::GetQueueIndex(QueueFlags flag) {
     return GetInstance()->GetQueueFamilyIndices()[flag];
 }
 
+MemoryAllocator* Device::GetAllocator() {
+    return allocator;
+}
+
+const VkPhysicalDeviceFeatures& Device::GetEnabledFeatures() const {
+    return enabledFeatures;
+}
+
+bool Device::IsExtensionEnabled(const char* extension) const {
+    for (const std::string& enabled : enabledExtensions) {
+        if (enabled == extension) {
+            return true;
+        }
+    }
+    return false;
+}
+
 SwapChain* Device::CreateSwapChain(VkSurfaceKHR surface, unsigned int numBuffers) {
     return new SwapChain(this, surface, numBuffers);
 }
 
+SwapChain* Device::CreateOffscreenSwapChain(uint32_t width, uint32_t height, unsigned int numBuffers) {
+    return new SwapChain(this, width, height, numBuffers);
+}
+
 Device::~Device() {
+    delete allocator;
     vkDestroyDevice(vkDevice, nullptr);
 }
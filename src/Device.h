@@ -1,9 +1,17 @@
 #pragma once
 
 #include <array>
+#include <string>
+#include <vector>
 #include <vulkan/vulkan.h>
 #include "QueueFlags.h"
 #include "SwapChain.h"
+#include "MemoryAllocator.h"
+
+// Older SDK headers only know the AMD version of the extension, both have the same entry point signature
+#ifndef VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+#define VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME "VK_KHR_draw_indirect_count"
+#endif
 
 class SwapChain;
 class Device {
@@ -11,19 +19,26 @@ class Device {
 
 public:
     SwapChain* CreateSwapChain(VkSurfaceKHR surface, unsigned int numBuffers);
+    SwapChain* CreateOffscreenSwapChain(uint32_t width, uint32_t height, unsigned int numBuffers);
     Instance* GetInstance();
     VkDevice GetVkDevice();
     VkQueue GetQueue(QueueFlags flag);
     unsigned int GetQueueIndex(QueueFlags flag);
+    MemoryAllocator* GetAllocator();
+    const VkPhysicalDeviceFeatures& GetEnabledFeatures() const;
+    bool IsExtensionEnabled(const char* extension) const;
     ~Device();
 
 private:
     using Queues = std::array<VkQueue, sizeof(QueueFlags)>;
     
     Device() = delete;
-    Device(Instance* instance, VkDevice vkDevice, Queues queues);
+    Device(Instance* instance, VkDevice vkDevice, Queues queues, VkPhysicalDeviceFeatures enabledFeatures, const std::vector<const char*>& enabledExtensions);
 
     Instance* instance;
     VkDevice vkDevice;
     Queues queues;
+    VkPhysicalDeviceFeatures enabledFeatures;
+    std::vector<std::string> enabledExtensions;
+    MemoryAllocator* allocator;
 };
@@ -1,4 +1,5 @@
 #include "FbxLoader.h"
+#include "MeshOptimizer.h"
 
 
 void FbxLoader::loadFbx(const std::string path) {
@@ -14,6 +15,8 @@ void FbxLoader::loadFbx(const std::string path) {
 	this->directory = path.substr(0, path.find_last_of('/'));
 
 	this->processNode(scene->mRootNode, scene);
+	// Assimp keeps the file's triangle order
+	MeshOptimizer::Optimize(vertices, indices, path.c_str());
 }
 
 void FbxLoader::processNode(aiNode* node, const aiScene* scene) {
@@ -0,0 +1,5 @@
+#pragma once
+
+// Number of frames the CPU may record ahead of the GPU.
+// Uniform ring slices, culling outputs, command buffers and sync objects are replicated this many times.
+static constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 2;
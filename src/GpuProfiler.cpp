@@ -0,0 +1,232 @@
+#include <stdexcept>
+#include <algorithm>
+#include "GpuProfiler.h"
+#include "Instance.h"
+
+namespace {
+	const uint32_t SCOPE_COUNT = static_cast<uint32_t>(ProfilerScope::Count);
+
+	const char* scopeNames[SCOPE_COUNT] = {
+		"Cull trees",
+		"Frame",
+		"Terrain",
+		"Skybox",
+		"GUI",
+		"Bark",
+		"Leaf",
+		"Billboard",
+		"Fake trees",
+		"Depth pyramid",
+		"Cull occluded",
+	};
+
+	uint64_t TimestampMask(uint32_t validBits) {
+		if (validBits >= 64) {
+			return ~0ull;
+		}
+		return (1ull << validBits) - 1;
+	}
+}
+
+GpuProfiler::GpuProfiler(Device* device, uint32_t frameCount) : device(device), frameCount(frameCount) {
+	Instance* instance = device->GetInstance();
+	timestampPeriod = instance->GetPhysicalDeviceProperties().limits.timestampPeriod;
+
+	// A family without valid timestamp bits cannot be timed, its scopes are simply left empty
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(instance->GetPhysicalDevice(), &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(instance->GetPhysicalDevice(), &familyCount, families.data());
+	graphicsMask = TimestampMask(families[device->GetQueueIndex(QueueFlags::Graphics)].timestampValidBits);
+	computeMask = TimestampMask(families[device->GetQueueIndex(QueueFlags::Compute)].timestampValidBits);
+	if (!graphicsMask || !computeMask) {
+		printf("Timestamps not supported on the %s queue\n", !graphicsMask ? "graphics" : "compute");
+	}
+
+	VkQueryPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = SCOPE_COUNT * MAX_SLOTS * 2;
+
+	queryPools.resize(frameCount);
+	for (uint32_t i = 0; i < frameCount; i++) {
+		if (vkCreateQueryPool(device->GetVkDevice(), &poolInfo, nullptr, &queryPools[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create timestamp query pool");
+		}
+	}
+	submitted.resize(frameCount, false);
+	submitIndices.resize(frameCount, -1);
+	for (uint32_t s = 0; s < SCOPE_COUNT; s++) {
+		lastTimes[s] = -1.0f;
+	}
+	// Value and availability word for every query of one scope
+	results.resize(MAX_SLOTS * 2 * 2);
+}
+
+uint64_t GpuProfiler::GetTimestampMask(ProfilerScope scope) const {
+	bool compute = scope == ProfilerScope::CullTrees;
+	return compute ? computeMask : graphicsMask;
+}
+
+bool GpuProfiler::IsSupported(ProfilerScope scope) const {
+	return GetTimestampMask(scope) != 0;
+}
+
+uint32_t GpuProfiler::GetQueryIndex(ProfilerScope scope, uint32_t slot) const {
+	return (static_cast<uint32_t>(scope) * MAX_SLOTS + slot) * 2;
+}
+
+void GpuProfiler::RecordReset(VkCommandBuffer commandBuffer, uint32_t frame, ProfilerScope first, ProfilerScope last) {
+	if (!IsSupported(first)) {
+		return;
+	}
+	uint32_t firstQuery = GetQueryIndex(first, 0);
+	vkCmdResetQueryPool(commandBuffer, queryPools[frame], firstQuery, GetQueryIndex(last, 0) - firstQuery);
+}
+
+void GpuProfiler::RecordBegin(VkCommandBuffer commandBuffer, uint32_t frame, ProfilerScope scope, uint32_t slot) {
+	if (slot >= MAX_SLOTS || !IsSupported(scope)) {
+		return;
+	}
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPools[frame], GetQueryIndex(scope, slot));
+}
+
+void GpuProfiler::RecordEnd(VkCommandBuffer commandBuffer, uint32_t frame, ProfilerScope scope, uint32_t slot) {
+	if (slot >= MAX_SLOTS || !IsSupported(scope)) {
+		return;
+	}
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPools[frame], GetQueryIndex(scope, slot) + 1);
+}
+
+void GpuProfiler::MarkSubmitted(uint32_t frame) {
+	submitted[frame] = true;
+	submitIndices[frame] = submitCount++;
+}
+
+void GpuProfiler::Collect(uint32_t frame) {
+	if (!submitted[frame]) {
+		return;
+	}
+	submitted[frame] = false;
+	lastCollectedSubmit = submitIndices[frame];
+
+	if (csvFile) {
+		fprintf(csvFile, "%llu", static_cast<unsigned long long>(collectedFrames));
+	}
+
+	for (uint32_t s = 0; s < SCOPE_COUNT; s++) {
+		ProfilerScope scope = static_cast<ProfilerScope>(s);
+		bool valid = false;
+		float milliseconds = 0.0f;
+
+		if (IsSupported(scope)) {
+			// Slots that were never written this frame report unavailable instead of blocking
+			VkResult result = vkGetQueryPoolResults(device->GetVkDevice(), queryPools[frame], GetQueryIndex(scope, 0), MAX_SLOTS * 2,
+				results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+			if (result == VK_SUCCESS || result == VK_NOT_READY) {
+				uint64_t mask = GetTimestampMask(scope);
+				for (uint32_t slot = 0; slot < MAX_SLOTS; slot++) {
+					const uint64_t* begin = &results[slot * 4];
+					const uint64_t* end = &results[slot * 4 + 2];
+					if (begin[1] && end[1]) {
+						milliseconds += float((end[0] - begin[0]) & mask) * timestampPeriod * 1e-6f;
+						valid = true;
+					}
+				}
+			}
+		}
+
+		lastTimes[s] = valid ? milliseconds : -1.0f;
+		if (valid) {
+			History& h = history[s];
+			h.samples[h.head] = milliseconds;
+			h.head = (h.head + 1) % HISTORY_SIZE;
+			if (h.count < HISTORY_SIZE) {
+				h.count++;
+			}
+		}
+		if (csvFile) {
+			if (valid) {
+				fprintf(csvFile, ",%.4f", milliseconds);
+			}
+			else {
+				fprintf(csvFile, ",");
+			}
+		}
+	}
+
+	if (csvFile) {
+		fprintf(csvFile, "\n");
+	}
+	collectedFrames++;
+}
+
+bool GpuProfiler::StartCsv(const char* path) {
+	StopCsv();
+	csvFile = fopen(path, "w");
+	if (!csvFile) {
+		printf("Failed to open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(csvFile, "frame");
+	for (uint32_t s = 0; s < SCOPE_COUNT; s++) {
+		fprintf(csvFile, ",%s_ms", scopeNames[s]);
+	}
+	fprintf(csvFile, "\n");
+	printf("Writing GPU timings to %s\n", path);
+	return true;
+}
+
+void GpuProfiler::StopCsv() {
+	if (csvFile) {
+		fclose(csvFile);
+		csvFile = nullptr;
+	}
+}
+
+bool GpuProfiler::IsRecordingCsv() const {
+	return csvFile != nullptr;
+}
+
+ProfilerStats GpuProfiler::GetStats(ProfilerScope scope) const {
+	ProfilerStats stats;
+	const History& h = history[static_cast<uint32_t>(scope)];
+	if (h.count == 0) {
+		return stats;
+	}
+
+	float sorted[HISTORY_SIZE];
+	float sum = 0.0f;
+	for (uint32_t i = 0; i < h.count; i++) {
+		sorted[i] = h.samples[i];
+		sum += h.samples[i];
+	}
+	std::sort(sorted, sorted + h.count);
+
+	stats.last = h.samples[(h.head + HISTORY_SIZE - 1) % HISTORY_SIZE];
+	stats.min = sorted[0];
+	stats.avg = sum / h.count;
+	stats.p99 = sorted[std::min(h.count - 1, h.count * 99 / 100)];
+	return stats;
+}
+
+int64_t GpuProfiler::GetLastCollectedSubmit() const {
+	return lastCollectedSubmit;
+}
+
+float GpuProfiler::GetLastTime(ProfilerScope scope) const {
+	return lastTimes[static_cast<uint32_t>(scope)];
+}
+
+const char* GpuProfiler::GetScopeName(ProfilerScope scope) {
+	return scopeNames[static_cast<uint32_t>(scope)];
+}
+
+GpuProfiler::~GpuProfiler() {
+	StopCsv();
+	for (VkQueryPool pool : queryPools) {
+		vkDestroyQueryPool(device->GetVkDevice(), pool, nullptr);
+	}
+}
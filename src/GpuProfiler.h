@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdio>
+#include <vector>
+#include "Device.h"
+
+// Passes timed by the profiler. Compute scopes come first so each queue resets one contiguous range
+enum class ProfilerScope : uint32_t {
+	CullTrees = 0,
+	Frame,
+	Terrain,
+	Skybox,
+	Gui,
+	Bark,
+	Leaf,
+	Billboard,
+	FakeTrees,
+	DepthPyramid,
+	CullOccluded,
+	Count
+};
+
+struct ProfilerStats {
+	float last = 0.0f;
+	float min = 0.0f;
+	float avg = 0.0f;
+	float p99 = 0.0f;
+};
+
+// GPU pass timings from timestamp queries.
+// Every frame in flight owns a query pool, and each scope a few begin/end pairs (slots) in it so passes recorded
+// more than once per frame add up to one number. Results are read right after the frame's fence has signaled, i.e.
+// MAX_FRAMES_IN_FLIGHT frames late, so reading them never stalls.
+class GpuProfiler {
+public:
+	static constexpr uint32_t MAX_SLOTS = 8;
+	static constexpr uint32_t HISTORY_SIZE = 256;
+
+	GpuProfiler() = delete;
+	GpuProfiler(Device* device, uint32_t frameCount);
+	~GpuProfiler();
+
+	// Reset the queries of scopes [first, last), must be recorded outside of a render pass
+	void RecordReset(VkCommandBuffer commandBuffer, uint32_t frame, ProfilerScope first, ProfilerScope last);
+	void RecordBegin(VkCommandBuffer commandBuffer, uint32_t frame, ProfilerScope scope, uint32_t slot = 0);
+	void RecordEnd(VkCommandBuffer commandBuffer, uint32_t frame, ProfilerScope scope, uint32_t slot = 0);
+
+	// Call once the frame's fence has signaled, before it is submitted again
+	void Collect(uint32_t frame);
+	// Call after the frame's command buffers have been submitted
+	void MarkSubmitted(uint32_t frame);
+
+	bool StartCsv(const char* path);
+	void StopCsv();
+	bool IsRecordingCsv() const;
+
+	// Milliseconds over the last HISTORY_SIZE collected frames
+	ProfilerStats GetStats(ProfilerScope scope) const;
+	// Submit number (counted by MarkSubmitted) of the last collected frame, -1 before the first one
+	int64_t GetLastCollectedSubmit() const;
+	// Milliseconds of the scope in the last collected frame, negative if it was not timed
+	float GetLastTime(ProfilerScope scope) const;
+	static const char* GetScopeName(ProfilerScope scope);
+
+private:
+	uint64_t GetTimestampMask(ProfilerScope scope) const;
+	bool IsSupported(ProfilerScope scope) const;
+	uint32_t GetQueryIndex(ProfilerScope scope, uint32_t slot) const;
+
+	Device* device;
+	uint32_t frameCount;
+	// Nanoseconds per timestamp tick
+	float timestampPeriod;
+	uint64_t graphicsMask;
+	uint64_t computeMask;
+
+	std::vector<VkQueryPool> queryPools;
+	std::vector<bool> submitted;
+	std::vector<int64_t> submitIndices;
+	int64_t submitCount = 0;
+	int64_t lastCollectedSubmit = -1;
+	float lastTimes[static_cast<uint32_t>(ProfilerScope::Count)];
+	std::vector<uint64_t> results;
+
+	// Rolling window of milliseconds per scope
+	struct History {
+		float samples[HISTORY_SIZE];
+		uint32_t head = 0;
+		uint32_t count = 0;
+	};
+	History history[static_cast<uint32_t>(ProfilerScope::Count)];
+
+	FILE* csvFile = nullptr;
+	uint64_t collectedFrames = 0;
+};
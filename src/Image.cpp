@@ -1,6 +1,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 
+#include <cstring>
+#include <vector>
 #include "Image.h"
 #include "Device.h"
 #include "Instance.h"
@@ -29,21 +33,39 @@ void Image::Create(Device* device, uint32_t width, uint32_t height, VkFormat for
         throw std::runtime_error("Failed to create image");
     }
 
-    // Allocate memory for the image
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device->GetVkDevice(), image, &memRequirements);
+    // Sub-allocate memory from the device's pools and bind the image
+    imageMemory = device->GetAllocator()->BindImage(image, properties).memory;
+}
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(memRequirements.memoryTypeBits, properties);
+void Image::CreateMipmapped(Device* device, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, const std::vector<uint32_t>& queueFamilies, VkImage& image, VkDeviceMemory& imageMemory) {
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = usage;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (queueFamilies.size() > 1) {
+		imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+		imageInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
+	else {
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
 
-    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate image memory");
-    }
+	if (vkCreateImage(device->GetVkDevice(), &imageInfo, nullptr, &image) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create image");
+	}
 
-    // Bind the image
-    vkBindImageMemory(device->GetVkDevice(), image, imageMemory, 0);
+	// Sub-allocate memory from the device's pools and bind the image
+	imageMemory = device->GetAllocator()->BindImage(image, properties).memory;
 }
 
 void Image::CreateCubeMapImage(Device * device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory)
@@ -69,24 +91,16 @@ void Image::CreateCubeMapImage(Device * device, uint32_t width, uint32_t height,
 		throw std::runtime_error("Failed to create image");
 	}
 
-	// Allocate memory for the image
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device->GetVkDevice(), image, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate image memory");
-	}
+	// Sub-allocate memory from the device's pools and bind the image
+	imageMemory = device->GetAllocator()->BindImage(image, properties).memory;
+}
 
-	// Bind the image
-	vkBindImageMemory(device->GetVkDevice(), image, imageMemory, 0);
+void Image::Destroy(Device* device, VkImage image) {
+    device->GetAllocator()->FreeImage(image);
+    vkDestroyImage(device->GetVkDevice(), image, nullptr);
 }
 
-void Image::TransitionLayout(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout,bool cubemap) {
+void Image::RecordTransitionLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, bool cubemap) {
     auto hasStencilComponent = [](VkFormat format) {
         return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
   };
@@ -141,6 +155,10 @@ void Image::TransitionLayout(Device* device, VkCommandPool commandPool, VkImage
         throw std::invalid_argument("Unsupported layout transition");
     }
 
+    vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Image::TransitionLayout(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout,bool cubemap) {
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -156,7 +174,7 @@ void Image::TransitionLayout(Device* device, VkCommandPool commandPool, VkImage
 
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
   
-    vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    Image::RecordTransitionLayout(commandBuffer, image, format, oldLayout, newLayout, cubemap);
   
     vkEndCommandBuffer(commandBuffer);
     
@@ -192,7 +210,27 @@ VkImageView Image::CreateView(Device* device, VkImage image, VkFormat format, Vk
     return imageView;
 }
 
-void Image::CopyFromBuffer(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkImage& image, uint32_t width, uint32_t height) {
+VkImageView Image::CreateMipView(Device* device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t baseMipLevel, uint32_t levelCount) {
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange.aspectMask = aspectFlags;
+	viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+	viewInfo.subresourceRange.levelCount = levelCount;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	VkImageView imageView;
+	if (vkCreateImageView(device->GetVkDevice(), &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to texture image view");
+	}
+
+	return imageView;
+}
+
+VkBufferImageCopy Image::FullCopyRegion(uint32_t width, uint32_t height, uint32_t layer) {
     // Specify which part of the buffer is going to be copied to which part of the image
     VkBufferImageCopy region = {};
     region.bufferOffset = 0;
@@ -201,76 +239,15 @@ void Image::CopyFromBuffer(Device* device, VkCommandPool commandPool, VkBuffer b
 
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.baseArrayLayer = layer;
     region.imageSubresource.layerCount = 1;
 
     region.imageOffset = { 0, 0, 0 };
     region.imageExtent = { width, height, 1 };
-
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(device->GetQueue(QueueFlags::Transfer), 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(device->GetQueue(QueueFlags::Transfer));
-    vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
-}
-
-void Image::CopyFromBufferMultiRegions(Device * device, VkCommandPool commandPool, VkBuffer buffer, VkImage & image, 
-	uint32_t width, uint32_t height,std::vector<VkBufferImageCopy>regions)
-{
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = commandPool;
-	allocInfo.commandBufferCount = 1;
-
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, &commandBuffer);
-
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-		static_cast<uint32_t>(regions.size()), regions.data());
-
-	vkEndCommandBuffer(commandBuffer);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	vkQueueSubmit(device->GetQueue(QueueFlags::Transfer), 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(device->GetQueue(QueueFlags::Transfer));
-	vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
-
+    return region;
 }
 
-void Image::FromFile(Device* device, VkCommandPool commandPool, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void Image::FromFile(Device* device, UploadContext* uploadContext, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
     int texWidth, texHeight, texChannels;
     stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
     VkDeviceSize imageSize = texWidth * texHeight * 4;
@@ -279,41 +256,26 @@ void Image::FromFile(Device* device, VkCommandPool commandPool, const char* path
         throw std::runtime_error("Failed to load texture image");
     }
 
-    // Create staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    BufferUtils::CreateBuffer(device, imageSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
-
-    // Copy pixel values to the buffer
-    void* data;
-    vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
-
-    // Free pixel array
-    stbi_image_free(pixels);
-
     // Create Vulkan image
     Image::Create(device, texWidth, texHeight, format, tiling, VK_IMAGE_USAGE_TRANSFER_DST_BIT | usage, properties, image, imageMemory);
 
-    // Copy the staging buffer to the texture image
+    // Copy the pixels to the texture image
     // --> First need to transition the texture image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-    Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,false);
-    Image::CopyFromBuffer(device, commandPool, stagingBuffer, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+    uploadContext->TransitionLayout(image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false);
+    uploadContext->UploadImage(pixels, imageSize, image, { Image::FullCopyRegion(texWidth, texHeight, 0) });
 
     // Transition texture image for shader access
-    Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout,false);
+    uploadContext->TransitionLayout(image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, false);
 
-    // No need for staging buffer anymore
-    vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+    // Pixels were copied into the staging ring, free pixel array
+    stbi_image_free(pixels);
 }
 
-void Image::FromMultiFile(Device * device, VkCommandPool commandPool, const std::vector<char*> paths, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory)
+void Image::FromMultiFile(Device * device, UploadContext* uploadContext, const std::vector<char*> paths, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory)
 {
+	if (paths.size() < 6)
+		throw std::runtime_error("At least 6 images required to construct a cube map");
+
 	int texWidth, texHeight, texChannels;
 	stbi_uc* pixels = stbi_load(paths[0], &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
@@ -321,64 +283,30 @@ void Image::FromMultiFile(Device * device, VkCommandPool commandPool, const std:
 	if (!pixels) {
 		throw std::runtime_error("Failed to load texture image");
 	}
+	stbi_image_free(pixels);
+
 	// Create Vulkan image
 	Image::CreateCubeMapImage(device, texWidth, texHeight, format, tiling, VK_IMAGE_USAGE_TRANSFER_DST_BIT | usage, properties, image, imageMemory);
-	if(paths.size()<6) 
-		throw std::runtime_error("At least 6 images required to construct a cube map");
-	// Create staging buffer
+
+	// All six faces go into the same batch between a single pair of transitions
+	uploadContext->TransitionLayout(image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true);
 	for (int i = 0; i < 6; i++) {
 		pixels = stbi_load(paths[i], &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-		BufferUtils::CreateBuffer(device, imageSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
+		if (!pixels) {
+			throw std::runtime_error("Failed to load texture image");
+		}
 
-		// Copy pixel values to the buffer
-		void* data;
-		vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, static_cast<size_t>(imageSize));
-		vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
+		uploadContext->UploadImage(pixels, imageSize, image, { Image::FullCopyRegion(texWidth, texHeight, i) });
 
 		// Free pixel array
 		stbi_image_free(pixels);
-
-		//Create image sublayer source
-		VkImageSubresourceLayers image_subresource = {
-			VK_IMAGE_ASPECT_COLOR_BIT,    // VkImageAspectFlags     aspectMask
-			0,                            // uint32_t               mipLevel
-			static_cast<uint32_t>(i),     // uint32_t               baseArrayLayer
-			1                             // uint32_t               layerCount
-		};
-
-		// Copy the staging buffer to the texture image
-		// --> First need to transition the texture image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-		Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true);
-		Image::CopyFromBufferMultiRegions(device, commandPool, stagingBuffer, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight),
-		{
-			{
-			0,                                        // VkDeviceSize               bufferOffset
-			0,                                        // uint32_t                   bufferRowLength
-			0,                                        // uint32_t                   bufferImageHeight
-			image_subresource,						  // VkImageSubresourceLayers   imageSubresource
-			{0,0,0},								  // VkOffset3D                 imageOffset
-			{ static_cast<uint32_t>(texWidth),
-			static_cast<uint32_t>(texHeight),1 }
-			}// VkExtent3D                 imageExtent
-		 });
-
-		// Transition texture image for shader access
-		Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, true);
-
-		// No need for staging buffer anymore
-		vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-		vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
 	}
 
+	// Transition texture image for shader access
+	uploadContext->TransitionLayout(image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, true);
 }
 
-void Image::FromGuiTexture(Device * device, VkCommandPool commandPool, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory)
+void Image::FromGuiTexture(Device * device, UploadContext* uploadContext, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory)
 {
 	ImGuiIO& io = ImGui::GetIO();
 	unsigned char* pixels;
@@ -391,37 +319,99 @@ void Image::FromGuiTexture(Device * device, VkCommandPool commandPool, VkFormat
 		throw std::runtime_error("Failed to load texture image");
 	}
 
-	// Create staging buffer
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-	BufferUtils::CreateBuffer(device, imageSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
-
-	// Copy pixel values to the buffer
-	void* data;
-	vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
-
-	// Free pixel array
-	//stbi_image_free(pixels);
-
 	// Create Vulkan image
 	Image::Create(device, texWidth, texHeight, format, tiling, VK_IMAGE_USAGE_TRANSFER_DST_BIT | usage, properties, image, imageMemory);
 
-	// Copy the staging buffer to the texture image
+	// Copy the pixels to the texture image
 	// --> First need to transition the texture image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-	Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false);
-	Image::CopyFromBuffer(device, commandPool, stagingBuffer, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+	uploadContext->TransitionLayout(image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false);
+	uploadContext->UploadImage(pixels, imageSize, image, { Image::FullCopyRegion(texWidth, texHeight, 0) });
 
 	// Transition texture image for shader access
-	Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, false);
-
-	// No need for staging buffer anymore
-	vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-	vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+	uploadContext->TransitionLayout(image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, false);
 
 	io.Fonts->TexID = (void *)(intptr_t)image;
 }
+
+bool Image::SaveToPng(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout layout, uint32_t width, uint32_t height, const char* path) {
+	bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+	if (!bgra && format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_R8G8B8A8_SRGB) {
+		printf("Cannot save image format %d to %s\n", format, path);
+		return false;
+	}
+
+	VkDeviceSize imageSize = VkDeviceSize(width) * height * 4;
+	VkBuffer readbackBuffer;
+	VkDeviceMemory readbackBufferMemory;
+	BufferUtils::CreateBuffer(device, imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferMemory);
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, &commandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	// Make the finished color writes visible to the copy, the layout is only changed if it is not already a transfer source
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barrier.oldLayout = layout;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkBufferImageCopy region = Image::FullCopyRegion(width, height, 0);
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+	if (layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+		std::swap(barrier.oldLayout, barrier.newLayout);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	VkMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
+	vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
+
+	// PNG wants RGBA and an opaque image, the alpha channel holds whatever the blending left behind
+	std::vector<unsigned char> pixels(static_cast<size_t>(imageSize));
+	memcpy(pixels.data(), BufferUtils::MapBuffer(device, readbackBuffer), static_cast<size_t>(imageSize));
+	for (size_t i = 0; i < pixels.size(); i += 4) {
+		if (bgra) {
+			std::swap(pixels[i], pixels[i + 2]);
+		}
+		pixels[i + 3] = 255;
+	}
+	BufferUtils::DestroyBuffer(device, readbackBuffer);
+
+	if (!stbi_write_png(path, width, height, 4, pixels.data(), width * 4)) {
+		printf("Failed to write %s\n", path);
+		return false;
+	}
+	return true;
+}
@@ -1,17 +1,27 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <vector>
 #include "Device.h"
+#include "UploadContext.h"
 
 namespace Image {
 
     void Create(Device* device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	// Image with a mip chain. With more than one queue family it is shared concurrently, so it needs no ownership transfers
+	void CreateMipmapped(Device* device, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, const std::vector<uint32_t>& queueFamilies, VkImage& image, VkDeviceMemory& imageMemory);
 	void CreateCubeMapImage(Device* device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+    void RecordTransitionLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, bool cubemap);
     void TransitionLayout(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout,bool cubemap);
     VkImageView CreateView(Device* device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,bool cubemap);
-    void CopyFromBuffer(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkImage& image, uint32_t width, uint32_t height);
-	void CopyFromBufferMultiRegions(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkImage& image, uint32_t width, uint32_t height, std::vector<VkBufferImageCopy>regions);
-	void FromFile(Device* device, VkCommandPool commandPool, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-	void FromMultiFile(Device* device, VkCommandPool commandPool, const std::vector<char*> paths, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-	void FromGuiTexture(Device* device, VkCommandPool commandPool, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	// View of levelCount mip levels starting at baseMipLevel
+	VkImageView CreateMipView(Device* device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t baseMipLevel, uint32_t levelCount);
+    VkBufferImageCopy FullCopyRegion(uint32_t width, uint32_t height, uint32_t layer);
+	void FromFile(Device* device, UploadContext* uploadContext, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	void FromMultiFile(Device* device, UploadContext* uploadContext, const std::vector<char*> paths, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	// imageMemory is shared with other resources, release the image through here instead of vkFreeMemory
+	void Destroy(Device* device, VkImage image);
+	// Reads back a color image that is no longer in use and writes it as an 8 bit RGBA PNG, layout is restored afterwards
+	bool SaveToPng(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout layout, uint32_t width, uint32_t height, const char* path);
+	void FromGuiTexture(Device* device, UploadContext* uploadContext, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
 }
@@ -0,0 +1,373 @@
+#include <cmath>
+#include <stdexcept>
+#include "ImpostorBaker.h"
+#include "Image.h"
+#include "Instance.h"
+#include "ShaderModule.h"
+
+namespace {
+	const VkFormat ATLAS_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+	// Same as the push constants in impostorBake.vert / .frag
+	struct FrameConstants {
+		// xyz: frame basis in model space, forward points at the baking camera
+		// w: sphere center height, sphere radius and the layer's alpha cutoff
+		glm::vec4 right;
+		glm::vec4 up;
+		glm::vec4 forward;
+		glm::vec4 normalScale;
+	};
+}
+
+ImpostorBaker::ImpostorBaker(Device* device) : device(device), logicalDevice(device->GetVkDevice()) {
+	depthFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+	// Albedo and normal / depth are sampled by the billboards afterwards, the depth buffer is thrown away
+	VkAttachmentDescription attachments[3] = {};
+	for (int i = 0; i < 2; i++) {
+		attachments[i].format = ATLAS_FORMAT;
+		attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	attachments[2].format = depthFormat;
+	attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorAttachmentRefs[2] = {
+		{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+		{ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+	};
+	VkAttachmentReference depthAttachmentRef = { 2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 2;
+	subpass.pColorAttachments = colorAttachmentRefs;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+	// The forest's fragment shaders read the atlases
+	VkSubpassDependency dependency = {};
+	dependency.srcSubpass = 0;
+	dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 3;
+	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &dependency;
+	if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create impostor render pass");
+	}
+
+	// Diffuse and normal map of one layer
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	for (uint32_t i = 0; i < 2; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		bindings[i].pImmutableSamplers = nullptr;
+	}
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(FrameConstants);
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	VkShaderModule vertShaderModule = ShaderModule::Create("shaders/impostorBake.vert.spv", logicalDevice);
+	VkShaderModule fragShaderModule = ShaderModule::Create("shaders/impostorBake.frag.spv", logicalDevice);
+	VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+
+	VkVertexInputBindingDescription bindingDescription = Vertex::getBindingDescription();
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = Vertex::getAttributeDescriptions();
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	// Every frame has its own viewport in the atlas
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+	VkDynamicState dynamicStates[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	// Leaves are seen from both sides
+	VkPipelineRasterizationStateCreateInfo rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling = {};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencil.minDepthBounds = 0.0f;
+	depthStencil.maxDepthBounds = 1.0f;
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachments[2] = {};
+	for (int i = 0; i < 2; i++) {
+		colorBlendAttachments[i].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachments[i].blendEnable = VK_FALSE;
+	}
+	VkPipelineColorBlendStateCreateInfo colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.attachmentCount = 2;
+	colorBlending.pAttachments = colorBlendAttachments;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+	if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create impostor pipeline");
+	}
+	vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
+	vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
+
+	VkCommandPoolCreateInfo commandPoolInfo = {};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.queueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	if (vkCreateCommandPool(logicalDevice, &commandPoolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create command pool");
+	}
+}
+
+ImpostorAtlas ImpostorBaker::Bake(const std::vector<ImpostorLayer>& layers, const Culling::BoundingSphere& sphere) {
+	const uint32_t atlasSize = IMPOSTOR_FRAMES * IMPOSTOR_FRAME_SIZE;
+	ImpostorAtlas atlas;
+	Image::Create(device, atlasSize, atlasSize, ATLAS_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, atlas.albedo, atlas.albedoMemory);
+	Image::Create(device, atlasSize, atlasSize, ATLAS_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, atlas.normalDepth, atlas.normalDepthMemory);
+	VkImage depthImage;
+	VkDeviceMemory depthImageMemory;
+	Image::Create(device, atlasSize, atlasSize, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+
+	VkImageView views[3] = {
+		Image::CreateView(device, atlas.albedo, ATLAS_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, false),
+		Image::CreateView(device, atlas.normalDepth, ATLAS_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, false),
+		Image::CreateView(device, depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, false),
+	};
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = renderPass;
+	framebufferInfo.attachmentCount = 3;
+	framebufferInfo.pAttachments = views;
+	framebufferInfo.width = atlasSize;
+	framebufferInfo.height = atlasSize;
+	framebufferInfo.layers = 1;
+	VkFramebuffer framebuffer;
+	if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create impostor framebuffer");
+	}
+
+	// One descriptor set per layer
+	const uint32_t layerCount = static_cast<uint32_t>(layers.size());
+	VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * layerCount };
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = layerCount;
+	VkDescriptorPool descriptorPool;
+	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor pool");
+	}
+	std::vector<VkDescriptorSetLayout> setLayouts(layerCount, descriptorSetLayout);
+	std::vector<VkDescriptorSet> descriptorSets(layerCount);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = layerCount;
+	allocInfo.pSetLayouts = setLayouts.data();
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+	for (uint32_t l = 0; l < layerCount; l++) {
+		VkDescriptorImageInfo imageInfos[2] = {};
+		imageInfos[0] = { layers[l].model->GetDiffuseMapSampler(), layers[l].model->GetDiffuseMapView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		imageInfos[1] = { layers[l].model->GetNormalMapSampler(), layers[l].model->GetNormalMapView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		VkWriteDescriptorSet descriptorWrites[2] = {};
+		for (uint32_t i = 0; i < 2; i++) {
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = descriptorSets[l];
+			descriptorWrites[i].dstBinding = i;
+			descriptorWrites[i].dstArrayElement = 0;
+			descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pImageInfo = &imageInfos[i];
+		}
+		vkUpdateDescriptorSets(logicalDevice, 2, descriptorWrites, 0, nullptr);
+	}
+
+	VkCommandBufferAllocateInfo commandBufferInfo = {};
+	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferInfo.commandPool = commandPool;
+	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferInfo.commandBufferCount = 1;
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(logicalDevice, &commandBufferInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffers");
+	}
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	// Uncovered texels are transparent, face the frame's camera and lie at the back of the sphere
+	VkClearValue clearValues[3] = {};
+	clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+	clearValues[1].color = { { 0.5f, 0.5f, 1.0f, 1.0f } };
+	clearValues[2].depthStencil = { 1.0f, 0 };
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = framebuffer;
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = { atlasSize, atlasSize };
+	renderPassInfo.clearValueCount = 3;
+	renderPassInfo.pClearValues = clearValues;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+	for (uint32_t j = 0; j < IMPOSTOR_FRAMES; j++) {
+		for (uint32_t i = 0; i < IMPOSTOR_FRAMES; i++) {
+			VkViewport viewport = { float(i * IMPOSTOR_FRAME_SIZE), float(j * IMPOSTOR_FRAME_SIZE), float(IMPOSTOR_FRAME_SIZE), float(IMPOSTOR_FRAME_SIZE), 0.0f, 1.0f };
+			VkRect2D scissor = { { int32_t(i * IMPOSTOR_FRAME_SIZE), int32_t(j * IMPOSTOR_FRAME_SIZE) }, { IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE } };
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+			FrameConstants constants;
+			glm::vec3 forward = HemiOctahedronDecode(glm::vec2(float(i), float(j)) / float(IMPOSTOR_FRAMES - 1));
+			glm::vec3 right, up;
+			FrameBasis(forward, right, up);
+			constants.right = glm::vec4(right, sphere.centerY);
+			constants.up = glm::vec4(up, sphere.radius);
+			for (uint32_t l = 0; l < layerCount; l++) {
+				const Model* model = layers[l].model;
+				constants.forward = glm::vec4(forward, layers[l].alphaCutoff);
+				constants.normalScale = glm::vec4(layers[l].normalScale, 0.0f, 0.0f);
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(FrameConstants), &constants);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[l], 0, nullptr);
+				VkBuffer vertexBuffer = model->getVertexBuffer();
+				VkDeviceSize offset = 0;
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+				vkCmdBindIndexBuffer(commandBuffer, model->getIndexBuffer(), 0, model->getIndexType());
+				vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(model->getIndices().size()), 1, 0, 0, 0);
+			}
+		}
+	}
+	vkCmdEndRenderPass(commandBuffer);
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
+
+	vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+	vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+	vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+	for (VkImageView view : views) {
+		vkDestroyImageView(logicalDevice, view, nullptr);
+	}
+	Image::Destroy(device, depthImage);
+	return atlas;
+}
+
+glm::vec3 ImpostorBaker::HemiOctahedronDecode(glm::vec2 grid) {
+	// The grid is the octahedron's upper half rotated by 45 degrees, so its corners are the horizon directions
+	glm::vec2 a = grid * 2.0f - 1.0f;
+	glm::vec2 p = glm::vec2(a.x + a.y, a.y - a.x) * 0.5f;
+	return glm::normalize(glm::vec3(p.x, 1.0f - std::abs(p.x) - std::abs(p.y), p.y));
+}
+
+void ImpostorBaker::FrameBasis(glm::vec3 forward, glm::vec3& right, glm::vec3& up) {
+	right = std::abs(forward.y) < 0.999f ? glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward)) : glm::vec3(1.0f, 0.0f, 0.0f);
+	up = glm::cross(forward, right);
+}
+
+ImpostorBaker::~ImpostorBaker() {
+	vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+	vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+}
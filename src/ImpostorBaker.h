@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "Culling.h"
+#include "Device.h"
+#include "Model.h"
+
+// Frames per side of the hemi-octahedral grid, same as in billboard.vert and billboard.frag
+const uint32_t IMPOSTOR_FRAMES = 8;
+// Pixels per side of one frame
+const uint32_t IMPOSTOR_FRAME_SIZE = 256;
+
+// One model of a species and how its fragment shader reads its textures
+struct ImpostorLayer {
+	const Model* model;
+	// Texels with less alpha are cut out
+	float alphaCutoff;
+	// Tangent space normal map xy scale, sign included
+	glm::vec2 normalScale;
+};
+
+// Species seen from IMPOSTOR_FRAMES x IMPOSTOR_FRAMES directions over the upper hemisphere, frame (i, j) is looking
+// along -HemiOctahedronDecode((i, j) / (IMPOSTOR_FRAMES - 1)) and sits in column i, row j. Both atlases are
+// R8G8B8A8_UNORM in SHADER_READ_ONLY_OPTIMAL layout.
+struct ImpostorAtlas {
+	// Unlit color, alpha is coverage
+	VkImage albedo = VK_NULL_HANDLE;
+	VkDeviceMemory albedoMemory = VK_NULL_HANDLE;
+	// Model space normal in rgb, depth through the bounding sphere in a: 0 at its front, 0.5 at its center, 1 at its back
+	VkImage normalDepth = VK_NULL_HANDLE;
+	VkDeviceMemory normalDepthMemory = VK_NULL_HANDLE;
+};
+
+// Renders the full models of a species into impostor atlases for the billboard pipeline. Every frame is an orthographic
+// view of the species' bounding sphere, so the billboard shader can find a fragment in any frame by intersecting its
+// view ray with the frame's plane.
+class ImpostorBaker {
+public:
+	ImpostorBaker() = delete;
+	ImpostorBaker(Device* device);
+	~ImpostorBaker();
+
+	// The layers' buffers and textures have to be uploaded already. Waits until the atlases are done
+	ImpostorAtlas Bake(const std::vector<ImpostorLayer>& layers, const Culling::BoundingSphere& sphere);
+
+	// (i, j) / (IMPOSTOR_FRAMES - 1) in [0, 1]^2 to a direction with y >= 0, same as in billboard.frag
+	static glm::vec3 HemiOctahedronDecode(glm::vec2 grid);
+	// Right and up of the frame looking along -forward, same as in billboard.frag
+	static void FrameBasis(glm::vec3 forward, glm::vec3& right, glm::vec3& up);
+
+private:
+	Device* device;
+	VkDevice logicalDevice;
+	VkFormat depthFormat;
+
+	VkRenderPass renderPass;
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	VkCommandPool commandPool;
+};
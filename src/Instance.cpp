@@ -104,6 +104,18 @@ const std::vector<VkPresentModeKHR>& Instance::GetPresentModes() const {
     return presentModes;
 }
 
+const VkPhysicalDeviceMemoryProperties& Instance::GetMemoryProperties() const {
+    return deviceMemoryProperties;
+}
+
+const VkPhysicalDeviceProperties& Instance::GetPhysicalDeviceProperties() const {
+    return deviceProperties;
+}
+
+const VkPhysicalDeviceFeatures& Instance::GetPhysicalDeviceFeatures() const {
+    return supportedFeatures;
+}
+
 uint32_t Instance::GetMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties) const {
     // Iterate over all memory types available for the device used in this example
     for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
@@ -215,6 +227,16 @@ namespace {
             i++;
         }
 
+        // Prefer a compute-only family so culling can overlap rendering, keep the shared one otherwise
+        if (requiredQueues[QueueFlags::Compute]) {
+            for (uint32_t j = 0; j < queueFamilies.size(); j++) {
+                if (queueFamilies[j].queueCount > 0 && (queueFamilies[j].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamilies[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                    indices[QueueFlags::Compute] = j;
+                    break;
+                }
+            }
+        }
+
         return indices;
     }
 
@@ -297,6 +319,16 @@ void Instance::PickPhysicalDevice(std::vector<const char*> deviceExtensions, Que
     }
 
     vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+}
+
+bool Instance::RequestOptionalDeviceExtension(const char* extension) {
+    if (!checkDeviceExtensionSupport(physicalDevice, { extension })) {
+        return false;
+    }
+    deviceExtensions.push_back(extension);
+    return true;
 }
 
 Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures) {
@@ -357,7 +389,7 @@ Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFea
         }
     }
 
-    return new Device(this, vkDevice, queues);
+    return new Device(this, vkDevice, queues, deviceFeatures, deviceExtensions);
 }
 
 Instance::~Instance() {
@@ -20,11 +20,16 @@ public:
     const VkSurfaceCapabilitiesKHR& GetSurfaceCapabilities() const;
     const std::vector<VkSurfaceFormatKHR>& GetSurfaceFormats() const;
     const std::vector<VkPresentModeKHR>& GetPresentModes() const;
+    const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const;
+    const VkPhysicalDeviceProperties& GetPhysicalDeviceProperties() const;
+    const VkPhysicalDeviceFeatures& GetPhysicalDeviceFeatures() const;
     
     uint32_t GetMemoryTypeIndex(uint32_t types, VkMemoryPropertyFlags properties) const;
     VkFormat GetSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) const;
 
     void PickPhysicalDevice(std::vector<const char*> deviceExtensions, QueueFlagBits requiredQueues, VkSurfaceKHR surface = VK_NULL_HANDLE);
+    // After PickPhysicalDevice, enables the extension in CreateDevice if the picked device has it. Returns whether it does
+    bool RequestOptionalDeviceExtension(const char* extension);
 
     Device* CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures);
 
@@ -43,4 +48,6 @@ private:
     std::vector<VkSurfaceFormatKHR> surfaceFormats;
     std::vector<VkPresentModeKHR> presentModes;
     VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+    VkPhysicalDeviceProperties deviceProperties;
+    VkPhysicalDeviceFeatures supportedFeatures;
 };
@@ -1,128 +1,131 @@
+#include <algorithm>
 #include "InstanceData.h"
 #include "BufferUtils.h"
 
 
-//Instance Buffer
-InstanceBuffer::InstanceBuffer(Device* device, VkCommandPool commandPool, const std::vector<InstanceData> &Data, int numBarkVertices, int numLeafVertices, int numBillboardsVertices)
-	:device(device),Data(Data),InstanceCount(Data.size()){
+//Forest Instance Buffer
+ForestInstanceBuffer::ForestInstanceBuffer(Device* device, UploadContext* uploadContext, const std::vector<InstanceData> &Data, const std::vector<uint32_t> &groups,
+	const std::vector<VkDrawIndexedIndirectCommand> &commands, uint32_t meshletDrawCapacity)
+	:device(device),Data(Data),meshletDrawCapacity(meshletDrawCapacity),InstanceCount(Data.size()){
 
-	VkDrawIndexedIndirectCommand indirectCmd[3] = {};
-	// Bark
-	indirectCmd[0].instanceCount = Data.size();
-	indirectCmd[0].firstInstance = 0;
-	indirectCmd[0].vertexOffset = 0;
-	indirectCmd[0].indexCount = numBarkVertices;
-	indirectCmd[0].firstIndex = 0;
-	// Leaf
-	indirectCmd[1].instanceCount = Data.size();
-	indirectCmd[1].firstInstance = 0;
-	indirectCmd[1].vertexOffset = 0;
-	indirectCmd[1].indexCount = numLeafVertices;
-	indirectCmd[1].firstIndex = 0;
-	// billboard
-	indirectCmd[2].instanceCount = Data.size();
-	indirectCmd[2].firstInstance = 0;
-	indirectCmd[2].vertexOffset = 0;
-	indirectCmd[2].indexCount = numBillboardsVertices;
-	indirectCmd[2].firstIndex = 0;
-	//leaf LOD0
-	//billboard LOD1
+	std::vector<VkDrawIndexedIndirectCommand> indirectCmd = commands;
+	// Template the instance counts are reset from before every culling pass
+	std::vector<VkDrawIndexedIndirectCommand> emptyCmd = commands;
+	for (VkDrawIndexedIndirectCommand& command : emptyCmd) {
+		command.instanceCount = 0;
+	}
+	std::vector<uint32_t> groupData = groups;
+	// Buffers cannot be empty, a forest without trees still gets one (unused) instance slot
+	VkDeviceSize instancesSize = std::max<size_t>(Data.size(), 1) * sizeof(InstanceData);
+	VkDeviceSize commandsSize = indirectCmd.size() * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceMemory memory;
+
+	// Uploaded on the graphics queue and read by the culling passes on both queues, so the instances, their groups,
+	// the LOD states and the command template are shared with the compute family rather than handed over every frame
+	const BufferUtils::BufferSharing shared = BufferUtils::BUFFER_SHARING_GRAPHICS_COMPUTE;
 	if (Data.size() > 0) {
-		BufferUtils::CreateBufferFromData(device, commandPool, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, DataBuffer, DataMemory);
-		/*BufferUtils::CreateBufferFromData(device, commandPool, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, culledDataBuffer[0], culledDataMemory[0]);
-		BufferUtils::CreateBufferFromData(device, commandPool, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, culledDataBuffer[1], culledDataMemory[1]);*/
-		BufferUtils::CreateBuffer(device, Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledDataBuffer[0], culledDataMemory[0]);
-		BufferUtils::CreateBuffer(device, Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledDataBuffer[1], culledDataMemory[1]);
-		BufferUtils::CreateBufferFromData(device, commandPool, &indirectCmd[0], sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numDataBuffer[0], numDataMemory[0]);
-		BufferUtils::CreateBufferFromData(device, commandPool, &indirectCmd[1], sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numDataBuffer[1], numDataMemory[1]);
-		BufferUtils::CreateBufferFromData(device, commandPool, &indirectCmd[2], sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numDataBuffer[2], numDataMemory[2]);
+		BufferUtils::CreateBufferFromData(device, uploadContext, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, DataBuffer, memory, shared);
+		BufferUtils::CreateBufferFromData(device, uploadContext, groupData.data(), groupData.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, groupBuffer, memory, shared);
+	}
+	else {
+		BufferUtils::CreateBuffer(device, instancesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, DataBuffer, memory, shared);
+		BufferUtils::CreateBuffer(device, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, groupBuffer, memory, shared);
+	}
+	// Culling has not seen any instance yet
+	std::vector<glm::vec4> lodStates(std::max<size_t>(Data.size(), 1), glm::vec4(0.0f));
+	BufferUtils::CreateBufferFromData(device, uploadContext, lodStates.data(), lodStates.size() * sizeof(glm::vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, lodStateBuffer, memory, shared);
+	BufferUtils::CreateBufferFromData(device, uploadContext, indirectCmd.data(), commandsSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, allCommandBuffer, memory);
+	BufferUtils::CreateBufferFromData(device, uploadContext, emptyCmd.data(), commandsSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, emptyCommandBuffer, memory, shared);
+
+	for (uint32_t f = 0; f < MAX_FRAMES_IN_FLIGHT; f++) {
+		BufferUtils::CreateBuffer(device, TREE_LOD_COUNT * instancesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledDataBuffer[f], memory);
+		BufferUtils::CreateBufferFromData(device, uploadContext, indirectCmd.data(), commandsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, drawCommandBuffer[f], memory);
+		// Filled by the draw compaction pass before anything reads them
+		BufferUtils::CreateBuffer(device, TREE_LIST_COUNT * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, compactedCommandBuffer[f], memory);
+		BufferUtils::CreateBuffer(device, TREE_LIST_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawCountBuffer[f], memory);
+
+		// Occluded count followed by the index and fade of every occluded instance
+		BufferUtils::CreateBuffer(device, (2 * std::max<size_t>(Data.size(), 1) + 1) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, occludedBuffer[f], memory);
+		BufferUtils::CreateBuffer(device, MAX_TREE_LODS * instancesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lateCulledDataBuffer[f], memory);
+		// Instance counts are cleared on the GPU before every late culling pass
+		BufferUtils::CreateBufferFromData(device, uploadContext, emptyCmd.data(), 2 * MAX_TREE_LODS * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, lateCommandBuffer[f], memory);
+		// Seven counters per group, see CullingStats in cullingCompute.comp
+		BufferUtils::CreateBuffer(device, MAX_TREE_GROUPS * 7 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullingStatsBuffer[f], memory);
+		// Written by the meshlet culling pass up to its draw counts, which are cleared before it
+		BufferUtils::CreateBuffer(device, 2 * std::max(meshletDrawCapacity, 1u) * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletCommandBuffer[f], memory);
+		BufferUtils::CreateBuffer(device, 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletDrawCountBuffer[f], memory);
 	}
 }
-VkBuffer InstanceBuffer::GetInstanceDataBuffer() const{
+VkBuffer ForestInstanceBuffer::GetInstanceDataBuffer() const{
 	return DataBuffer;
 }
-VkBuffer InstanceBuffer::GetCulledInstanceDataBuffer(int num) const {
-	return culledDataBuffer[num];
+VkBuffer ForestInstanceBuffer::GetInstanceGroupBuffer() const {
+	return groupBuffer;
 }
-VkBuffer InstanceBuffer::GetNumInstanceDataBuffer(int num) const {
-	return numDataBuffer[num];
+VkBuffer ForestInstanceBuffer::GetLodStateBuffer() const {
+	return lodStateBuffer;
 }
-VkDeviceMemory InstanceBuffer::GetInstanceDataMemory() const {
-	return DataMemory;
+VkBuffer ForestInstanceBuffer::GetAllDrawCommandBuffer() const {
+	return allCommandBuffer;
 }
-VkDeviceMemory InstanceBuffer::GetCulledInstanceDataMemory(int num) const {
-	return culledDataMemory[num];
+VkBuffer ForestInstanceBuffer::GetEmptyDrawCommandBuffer() const {
+	return emptyCommandBuffer;
 }
-VkDeviceMemory InstanceBuffer::GetNumInstanceDataMemory(int num) const {
-	return numDataMemory[num];
+VkBuffer ForestInstanceBuffer::GetCulledInstanceDataBuffer(uint32_t frame) const {
+	return culledDataBuffer[frame];
 }
-InstanceBuffer::~InstanceBuffer() {
-	if (Data.size() > 0) {
-		vkDestroyBuffer(device->GetVkDevice(), DataBuffer, nullptr);
-		vkDestroyBuffer(device->GetVkDevice(), culledDataBuffer[0], nullptr);
-		vkDestroyBuffer(device->GetVkDevice(), culledDataBuffer[1], nullptr);
-		vkDestroyBuffer(device->GetVkDevice(), numDataBuffer[0], nullptr);
-		vkDestroyBuffer(device->GetVkDevice(), numDataBuffer[1], nullptr);
-		vkFreeMemory(device->GetVkDevice(), DataMemory, nullptr);
-		vkFreeMemory(device->GetVkDevice(), culledDataMemory[0], nullptr);
-		vkFreeMemory(device->GetVkDevice(), culledDataMemory[1], nullptr);
-		vkFreeMemory(device->GetVkDevice(), numDataMemory[0], nullptr);
-		vkFreeMemory(device->GetVkDevice(), numDataMemory[1], nullptr);
-	}
+VkDeviceSize ForestInstanceBuffer::GetCulledInstanceDataOffset(uint32_t level) const {
+	return level * std::max<VkDeviceSize>(Data.size(), 1) * sizeof(InstanceData);
 }
-int InstanceBuffer::GetInstanceCount() const {
-	return InstanceCount;
+VkBuffer ForestInstanceBuffer::GetDrawCommandBuffer(uint32_t frame) const {
+	return drawCommandBuffer[frame];
 }
-
-//Fake
-FakeInstanceBuffer::FakeInstanceBuffer(Device* device, VkCommandPool commandPool, const std::vector<InstanceData> &Data)
-	:device(device), Data(Data), InstanceCount(Data.size()) {
-
-	VkDrawIndexedIndirectCommand indirectCmd = {};
-	indirectCmd.instanceCount = Data.size();
-	indirectCmd.firstInstance = 0;
-	indirectCmd.vertexOffset = 0;
-	indirectCmd.indexCount = 6;
-	indirectCmd.firstIndex = 0;
-
-	//leaf LOD0
-	//billboard LOD1
-	if (Data.size() > 0) {
-		BufferUtils::CreateBufferFromData(device, commandPool, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, FakeDataBuffer, FakeDataMemory);
-		/*BufferUtils::CreateBufferFromData(device, commandPool, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, culledDataBuffer[0], culledDataMemory[0]);
-		BufferUtils::CreateBufferFromData(device, commandPool, this->Data.data(), Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, culledDataBuffer[1], culledDataMemory[1]);*/
-		BufferUtils::CreateBuffer(device, Data.size() * sizeof(InstanceData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, fakeCulledDataBuffer, fakeCulledDataMemory);
-		BufferUtils::CreateBufferFromData(device, commandPool, &indirectCmd, sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, fakeNumDataBuffer, fakeNumDataMemory);
-	}
+VkBuffer ForestInstanceBuffer::GetCompactedDrawCommandBuffer(uint32_t frame) const {
+	return compactedCommandBuffer[frame];
 }
-VkBuffer FakeInstanceBuffer::GetInstanceDataBuffer() const {
-	return FakeDataBuffer;
+VkBuffer ForestInstanceBuffer::GetDrawCountBuffer(uint32_t frame) const {
+	return drawCountBuffer[frame];
 }
-VkBuffer FakeInstanceBuffer::GetCulledInstanceDataBuffer() const {
-	return fakeCulledDataBuffer;
+VkBuffer ForestInstanceBuffer::GetOccludedInstanceBuffer(uint32_t frame) const {
+	return occludedBuffer[frame];
 }
-VkBuffer FakeInstanceBuffer::GetNumInstanceDataBuffer() const {
-	return fakeNumDataBuffer;
+VkBuffer ForestInstanceBuffer::GetLateCulledInstanceDataBuffer(uint32_t frame) const {
+	return lateCulledDataBuffer[frame];
 }
-VkDeviceMemory FakeInstanceBuffer::GetInstanceDataMemory() const {
-	return FakeDataMemory;
+VkBuffer ForestInstanceBuffer::GetLateDrawCommandBuffer(uint32_t frame) const {
+	return lateCommandBuffer[frame];
 }
-VkDeviceMemory FakeInstanceBuffer::GetCulledInstanceDataMemory() const {
-	return fakeCulledDataMemory;
+VkBuffer ForestInstanceBuffer::GetCullingStatsBuffer(uint32_t frame) const {
+	return cullingStatsBuffer[frame];
 }
-VkDeviceMemory FakeInstanceBuffer::GetNumInstanceDataMemory() const {
-	return fakeNumDataMemory;
+VkBuffer ForestInstanceBuffer::GetMeshletCommandBuffer(uint32_t frame) const {
+	return meshletCommandBuffer[frame];
 }
-FakeInstanceBuffer::~FakeInstanceBuffer() {
-	if (Data.size() > 0) {
-		vkDestroyBuffer(device->GetVkDevice(), FakeDataBuffer, nullptr);
-		vkDestroyBuffer(device->GetVkDevice(), fakeCulledDataBuffer, nullptr);
-		vkDestroyBuffer(device->GetVkDevice(), fakeNumDataBuffer, nullptr);
-		vkFreeMemory(device->GetVkDevice(), FakeDataMemory, nullptr);
-		vkFreeMemory(device->GetVkDevice(), fakeCulledDataMemory, nullptr);
-		vkFreeMemory(device->GetVkDevice(), fakeNumDataMemory, nullptr);
+VkBuffer ForestInstanceBuffer::GetMeshletDrawCountBuffer(uint32_t frame) const {
+	return meshletDrawCountBuffer[frame];
+}
+uint32_t ForestInstanceBuffer::GetMeshletDrawCapacity() const {
+	return meshletDrawCapacity;
+}
+ForestInstanceBuffer::~ForestInstanceBuffer() {
+	BufferUtils::DestroyBuffer(device, DataBuffer);
+	BufferUtils::DestroyBuffer(device, groupBuffer);
+	BufferUtils::DestroyBuffer(device, lodStateBuffer);
+	BufferUtils::DestroyBuffer(device, allCommandBuffer);
+	BufferUtils::DestroyBuffer(device, emptyCommandBuffer);
+	for (uint32_t f = 0; f < MAX_FRAMES_IN_FLIGHT; f++) {
+		BufferUtils::DestroyBuffer(device, culledDataBuffer[f]);
+		BufferUtils::DestroyBuffer(device, drawCommandBuffer[f]);
+		BufferUtils::DestroyBuffer(device, compactedCommandBuffer[f]);
+		BufferUtils::DestroyBuffer(device, drawCountBuffer[f]);
+		BufferUtils::DestroyBuffer(device, occludedBuffer[f]);
+		BufferUtils::DestroyBuffer(device, lateCulledDataBuffer[f]);
+		BufferUtils::DestroyBuffer(device, lateCommandBuffer[f]);
+		BufferUtils::DestroyBuffer(device, cullingStatsBuffer[f]);
+		BufferUtils::DestroyBuffer(device, meshletCommandBuffer[f]);
+		BufferUtils::DestroyBuffer(device, meshletDrawCountBuffer[f]);
 	}
 }
-int FakeInstanceBuffer::GetInstanceCount() const {
+int ForestInstanceBuffer::GetInstanceCount() const {
 	return InstanceCount;
 }
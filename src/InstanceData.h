@@ -4,9 +4,15 @@
 #include <glm/glm.hpp>
 #include <array>
 #include "Device.h"
+#include "UploadContext.h"
+#include "FrameConfig.h"
 struct InstanceData {
 	glm::vec4 pos_scale;
 	glm::vec4 tintColor_theta;
+	// LOD cross-fade, kept between frames by the culling pass and copied into the culled instances. 0: fade from the full
+	// tree (0) to the billboard (1), fake trees fade in towards 1 1: LOD the instance settles on, same encoding 2: 1 once
+	// culling has seen the instance 3: unused
+	glm::vec4 lodState = glm::vec4(0.0f);
 	InstanceData() {};
 	InstanceData(glm::vec4 position_scale, glm::vec4 tintColor_theta) :pos_scale(position_scale), tintColor_theta(tintColor_theta) {}
 	// Get the binding description, which describes the rate to load data from memory
@@ -21,7 +27,7 @@ struct InstanceData {
 
 	// Get the attribute descriptions, which describe how to handle vertex input
 	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
-		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(3);
 
 		// Position & Scale
 		attributeDescriptions[0].binding = 1;
@@ -34,66 +40,121 @@ struct InstanceData {
 		attributeDescriptions[1].location = 7;
 		attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
 		attributeDescriptions[1].offset = offsetof(InstanceData, tintColor_theta);
+
+		// LOD fade
+		attributeDescriptions[2].binding = 1;
+		attributeDescriptions[2].location = 8;
+		attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(InstanceData, lodState);
 		return attributeDescriptions;
 	}
 };
 
-class InstanceBuffer {
-protected:
-	Device* device;
-	std::vector<InstanceData> Data;
-	VkBuffer DataBuffer;
-	//LOD 0 & LOD 1
-	VkBuffer culledDataBuffer[2];
-	VkBuffer numDataBuffer[3];
-
-	VkDeviceMemory DataMemory;
-	VkDeviceMemory culledDataMemory[2];
-	VkDeviceMemory numDataMemory[3];
-	//No indices. Indices should corespond with Model.
-	int InstanceCount = 0;
+// Tree groups are the tree species followed by the fake tree groups. All of them share one instance buffer, one
+// culling dispatch and one multi-draw per pass. Same limit as in the culling and tree shaders
+#define MAX_TREE_GROUPS 16
 
-public:
-	InstanceBuffer() = delete;
-	InstanceBuffer(Device* device, VkCommandPool commandPool, const std::vector<InstanceData> &Data, int numBarkVertices, int numLeafVertices, int numBillboardsVertices);
-	virtual ~InstanceBuffer();
-	VkBuffer GetInstanceDataBuffer() const;
-	VkBuffer GetCulledInstanceDataBuffer(int LOD_num) const;
-	VkBuffer GetNumInstanceDataBuffer(int LOD_num) const;
-	int GetInstanceCount() const;
-	
-	VkDeviceMemory GetInstanceDataMemory() const;
-	VkDeviceMemory GetCulledInstanceDataMemory(int LOD_num) const;
-	VkDeviceMemory GetNumInstanceDataMemory(int LOD_num) const;
+// Mesh levels a species can have, each drawn with its own bark and leaf model. The billboard is the level after the
+// last mesh level (TREE_LOD_BILLBOARD). Same limit as in the culling and tree shaders. cullingCompute.comp counts the
+// visible trees of every level in 10 bits of one uint (flags.x of its workgroup scan), so 3 levels is the most it holds
+#define MAX_TREE_LODS 3
+// Bits of one mesh level's count in that scan, a workgroup has fewer invocations than they hold
+#define TREE_LOD_COUNT_BITS 10
+static_assert(MAX_TREE_LODS * TREE_LOD_COUNT_BITS <= 32, "the culling scan packs every mesh level's count into one uint");
+#define TREE_LOD_BILLBOARD MAX_TREE_LODS
+#define TREE_LOD_COUNT (MAX_TREE_LODS + 1)
 
+// Instances settle on their billboard below min(LOD0, LOD1 * TREE_LOD_HYSTERESIS) pixels and back on their full tree
+// above LOD1, in between they keep the LOD they have. Same as in cullingCompute.comp
+#define TREE_LOD_HYSTERESIS 0.9f
+
+// Pipeline, model batch and materials a tree is drawn with. Fake tree groups only have billboards
+enum TreeDrawKind {
+	TREE_DRAW_BARK = 0,
+	TREE_DRAW_LEAF,
+	TREE_DRAW_BILLBOARD,
+	TREE_DRAW_KIND_COUNT
 };
 
-class FakeInstanceBuffer {
+// Indirect commands of a frame are grouped by slot, command slot * MAX_TREE_GROUPS + group draws the group's instances
+// of one kind and level: bark and leaf of every mesh level, then the billboards. Levels a group does not have draw no
+// indices
+#define TREE_DRAW_SLOT_COUNT (2 * MAX_TREE_LODS + 1)
+
+inline uint32_t TreeDrawSlot(TreeDrawKind kind, uint32_t level) {
+	return kind == TREE_DRAW_BILLBOARD ? 2 * MAX_TREE_LODS : 2 * level + kind;
+}
+
+// Lists of the compacted commands, MAX_TREE_GROUPS each, with one draw count per list. The first
+// TREE_DRAW_SLOT_COUNT lists match the slots, fake tree billboards get their own list
+#define TREE_LIST_FAKE TREE_DRAW_SLOT_COUNT
+#define TREE_LIST_COUNT (TREE_DRAW_SLOT_COUNT + 1)
+
+// Up to this many visible level 0 instances of every species have their bark and leaf meshlets culled one by one, the
+// first ones culling appended rather than the closest. The rest draws whole meshes. Specialization constant of meshletCulling.comp and drawCompaction.comp
+#define MESHLET_INSTANCES 128
+
+class ForestInstanceBuffer {
 protected:
 	Device* device;
 	std::vector<InstanceData> Data;
-	VkBuffer FakeDataBuffer;
-	// 3 types of fake tree
-	VkBuffer fakeCulledDataBuffer;
-	VkBuffer fakeNumDataBuffer;
-
-	VkDeviceMemory FakeDataMemory;
-	VkDeviceMemory fakeCulledDataMemory;
-	VkDeviceMemory fakeNumDataMemory;
-	//No indices. Indices should corespond with Model.
+	// Group of every instance. Each group's instances are contiguous, culled instances keep their group's range
+	VkBuffer DataBuffer;
+	VkBuffer groupBuffer;
+	// Commands with all instances, drawn when culling is compiled out, and the same with no instances, copied over
+	// the late commands before every late culling pass
+	VkBuffer allCommandBuffer;
+	VkBuffer emptyCommandBuffer;
+	//Visible instances of every level (TREE_LOD_COUNT regions of InstanceCount each), one per frame in flight so culling
+	//can run ahead of drawing
+	VkBuffer culledDataBuffer[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer drawCommandBuffer[MAX_FRAMES_IN_FLIGHT];
+	// Commands that have instances, packed into TreeDrawList lists, and their draw counts
+	VkBuffer compactedCommandBuffer[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer drawCountBuffer[MAX_FRAMES_IN_FLIGHT];
+	// lodState of every instance between culling passes, only the culling pass touches it
+	VkBuffer lodStateBuffer;
+	//Occlusion culling: count, indices and fades of the full trees hidden in the previous depth pyramid, the ones the late
+	//pass draws after all (one region per mesh level, bark & leaf commands of every mesh level) and the culling counters
+	//of every group
+	VkBuffer occludedBuffer[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer lateCulledDataBuffer[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer lateCommandBuffer[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer cullingStatsBuffer[MAX_FRAMES_IN_FLIGHT];
+	// Meshlet culling: one command per visible meshlet, bark and leaf in one region of meshletDrawCapacity each, and
+	// their two draw counts
+	VkBuffer meshletCommandBuffer[MAX_FRAMES_IN_FLIGHT];
+	VkBuffer meshletDrawCountBuffer[MAX_FRAMES_IN_FLIGHT];
+	uint32_t meshletDrawCapacity;
 	int InstanceCount = 0;
 
 public:
-	FakeInstanceBuffer() = delete;
-	FakeInstanceBuffer(Device* device, VkCommandPool commandPool, const std::vector<InstanceData> &Data);
-	virtual ~FakeInstanceBuffer();
+	ForestInstanceBuffer() = delete;
+	// commands holds TREE_DRAW_SLOT_COUNT * MAX_TREE_GROUPS commands with all instances of their group. meshletDrawCapacity
+	// is the most meshlet commands one draw kind can emit
+	ForestInstanceBuffer(Device* device, UploadContext* uploadContext, const std::vector<InstanceData> &Data, const std::vector<uint32_t> &groups,
+		const std::vector<VkDrawIndexedIndirectCommand> &commands, uint32_t meshletDrawCapacity);
+	virtual ~ForestInstanceBuffer();
 	VkBuffer GetInstanceDataBuffer() const;
-	VkBuffer GetCulledInstanceDataBuffer() const;
-	VkBuffer GetNumInstanceDataBuffer() const;
+	VkBuffer GetInstanceGroupBuffer() const;
+	VkBuffer GetLodStateBuffer() const;
+	VkBuffer GetAllDrawCommandBuffer() const;
+	VkBuffer GetEmptyDrawCommandBuffer() const;
+	VkBuffer GetCulledInstanceDataBuffer(uint32_t frame) const;
+	// Start of a level's region in the culled and late culled instance buffers. Bound as the vertex buffer offset, so
+	// the draws of every level use their group's firstInstance
+	VkDeviceSize GetCulledInstanceDataOffset(uint32_t level) const;
+	VkBuffer GetDrawCommandBuffer(uint32_t frame) const;
+	VkBuffer GetCompactedDrawCommandBuffer(uint32_t frame) const;
+	VkBuffer GetDrawCountBuffer(uint32_t frame) const;
+	VkBuffer GetOccludedInstanceBuffer(uint32_t frame) const;
+	VkBuffer GetLateCulledInstanceDataBuffer(uint32_t frame) const;
+	// Bark and leaf commands of every mesh level, same slots as the draw commands
+	VkBuffer GetLateDrawCommandBuffer(uint32_t frame) const;
+	VkBuffer GetCullingStatsBuffer(uint32_t frame) const;
+	// Bark commands first, the leaf ones from GetMeshletDrawCapacity() on
+	VkBuffer GetMeshletCommandBuffer(uint32_t frame) const;
+	VkBuffer GetMeshletDrawCountBuffer(uint32_t frame) const;
+	uint32_t GetMeshletDrawCapacity() const;
 	int GetInstanceCount() const;
-
-	VkDeviceMemory GetInstanceDataMemory() const;
-	VkDeviceMemory GetCulledInstanceDataMemory() const;
-	VkDeviceMemory GetNumInstanceDataMemory() const;
-
-};
\ No newline at end of file
+};
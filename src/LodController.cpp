@@ -0,0 +1,133 @@
+#include <algorithm>
+#include "LodController.h"
+
+namespace {
+	// Distances at quality 1 relative to the initial settings, and the smallest fraction of them quality 0 keeps
+	const float HEADROOM = 1.5f;
+	const float MIN_SCALE = 0.25f;
+	// Quality at which the scaled distances reproduce the initial settings
+	const float INITIAL_QUALITY = (1.0f / HEADROOM - MIN_SCALE) / (1.0f - MIN_SCALE);
+	// Fraction of their distance fake trees move out by at quality 0, on top of the scaling
+	const float FAKE_TREE_PUSH = 0.35f;
+
+	// Exponential smoothing of the measured frame time
+	const float SMOOTHING = 0.1f;
+	// Quality drops above target * (1 + UPPER_BAND) and rises below target * (1 - LOWER_BAND). The lower band is
+	// wider so a raise does not immediately land above the upper edge again
+	const float UPPER_BAND = 0.05f;
+	const float LOWER_BAND = 0.15f;
+	// Quality change per relative frame time error, limited to MAX_STEP per adjustment
+	const float GAIN = 0.25f;
+	const float MAX_STEP = 0.03f;
+	// Collected frames between adjustments, enough for the smoothed time to follow a step
+	const uint32_t COOLDOWN_FRAMES = 15;
+
+	const char* stateNames[] = {
+		"Disabled",
+		"Waiting",
+		"Holding",
+		"Reducing",
+		"Raising",
+	};
+
+	float Scale(float quality) {
+		return MIN_SCALE + (1.0f - MIN_SCALE) * quality;
+	}
+}
+
+LodController::LodController(const LodSettings& initial) : settings(initial) {
+	maxSettings.lod0 = initial.lod0 / HEADROOM;
+	maxSettings.lod1 = initial.lod1 / HEADROOM;
+	maxSettings.fakeTreeLod = initial.fakeTreeLod / HEADROOM;
+	quality = INITIAL_QUALITY;
+}
+
+void LodController::SetEnabled(bool enabled) {
+	this->enabled = enabled;
+	smoothedMs = -1.0f;
+	cooldown = 0;
+	state = enabled ? State::Waiting : State::Disabled;
+}
+
+bool LodController::IsEnabled() const {
+	return enabled;
+}
+
+void LodController::SetTargetMs(float targetMs) {
+	this->targetMs = targetMs;
+}
+
+float LodController::GetTargetMs() const {
+	return targetMs;
+}
+
+bool LodController::Update(float gpuFrameMs) {
+	if (!enabled || gpuFrameMs < 0.0f) {
+		return false;
+	}
+
+	smoothedMs = smoothedMs < 0.0f ? gpuFrameMs : smoothedMs + SMOOTHING * (gpuFrameMs - smoothedMs);
+	if (state == State::Waiting) {
+		state = State::Holding;
+	}
+	if (cooldown > 0) {
+		cooldown--;
+		return false;
+	}
+
+	float step;
+	if (smoothedMs > targetMs * (1.0f + UPPER_BAND)) {
+		step = -std::min(MAX_STEP, GAIN * (smoothedMs - targetMs) / targetMs);
+		state = State::Reducing;
+	}
+	else if (smoothedMs < targetMs * (1.0f - LOWER_BAND)) {
+		step = std::min(MAX_STEP, GAIN * (targetMs - smoothedMs) / targetMs);
+		state = State::Raising;
+	}
+	else {
+		state = State::Holding;
+		return false;
+	}
+
+	float newQuality = std::max(0.0f, std::min(1.0f, quality + step));
+	if (newQuality == quality) {
+		// Pinned at either end of the range
+		state = State::Holding;
+		return false;
+	}
+
+	quality = newQuality;
+	ApplyQuality();
+	cooldown = COOLDOWN_FRAMES;
+	return true;
+}
+
+void LodController::ApplyQuality() {
+	// Projected sizes are inversely proportional to the distance they are reached at
+	float scale = Scale(quality);
+	settings.lod0 = maxSettings.lod0 / scale;
+	settings.lod1 = maxSettings.lod1 / scale;
+	// Fake trees only fill the far field, below the initial quality they thin out faster than the real trees shrink
+	float push = FAKE_TREE_PUSH * std::max(0.0f, INITIAL_QUALITY - quality) / INITIAL_QUALITY;
+	settings.fakeTreeLod = maxSettings.fakeTreeLod / (scale * (1.0f + push));
+}
+
+const LodSettings& LodController::GetSettings() const {
+	return settings;
+}
+
+float LodController::GetQuality() const {
+	return quality;
+}
+
+float LodController::GetSmoothedMs() const {
+	return smoothedMs;
+}
+
+LodController::State LodController::GetState() const {
+	return state;
+}
+
+const char* LodController::GetStateName(State state) {
+	return stateNames[static_cast<int>(state)];
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Projected sizes in pixels pushed into the LODInfo uniforms
+struct LodSettings {
+	// Full trees are drawn down to lod0, billboards from lod1 down
+	float lod0;
+	float lod1;
+	// Fake trees are drawn from this size down
+	float fakeTreeLod;
+};
+
+// Closed loop controller that trades LOD distances for GPU frame time.
+// One quality value in [0, 1] is mapped onto all LOD distances, the size thresholds scale with their inverse. The measured frame time is smoothed, quality only
+// drops above the upper edge of a band around the target and only rises below its lower edge (hysteresis), and
+// every adjustment is limited in size and followed by a cooldown so the result of one step is measured before the next.
+class LodController {
+public:
+	enum class State {
+		Disabled,
+		// No GPU frame time has been measured yet, e.g. timestamps are not supported
+		Waiting,
+		Holding,
+		Reducing,
+		Raising,
+	};
+
+	LodController() = delete;
+	// Quality starts where the given settings are, the range it can move in is derived from them
+	explicit LodController(const LodSettings& initial);
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const;
+	void SetTargetMs(float targetMs);
+	float GetTargetMs() const;
+
+	// Call with the GPU frame time of every newly collected frame, returns true when the settings changed
+	bool Update(float gpuFrameMs);
+
+	const LodSettings& GetSettings() const;
+	float GetQuality() const;
+	float GetSmoothedMs() const;
+	State GetState() const;
+	static const char* GetStateName(State state);
+
+private:
+	void ApplyQuality();
+
+	bool enabled = false;
+	float targetMs = 16.0f;
+	float smoothedMs = -1.0f;
+	float quality;
+	uint32_t cooldown = 0;
+	State state = State::Disabled;
+
+	// Settings at quality 1, lower qualities scale the distances down and so the sizes up
+	LodSettings maxSettings;
+	LodSettings settings;
+};
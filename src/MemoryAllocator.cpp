@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include "MemoryAllocator.h"
+#include "Device.h"
+#include "Instance.h"
+
+namespace {
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+MemoryAllocator::MemoryAllocator(Device* device, VkDeviceSize blockSize)
+	: device(device), blockSize(blockSize) {
+	const VkPhysicalDeviceMemoryProperties& memoryProperties = device->GetInstance()->GetMemoryProperties();
+	maxAllocationCount = device->GetInstance()->GetPhysicalDeviceProperties().limits.maxMemoryAllocationCount;
+
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+	for (uint32_t i = 0; i < pools.size(); i++) {
+		pools[i].memoryTypeIndex = i / 2;
+	}
+}
+
+MemoryBlock* MemoryAllocator::CreateBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated) {
+	if (deviceAllocationCount >= maxAllocationCount) {
+		throw std::runtime_error("Exceeded maxMemoryAllocationCount");
+	}
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	MemoryBlock* block = new MemoryBlock();
+	if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+		delete block;
+		throw std::runtime_error("Failed to allocate device memory block");
+	}
+	deviceAllocationCount++;
+
+	block->size = size;
+	block->dedicated = dedicated;
+	block->freeRanges.push_back({ 0, size });
+
+	// Keep host visible blocks mapped for their whole lifetime
+	VkMemoryPropertyFlags flags = device->GetInstance()->GetMemoryProperties().memoryTypes[memoryTypeIndex].propertyFlags;
+	if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		vkMapMemory(device->GetVkDevice(), block->memory, 0, VK_WHOLE_SIZE, 0, &block->mappedData);
+	}
+
+	return block;
+}
+
+void MemoryAllocator::DestroyBlock(MemoryBlock* block) {
+	if (block->mappedData != nullptr) {
+		vkUnmapMemory(device->GetVkDevice(), block->memory);
+	}
+	vkFreeMemory(device->GetVkDevice(), block->memory, nullptr);
+	deviceAllocationCount--;
+	delete block;
+}
+
+bool MemoryAllocator::AllocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+	// First fit over the offset-sorted free list
+	for (size_t i = 0; i < block->freeRanges.size(); i++) {
+		MemoryFreeRange range = block->freeRanges[i];
+		VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+		VkDeviceSize padding = alignedOffset - range.offset;
+		if (padding + size > range.size) {
+			continue;
+		}
+
+		VkDeviceSize tail = range.size - padding - size;
+		block->freeRanges.erase(block->freeRanges.begin() + i);
+		if (tail > 0) {
+			block->freeRanges.insert(block->freeRanges.begin() + i, { alignedOffset + size, tail });
+		}
+		if (padding > 0) {
+			block->freeRanges.insert(block->freeRanges.begin() + i, { range.offset, padding });
+		}
+
+		block->allocationCount++;
+		offset = alignedOffset;
+		return true;
+	}
+	return false;
+}
+
+Allocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear) {
+	uint32_t memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(requirements.memoryTypeBits, properties);
+	uint32_t poolIndex = memoryTypeIndex * 2 + (linear ? 0 : 1);
+	Pool& pool = pools[poolIndex];
+
+	// Host visible but non coherent ranges are flushed in nonCoherentAtomSize units, so keep them apart
+	VkDeviceSize alignment = requirements.alignment;
+	VkMemoryPropertyFlags flags = device->GetInstance()->GetMemoryProperties().memoryTypes[memoryTypeIndex].propertyFlags;
+	if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+		alignment = std::max(alignment, device->GetInstance()->GetPhysicalDeviceProperties().limits.nonCoherentAtomSize);
+	}
+	VkDeviceSize size = alignUp(requirements.size, alignment);
+
+	Allocation allocation;
+	allocation.size = size;
+	allocation.poolIndex = poolIndex;
+
+	// Big resources get a block of their own instead of wasting most of a shared one
+	if (size > blockSize / 2) {
+		MemoryBlock* block = CreateBlock(memoryTypeIndex, size, true);
+		AllocateFromBlock(block, size, alignment, allocation.offset);
+		pool.blocks.push_back(block);
+		allocation.block = block;
+	}
+	else {
+		for (MemoryBlock* block : pool.blocks) {
+			if (!block->dedicated && AllocateFromBlock(block, size, alignment, allocation.offset)) {
+				allocation.block = block;
+				break;
+			}
+		}
+		if (allocation.block == nullptr) {
+			MemoryBlock* block = CreateBlock(memoryTypeIndex, blockSize, false);
+			AllocateFromBlock(block, size, alignment, allocation.offset);
+			pool.blocks.push_back(block);
+			allocation.block = block;
+		}
+	}
+
+	allocation.memory = allocation.block->memory;
+	if (allocation.block->mappedData != nullptr) {
+		allocation.mappedData = static_cast<char*>(allocation.block->mappedData) + allocation.offset;
+	}
+	return allocation;
+}
+
+void MemoryAllocator::Free(const Allocation& allocation) {
+	MemoryBlock* block = allocation.block;
+
+	// Insert the range back in offset order and merge it with its neighbours
+	std::vector<MemoryFreeRange>& ranges = block->freeRanges;
+	auto it = std::lower_bound(ranges.begin(), ranges.end(), allocation.offset,
+		[](const MemoryFreeRange& range, VkDeviceSize offset) { return range.offset < offset; });
+	it = ranges.insert(it, { allocation.offset, allocation.size });
+
+	if (it + 1 != ranges.end() && it->offset + it->size == (it + 1)->offset) {
+		it->size += (it + 1)->size;
+		ranges.erase(it + 1);
+	}
+	if (it != ranges.begin() && (it - 1)->offset + (it - 1)->size == it->offset) {
+		(it - 1)->size += it->size;
+		ranges.erase(it);
+	}
+
+	block->allocationCount--;
+
+	// Release empty blocks, but keep one shared block per pool around to avoid thrashing
+	if (block->allocationCount == 0) {
+		Pool& pool = pools[allocation.poolIndex];
+		size_t sharedBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(), [](MemoryBlock* b) { return !b->dedicated; });
+		if (block->dedicated || sharedBlocks > 1) {
+			pool.blocks.erase(std::find(pool.blocks.begin(), pool.blocks.end(), block));
+			DestroyBlock(block);
+		}
+	}
+}
+
+const Allocation& MemoryAllocator::BindBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device->GetVkDevice(), buffer, &memRequirements);
+
+	Allocation allocation = Allocate(memRequirements, properties, true);
+	if (vkBindBufferMemory(device->GetVkDevice(), buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+		Free(allocation);
+		throw std::runtime_error("Failed to bind buffer memory");
+	}
+	return bufferAllocations[buffer] = allocation;
+}
+
+const Allocation& MemoryAllocator::BindImage(VkImage image, VkMemoryPropertyFlags properties) {
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device->GetVkDevice(), image, &memRequirements);
+
+	Allocation allocation = Allocate(memRequirements, properties, false);
+	if (vkBindImageMemory(device->GetVkDevice(), image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+		Free(allocation);
+		throw std::runtime_error("Failed to bind image memory");
+	}
+	return imageAllocations[image] = allocation;
+}
+
+void MemoryAllocator::FreeBuffer(VkBuffer buffer) {
+	auto it = bufferAllocations.find(buffer);
+	if (it == bufferAllocations.end()) {
+		return;
+	}
+	Free(it->second);
+	bufferAllocations.erase(it);
+}
+
+void MemoryAllocator::FreeImage(VkImage image) {
+	auto it = imageAllocations.find(image);
+	if (it == imageAllocations.end()) {
+		return;
+	}
+	Free(it->second);
+	imageAllocations.erase(it);
+}
+
+void* MemoryAllocator::MapBuffer(VkBuffer buffer) const {
+	auto it = bufferAllocations.find(buffer);
+	if (it == bufferAllocations.end() || it->second.mappedData == nullptr) {
+		throw std::runtime_error("Buffer is not host visible");
+	}
+	return it->second.mappedData;
+}
+
+MemoryStats MemoryAllocator::GetStats() const {
+	MemoryStats stats;
+	for (const Pool& pool : pools) {
+		for (const MemoryBlock* block : pool.blocks) {
+			stats.blockCount++;
+			stats.dedicatedBlockCount += block->dedicated ? 1 : 0;
+			stats.allocationCount += block->allocationCount;
+			stats.blockBytes += block->size;
+			for (const MemoryFreeRange& range : block->freeRanges) {
+				stats.freeBytes += range.size;
+				stats.largestFreeRange = std::max(stats.largestFreeRange, range.size);
+				stats.freeRangeCount++;
+			}
+		}
+	}
+	stats.usedBytes = stats.blockBytes - stats.freeBytes;
+	if (stats.freeBytes > 0) {
+		stats.fragmentation = 1.0f - float(stats.largestFreeRange) / float(stats.freeBytes);
+	}
+	return stats;
+}
+
+void MemoryAllocator::PrintStats() const {
+	MemoryStats stats = GetStats();
+	printf("|| Device memory: %u blocks (%u dedicated, %u/%u vkAllocateMemory) <allocations: %u>||\n",
+		stats.blockCount, stats.dedicatedBlockCount, deviceAllocationCount, maxAllocationCount, stats.allocationCount);
+	printf("|| <reserved: %.2f MB> <used: %.2f MB> <free: %.2f MB in %u ranges> <fragmentation: %.3f>||\n",
+		stats.blockBytes / 1048576.0, stats.usedBytes / 1048576.0, stats.freeBytes / 1048576.0, stats.freeRangeCount, stats.fragmentation);
+}
+
+MemoryAllocator::~MemoryAllocator() {
+	for (Pool& pool : pools) {
+		for (MemoryBlock* block : pool.blocks) {
+			DestroyBlock(block);
+		}
+		pool.blocks.clear();
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <map>
+#include <vector>
+
+class Device;
+struct MemoryBlock;
+
+// Allocation handed out by the MemoryAllocator. Several allocations share one VkDeviceMemory block,
+// so callers must never vkFreeMemory / vkMapMemory "memory" themselves.
+struct Allocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mappedData = nullptr;
+	uint32_t poolIndex = 0;
+	MemoryBlock* block = nullptr;
+};
+
+struct MemoryFreeRange {
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+// One vkAllocateMemory, sub-allocated through an offset-sorted free list
+struct MemoryBlock {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	void* mappedData = nullptr;
+	bool dedicated = false;
+	uint32_t allocationCount = 0;
+	std::vector<MemoryFreeRange> freeRanges;
+};
+
+struct MemoryStats {
+	uint32_t blockCount = 0;
+	uint32_t dedicatedBlockCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize freeBytes = 0;
+	VkDeviceSize largestFreeRange = 0;
+	uint32_t freeRangeCount = 0;
+	// 0: all free space is contiguous, 1: free space is scattered in tiny ranges
+	float fragmentation = 0.0f;
+};
+
+// Pooled device memory allocator.
+// One pool per (memory type, linear/optimal) pair, each pool owns a list of large VkDeviceMemory blocks that
+// are sub-allocated with an offset-sorted free list. Linear resources (buffers) and optimal resources (images)
+// never share a block, so bufferImageGranularity never has to be considered.
+class MemoryAllocator {
+public:
+	static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+	MemoryAllocator() = delete;
+	MemoryAllocator(Device* device, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+	~MemoryAllocator();
+
+	// Allocate memory for the resource and bind it
+	const Allocation& BindBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+	const Allocation& BindImage(VkImage image, VkMemoryPropertyFlags properties);
+
+	// Return the resource's range to its block. The resource itself is not destroyed
+	void FreeBuffer(VkBuffer buffer);
+	void FreeImage(VkImage image);
+
+	// Host visible blocks are persistently mapped, this returns the pointer to the buffer's range
+	void* MapBuffer(VkBuffer buffer) const;
+
+	MemoryStats GetStats() const;
+	void PrintStats() const;
+
+private:
+	struct Pool {
+		uint32_t memoryTypeIndex;
+		std::vector<MemoryBlock*> blocks;
+	};
+
+	Allocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+	void Free(const Allocation& allocation);
+
+	MemoryBlock* CreateBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated);
+	void DestroyBlock(MemoryBlock* block);
+	bool AllocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+
+	Device* device;
+	VkDeviceSize blockSize;
+	uint32_t maxAllocationCount;
+	uint32_t deviceAllocationCount = 0;
+
+	// index = memoryTypeIndex * 2 + (linear ? 0 : 1)
+	std::vector<Pool> pools;
+	std::map<VkBuffer, Allocation> bufferAllocations;
+	std::map<VkImage, Allocation> imageAllocations;
+};
@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "MeshOptimizer.h"
+
+namespace {
+	// Entries of the LRU cache OptimizeVertexCache plans for, larger than the FIFO the results are measured with
+	const int FORSYTH_CACHE_SIZE = 32;
+	const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+	const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+	const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+	const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+	// FIFO post-transform cache. A vertex is cached while fewer than size misses happened after its own
+	struct FifoCache {
+		std::vector<uint32_t> stamps;
+		uint32_t size;
+		uint32_t time;
+
+		FifoCache(size_t vertexCount, uint32_t size) : stamps(vertexCount, 0), size(size), time(size + 1) {}
+
+		void Flush() {
+			time += size + 1;
+		}
+
+		uint32_t Touch(uint32_t vertex) {
+			if (time - stamps[vertex] > size) {
+				stamps[vertex] = time++;
+				return 1;
+			}
+			return 0;
+		}
+
+		// Vertices of the triangle that had to be transformed
+		uint32_t Add(const uint32_t* triangle) {
+			return Touch(triangle[0]) + Touch(triangle[1]) + Touch(triangle[2]);
+		}
+	};
+
+	// Forsyth's score of a vertex at cachePosition (-1 outside the cache) that is still used by remaining triangles
+	float VertexScore(int cachePosition, uint32_t remaining) {
+		if (remaining == 0) {
+			return -1.0f;
+		}
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			// The last triangle's vertices get a fixed score, so the next one does not simply reuse its edge
+			score = cachePosition < 3 ? FORSYTH_LAST_TRIANGLE_SCORE :
+				std::pow(1.0f - float(cachePosition - 3) / float(FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY_POWER);
+		}
+		// Vertices with few triangles left are worth finishing before they drop out of the cache
+		return score + FORSYTH_VALENCE_BOOST_SCALE * std::pow(float(remaining), -FORSYTH_VALENCE_BOOST_POWER);
+	}
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize) {
+	CacheStats stats;
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return stats;
+	}
+
+	FifoCache cache(vertexCount, cacheSize);
+	std::vector<bool> referenced(vertexCount, false);
+	size_t misses = 0;
+	size_t referencedCount = 0;
+	for (size_t t = 0; t < triangleCount; t++) {
+		misses += cache.Add(&indices[t * 3]);
+		for (int k = 0; k < 3; k++) {
+			if (!referenced[indices[t * 3 + k]]) {
+				referenced[indices[t * 3 + k]] = true;
+				referencedCount++;
+			}
+		}
+	}
+	stats.acmr = float(misses) / float(triangleCount);
+	stats.atvr = float(misses) / float(referencedCount);
+	return stats;
+}
+
+std::vector<uint32_t> MeshOptimizer::OptimizeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount) {
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<uint32_t> result;
+	result.reserve(triangleCount * 3);
+	if (triangleCount == 0) {
+		return result;
+	}
+
+	// Triangles of every vertex, the first remaining[v] of them are not emitted yet
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t index : indices) {
+		remaining[index]++;
+	}
+	std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> filled(vertexCount, 0);
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				adjacency[adjacencyStart[v] + filled[v]++] = uint32_t(t);
+			}
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+	}
+	std::vector<float> triangleScore(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+	}
+	std::vector<bool> emitted(triangleCount, false);
+
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> nextCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+	// Dead ends continue with the first triangle in input order that is left
+	size_t cursor = 0;
+	int64_t best = 0;
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+		if (best < 0) {
+			while (emitted[cursor]) {
+				cursor++;
+			}
+			best = int64_t(cursor);
+		}
+
+		const uint32_t* triangle = &indices[size_t(best) * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+		emitted[size_t(best)] = true;
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = triangle[k];
+			uint32_t* begin = &adjacency[adjacencyStart[v]];
+			uint32_t* it = std::find(begin, begin + remaining[v], uint32_t(best));
+			std::swap(*it, begin[remaining[v] - 1]);
+			remaining[v]--;
+		}
+
+		// The triangle's vertices move to the front, the rest keeps its order
+		nextCache.assign(triangle, triangle + 3);
+		for (uint32_t v : cache) {
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+				nextCache.push_back(v);
+			}
+		}
+		for (size_t i = FORSYTH_CACHE_SIZE; i < nextCache.size(); i++) {
+			cachePosition[nextCache[i]] = -1;
+			vertexScore[nextCache[i]] = VertexScore(-1, remaining[nextCache[i]]);
+		}
+		for (size_t i = 0; i < nextCache.size() && i < size_t(FORSYTH_CACHE_SIZE); i++) {
+			cachePosition[nextCache[i]] = int(i);
+			vertexScore[nextCache[i]] = VertexScore(int(i), remaining[nextCache[i]]);
+		}
+
+		// Only triangles around cached and evicted vertices changed their score, the best of them goes next
+		best = -1;
+		float bestScore = 0.0f;
+		for (uint32_t v : nextCache) {
+			for (uint32_t a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++) {
+				uint32_t t = adjacency[a];
+				triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				if (triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+		if (nextCache.size() > size_t(FORSYTH_CACHE_SIZE)) {
+			nextCache.resize(FORSYTH_CACHE_SIZE);
+		}
+		std::swap(cache, nextCache);
+	}
+	return result;
+}
+
+std::vector<uint32_t> MeshOptimizer::OptimizeOverdraw(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold) {
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return indices;
+	}
+
+	// Hard boundaries where a triangle misses with all three vertices, the cache order jumped to a new patch there
+	FifoCache cache(vertices.size(), ANALYSIS_CACHE_SIZE);
+	std::vector<uint32_t> patches;
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (cache.Add(&indices[t * 3]) == 3 || t == 0) {
+			patches.push_back(uint32_t(t));
+		}
+	}
+	patches.push_back(uint32_t(triangleCount));
+
+	// Soft boundaries inside a patch, wherever the cluster so far is within threshold of the patch' ACMR
+	std::vector<uint32_t> clusters;
+	for (size_t p = 0; p + 1 < patches.size(); p++) {
+		const uint32_t start = patches[p];
+		const uint32_t end = patches[p + 1];
+		cache.Flush();
+		uint32_t patchMisses = 0;
+		for (uint32_t t = start; t < end; t++) {
+			patchMisses += cache.Add(&indices[t * 3]);
+		}
+		const float clusterThreshold = threshold * float(patchMisses) / float(end - start);
+
+		clusters.push_back(start);
+		cache.Flush();
+		uint32_t misses = 0;
+		uint32_t triangles = 0;
+		for (uint32_t t = start; t < end; t++) {
+			misses += cache.Add(&indices[t * 3]);
+			triangles++;
+			if (float(misses) / float(triangles) <= clusterThreshold) {
+				clusters.push_back(t + 1);
+				cache.Flush();
+				misses = 0;
+				triangles = 0;
+			}
+		}
+		// The cluster after the last boundary is left over and usually poor, it joins the one before. If the last
+		// boundary is the patch' end that drops it as well
+		if (clusters.back() != start) {
+			clusters.pop_back();
+		}
+	}
+	clusters.push_back(uint32_t(triangleCount));
+
+	// Area weighted center of the whole mesh and center and normal of every cluster
+	std::vector<glm::vec3> clusterCenters(clusters.size() - 1, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusters.size() - 1, glm::vec3(0.0f));
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c + 1 < clusters.size(); c++) {
+		float clusterArea = 0.0f;
+		for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			const glm::vec3& p0 = vertices[indices[t * 3]].pos;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+			clusterCenters[c] += center * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+			meshCenter += center * area;
+			meshArea += area;
+		}
+		clusterCenters[c] = clusterArea > 0.0f ? clusterCenters[c] / clusterArea : vertices[indices[clusters[c] * 3]].pos;
+		float normalLength = glm::length(clusterNormals[c]);
+		clusterNormals[c] = normalLength > 0.0f ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+	}
+	if (meshArea > 0.0f) {
+		meshCenter /= meshArea;
+	}
+
+	// Clusters facing away from the center sit on the outside and are drawn first
+	std::vector<float> keys(clusters.size() - 1);
+	std::vector<uint32_t> order(clusters.size() - 1);
+	for (size_t c = 0; c < keys.size(); c++) {
+		keys[c] = glm::dot(clusterCenters[c] - meshCenter, clusterNormals[c]);
+		order[c] = uint32_t(c);
+	}
+	std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (uint32_t c : order) {
+		result.insert(result.end(), indices.begin() + size_t(clusters[c]) * 3, indices.begin() + size_t(clusters[c + 1]) * 3);
+	}
+	return result;
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	const uint32_t UNUSED = 0xFFFFFFFFu;
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+	for (uint32_t& index : indices) {
+		if (remap[index] == UNUSED) {
+			remap[index] = uint32_t(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices.swap(reordered);
+}
+
+void MeshOptimizer::Optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const char* name) {
+	CacheStats before = AnalyzeVertexCache(indices, vertices.size());
+	indices = OptimizeVertexCache(indices, vertices.size());
+	indices = OptimizeOverdraw(indices, vertices);
+	OptimizeVertexFetch(vertices, indices);
+	CacheStats after = AnalyzeVertexCache(indices, vertices.size());
+	printf("%s: %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name, unsigned(indices.size() / 3), before.acmr, after.acmr, before.atvr, after.atvr);
+}
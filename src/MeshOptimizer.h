@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include "Vertex.h"
+
+// Reorders the meshes FbxLoader and MeshSimplifier produce for the GPU: triangles for the post-transform vertex cache
+// (Forsyth, "Linear-Speed Vertex Cache Optimisation"), then clusters of them against overdraw (Sander et al., "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw") and finally vertices in the order the triangles first
+// use them. None of it changes what is drawn.
+namespace MeshOptimizer {
+	struct CacheStats {
+		// Average cache miss ratio, transformed vertices per triangle: 0.5 at best for large regular meshes, 3 at worst
+		float acmr = 0.0f;
+		// Average transform to vertex ratio, transformed vertices per referenced vertex: 1 at best
+		float atvr = 0.0f;
+	};
+
+	// Entries of the FIFO cache the stats are measured with
+	const uint32_t ANALYSIS_CACHE_SIZE = 16;
+
+	// Vertex cache behavior of the triangle list on a FIFO cache of cacheSize entries
+	CacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = ANALYSIS_CACHE_SIZE);
+
+	// Same triangles, in an order that reuses recently transformed vertices
+	std::vector<uint32_t> OptimizeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount);
+
+	// Splits a cache optimized triangle list into clusters and draws the ones facing away from the mesh center first,
+	// they tend to cover the rest. A cluster may end early while its ACMR stays below threshold times the ACMR of the
+	// whole patch, more clusters sort better but reuse fewer vertices
+	std::vector<uint32_t> OptimizeOverdraw(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+
+	// Moves the vertices into the order the triangles first use them and drops unreferenced ones
+	void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	// All of the above. Prints ACMR and ATVR before and after under name
+	void Optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const char* name);
+}
@@ -0,0 +1,535 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+
+namespace {
+	// Open border edges add a plane through the edge, perpendicular to its triangle, so collapses keep the outline.
+	// Weighted per squared edge length, this much stronger than the surface
+	const double BORDER_WEIGHT = 10.0;
+	// A level that keeps more than this share of the indices of the level before ends the chain
+	const float MIN_REDUCTION = 0.95f;
+
+	// "LODS"
+	const uint32_t CACHE_MAGIC = 0x53444F4Cu;
+	// 2: levels are optimized for the vertex cache and overdraw
+	const uint32_t CACHE_VERSION = 2;
+
+	enum class VertexKind : uint8_t {
+		// Interior vertex with one set of attributes, collapses along any edge
+		Manifold,
+		// On an open border, collapses along the border only
+		Border,
+		// Two vertices with different attributes at one position, collapses along the seam only
+		Seam,
+		// Seam corners, seams on a border and non-manifold vertices never move
+		Locked,
+	};
+
+	// Sum of squared distances to weighted planes, divided by the summed weight when evaluated
+	struct Quadric {
+		double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+		double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+		double c = 0.0;
+		double weight = 0.0;
+
+		void AddPlane(const glm::dvec3& n, double d, double w) {
+			a00 += w * n.x * n.x;
+			a01 += w * n.x * n.y;
+			a02 += w * n.x * n.z;
+			a11 += w * n.y * n.y;
+			a12 += w * n.y * n.z;
+			a22 += w * n.z * n.z;
+			b0 += w * n.x * d;
+			b1 += w * n.y * d;
+			b2 += w * n.z * d;
+			c += w * d * d;
+			weight += w;
+		}
+
+		void Add(const Quadric& q) {
+			a00 += q.a00;
+			a01 += q.a01;
+			a02 += q.a02;
+			a11 += q.a11;
+			a12 += q.a12;
+			a22 += q.a22;
+			b0 += q.b0;
+			b1 += q.b1;
+			b2 += q.b2;
+			c += q.c;
+			weight += q.weight;
+		}
+
+		// Mean squared distance of p to the planes
+		double Error(const glm::dvec3& p) const {
+			double e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z + 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z) +
+				2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+			return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+		}
+	};
+
+	struct PositionHash {
+		size_t operator()(const glm::vec3& p) const {
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	uint64_t EdgeKey(uint32_t a, uint32_t b) {
+		return (uint64_t(a) << 32) | b;
+	}
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+
+	// Keeps the referenced vertices in order of first use
+	MeshSimplifier::Mesh Compact(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+		MeshSimplifier::Mesh mesh;
+		std::vector<uint32_t> newIndex(vertices.size(), UINT32_MAX);
+		mesh.indices.reserve(indices.size());
+		for (uint32_t index : indices) {
+			if (newIndex[index] == UINT32_MAX) {
+				newIndex[index] = static_cast<uint32_t>(mesh.vertices.size());
+				mesh.vertices.push_back(vertices[index]);
+			}
+			mesh.indices.push_back(newIndex[index]);
+		}
+		return mesh;
+	}
+
+	uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+		// FNV-1a
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+		}
+		return hash;
+	}
+
+	uint64_t HashSource(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const MeshSimplifier::ChainSettings& settings) {
+		uint64_t hash = 0xCBF29CE484222325ull;
+		hash = HashBytes(hash, vertices.data(), vertices.size() * sizeof(Vertex));
+		hash = HashBytes(hash, indices.data(), indices.size() * sizeof(uint32_t));
+		hash = HashBytes(hash, &settings.levels, sizeof(settings.levels));
+		hash = HashBytes(hash, &settings.ratio, sizeof(settings.ratio));
+		hash = HashBytes(hash, &settings.maxError, sizeof(settings.maxError));
+		return hash;
+	}
+
+	bool ReadCache(const std::string& path, uint64_t hash, std::vector<MeshSimplifier::Mesh>& chain) {
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file) {
+			return false;
+		}
+
+		uint32_t header[4] = {};
+		uint64_t storedHash = 0;
+		bool valid = fread(header, sizeof(header), 1, file) == 1 && fread(&storedHash, sizeof(storedHash), 1, file) == 1 &&
+			header[0] == CACHE_MAGIC && header[1] == CACHE_VERSION && header[2] == sizeof(Vertex) && storedHash == hash;
+		chain.resize(valid ? header[3] : 0);
+		for (MeshSimplifier::Mesh& mesh : chain) {
+			uint32_t counts[2] = {};
+			valid = valid && fread(counts, sizeof(counts), 1, file) == 1;
+			if (!valid) {
+				break;
+			}
+			mesh.vertices.resize(counts[0]);
+			mesh.indices.resize(counts[1]);
+			valid = (counts[0] == 0 || fread(mesh.vertices.data(), sizeof(Vertex), counts[0], file) == counts[0]) &&
+				(counts[1] == 0 || fread(mesh.indices.data(), sizeof(uint32_t), counts[1], file) == counts[1]);
+			for (size_t i = 0; valid && i < mesh.indices.size(); i++) {
+				valid = mesh.indices[i] < counts[0];
+			}
+		}
+		fclose(file);
+		if (!valid) {
+			chain.clear();
+		}
+		return valid;
+	}
+
+	bool WriteCache(const std::string& path, uint64_t hash, const std::vector<MeshSimplifier::Mesh>& chain) {
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+
+		uint32_t header[4] = { CACHE_MAGIC, CACHE_VERSION, sizeof(Vertex), static_cast<uint32_t>(chain.size()) };
+		bool written = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(&hash, sizeof(hash), 1, file) == 1;
+		for (const MeshSimplifier::Mesh& mesh : chain) {
+			uint32_t counts[2] = { static_cast<uint32_t>(mesh.vertices.size()), static_cast<uint32_t>(mesh.indices.size()) };
+			written = written && fwrite(counts, sizeof(counts), 1, file) == 1 &&
+				fwrite(mesh.vertices.data(), sizeof(Vertex), counts[0], file) == counts[0] &&
+				fwrite(mesh.indices.data(), sizeof(uint32_t), counts[1], file) == counts[1];
+		}
+		return fclose(file) == 0 && written;
+	}
+}
+
+MeshSimplifier::Mesh MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, float* error) {
+	const uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+	std::vector<uint32_t> current(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+	if (error) {
+		*error = 0.0f;
+	}
+
+	// Every vertex maps to the first vertex at its position, collapses and quadrics work on these representatives.
+	// Adding 0 turns -0 into 0 so both hash alike
+	std::vector<uint32_t> rep(vertexCount);
+	{
+		std::unordered_map<glm::vec3, uint32_t, PositionHash> first;
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			rep[v] = first.emplace(vertices[v].pos + glm::vec3(0.0f), v).first->second;
+		}
+	}
+
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (uint32_t index : current) {
+		lo = glm::min(lo, vertices[index].pos);
+		hi = glm::max(hi, vertices[index].pos);
+	}
+	const double extent = current.empty() ? 0.0 : std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+	if (extent <= 0.0) {
+		return Compact(vertices, current);
+	}
+
+	// Directed edges between representatives, an edge without its reverse is on an open border
+	std::unordered_map<uint64_t, uint32_t> directed;
+	auto buildEdges = [&]() {
+		directed.clear();
+		for (size_t t = 0; t < current.size(); t += 3) {
+			for (int e = 0; e < 3; e++) {
+				directed[EdgeKey(rep[current[t + e]], rep[current[t + (e + 1) % 3]])]++;
+			}
+		}
+	};
+	auto isBorder = [&](uint32_t a, uint32_t b) {
+		return directed.count(EdgeKey(b, a)) == 0;
+	};
+	buildEdges();
+
+	// Classification of the source topology
+	std::vector<VertexKind> kind(vertexCount, VertexKind::Manifold);
+	{
+		std::vector<uint32_t> borderEdges(vertexCount, 0);
+		std::vector<uint32_t> wedges(vertexCount, 0);
+		std::vector<bool> nonManifold(vertexCount, false);
+		std::vector<bool> referenced(vertexCount, false);
+		for (const auto& edge : directed) {
+			uint32_t a = uint32_t(edge.first >> 32);
+			uint32_t b = uint32_t(edge.first & 0xFFFFFFFFu);
+			auto reverse = directed.find(EdgeKey(b, a));
+			if (edge.second > 1 || (reverse != directed.end() && reverse->second > 1)) {
+				nonManifold[a] = nonManifold[b] = true;
+			}
+			if (reverse == directed.end()) {
+				borderEdges[a]++;
+				borderEdges[b]++;
+			}
+		}
+		for (uint32_t index : current) {
+			if (!referenced[index]) {
+				referenced[index] = true;
+				wedges[rep[index]]++;
+			}
+		}
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			if (rep[v] != v) {
+				continue;
+			}
+			if (nonManifold[v] || wedges[v] > 2 || (borderEdges[v] > 0 && (borderEdges[v] != 2 || wedges[v] > 1))) {
+				kind[v] = VertexKind::Locked;
+			}
+			else if (borderEdges[v] > 0) {
+				kind[v] = VertexKind::Border;
+			}
+			else if (wedges[v] == 2) {
+				kind[v] = VertexKind::Seam;
+			}
+		}
+	}
+
+	auto position = [&](uint32_t v) {
+		return glm::dvec3(vertices[v].pos);
+	};
+
+	// Area weighted triangle planes plus the border planes
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < current.size(); t += 3) {
+		uint32_t r[3] = { rep[current[t]], rep[current[t + 1]], rep[current[t + 2]] };
+		glm::dvec3 p[3] = { position(r[0]), position(r[1]), position(r[2]) };
+		glm::dvec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+		double length = glm::length(n);
+		if (length == 0.0) {
+			continue;
+		}
+		n /= length;
+		for (int i = 0; i < 3; i++) {
+			quadrics[r[i]].AddPlane(n, -glm::dot(n, p[0]), 0.5 * length);
+		}
+		for (int e = 0; e < 3; e++) {
+			uint32_t a = r[e];
+			uint32_t b = r[(e + 1) % 3];
+			if (!isBorder(a, b)) {
+				continue;
+			}
+			glm::dvec3 edge = p[(e + 1) % 3] - p[e];
+			glm::dvec3 en = glm::cross(edge, n);
+			double enLength = glm::length(en);
+			if (enLength == 0.0) {
+				continue;
+			}
+			en /= enLength;
+			double w = BORDER_WEIGHT * glm::dot(edge, edge);
+			quadrics[a].AddPlane(en, -glm::dot(en, p[e]), w);
+			quadrics[b].AddPlane(en, -glm::dot(en, p[e]), w);
+		}
+	}
+
+	const double maxCost = double(maxError) * double(maxError) * extent * extent;
+	double worst = 0.0;
+	std::vector<uint32_t> remap(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++) {
+		remap[v] = v;
+	}
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+	std::vector<uint32_t> triangles;
+	std::vector<uint64_t> edges;
+	std::vector<Collapse> collapses;
+	std::vector<bool> locked(vertexCount);
+
+	// Each pass collapses the cheapest edges that do not touch each other, then rebuilds the index buffer
+	while (current.size() > targetIndexCount) {
+		// Triangles around every representative
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (uint32_t index : current) {
+			triangleOffsets[rep[index] + 1]++;
+		}
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+		triangles.resize(current.size());
+		{
+			std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (size_t i = 0; i < current.size(); i++) {
+				triangles[fill[rep[current[i]]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		// Wedge of the target each wedge of the source turns into, from the triangles sharing the edge. Fails when a
+		// source wedge has no or several targets, or two source wedges would merge, i.e. the edge does not follow the
+		// seam. Triangles that do not share the edge must not flip
+		uint32_t fromWedges[2];
+		uint32_t toWedges[2];
+		uint32_t wedgeCount;
+		auto mapWedges = [&](uint32_t from, uint32_t to) {
+			wedgeCount = 0;
+			for (uint32_t i = triangleOffsets[from]; i < triangleOffsets[from + 1]; i++) {
+				const uint32_t* corners = &current[3 * triangles[i]];
+				uint32_t fromCorner = 3;
+				uint32_t toCorner = 3;
+				for (uint32_t c = 0; c < 3; c++) {
+					fromCorner = rep[corners[c]] == from ? c : fromCorner;
+					toCorner = rep[corners[c]] == to ? c : toCorner;
+				}
+
+				uint32_t w = 0;
+				while (w < wedgeCount && fromWedges[w] != corners[fromCorner]) {
+					w++;
+				}
+				if (toCorner == 3) {
+					// Only moves, checked for flips below
+					continue;
+				}
+				if (w == wedgeCount) {
+					if (wedgeCount == 2) {
+						return false;
+					}
+					fromWedges[w] = corners[fromCorner];
+					toWedges[w] = corners[toCorner];
+					wedgeCount++;
+				}
+				else if (toWedges[w] != corners[toCorner]) {
+					return false;
+				}
+			}
+			if (wedgeCount == 2 && toWedges[0] == toWedges[1]) {
+				return false;
+			}
+
+			glm::dvec3 target = position(to);
+			for (uint32_t i = triangleOffsets[from]; i < triangleOffsets[from + 1]; i++) {
+				const uint32_t* corners = &current[3 * triangles[i]];
+				uint32_t fromCorner = 3;
+				bool shared = false;
+				for (uint32_t c = 0; c < 3; c++) {
+					fromCorner = rep[corners[c]] == from ? c : fromCorner;
+					shared = shared || rep[corners[c]] == to;
+				}
+				bool mapped = false;
+				for (uint32_t w = 0; w < wedgeCount; w++) {
+					mapped = mapped || fromWedges[w] == corners[fromCorner];
+				}
+				if (!mapped) {
+					// A wedge that never meets the target would be left without attributes
+					return false;
+				}
+				if (shared) {
+					continue;
+				}
+				glm::dvec3 p[3] = { position(rep[corners[0]]), position(rep[corners[1]]), position(rep[corners[2]]) };
+				glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				p[fromCorner] = target;
+				glm::dvec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+				if (glm::dot(before, after) <= 0.0) {
+					return false;
+				}
+			}
+			return wedgeCount > 0;
+		};
+
+		auto allowed = [&](uint32_t from, uint32_t to) {
+			return kind[from] != VertexKind::Locked && (kind[from] != VertexKind::Border || isBorder(from, to) || isBorder(to, from));
+		};
+
+		edges.clear();
+		for (size_t t = 0; t < current.size(); t += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = rep[current[t + e]];
+				uint32_t b = rep[current[t + (e + 1) % 3]];
+				edges.push_back(EdgeKey(std::min(a, b), std::max(a, b)));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		collapses.clear();
+		for (uint64_t edge : edges) {
+			uint32_t a = uint32_t(edge >> 32);
+			uint32_t b = uint32_t(edge & 0xFFFFFFFFu);
+			double costAB = allowed(a, b) ? quadrics[a].Error(position(b)) : std::numeric_limits<double>::infinity();
+			double costBA = allowed(b, a) ? quadrics[b].Error(position(a)) : std::numeric_limits<double>::infinity();
+			if (costAB <= costBA && costAB <= maxCost) {
+				collapses.push_back({ a, b, costAB });
+			}
+			else if (costBA < costAB && costBA <= maxCost) {
+				collapses.push_back({ b, a, costBA });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.cost < y.cost;
+		});
+
+		// Every collapse removes the one or two triangles on its edge
+		const size_t trianglesToRemove = (current.size() - targetIndexCount + 2) / 3;
+		size_t removed = 0;
+		size_t applied = 0;
+		std::fill(locked.begin(), locked.end(), false);
+		for (const Collapse& collapse : collapses) {
+			if (removed >= trianglesToRemove) {
+				break;
+			}
+			// The triangles around the source change shape, none of their vertices may move in the same pass
+			bool free = true;
+			for (uint32_t i = triangleOffsets[collapse.from]; free && i < triangleOffsets[collapse.from + 1]; i++) {
+				const uint32_t* corners = &current[3 * triangles[i]];
+				free = !locked[rep[corners[0]]] && !locked[rep[corners[1]]] && !locked[rep[corners[2]]];
+			}
+			if (!free || locked[collapse.to] || !mapWedges(collapse.from, collapse.to)) {
+				continue;
+			}
+
+			for (uint32_t i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++) {
+				const uint32_t* corners = &current[3 * triangles[i]];
+				bool shared = false;
+				for (uint32_t c = 0; c < 3; c++) {
+					locked[rep[corners[c]]] = true;
+					shared = shared || rep[corners[c]] == collapse.to;
+				}
+				removed += shared ? 1 : 0;
+			}
+			for (uint32_t w = 0; w < wedgeCount; w++) {
+				remap[fromWedges[w]] = toWedges[w];
+			}
+			quadrics[collapse.to].Add(quadrics[collapse.from]);
+			worst = std::max(worst, collapse.cost);
+			applied++;
+		}
+		if (applied == 0) {
+			break;
+		}
+
+		// Move the collapsed wedges and drop the triangles that became degenerate
+		size_t kept = 0;
+		for (size_t t = 0; t < current.size(); t += 3) {
+			uint32_t a = remap[current[t]];
+			uint32_t b = remap[current[t + 1]];
+			uint32_t c = remap[current[t + 2]];
+			if (rep[a] != rep[b] && rep[b] != rep[c] && rep[a] != rep[c]) {
+				current[kept++] = a;
+				current[kept++] = b;
+				current[kept++] = c;
+			}
+		}
+		current.resize(kept);
+		buildEdges();
+	}
+
+	if (error) {
+		*error = float(sqrt(worst) / extent);
+	}
+	return Compact(vertices, current);
+}
+
+std::vector<MeshSimplifier::Mesh> MeshSimplifier::BuildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const ChainSettings& settings) {
+	std::vector<Mesh> chain;
+	// Levels are simplified from the one before, which must not move while the next is added
+	chain.reserve(settings.levels);
+	const std::vector<Vertex>* sourceVertices = &vertices;
+	const std::vector<uint32_t>* sourceIndices = &indices;
+	for (uint32_t l = 0; l < settings.levels; l++) {
+		size_t target = size_t(float(sourceIndices->size() / 3) * settings.ratio) * 3;
+		float error;
+		Mesh level = Simplify(*sourceVertices, *sourceIndices, target, settings.maxError, &error);
+		if (float(level.indices.size()) > float(sourceIndices->size()) * MIN_REDUCTION) {
+			printf("  LOD %u: stopped at %u of %u triangles\n", l + 1, unsigned(level.indices.size() / 3), unsigned(sourceIndices->size() / 3));
+			break;
+		}
+		printf("  LOD %u: %u -> %u triangles, error %.4f\n", l + 1, unsigned(sourceIndices->size() / 3), unsigned(level.indices.size() / 3), error);
+		// Collapses leave the triangles in the source's order with holes in it
+		char name[32];
+		snprintf(name, sizeof(name), "  LOD %u", l + 1);
+		MeshOptimizer::Optimize(level.vertices, level.indices, name);
+		chain.push_back(std::move(level));
+		sourceVertices = &chain.back().vertices;
+		sourceIndices = &chain.back().indices;
+	}
+	return chain;
+}
+
+std::vector<MeshSimplifier::Mesh> MeshSimplifier::LoadOrBuildLodChain(const std::string& cachePath, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	const ChainSettings& settings) {
+	uint64_t hash = HashSource(vertices, indices, settings);
+	std::vector<Mesh> chain;
+	if (ReadCache(cachePath, hash, chain)) {
+		printf("LOD chain of %u levels from %s\n", unsigned(chain.size()), cachePath.c_str());
+		return chain;
+	}
+
+	printf("Building LOD chain for %s\n", cachePath.c_str());
+	chain = BuildLodChain(vertices, indices, settings);
+	if (!WriteCache(cachePath, hash, chain)) {
+		printf("Could not write %s, the LOD chain is rebuilt on the next start\n", cachePath.c_str());
+	}
+	return chain;
+}
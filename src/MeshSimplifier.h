@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Vertex.h"
+
+// Quadric error metric simplification of the meshes FbxLoader produces, for species without artist made LODs.
+// Edges collapse onto one of their two vertices, so every vertex left keeps its exact attributes. Vertices that share
+// a position but not their attributes form UV / normal seams, they only collapse along the seam so both sides stay
+// intact. Vertices on an open border only collapse along the border.
+namespace MeshSimplifier {
+	struct Mesh {
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+	};
+
+	struct ChainSettings {
+		// Simplified levels after the source mesh
+		uint32_t levels = 2;
+		// Triangles of each level relative to the one before
+		float ratio = 0.5f;
+		// Largest collapse error relative to the mesh extent, a level stops short of its triangle target beyond it
+		float maxError = 0.05f;
+	};
+
+	// Collapses edges in order of error until at most targetIndexCount indices are left or the next collapse would
+	// exceed maxError. Unreferenced vertices are dropped. The largest error relative to the mesh extent goes to error
+	Mesh Simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, float* error = nullptr);
+
+	// Each level is simplified from the one before. The chain ends early once a level cannot remove a meaningful share
+	// of the triangles any more
+	std::vector<Mesh> BuildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const ChainSettings& settings);
+
+	// BuildLodChain, cached in cachePath. The cache stores a hash of the source mesh and the settings and is rebuilt
+	// when either changed or it cannot be read
+	std::vector<Mesh> LoadOrBuildLodChain(const std::string& cachePath, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+		const ChainSettings& settings);
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+#include "MeshletBuilder.h"
+
+namespace {
+	// Widens every cone by this angle in radians, wind bending turns the triangles a little after culling has seen them
+	const float CONE_SLACK = 0.1f;
+
+	// Sphere around the AABB center of the vertices, within a few percent of the smallest one for meshlet sized sets
+	glm::vec4 BoundingSphere(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& meshletVertices) {
+		glm::vec3 low = vertices[meshletVertices[0]].pos;
+		glm::vec3 high = low;
+		for (uint32_t v : meshletVertices) {
+			low = glm::min(low, vertices[v].pos);
+			high = glm::max(high, vertices[v].pos);
+		}
+		const glm::vec3 center = 0.5f * (low + high);
+		float radius = 0.0f;
+		for (uint32_t v : meshletVertices) {
+			radius = std::max(radius, glm::length(vertices[v].pos - center));
+		}
+		return glm::vec4(center, radius);
+	}
+
+	// Cone around the face normals of the triangles, counter-clockwise ones facing the viewer as in the tree pipelines
+	glm::vec4 NormalCone(const std::vector<Vertex>& vertices, const uint32_t* indices, uint32_t triangleCount) {
+		const glm::vec4 never = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		std::vector<glm::vec3> normals;
+		normals.reserve(triangleCount);
+		glm::vec3 sum = glm::vec3(0.0f);
+		for (uint32_t t = 0; t < triangleCount; t++) {
+			const glm::vec3& a = vertices[indices[3 * t]].pos;
+			const glm::vec3& b = vertices[indices[3 * t + 1]].pos;
+			const glm::vec3& c = vertices[indices[3 * t + 2]].pos;
+			const glm::vec3 normal = glm::cross(b - a, c - a);
+			const float length = glm::length(normal);
+			// Degenerate triangles rasterize nothing, they do not widen the cone
+			if (length > 0.0f) {
+				normals.push_back(normal / length);
+				sum += normals.back();
+			}
+		}
+		if (normals.empty() || !(glm::length(sum) > 1e-6f)) {
+			return never;
+		}
+
+		const glm::vec3 axis = glm::normalize(sum);
+		float minDot = 1.0f;
+		for (const glm::vec3& normal : normals) {
+			minDot = std::min(minDot, glm::dot(normal, axis));
+		}
+		const float angle = std::acos(glm::clamp(minDot, -1.0f, 1.0f)) + CONE_SLACK;
+		// Triangles spread over a half space or more face the viewer from everywhere
+		if (angle >= 0.5f * glm::pi<float>()) {
+			return never;
+		}
+		return glm::vec4(axis, std::sin(angle));
+	}
+}
+
+std::vector<Meshlet> MeshletBuilder::Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, bool twoSided) {
+	std::vector<Meshlet> meshlets;
+	// Meshlet that last used each vertex, plus one so zero means none
+	std::vector<uint32_t> usedBy(vertices.size(), 0);
+	std::vector<uint32_t> meshletVertices;
+	size_t start = 0;
+
+	auto finish = [&](size_t end) {
+		Meshlet meshlet;
+		meshlet.sphere = BoundingSphere(vertices, meshletVertices);
+		if (!twoSided) {
+			meshlet.cone = NormalCone(vertices, &indices[start], static_cast<uint32_t>((end - start) / 3));
+		}
+		meshlet.firstIndex = firstIndex + static_cast<uint32_t>(start);
+		meshlet.indexCount = static_cast<uint32_t>(end - start);
+		meshlets.push_back(meshlet);
+		meshletVertices.clear();
+		start = end;
+	};
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		uint32_t newVertices = 0;
+		for (size_t k = 0; k < 3; k++) {
+			// Counted once even if the triangle repeats it
+			if (usedBy[indices[i + k]] != meshlets.size() + 1 && std::find(&indices[i], &indices[i + k], indices[i + k]) == &indices[i + k]) {
+				newVertices++;
+			}
+		}
+		if (i > start && (meshletVertices.size() + newVertices > MESHLET_MAX_VERTICES || (i - start) / 3 >= MESHLET_MAX_TRIANGLES)) {
+			finish(i);
+		}
+		for (size_t k = 0; k < 3; k++) {
+			uint32_t& marker = usedBy[indices[i + k]];
+			if (marker != meshlets.size() + 1) {
+				marker = static_cast<uint32_t>(meshlets.size() + 1);
+				meshletVertices.push_back(indices[i + k]);
+			}
+		}
+	}
+	if (!meshletVertices.empty()) {
+		finish(indices.size() - indices.size() % 3);
+	}
+	return meshlets;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include "Vertex.h"
+
+// Limits of one meshlet. 124 triangles leave room for the per-primitive data of mesh shader implementations that want
+// it in 128, 64 vertices fit one workgroup
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// A run of consecutive triangles of a batch's index buffer. Same as Meshlet in meshletCulling.comp
+struct Meshlet {
+	// Model space, xyz center w radius
+	glm::vec4 sphere = glm::vec4(0.0f);
+	// xyz average facing, w sin of the largest angle between a triangle and it. Seen from anywhere within the angle
+	// w of xyz the whole meshlet faces away: dot(center - eye, xyz) >= w * |center - eye| + radius. 1 never culls
+	glm::vec4 cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	// Into the batch's index buffer
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	uint32_t pad[2] = {};
+};
+
+// Splits triangle lists into meshlets for culling finer than whole instances. Triangles stay in their order, so a
+// meshlet is a range of the index buffer and the meshes MeshOptimizer already ordered for the vertex cache keep it.
+namespace MeshletBuilder {
+	// Starts a new meshlet whenever the next triangle would go over one of the limits. Two-sided meshes can be seen from
+	// behind, their cones never cull
+	std::vector<Meshlet> Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, bool twoSided);
+}
@@ -2,49 +2,42 @@
 #include "BufferUtils.h"
 #include "Image.h"
 
-Model::Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+Model::Model(Device* device, UploadContext* uploadContext, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
   : device(device), vertices(vertices), indices(indices) {
 
     if (vertices.size() > 0) {
-        BufferUtils::CreateBufferFromData(device, commandPool, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+        BufferUtils::CreateBufferFromData(device, uploadContext, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
     }
     if (indices.size() > 0) {
-        BufferUtils::CreateBufferFromData(device, commandPool, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+        indexType = BufferUtils::GetIndexType(indices);
+        BufferUtils::CreateIndexBuffer(device, uploadContext, indices, indexType, indexBuffer, indexBufferMemory);
     }
 
     modelBufferObject.modelMatrix = glm::mat4(1.0f);
-    BufferUtils::CreateBufferFromData(device, commandPool, &modelBufferObject, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
+    BufferUtils::CreateBufferFromData(device, uploadContext, &modelBufferObject, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
 }
 
-Model::Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, glm::vec3 position, float scale, float theta)
+Model::Model(Device* device, UploadContext* uploadContext, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, glm::vec3 position, float scale, float theta)
 	: device(device), vertices(vertices), indices(indices) {
 
 	if (vertices.size() > 0) {
-		BufferUtils::CreateBufferFromData(device, commandPool, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+		BufferUtils::CreateBufferFromData(device, uploadContext, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
 	}
 
 	if (indices.size() > 0) {
-		BufferUtils::CreateBufferFromData(device, commandPool, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+		indexType = BufferUtils::GetIndexType(indices);
+		BufferUtils::CreateIndexBuffer(device, uploadContext, indices, indexType, indexBuffer, indexBufferMemory);
 	}
 
 
 	modelBufferObject.modelMatrix = glm::translate(glm::mat4(1), position);
-	BufferUtils::CreateBufferFromData(device, commandPool, &modelBufferObject, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
+	BufferUtils::CreateBufferFromData(device, uploadContext, &modelBufferObject, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
 }
 
 Model::~Model() {
-    if (indices.size() > 0) {
-        vkDestroyBuffer(device->GetVkDevice(), indexBuffer, nullptr);
-        vkFreeMemory(device->GetVkDevice(), indexBufferMemory, nullptr);
-    }
-
-    if (vertices.size() > 0) {
-        vkDestroyBuffer(device->GetVkDevice(), vertexBuffer, nullptr);
-        vkFreeMemory(device->GetVkDevice(), vertexBufferMemory, nullptr);
-    }
+	ReleaseGeometryBuffers();
 
-    vkDestroyBuffer(device->GetVkDevice(), modelBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), modelBufferMemory, nullptr);
+    BufferUtils::DestroyBuffer(device, modelBuffer);
 
 	if (diffuseMapView != VK_NULL_HANDLE) {
         vkDestroyImageView(device->GetVkDevice(), diffuseMapView, nullptr);
@@ -71,6 +64,18 @@ Model::~Model() {
 	}
 }
 
+void Model::ReleaseGeometryBuffers() {
+	if (indexBuffer != VK_NULL_HANDLE) {
+		BufferUtils::DestroyBuffer(device, indexBuffer);
+		indexBuffer = VK_NULL_HANDLE;
+	}
+
+	if (vertexBuffer != VK_NULL_HANDLE) {
+		BufferUtils::DestroyBuffer(device, vertexBuffer);
+		vertexBuffer = VK_NULL_HANDLE;
+	}
+}
+
 void Model::SetDiffuseMap(VkImage texture) {
     this->diffuseMap = texture;
     this->diffuseMapView = Image::CreateView(device, texture, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT,false);
@@ -213,6 +218,10 @@ VkBuffer Model::getIndexBuffer() const {
     return indexBuffer;
 }
 
+VkIndexType Model::getIndexType() const {
+    return indexType;
+}
+
 const ModelBufferObject& Model::getModelBufferObject() const {
     return modelBufferObject;
 }
@@ -7,6 +7,7 @@
 
 #include "Vertex.h"
 #include "Device.h"
+#include "UploadContext.h"
 
 
 struct ModelBufferObject {
@@ -18,12 +19,14 @@ protected:
     Device* device;
 
     std::vector<Vertex> vertices;
-    VkBuffer vertexBuffer;
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
     VkDeviceMemory vertexBufferMemory;
 
+    // Kept at 32 bit, the index buffer has the width of indexType
     std::vector<uint32_t> indices;
-    VkBuffer indexBuffer;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
     VkDeviceMemory indexBufferMemory;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
 
 
     VkBuffer modelBuffer;
@@ -46,8 +49,8 @@ protected:
 
 public:
     Model() = delete;
-	Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
-	Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, glm::vec3 position, float scale, float theta);
+	Model(Device* device, UploadContext* uploadContext, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+	Model(Device* device, UploadContext* uploadContext, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, glm::vec3 position, float scale, float theta);
 	virtual ~Model();
 
     virtual void SetDiffuseMap(VkImage texture);
@@ -62,6 +65,12 @@ public:
 
     VkBuffer getIndexBuffer() const;
 
+    VkIndexType getIndexType() const;
+
+	// Frees the vertex and index buffers once nothing draws from them anymore, e.g. tree models after their batches
+	// and impostors are built. The vertices and indices stay on the CPU
+	void ReleaseGeometryBuffers();
+
     const ModelBufferObject& getModelBufferObject() const;
 
     VkBuffer GetModelBuffer() const;
@@ -0,0 +1,119 @@
+#include "ModelBatch.h"
+#include "BufferUtils.h"
+
+ModelBatch::ModelBatch(Device* device, UploadContext* uploadContext, const std::vector<const Model*>& models, VertexFormat format, BatchMeshlets meshlets)
+	: device(device), format(format) {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Meshlet> batchMeshlets;
+	for (const Model* model : models) {
+		VkDrawIndexedIndirectCommand draw = {};
+		draw.firstIndex = static_cast<uint32_t>(indices.size());
+		draw.vertexOffset = static_cast<int32_t>(vertices.size());
+		MeshletRange range;
+		range.firstMeshlet = static_cast<uint32_t>(batchMeshlets.size());
+		range.vertexOffset = draw.vertexOffset;
+		if (model) {
+			draw.indexCount = static_cast<uint32_t>(model->getIndices().size());
+			vertices.insert(vertices.end(), model->getVertices().begin(), model->getVertices().end());
+			indices.insert(indices.end(), model->getIndices().begin(), model->getIndices().end());
+			if (meshlets != BATCH_MESHLETS_NONE) {
+				std::vector<Meshlet> modelMeshlets = MeshletBuilder::Build(model->getVertices(), model->getIndices(), draw.firstIndex, meshlets == BATCH_MESHLETS_TWO_SIDED);
+				range.meshletCount = static_cast<uint32_t>(modelMeshlets.size());
+				batchMeshlets.insert(batchMeshlets.end(), modelMeshlets.begin(), modelMeshlets.end());
+			}
+		}
+		draws.push_back(draw);
+		meshletRanges.push_back(range);
+	}
+
+	ModelBatchBufferObject modelBufferObject;
+	VkDeviceMemory memory;
+	if (!vertices.empty() && format == VERTEX_FORMAT_PACKED) {
+		modelBufferObject.positionQuantization = PositionQuantization::Fit(vertices);
+		std::vector<PackedVertex> packedVertices;
+		packedVertices.reserve(vertices.size());
+		for (const Vertex& vertex : vertices) {
+			packedVertices.push_back(PackedVertex::Pack(vertex, modelBufferObject.positionQuantization));
+		}
+		BufferUtils::CreateBufferFromData(device, uploadContext, packedVertices.data(), packedVertices.size() * sizeof(PackedVertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, memory);
+	}
+	else if (!vertices.empty()) {
+		BufferUtils::CreateBufferFromData(device, uploadContext, vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, memory);
+	}
+	if (!indices.empty()) {
+		indexType = BufferUtils::GetIndexType(indices);
+		BufferUtils::CreateIndexBuffer(device, uploadContext, indices, indexType, indexBuffer, memory);
+	}
+	BufferUtils::CreateBufferFromData(device, uploadContext, &modelBufferObject, sizeof(ModelBatchBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, memory);
+
+	if (meshlets != BATCH_MESHLETS_NONE) {
+		// Buffers cannot be empty, a batch without geometry still gets one meshlet and range that nothing reads
+		if (batchMeshlets.empty()) {
+			batchMeshlets.push_back(Meshlet());
+		}
+		std::vector<MeshletRange> ranges = meshletRanges;
+		if (ranges.empty()) {
+			ranges.push_back(MeshletRange());
+		}
+		// Uploaded on the graphics queue, read by the meshlet culling pass on the compute queue
+		BufferUtils::CreateBufferFromData(device, uploadContext, batchMeshlets.data(), batchMeshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletBuffer, memory,
+			BufferUtils::BUFFER_SHARING_GRAPHICS_COMPUTE);
+		BufferUtils::CreateBufferFromData(device, uploadContext, ranges.data(), ranges.size() * sizeof(MeshletRange), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletRangeBuffer, memory,
+			BufferUtils::BUFFER_SHARING_GRAPHICS_COMPUTE);
+	}
+}
+
+ModelBatch::~ModelBatch() {
+	if (vertexBuffer != VK_NULL_HANDLE) {
+		BufferUtils::DestroyBuffer(device, vertexBuffer);
+	}
+	if (indexBuffer != VK_NULL_HANDLE) {
+		BufferUtils::DestroyBuffer(device, indexBuffer);
+	}
+	if (meshletBuffer != VK_NULL_HANDLE) {
+		BufferUtils::DestroyBuffer(device, meshletBuffer);
+		BufferUtils::DestroyBuffer(device, meshletRangeBuffer);
+	}
+	BufferUtils::DestroyBuffer(device, modelBuffer);
+}
+
+VertexFormat ModelBatch::GetVertexFormat() const {
+	return format;
+}
+
+VkBuffer ModelBatch::GetVertexBuffer() const {
+	return vertexBuffer;
+}
+
+VkBuffer ModelBatch::GetModelBuffer() const {
+	return modelBuffer;
+}
+
+VkBuffer ModelBatch::GetIndexBuffer() const {
+	return indexBuffer;
+}
+
+VkIndexType ModelBatch::GetIndexType() const {
+	return indexType;
+}
+
+uint32_t ModelBatch::GetModelCount() const {
+	return static_cast<uint32_t>(draws.size());
+}
+
+const VkDrawIndexedIndirectCommand& ModelBatch::GetDraw(uint32_t i) const {
+	return draws[i];
+}
+
+VkBuffer ModelBatch::GetMeshletBuffer() const {
+	return meshletBuffer;
+}
+
+VkBuffer ModelBatch::GetMeshletRangeBuffer() const {
+	return meshletRangeBuffer;
+}
+
+const MeshletRange& ModelBatch::GetMeshletRange(uint32_t i) const {
+	return meshletRanges[i];
+}
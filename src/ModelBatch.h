@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "Model.h"
+#include "MeshletBuilder.h"
+
+// Set 1, binding 0 of the tree pipelines. Same as ModelBufferObject in bark.vert and leaf.vert,
+// billboard.vert only reads the model matrix
+struct ModelBatchBufferObject {
+	glm::mat4 modelMatrix = glm::mat4(1.0f);
+	// Unpacks the positions of a packed batch, identity otherwise
+	PositionQuantization positionQuantization;
+};
+
+// Whether a batch splits its models into meshlets, and whether their back faces are drawn
+enum BatchMeshlets {
+	BATCH_MESHLETS_NONE = 0,
+	BATCH_MESHLETS_ONE_SIDED,
+	BATCH_MESHLETS_TWO_SIDED
+};
+
+// Meshlets of one model in the batch's meshlet buffer. Same as MeshletRange in meshletCulling.comp
+struct MeshletRange {
+	uint32_t firstMeshlet = 0;
+	uint32_t meshletCount = 0;
+	// Of the model's draw
+	int32_t vertexOffset = 0;
+	uint32_t pad = 0;
+};
+
+// Geometry of several models in one vertex and one index buffer, so a single multi-draw can switch between them
+// through firstIndex and vertexOffset of its indirect commands
+class ModelBatch {
+protected:
+	Device* device;
+
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkBuffer modelBuffer = VK_NULL_HANDLE;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	VertexFormat format;
+	std::vector<VkDrawIndexedIndirectCommand> draws;
+	VkBuffer meshletBuffer = VK_NULL_HANDLE;
+	VkBuffer meshletRangeBuffer = VK_NULL_HANDLE;
+	std::vector<MeshletRange> meshletRanges;
+
+public:
+	ModelBatch() = delete;
+	// A null model leaves an empty entry, its draw has no indices. Packed batches quantize every model's positions in
+	// one box around all of them, so the draws can share the model buffer
+	ModelBatch(Device* device, UploadContext* uploadContext, const std::vector<const Model*>& models, VertexFormat format = VERTEX_FORMAT_FULL,
+		BatchMeshlets meshlets = BATCH_MESHLETS_NONE);
+	~ModelBatch();
+
+	VertexFormat GetVertexFormat() const;
+	VkBuffer GetVertexBuffer() const;
+	// Holds a ModelBatchBufferObject
+	VkBuffer GetModelBuffer() const;
+	VkBuffer GetIndexBuffer() const;
+	// Indices stay local to their model and vertexOffset is added after, so 16 bit suffice while every model has
+	// fewer than 65536 vertices
+	VkIndexType GetIndexType() const;
+	uint32_t GetModelCount() const;
+	// indexCount, firstIndex and vertexOffset of the i-th model, no instances
+	const VkDrawIndexedIndirectCommand& GetDraw(uint32_t i) const;
+	// Null unless built with meshlets. The meshlets of every model, their indices are in the batch's index buffer, and
+	// one MeshletRange per model
+	VkBuffer GetMeshletBuffer() const;
+	VkBuffer GetMeshletRangeBuffer() const;
+	const MeshletRange& GetMeshletRange(uint32_t i) const;
+};
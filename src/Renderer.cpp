@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include "Renderer.h"
 #include "Instance.h"
 #include "ShaderModule.h"
@@ -6,52 +9,127 @@
 #include "skybox.h"
 #include "Camera.h"
 #include "Image.h"
+#include "BufferUtils.h"
+#include "Culling.h"
+
+// Workgroup size of the culling and grass shaders, specialization constant 0 in each of them.
+// --compaction-benchmark compares sizes on the current GPU
+static constexpr uint32_t WORKGROUP_SIZE = 32;
+static const VkSpecializationMapEntry WORKGROUP_SIZE_ENTRY = { 0, 0, sizeof(uint32_t) };
+static const VkSpecializationInfo WORKGROUP_SIZE_SPECIALIZATION = { 1, &WORKGROUP_SIZE_ENTRY, sizeof(uint32_t), &WORKGROUP_SIZE };
+// Enough for a 32768 wide pyramid
+// Matrix entries closer than this (relative to the entry) count as unchanged for temporal culling
+static constexpr float CULLING_REUSE_EPSILON = 1e-5f;
+
+static bool NearlyEqual(const glm::mat4& a, const glm::mat4& b) {
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 4; r++) {
+			if (std::abs(a[c][r] - b[c][r]) > CULLING_REUSE_EPSILON * std::max(1.0f, std::abs(a[c][r]))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
-static constexpr unsigned int WORKGROUP_SIZE = 32;
+static constexpr uint32_t MAX_DEPTH_PYRAMID_LEVELS = 16;
+static constexpr uint32_t DEPTH_PYRAMID_GROUP_SIZE = 8;
+
+static uint32_t PreviousPowerOfTwo(uint32_t value) {
+	uint32_t power = 1;
+	while (power * 2 <= value) {
+		power *= 2;
+	}
+	return power;
+}
 
 #define LOD_FRUSTUM_CULLING 1
+// Cull the bark and leaf meshlets of up to MESHLET_INSTANCES visible level 0 instances on their own, when the device has a draw count
+#define MESHLET_CULLING 1
+
+// Push constants of meshletCulling.comp
+struct MeshletCullingParameters {
+	uint32_t kind;
+	uint32_t maxCommands;
+};
 
-Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera)
+// A whole workgroup at one mesh level must fit that level's bits of the culling scan
+static_assert(WORKGROUP_SIZE < (1u << TREE_LOD_COUNT_BITS), "the culling scan counts would carry into the next mesh level");
+// Bark and leaf take one profiler slot per mesh level, plus one for the late pass
+static_assert(MAX_TREE_LODS < GpuProfiler::MAX_SLOTS, "not enough profiler slots for every mesh level");
+
+Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, GpuProfiler* profiler)
 	: device(device),
 	logicalDevice(device->GetVkDevice()),
 	swapChain(swapChain),
 	scene(scene),
-	camera(camera) {
+	camera(camera),
+	uniformRing(scene->GetUniformRing()),
+	profiler(profiler) {
+
+	// Culling runs on its own queue family when the device has one, otherwise on the graphics queue
+	asyncCompute = device->GetQueueIndex(QueueFlags::Graphics) != device->GetQueueIndex(QueueFlags::Compute);
+	printf("Culling on %s queue\n", asyncCompute ? "async compute" : "graphics");
+
+	// The forest is drawn with one multi-draw per pipeline. With a draw count extension the GPU also decides how many
+	// commands there are, without one every group slot is drawn and the culled ones have no instances
+	multiDrawIndirect = device->GetEnabledFeatures().multiDrawIndirect == VK_TRUE;
+	if (device->IsExtensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+		drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawIndexedIndirectCountKHR");
+	}
+	else if (device->IsExtensionEnabled(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+		drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawIndexedIndirectCountAMD");
+	}
+	printf("Forest drawn with %s\n", drawIndexedIndirectCount ? "indirect count" : multiDrawIndirect ? "multi-draw indirect" : "single indirect draws");
+	// The meshlet commands of every frame differ in number, drawing all of them would mostly draw nothing
+	meshletCulling = MESHLET_CULLING && LOD_FRUSTUM_CULLING && drawIndexedIndirectCount && scene->GetForest()->GetMeshletDrawCapacity() > 0;
+	printf("Meshlet culling %s\n", meshletCulling ? "on" : "off");
 
 	CreateCommandPools();
 	CreateRenderPass();
 // Funcs: Descriptor Set Layout
 	CreateCameraDescriptorSetLayout();
 	CreateModelDescriptorSetLayout();
+	CreateForestMaterialDescriptorSetLayout();
 	CreateGrassDescriptorSetLayout();
 	CreateTimeDescriptorSetLayout();
 	CreateWindDescriptorSetLayout();
 	CreateDayNightDescriptorSetLayout();
 	CreateComputeDescriptorSetLayout();
 	CreateCullingComputeDescriptorSetLayout();
-	CreateFakeCullingComputeDescriptorSetLayout();
+	CreateDrawCompactionDescriptorSetLayout();
 	CreateSkyboxDescriptorSetLayout();
 	CreateTerrainDescriptorSetLayout();
 	CreateGuiDescriptorSetLayout();
 	CreateLODInfoDescriptorSetLayout();
+	CreateDepthPyramidDescriptorSetLayout();
+	CreateOcclusionDescriptorSetLayout();
+	CreateLateCullingComputeDescriptorSetLayout();
+	CreateMeshletCullingDescriptorSetLayouts();
 
 	CreateDescriptorPool();
+	CreateOcclusionCullingResources();
 
 // Funcs: Descriptor Set
 	CreateCameraDescriptorSet();
 	CreateModelDescriptorSets();
+	CreateForestMaterialDescriptorSets();
 	CreateGrassDescriptorSets();
 	CreateTimeDescriptorSet();
 	CreateWindDescriptorSet();
 	CreateDayNightDescriptorSet();
 	CreateComputeDescriptorSets();
 	CreateCullingComputeDescriptorSets();
-	CreateFakeCullingComputeDescriptorSets();
+	CreateDrawCompactionDescriptorSets();
 	CreateSkyboxDescriptorSet();
 	CreateTerrainDescriptorSet();
 	CreateGrassDescriptorSets();
 	CreateLODInfoDescriptorSets();
 	CreateGuiDescriptorSets();
+	CreateDepthPyramidDescriptorSets();
+	CreateOcclusionDescriptorSets();
+	CreateLateCullingComputeDescriptorSets();
+	CreateMeshletCullingDescriptorSets();
 
 	CreateFrameResources();
 	
@@ -63,13 +141,29 @@ Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* c
 	CreateGrassPipeline();
 	CreateComputePipeline();
 	CreateCullingComputePipeline();
-	CreateFakeCullingComputePipeline();
+	CreateDrawCompactionPipeline();
 	CreateSkyboxPipeline();
 	CreateTerrainPipeline();
 	CreateGuiPipeline();
+	CreateDepthPyramidPipeline();
+	CreateLateCullingComputePipeline();
+	CreateMeshletCullingPipeline();
 
+	CreateVisibleCountBuffers();
+	CreateTerrainChunkBuffers();
 	RecordCommandBuffers();
-	RecordComputeCommandBuffer();
+	computeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	cullingReuseCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		RecordComputeCommandBuffer(frame);
+		RecordCullingReuseCommandBuffer(frame);
+	}
+#if LOD_FRUSTUM_CULLING
+	if (asyncCompute) {
+		ReleaseCullingOutputsToCompute();
+	}
+#endif
+	CreateSyncObjects();
 }
 
 void Renderer::CreateCommandPools() {
@@ -102,7 +196,8 @@ void Renderer::CreateRenderPass() {
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// The late pass continues drawing into it
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	// Create a color attachment reference to be used with subpass
 	VkAttachmentReference colorAttachmentRef = {};
@@ -110,16 +205,17 @@ void Renderer::CreateRenderPass() {
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	// Depth buffer attachment
-	VkFormat depthFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	VkFormat depthFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 	VkAttachmentDescription depthAttachment = {};
 	depthAttachment.format = depthFormat;
 	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	// The depth pyramid is built from it between the passes
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
 	// Create a depth attachment reference
 	VkAttachmentReference depthAttachmentRef = {};
@@ -135,14 +231,22 @@ void Renderer::CreateRenderPass() {
 
 	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
 
-	// Specify subpass dependency
-	VkSubpassDependency dependency = {};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	// Specify subpass dependencies
+	std::array<VkSubpassDependency, 2> dependencies = {};
+	// The depth clear waits for the previous frame's depth pyramid build and late pass
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	// Depth is sampled by the pyramid build, color and depth are loaded again by the late pass
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
 	// Create render pass
 	VkRenderPassCreateInfo renderPassInfo = {};
@@ -151,19 +255,45 @@ void Renderer::CreateRenderPass() {
 	renderPassInfo.pAttachments = attachments.data();
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	renderPassInfo.pDependencies = dependencies.data();
 
 	if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create render pass");
 	}
+
+	// Late pass, same attachments so it shares framebuffers and pipelines with the first one
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	// Offscreen images are only ever read back by transfers
+	attachments[0].finalLayout = swapChain->IsHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// Depth writes must not start before the pyramid build has read it
+	VkSubpassDependency lateDependency = {};
+	lateDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	lateDependency.dstSubpass = 0;
+	lateDependency.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	lateDependency.srcAccessMask = 0;
+	lateDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	lateDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &lateDependency;
+
+	if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &lateRenderPass) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create render pass");
+	}
 }
 
 void Renderer::CreateCameraDescriptorSetLayout() {
 	// Describe the binding of the descriptor set layout
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
 	uboLayoutBinding.pImmutableSamplers = nullptr;
@@ -223,11 +353,54 @@ void Renderer::CreateModelDescriptorSetLayout() {
 	}
 }
 
+void Renderer::CreateForestMaterialDescriptorSetLayout() {
+	// Same bindings as a model, but with the diffuse and normal maps of every tree group
+	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+	uboLayoutBinding.binding = 0;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorCount = 1;
+	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	uboLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding diffuseSamplerLayoutBinding = {};
+	diffuseSamplerLayoutBinding.binding = 1;
+	diffuseSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	diffuseSamplerLayoutBinding.descriptorCount = MAX_TREE_GROUPS;
+	diffuseSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	diffuseSamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding normalSamplerLayoutBinding = {};
+	normalSamplerLayoutBinding.binding = 2;
+	normalSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	normalSamplerLayoutBinding.descriptorCount = MAX_TREE_GROUPS;
+	normalSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	normalSamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding noiseSamplerLayoutBinding = {};
+	noiseSamplerLayoutBinding.binding = 3;
+	noiseSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	noiseSamplerLayoutBinding.descriptorCount = 1;
+	noiseSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	noiseSamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, diffuseSamplerLayoutBinding, normalSamplerLayoutBinding, noiseSamplerLayoutBinding };
+
+	// Create the descriptor set layout
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &forestMaterialDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+}
+
 void Renderer::CreateTimeDescriptorSetLayout() {
 	// Describe the binding of the descriptor set layout
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
 	;
@@ -250,7 +423,7 @@ void Renderer::CreateWindDescriptorSetLayout() {
 	// Describe the binding of the descriptor set layout
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
 	;
@@ -273,7 +446,7 @@ void Renderer::CreateDayNightDescriptorSetLayout() {
 	// Describe the binding of the descriptor set layout
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
 	;
@@ -352,49 +525,16 @@ void Renderer::CreateComputeDescriptorSetLayout() {
 }
 
 void Renderer::CreateCullingComputeDescriptorSetLayout() {
-	// TODO: Create the descriptor set layout for the compute pipeline
-	// Remember this is like a class definition stating why types of information
-	// will be stored at each binding
-	VkDescriptorSetLayoutBinding instanceBinding = {};
-	instanceBinding.binding = 0;
-	instanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	instanceBinding.descriptorCount = 1;
-	instanceBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	instanceBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding culledInstanceBinding[2] = {};
-	culledInstanceBinding[0].binding = 1;
-	culledInstanceBinding[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	culledInstanceBinding[0].descriptorCount = 1;
-	culledInstanceBinding[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	culledInstanceBinding[0].pImmutableSamplers = nullptr;
-
-	culledInstanceBinding[1].binding = 2;
-	culledInstanceBinding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	culledInstanceBinding[1].descriptorCount = 1;
-	culledInstanceBinding[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	culledInstanceBinding[1].pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding numInstanceBinding[3] = {};
-	numInstanceBinding[0].binding = 3;
-	numInstanceBinding[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	numInstanceBinding[0].descriptorCount = 1;
-	numInstanceBinding[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	numInstanceBinding[0].pImmutableSamplers = nullptr;
-
-	numInstanceBinding[1].binding = 4;
-	numInstanceBinding[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	numInstanceBinding[1].descriptorCount = 1;
-	numInstanceBinding[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	numInstanceBinding[1].pImmutableSamplers = nullptr;
-
-	numInstanceBinding[2].binding = 5;
-	numInstanceBinding[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	numInstanceBinding[2].descriptorCount = 1;
-	numInstanceBinding[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	numInstanceBinding[2].pImmutableSamplers = nullptr;
-
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { instanceBinding, culledInstanceBinding[0], culledInstanceBinding[1], numInstanceBinding[0], numInstanceBinding[1], numInstanceBinding[2] };
+	// Instances, their groups, culled instances of every level, indirect commands of every group, occluded instances
+	// for the late pass, the per group culling counters and the LOD state of every instance
+	std::vector<VkDescriptorSetLayoutBinding> bindings(7);
+	for (uint32_t j = 0; j < bindings.size(); j++) {
+		bindings[j].binding = j;
+		bindings[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[j].descriptorCount = 1;
+		bindings[j].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[j].pImmutableSamplers = nullptr;
+	}
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -407,33 +547,16 @@ void Renderer::CreateCullingComputeDescriptorSetLayout() {
 	}
 }
 
-void Renderer::CreateFakeCullingComputeDescriptorSetLayout() {
-	// TODO: Create the descriptor set layout for the compute pipeline
-	// Remember this is like a class definition stating why types of information
-	// will be stored at each binding
-	VkDescriptorSetLayoutBinding instanceBinding = {};
-	instanceBinding.binding = 0;
-	instanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	instanceBinding.descriptorCount = 1;
-	instanceBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	instanceBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding culledInstanceBinding = {};
-	culledInstanceBinding.binding = 1;
-	culledInstanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	culledInstanceBinding.descriptorCount = 1;
-	culledInstanceBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	culledInstanceBinding.pImmutableSamplers = nullptr;
-
-
-	VkDescriptorSetLayoutBinding numInstanceBinding = {};
-	numInstanceBinding.binding = 2;
-	numInstanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	numInstanceBinding.descriptorCount = 1;
-	numInstanceBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	numInstanceBinding.pImmutableSamplers = nullptr;
-
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { instanceBinding, culledInstanceBinding, numInstanceBinding };
+void Renderer::CreateDrawCompactionDescriptorSetLayout() {
+	// Indirect commands of every group, the compacted lists and their draw counts
+	std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+	for (uint32_t j = 0; j < bindings.size(); j++) {
+		bindings[j].binding = j;
+		bindings[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[j].descriptorCount = 1;
+		bindings[j].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[j].pImmutableSamplers = nullptr;
+	}
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -441,7 +564,7 @@ void Renderer::CreateFakeCullingComputeDescriptorSetLayout() {
 	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
 	layoutInfo.pBindings = bindings.data();
 
-	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &fakeCullingComputeDescriptorSetLayout) != VK_SUCCESS) {
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &drawCompactionDescriptorSetLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create descriptor set layout");
 	}
 }
@@ -502,7 +625,30 @@ void Renderer::CreateTerrainDescriptorSetLayout() {
 	normalSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	normalSamplerLayoutBinding.pImmutableSamplers = nullptr;
 
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, diffuseSamplerLayoutBinding, normalSamplerLayoutBinding };
+	// Quadtree levels and morph ranges
+	VkDescriptorSetLayoutBinding terrainLayoutBinding = {};
+	terrainLayoutBinding.binding = 3;
+	terrainLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	terrainLayoutBinding.descriptorCount = 1;
+	terrainLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	terrainLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding heightSamplerLayoutBinding = {};
+	heightSamplerLayoutBinding.binding = 4;
+	heightSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	heightSamplerLayoutBinding.descriptorCount = 1;
+	heightSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	heightSamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Normal and tangent of the heightfield
+	VkDescriptorSetLayoutBinding surfaceSamplerLayoutBinding = {};
+	surfaceSamplerLayoutBinding.binding = 5;
+	surfaceSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	surfaceSamplerLayoutBinding.descriptorCount = 1;
+	surfaceSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	surfaceSamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, diffuseSamplerLayoutBinding, normalSamplerLayoutBinding, terrainLayoutBinding, heightSamplerLayoutBinding, surfaceSamplerLayoutBinding };
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -518,7 +664,7 @@ void Renderer::CreateTerrainDescriptorSetLayout() {
 void Renderer::CreateLODInfoDescriptorSetLayout() {
 	VkDescriptorSetLayoutBinding LODInfoLayoutBinding = {};
 	LODInfoLayoutBinding.binding = 0;
-	LODInfoLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	LODInfoLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	LODInfoLayoutBinding.descriptorCount = 1;
 	LODInfoLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
 	LODInfoLayoutBinding.pImmutableSamplers = nullptr;
@@ -559,33 +705,160 @@ void Renderer::CreateGuiDescriptorSetLayout()
 	}
 }
 
+void Renderer::CreateDepthPyramidDescriptorSetLayout() {
+	// Level to reduce, the depth buffer for level 0
+	VkDescriptorSetLayoutBinding sourceBinding = {};
+	sourceBinding.binding = 0;
+	sourceBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sourceBinding.descriptorCount = 1;
+	sourceBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	sourceBinding.pImmutableSamplers = nullptr;
+
+	// Level to write
+	VkDescriptorSetLayoutBinding destinationBinding = {};
+	destinationBinding.binding = 1;
+	destinationBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	destinationBinding.descriptorCount = 1;
+	destinationBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	destinationBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { sourceBinding, destinationBinding };
+
+	// Create the descriptor set layout
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &depthPyramidDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+}
+
+void Renderer::CreateOcclusionDescriptorSetLayout() {
+	VkDescriptorSetLayoutBinding occlusionInfoBinding = {};
+	occlusionInfoBinding.binding = 0;
+	occlusionInfoBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	occlusionInfoBinding.descriptorCount = 1;
+	occlusionInfoBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	occlusionInfoBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding depthPyramidBinding = {};
+	depthPyramidBinding.binding = 1;
+	depthPyramidBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	depthPyramidBinding.descriptorCount = 1;
+	depthPyramidBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	depthPyramidBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { occlusionInfoBinding, depthPyramidBinding };
+
+	// Create the descriptor set layout
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &occlusionDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+}
+
+void Renderer::CreateMeshletCullingDescriptorSetLayouts() {
+	// Per frame: culled instances, indirect commands, meshlet commands and their draw counts, culling counters. Per
+	// batch: meshlets and the range of every model
+	const uint32_t bindingCounts[] = { 5, 2 };
+	VkDescriptorSetLayout* layouts[] = { &meshletCullingDescriptorSetLayout, &meshletDescriptorSetLayout };
+	for (int i = 0; i < 2; i++) {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(bindingCounts[i]);
+		for (uint32_t j = 0; j < bindings.size(); j++) {
+			bindings[j].binding = j;
+			bindings[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[j].descriptorCount = 1;
+			bindings[j].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			bindings[j].pImmutableSamplers = nullptr;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+
+		if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, layouts[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create descriptor set layout");
+		}
+	}
+}
+
+void Renderer::CreateLateCullingComputeDescriptorSetLayout() {
+	// Instances, their groups, occluded instances, late culled instances, late bark and leaf commands, culling counters
+	std::vector<VkDescriptorSetLayoutBinding> bindings(6);
+	for (uint32_t j = 0; j < bindings.size(); j++) {
+		bindings[j].binding = j;
+		bindings[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[j].descriptorCount = 1;
+		bindings[j].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[j].pImmutableSamplers = nullptr;
+	}
+
+	// Create the descriptor set layout
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &lateCullingComputeDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+}
+
 void Renderer::CreateDescriptorPool() {
 	// Describe which descriptor types that the descriptor sets will contain
 	std::vector<VkDescriptorPoolSize> poolSizes = {
 		// Camera
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC , 1 },
 
 		// Models + blades (diffuse, normal, noise)
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 3 * (static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size())) },
 
 		// Models + Blades
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size() + scene->GetLODInfoBuffer().size()) },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size()) },
+
+		// Forest materials, per draw kind (diffuse and normal of every group, noise)
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , TREE_DRAW_KIND_COUNT * (2 * MAX_TREE_GROUPS + 1) },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , TREE_DRAW_KIND_COUNT },
+
+		// LODInfo
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC , 1 },
 
 		// Time (compute)
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC , 1 },
 
 		// Compute
 		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 3 * (uint32_t)scene->GetBlades().size() },
 
-		// Culling Compute
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 6 * (uint32_t)scene->GetInstanceBuffer().size() },
+		// Culling Compute, per frame in flight
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 7 * MAX_FRAMES_IN_FLIGHT },
+
+		// Late Culling Compute, per frame in flight
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 6 * MAX_FRAMES_IN_FLIGHT },
+
+		// Draw compaction, per frame in flight
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 3 * MAX_FRAMES_IN_FLIGHT },
+
+		// Meshlet culling, per frame in flight and per bark and leaf batch
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 5 * MAX_FRAMES_IN_FLIGHT + 2 * 2 },
 
-		// Fake Culling Compute
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 3 * (uint32_t)scene->GetFakeInstanceBuffer().size() },
+		// Depth pyramid build, per frame in flight and level
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , MAX_DEPTH_PYRAMID_LEVELS * MAX_FRAMES_IN_FLIGHT },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE , MAX_DEPTH_PYRAMID_LEVELS * MAX_FRAMES_IN_FLIGHT },
 
-		// Terrain
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 2 },
+		// Occlusion info and depth pyramid, per frame in flight
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , MAX_FRAMES_IN_FLIGHT },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , MAX_FRAMES_IN_FLIGHT },
+
+		// Terrain (model and quadtree, diffuse, normal, height and surface)
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 2 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 4 },
 		
 		//skybox
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 3 }, 
@@ -594,10 +867,10 @@ void Renderer::CreateDescriptorPool() {
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 1 },
 
 		//Wind
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC , 1 },
 
 		//Day Night
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC , 1 },
 
 	};
 
@@ -605,7 +878,10 @@ void Renderer::CreateDescriptorPool() {
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = 37;//greater than 1*camera + 7*model + 2*model(faketrees) + 1*grass + 1*time + 1*compute + 1*terrain + 2*cullingCompute + 2*fakeCullingCompute + 4 * LODInfo + 1 * wind, 1 * daynight, 1*skybox+num**gui 
+	poolInfo.maxSets = 37 + TREE_DRAW_KIND_COUNT;//greater than 1*camera + 7*model + 2*model(faketrees) + 1*grass + 1*time + 1*compute + 1*terrain + 1 * LODInfo + 1 * wind, 1 * daynight, 1*skybox+num**gui + forest materials
+	// Depth pyramid levels, occlusion info, culling, late culling, draw compaction and meshlet culling, per frame in
+	// flight, and the meshlets of the bark and leaf batches
+	poolInfo.maxSets += MAX_FRAMES_IN_FLIGHT * (MAX_DEPTH_PYRAMID_LEVELS + 5) + 2;
 
 	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create descriptor pool");
@@ -628,8 +904,8 @@ void Renderer::CreateCameraDescriptorSet() {
 
 	// Configure the descriptors to refer to buffers
 	VkDescriptorBufferInfo cameraBufferInfo = {};
-	cameraBufferInfo.buffer = camera->GetBuffer();
-	cameraBufferInfo.offset = 0;
+	cameraBufferInfo.buffer = uniformRing->GetBuffer();
+	cameraBufferInfo.offset = camera->GetBufferOffset();
 	cameraBufferInfo.range = sizeof(CameraBufferObject);
 
 	std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
@@ -637,7 +913,7 @@ void Renderer::CreateCameraDescriptorSet() {
 	descriptorWrites[0].dstSet = cameraDescriptorSet;
 	descriptorWrites[0].dstBinding = 0;
 	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
 	descriptorWrites[0].pImageInfo = nullptr;
@@ -728,6 +1004,84 @@ void Renderer::CreateModelDescriptorSets() {
 	}
 }
 
+void Renderer::CreateForestMaterialDescriptorSets() {
+	std::vector<VkDescriptorSetLayout> layouts(TREE_DRAW_KIND_COUNT, forestMaterialDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = TREE_DRAW_KIND_COUNT;
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, forestMaterialDescriptorSets) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	const std::vector<TreeGroup>& groups = scene->GetTreeGroups();
+	for (int kind = 0; kind < TREE_DRAW_KIND_COUNT; kind++) {
+		// Model of every group for this kind, every mesh level uses the textures of the first. Fake trees have no bark
+		// or leaf and unused slots no group, they get the first model so every element of the arrays is valid
+		const Model* models[MAX_TREE_GROUPS];
+		const Model* fallback = nullptr;
+		for (uint32_t g = 0; g < MAX_TREE_GROUPS; g++) {
+			models[g] = nullptr;
+			if (g < groups.size() && kind == TREE_DRAW_BILLBOARD) {
+				models[g] = groups[g].billboard;
+			}
+			else if (g < groups.size() && !groups[g].levels.empty()) {
+				models[g] = kind == TREE_DRAW_BARK ? groups[g].levels[0].bark : groups[g].levels[0].leaf;
+			}
+			if (!fallback && models[g]) {
+				fallback = models[g];
+			}
+		}
+		if (!fallback) {
+			throw std::runtime_error("Forest has no tree models");
+		}
+
+		VkDescriptorImageInfo diffuseMapInfos[MAX_TREE_GROUPS];
+		VkDescriptorImageInfo normalMapInfos[MAX_TREE_GROUPS];
+		for (uint32_t g = 0; g < MAX_TREE_GROUPS; g++) {
+			const Model* model = models[g] ? models[g] : fallback;
+			diffuseMapInfos[g].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			diffuseMapInfos[g].imageView = model->GetDiffuseMapView();
+			diffuseMapInfos[g].sampler = model->GetDiffuseMapSampler();
+			normalMapInfos[g].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			normalMapInfos[g].imageView = model->GetNormalMapView();
+			normalMapInfos[g].sampler = model->GetNormalMapSampler();
+		}
+
+		// Model matrix, position quantization and noise are the same for every group
+		VkDescriptorBufferInfo modelBufferInfo = {};
+		modelBufferInfo.buffer = scene->GetModelBatch(TreeDrawKind(kind))->GetModelBuffer();
+		modelBufferInfo.offset = 0;
+		modelBufferInfo.range = sizeof(ModelBatchBufferObject);
+		VkDescriptorImageInfo noiseMapInfo = {};
+		noiseMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		noiseMapInfo.imageView = fallback->GetNoiseMapView();
+		noiseMapInfo.sampler = fallback->GetNoiseMapSampler();
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(4);
+		for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = forestMaterialDescriptorSets[kind];
+			descriptorWrites[j].dstBinding = j;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[j].descriptorCount = 1;
+		}
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].pBufferInfo = &modelBufferInfo;
+		descriptorWrites[1].descriptorCount = MAX_TREE_GROUPS;
+		descriptorWrites[1].pImageInfo = diffuseMapInfos;
+		descriptorWrites[2].descriptorCount = MAX_TREE_GROUPS;
+		descriptorWrites[2].pImageInfo = normalMapInfos;
+		descriptorWrites[3].pImageInfo = &noiseMapInfo;
+
+		// Update descriptor sets
+		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
 void Renderer::CreateGrassDescriptorSets() {
 	// TODO: Create Descriptor sets for the grass.
 	// This should involve creating descriptor sets which point to the model matrix of each group of grass blades
@@ -784,8 +1138,8 @@ void Renderer::CreateTimeDescriptorSet() {
 
 	// Configure the descriptors to refer to buffers
 	VkDescriptorBufferInfo timeBufferInfo = {};
-	timeBufferInfo.buffer = scene->GetTimeBuffer();
-	timeBufferInfo.offset = 0;
+	timeBufferInfo.buffer = uniformRing->GetBuffer();
+	timeBufferInfo.offset = scene->GetTimeBufferOffset();
 	timeBufferInfo.range = sizeof(Time);
 
 	std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
@@ -793,7 +1147,7 @@ void Renderer::CreateTimeDescriptorSet() {
 	descriptorWrites[0].dstSet = timeDescriptorSet;
 	descriptorWrites[0].dstBinding = 0;
 	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &timeBufferInfo;
 	descriptorWrites[0].pImageInfo = nullptr;
@@ -819,8 +1173,8 @@ void Renderer::CreateWindDescriptorSet() {
 
 	// Configure the descriptors to refer to buffers
 	VkDescriptorBufferInfo windBufferInfo = {};
-	windBufferInfo.buffer = scene->GetWindBuffer();
-	windBufferInfo.offset = 0;
+	windBufferInfo.buffer = uniformRing->GetBuffer();
+	windBufferInfo.offset = scene->GetWindBufferOffset();
 	windBufferInfo.range = sizeof(WindInfo);
 
 	std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
@@ -828,7 +1182,7 @@ void Renderer::CreateWindDescriptorSet() {
 	descriptorWrites[0].dstSet = windDescriptorSet;
 	descriptorWrites[0].dstBinding = 0;
 	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &windBufferInfo;
 	descriptorWrites[0].pImageInfo = nullptr;
@@ -854,8 +1208,8 @@ void Renderer::CreateDayNightDescriptorSet() {
 
 	// Configure the descriptors to refer to buffers
 	VkDescriptorBufferInfo dayNightBufferInfo = {};
-	dayNightBufferInfo.buffer = scene->GetDayNightBuffer();
-	dayNightBufferInfo.offset = 0;
+	dayNightBufferInfo.buffer = uniformRing->GetBuffer();
+	dayNightBufferInfo.offset = scene->GetDayNightBufferOffset();
 	dayNightBufferInfo.range = sizeof(DayNightInfo);
 
 	std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
@@ -863,7 +1217,7 @@ void Renderer::CreateDayNightDescriptorSet() {
 	descriptorWrites[0].dstSet = dayNightDescriptorSet;
 	descriptorWrites[0].dstBinding = 0;
 	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &dayNightBufferInfo;
 	descriptorWrites[0].pImageInfo = nullptr;
@@ -948,200 +1302,76 @@ void Renderer::CreateComputeDescriptorSets() {
 }
 
 void Renderer::CreateCullingComputeDescriptorSets() {
-	// TODO: Create Descriptor sets for the compute pipeline
-	// The descriptors should point to Storage buffers which will hold the grass blades, the culled grass blades, and the output number of grass blades 
-	cullingComputeDescriptorSets.resize(scene->GetInstanceBuffer().size());
-
-	// Describe the desciptor set
-	std::vector<VkDescriptorSetLayout> layouts;
-	for (int i = 0; i < scene->GetInstanceBuffer().size(); i++) {
-		layouts.push_back(cullingComputeDescriptorSetLayout);
-	}
+	// One set per frame in flight, every tree group is culled by the same dispatch
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, cullingComputeDescriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(cullingComputeDescriptorSets.size());
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
 	allocInfo.pSetLayouts = layouts.data();
 
 	// Allocate descriptor sets
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, cullingComputeDescriptorSets.data()) != VK_SUCCESS) {
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, cullingComputeDescriptorSets) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
 
-
-	for (uint32_t i = 0; i < scene->GetInstanceBuffer().size(); ++i) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(6);
-		//InstanceBuffer
-		VkDescriptorBufferInfo instanceDataBufferInfo = {};
-		instanceDataBufferInfo.buffer = scene->GetInstanceBuffer()[i]->GetInstanceDataBuffer();
-		instanceDataBufferInfo.offset = 0;
-		instanceDataBufferInfo.range = scene->GetInstanceBuffer()[i]->GetInstanceCount() * sizeof(InstanceData);
-
-		//CulledInstance Buffer LOD 0
-		VkDescriptorBufferInfo culledDataBufferInfo[2] = {};
-		culledDataBufferInfo[0].buffer = scene->GetInstanceBuffer()[i]->GetCulledInstanceDataBuffer(0);
-		culledDataBufferInfo[0].offset = 0;
-		culledDataBufferInfo[0].range = scene->GetInstanceBuffer()[i]->GetInstanceCount() * sizeof(InstanceData);
-
-		//CulledInstance Buffer LOD 1
-		culledDataBufferInfo[1].buffer = scene->GetInstanceBuffer()[i]->GetCulledInstanceDataBuffer(1);
-		culledDataBufferInfo[1].offset = 0;
-		culledDataBufferInfo[1].range = scene->GetInstanceBuffer()[i]->GetInstanceCount() * sizeof(InstanceData);
-
-		//Num of culled Instance Buffer
-		VkDescriptorBufferInfo numDataBufferInfo[3] = {};
-		// LOD 0 Leaf
-		numDataBufferInfo[0].buffer = scene->GetInstanceBuffer()[i]->GetNumInstanceDataBuffer(0);
-		numDataBufferInfo[0].offset = 0;
-		numDataBufferInfo[0].range = sizeof(VkDrawIndexedIndirectCommand);
-		// LOD 0 Bark
-		numDataBufferInfo[1].buffer = scene->GetInstanceBuffer()[i]->GetNumInstanceDataBuffer(1);
-		numDataBufferInfo[1].offset = 0;
-		numDataBufferInfo[1].range = sizeof(VkDrawIndexedIndirectCommand);
-		// LOD 1 Billboard
-		numDataBufferInfo[2].buffer = scene->GetInstanceBuffer()[i]->GetNumInstanceDataBuffer(2);
-		numDataBufferInfo[2].offset = 0;
-		numDataBufferInfo[2].range = sizeof(VkDrawIndexedIndirectCommand);
-
-
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = cullingComputeDescriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &instanceDataBufferInfo;
-		descriptorWrites[0].pImageInfo = nullptr;
-		descriptorWrites[0].pTexelBufferView = nullptr;
-
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = cullingComputeDescriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pBufferInfo = &culledDataBufferInfo[0];
-		descriptorWrites[1].pImageInfo = nullptr;
-		descriptorWrites[1].pTexelBufferView = nullptr;
-
-		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2].dstSet = cullingComputeDescriptorSets[i];
-		descriptorWrites[2].dstBinding = 2;
-		descriptorWrites[2].dstArrayElement = 0;
-		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[2].descriptorCount = 1;
-		descriptorWrites[2].pBufferInfo = &culledDataBufferInfo[1];
-		descriptorWrites[2].pImageInfo = nullptr;
-		descriptorWrites[2].pTexelBufferView = nullptr;
-
-		descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[3].dstSet = cullingComputeDescriptorSets[i];
-		descriptorWrites[3].dstBinding = 3;
-		descriptorWrites[3].dstArrayElement = 0;
-		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[3].descriptorCount = 1;
-		descriptorWrites[3].pBufferInfo = &numDataBufferInfo[0];
-		descriptorWrites[3].pImageInfo = nullptr;
-		descriptorWrites[3].pTexelBufferView = nullptr;
-
-		descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[4].dstSet = cullingComputeDescriptorSets[i];
-		descriptorWrites[4].dstBinding = 4;
-		descriptorWrites[4].dstArrayElement = 0;
-		descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[4].descriptorCount = 1;
-		descriptorWrites[4].pBufferInfo = &numDataBufferInfo[1];
-		descriptorWrites[4].pImageInfo = nullptr;
-		descriptorWrites[4].pTexelBufferView = nullptr;
-
-		descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[5].dstSet = cullingComputeDescriptorSets[i];
-		descriptorWrites[5].dstBinding = 5;
-		descriptorWrites[5].dstArrayElement = 0;
-		descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[5].descriptorCount = 1;
-		descriptorWrites[5].pBufferInfo = &numDataBufferInfo[2];
-		descriptorWrites[5].pImageInfo = nullptr;
-		descriptorWrites[5].pTexelBufferView = nullptr;
+	const ForestInstanceBuffer* forest = scene->GetForest();
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+		VkDescriptorBufferInfo bufferInfos[7] = {};
+		bufferInfos[0] = { forest->GetInstanceDataBuffer(), 0, VK_WHOLE_SIZE };
+		bufferInfos[1] = { forest->GetInstanceGroupBuffer(), 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { forest->GetCulledInstanceDataBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { forest->GetDrawCommandBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { forest->GetOccludedInstanceBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[5] = { forest->GetCullingStatsBuffer(frame), 0, VK_WHOLE_SIZE };
+		// Shared by every frame, culling passes run one after the other on the same queue
+		bufferInfos[6] = { forest->GetLodStateBuffer(), 0, VK_WHOLE_SIZE };
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(7);
+		for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = cullingComputeDescriptorSets[frame];
+			descriptorWrites[j].dstBinding = j;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+		}
 		// Update descriptor sets
 		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 	}
 }
 
-void Renderer::CreateFakeCullingComputeDescriptorSets() {
-	// TODO: Create Descriptor sets for the compute pipeline
-	// The descriptors should point to Storage buffers which will hold the grass blades, the culled grass blades, and the output number of grass blades 
-	fakeCullingComputeDescriptorSets.resize(scene->GetFakeInstanceBuffer().size());
-
-	// Describe the desciptor set
-	std::vector<VkDescriptorSetLayout> layouts;
-	for (int i = 0; i < scene->GetFakeInstanceBuffer().size(); i++) {
-		layouts.push_back(fakeCullingComputeDescriptorSetLayout);
-	}
+void Renderer::CreateDrawCompactionDescriptorSets() {
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, drawCompactionDescriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(fakeCullingComputeDescriptorSets.size());
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
 	allocInfo.pSetLayouts = layouts.data();
 
-	// Allocate descriptor sets
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, fakeCullingComputeDescriptorSets.data()) != VK_SUCCESS) {
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, drawCompactionDescriptorSets) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
 
+	const ForestInstanceBuffer* forest = scene->GetForest();
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+		VkDescriptorBufferInfo bufferInfos[3] = {};
+		bufferInfos[0] = { forest->GetDrawCommandBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[1] = { forest->GetCompactedDrawCommandBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { forest->GetDrawCountBuffer(frame), 0, VK_WHOLE_SIZE };
 
-	for (uint32_t i = 0; i < scene->GetFakeInstanceBuffer().size(); ++i) {
 		std::vector<VkWriteDescriptorSet> descriptorWrites(3);
-		//InstanceBuffer
-		VkDescriptorBufferInfo instanceDataBufferInfo = {};
-		instanceDataBufferInfo.buffer = scene->GetFakeInstanceBuffer()[i]->GetInstanceDataBuffer();
-		instanceDataBufferInfo.offset = 0;
-		instanceDataBufferInfo.range = scene->GetFakeInstanceBuffer()[i]->GetInstanceCount() * sizeof(InstanceData);
-
-		//CulledInstance Buffer
-		VkDescriptorBufferInfo culledDataBufferInfo = {};
-		culledDataBufferInfo.buffer = scene->GetFakeInstanceBuffer()[i]->GetCulledInstanceDataBuffer();
-		culledDataBufferInfo.offset = 0;
-		culledDataBufferInfo.range = scene->GetFakeInstanceBuffer()[i]->GetInstanceCount() * sizeof(InstanceData);
-
-		//Num of culled Instance Buffer
-		VkDescriptorBufferInfo numDataBufferInfo = {};
-		// LOD 0 Leaf
-		numDataBufferInfo.buffer = scene->GetFakeInstanceBuffer()[i]->GetNumInstanceDataBuffer();
-		numDataBufferInfo.offset = 0;
-		numDataBufferInfo.range = sizeof(VkDrawIndexedIndirectCommand);
-		
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = fakeCullingComputeDescriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &instanceDataBufferInfo;
-		descriptorWrites[0].pImageInfo = nullptr;
-		descriptorWrites[0].pTexelBufferView = nullptr;
-
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = fakeCullingComputeDescriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pBufferInfo = &culledDataBufferInfo;
-		descriptorWrites[1].pImageInfo = nullptr;
-		descriptorWrites[1].pTexelBufferView = nullptr;
-
-		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2].dstSet = fakeCullingComputeDescriptorSets[i];
-		descriptorWrites[2].dstBinding = 2;
-		descriptorWrites[2].dstArrayElement = 0;
-		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[2].descriptorCount = 1;
-		descriptorWrites[2].pBufferInfo = &numDataBufferInfo;
-		descriptorWrites[2].pImageInfo = nullptr;
-		descriptorWrites[2].pTexelBufferView = nullptr;
+		for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = drawCompactionDescriptorSets[frame];
+			descriptorWrites[j].dstBinding = j;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+		}
 
-		// Update descriptor sets
 		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 	}
 }
@@ -1218,7 +1448,7 @@ void Renderer::CreateTerrainDescriptorSet() {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
 
-	std::vector<VkWriteDescriptorSet> descriptorWrites(3);
+	std::vector<VkWriteDescriptorSet> descriptorWrites(6);
 
 	VkDescriptorBufferInfo modelBufferInfo = {};
 	modelBufferInfo.buffer = scene->GetTerrain()->GetModelBuffer();
@@ -1235,6 +1465,21 @@ void Renderer::CreateTerrainDescriptorSet() {
 	normalMapInfo.imageView = scene->GetTerrain()->GetNormalMapView();
 	normalMapInfo.sampler = scene->GetTerrain()->GetNormalMapSampler();
 
+	VkDescriptorBufferInfo terrainBufferInfo = {};
+	terrainBufferInfo.buffer = scene->GetTerrain()->GetTerrainBuffer();
+	terrainBufferInfo.offset = 0;
+	terrainBufferInfo.range = sizeof(TerrainBufferObject);
+
+	VkDescriptorImageInfo heightMapInfo = {};
+	heightMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	heightMapInfo.imageView = scene->GetTerrain()->GetHeightMapView();
+	heightMapInfo.sampler = scene->GetTerrain()->GetHeightMapSampler();
+
+	VkDescriptorImageInfo surfaceMapInfo = {};
+	surfaceMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	surfaceMapInfo.imageView = scene->GetTerrain()->GetSurfaceMapView();
+	surfaceMapInfo.sampler = scene->GetTerrain()->GetSurfaceMapSampler();
+
 	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	descriptorWrites[0].dstSet = terrainDescriptorSet;
 	descriptorWrites[0].dstBinding = 0;
@@ -1261,50 +1506,66 @@ void Renderer::CreateTerrainDescriptorSet() {
 	descriptorWrites[2].descriptorCount = 1;
 	descriptorWrites[2].pImageInfo = &normalMapInfo;
 
+	descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[3].dstSet = terrainDescriptorSet;
+	descriptorWrites[3].dstBinding = 3;
+	descriptorWrites[3].dstArrayElement = 0;
+	descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[3].descriptorCount = 1;
+	descriptorWrites[3].pBufferInfo = &terrainBufferInfo;
+
+	descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[4].dstSet = terrainDescriptorSet;
+	descriptorWrites[4].dstBinding = 4;
+	descriptorWrites[4].dstArrayElement = 0;
+	descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[4].descriptorCount = 1;
+	descriptorWrites[4].pImageInfo = &heightMapInfo;
+
+	descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[5].dstSet = terrainDescriptorSet;
+	descriptorWrites[5].dstBinding = 5;
+	descriptorWrites[5].dstArrayElement = 0;
+	descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[5].descriptorCount = 1;
+	descriptorWrites[5].pImageInfo = &surfaceMapInfo;
+
 	// Update descriptor sets
 	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 void Renderer::CreateLODInfoDescriptorSets() {
-	LODInfoDescriptorSets.resize(scene->GetLODInfoBuffer().size());
-	
 	// Describe the desciptor set
-	std::vector<VkDescriptorSetLayout> layouts;
-	for (int i = 0; i < scene->GetLODInfoBuffer().size(); ++i) {
-		layouts.push_back(LODInfoDescriptorSetLayout);
-	}
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(LODInfoDescriptorSets.size());
-	allocInfo.pSetLayouts = layouts.data();
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &LODInfoDescriptorSetLayout;
 
 	// Allocate descriptor set
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, LODInfoDescriptorSets.data()) != VK_SUCCESS) {
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &LODInfoDescriptorSet) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
 
-	for (uint32_t i = 0; i < scene->GetLODInfoBuffer().size(); ++i) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(1);
-
-		VkDescriptorBufferInfo LODBufferInfo = {};
-		LODBufferInfo.buffer = scene->GetLODInfoBuffer()[i];
-		LODBufferInfo.offset = 0;
-		LODBufferInfo.range = sizeof(glm::vec4);
+	// The whole LOD table, shaders index it with the tree group
+	VkDescriptorBufferInfo LODBufferInfo = {};
+	LODBufferInfo.buffer = uniformRing->GetBuffer();
+	LODBufferInfo.offset = scene->GetLODInfoBufferOffset();
+	LODBufferInfo.range = sizeof(LODInfo) * MAX_TREE_GROUPS;
 
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = LODInfoDescriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &LODBufferInfo;
-		descriptorWrites[0].pImageInfo = nullptr;
-		descriptorWrites[0].pTexelBufferView = nullptr;
+	std::vector<VkWriteDescriptorSet> descriptorWrites(1);
+	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[0].dstSet = LODInfoDescriptorSet;
+	descriptorWrites[0].dstBinding = 0;
+	descriptorWrites[0].dstArrayElement = 0;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	descriptorWrites[0].descriptorCount = 1;
+	descriptorWrites[0].pBufferInfo = &LODBufferInfo;
+	descriptorWrites[0].pImageInfo = nullptr;
+	descriptorWrites[0].pTexelBufferView = nullptr;
 
-		// Update descriptor sets
-		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-	}
+	// Update descriptor sets
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 void Renderer::CreateGuiDescriptorSets()
@@ -1341,6 +1602,200 @@ void Renderer::CreateGuiDescriptorSets()
 	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
+void Renderer::CreateDepthPyramidDescriptorSets() {
+	depthPyramidDescriptorSets.resize(MAX_DEPTH_PYRAMID_LEVELS * MAX_FRAMES_IN_FLIGHT);
+
+	// Allocated for the deepest pyramid, only the levels the current one has are written and used
+	std::vector<VkDescriptorSetLayout> layouts(depthPyramidDescriptorSets.size(), depthPyramidDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(depthPyramidDescriptorSets.size());
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, depthPyramidDescriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+}
+
+void Renderer::CreateOcclusionDescriptorSets() {
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, occlusionDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, occlusionDescriptorSets) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	// The pyramid itself is written by UpdateDepthPyramidDescriptorSets
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		VkDescriptorBufferInfo occlusionInfo = {};
+		occlusionInfo.buffer = occlusionInfoBuffers[frame];
+		occlusionInfo.offset = 0;
+		occlusionInfo.range = sizeof(OcclusionInfo);
+
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = occlusionDescriptorSets[frame];
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pBufferInfo = &occlusionInfo;
+
+		vkUpdateDescriptorSets(logicalDevice, 1, &descriptorWrite, 0, nullptr);
+	}
+}
+
+void Renderer::CreateMeshletCullingDescriptorSets() {
+	// One set per frame in flight and one per batch
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, meshletCullingDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, meshletCullingDescriptorSets) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	layouts.assign(2, meshletDescriptorSetLayout);
+	allocInfo.descriptorSetCount = 2;
+	allocInfo.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, meshletDescriptorSets) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	const ForestInstanceBuffer* forest = scene->GetForest();
+	std::vector<VkDescriptorBufferInfo> bufferInfos;
+	bufferInfos.reserve(5 * MAX_FRAMES_IN_FLIGHT + 2 * 2);
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	auto write = [&](VkDescriptorSet set, uint32_t binding, VkBuffer buffer) {
+		bufferInfos.push_back({ buffer, 0, VK_WHOLE_SIZE });
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = set;
+		descriptorWrite.dstBinding = binding;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pBufferInfo = &bufferInfos.back();
+		descriptorWrites.push_back(descriptorWrite);
+	};
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+		write(meshletCullingDescriptorSets[frame], 0, forest->GetCulledInstanceDataBuffer(frame));
+		write(meshletCullingDescriptorSets[frame], 1, forest->GetDrawCommandBuffer(frame));
+		write(meshletCullingDescriptorSets[frame], 2, forest->GetMeshletCommandBuffer(frame));
+		write(meshletCullingDescriptorSets[frame], 3, forest->GetMeshletDrawCountBuffer(frame));
+		write(meshletCullingDescriptorSets[frame], 4, forest->GetCullingStatsBuffer(frame));
+	}
+	for (int kind = TREE_DRAW_BARK; kind <= TREE_DRAW_LEAF; kind++) {
+		const ModelBatch* batch = scene->GetModelBatch(TreeDrawKind(kind));
+		write(meshletDescriptorSets[kind], 0, batch->GetMeshletBuffer());
+		write(meshletDescriptorSets[kind], 1, batch->GetMeshletRangeBuffer());
+	}
+
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void Renderer::CreateLateCullingComputeDescriptorSets() {
+	// One set per frame in flight
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, lateCullingComputeDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, lateCullingComputeDescriptorSets) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	const ForestInstanceBuffer* forest = scene->GetForest();
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+		VkDescriptorBufferInfo bufferInfos[6] = {};
+		bufferInfos[0] = { forest->GetInstanceDataBuffer(), 0, VK_WHOLE_SIZE };
+		bufferInfos[1] = { forest->GetInstanceGroupBuffer(), 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { forest->GetOccludedInstanceBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { forest->GetLateCulledInstanceDataBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { forest->GetLateDrawCommandBuffer(frame), 0, VK_WHOLE_SIZE };
+		bufferInfos[5] = { forest->GetCullingStatsBuffer(frame), 0, VK_WHOLE_SIZE };
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(6);
+		for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = lateCullingComputeDescriptorSets[frame];
+			descriptorWrites[j].dstBinding = j;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+		}
+
+		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void Renderer::UpdateDepthPyramidDescriptorSets() {
+	std::vector<VkDescriptorImageInfo> imageInfos;
+	imageInfos.reserve(MAX_FRAMES_IN_FLIGHT * (2 * depthPyramidLevels + 1));
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+			VkDescriptorSet descriptorSet = depthPyramidDescriptorSets[frame * MAX_DEPTH_PYRAMID_LEVELS + level];
+
+			// Level 0 reduces the depth buffer, every other level the one above it
+			VkDescriptorImageInfo sourceInfo = {};
+			sourceInfo.sampler = depthPyramidSampler;
+			sourceInfo.imageView = level == 0 ? depthImageView : depthPyramidLevelViews[frame][level - 1];
+			sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos.push_back(sourceInfo);
+
+			VkWriteDescriptorSet sourceWrite = {};
+			sourceWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			sourceWrite.dstSet = descriptorSet;
+			sourceWrite.dstBinding = 0;
+			sourceWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			sourceWrite.descriptorCount = 1;
+			sourceWrite.pImageInfo = &imageInfos.back();
+			descriptorWrites.push_back(sourceWrite);
+
+			VkDescriptorImageInfo destinationInfo = {};
+			destinationInfo.imageView = depthPyramidLevelViews[frame][level];
+			destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos.push_back(destinationInfo);
+
+			VkWriteDescriptorSet destinationWrite = sourceWrite;
+			destinationWrite.dstBinding = 1;
+			destinationWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			destinationWrite.pImageInfo = &imageInfos.back();
+			descriptorWrites.push_back(destinationWrite);
+		}
+
+		VkDescriptorImageInfo pyramidInfo = {};
+		pyramidInfo.sampler = depthPyramidSampler;
+		pyramidInfo.imageView = depthPyramidViews[frame];
+		pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos.push_back(pyramidInfo);
+
+		VkWriteDescriptorSet pyramidWrite = {};
+		pyramidWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		pyramidWrite.dstSet = occlusionDescriptorSets[frame];
+		pyramidWrite.dstBinding = 1;
+		pyramidWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		pyramidWrite.descriptorCount = 1;
+		pyramidWrite.pImageInfo = &imageInfos.back();
+		descriptorWrites.push_back(pyramidWrite);
+	}
+
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
 void Renderer::CreateGraphicsPipeline() {
 	VkShaderModule vertShaderModule = ShaderModule::Create("shaders/graphics.vert.spv", logicalDevice);
 	VkShaderModule fragShaderModule = ShaderModule::Create("shaders/graphics.frag.spv", logicalDevice);
@@ -1531,8 +1986,8 @@ void Renderer::CreateBarkPipeline() {
 	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
 	std::vector<VkVertexInputAttributeDescription> instanceDescriptions;
 
-	bindingDescriptions = { Vertex::getBindingDescription(),InstanceData::getBindingDescription()};
-	attributeDescriptions = Vertex::getAttributeDescriptions();
+	bindingDescriptions = { GetVertexBindingDescription(TREE_VERTEX_FORMAT), InstanceData::getBindingDescription() };
+	attributeDescriptions = GetVertexAttributeDescriptions(TREE_VERTEX_FORMAT);
 	instanceDescriptions = InstanceData::getAttributeDescriptions();
 	for (int i = 0; i < instanceDescriptions.size(); i++)
 		attributeDescriptions.push_back(instanceDescriptions[i]);
@@ -1628,7 +2083,7 @@ void Renderer::CreateBarkPipeline() {
 	colorBlending.blendConstants[2] = 0.0f;
 	colorBlending.blendConstants[3] = 0.0f;
 
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, modelDescriptorSetLayout, timeDescriptorSetLayout , LODInfoDescriptorSetLayout, dayNightDescriptorSetLayout, windDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, forestMaterialDescriptorSetLayout, timeDescriptorSetLayout , LODInfoDescriptorSetLayout, dayNightDescriptorSetLayout, windDescriptorSetLayout };
 
 	// Pipeline layout: used to specify uniform values
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
@@ -1698,8 +2153,8 @@ void Renderer::CreateLeafPipeline() {
 	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
 	std::vector<VkVertexInputAttributeDescription> instanceDescriptions;
 
-	bindingDescriptions = { Vertex::getBindingDescription() };
-	attributeDescriptions = Vertex::getAttributeDescriptions();
+	bindingDescriptions = { GetVertexBindingDescription(TREE_VERTEX_FORMAT), InstanceData::getBindingDescription() };
+	attributeDescriptions = GetVertexAttributeDescriptions(TREE_VERTEX_FORMAT);
 	instanceDescriptions = InstanceData::getAttributeDescriptions();
 	for (int i = 0; i < instanceDescriptions.size(); i++)
 		attributeDescriptions.push_back(instanceDescriptions[i]);
@@ -1795,7 +2250,7 @@ void Renderer::CreateLeafPipeline() {
 	colorBlending.blendConstants[2] = 0.0f;
 	colorBlending.blendConstants[3] = 0.0f;
 
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, modelDescriptorSetLayout, timeDescriptorSetLayout , LODInfoDescriptorSetLayout, dayNightDescriptorSetLayout, windDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, forestMaterialDescriptorSetLayout, timeDescriptorSetLayout , LODInfoDescriptorSetLayout, dayNightDescriptorSetLayout, windDescriptorSetLayout };
 
 	// Pipeline layout: used to specify uniform values
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
@@ -1961,7 +2416,7 @@ void Renderer::CreateBillboardPipeline() {
 	colorBlending.blendConstants[2] = 0.0f;
 	colorBlending.blendConstants[3] = 0.0f;
 
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, modelDescriptorSetLayout, timeDescriptorSetLayout , LODInfoDescriptorSetLayout, dayNightDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, forestMaterialDescriptorSetLayout, timeDescriptorSetLayout , LODInfoDescriptorSetLayout, dayNightDescriptorSetLayout };
 
 	// Pipeline layout: used to specify uniform values
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
@@ -2364,6 +2819,7 @@ void Renderer::CreateComputePipeline() {
 	computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
 	computeShaderStageInfo.module = computeShaderModule;
 	computeShaderStageInfo.pName = "main";
+	computeShaderStageInfo.pSpecializationInfo = &WORKGROUP_SIZE_SPECIALIZATION;
 
 	// TODO: Add the compute dsecriptor set layout you create to this list
 	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, computeDescriptorSetLayout };
@@ -2407,9 +2863,10 @@ void Renderer::CreateCullingComputePipeline() {
 	computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
 	computeShaderStageInfo.module = computeShaderModule;
 	computeShaderStageInfo.pName = "main";
+	computeShaderStageInfo.pSpecializationInfo = &WORKGROUP_SIZE_SPECIALIZATION;
 
 	// TODO: Add the compute dsecriptor set layout you create to this list
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, cullingComputeDescriptorSetLayout, LODInfoDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, cullingComputeDescriptorSetLayout, LODInfoDescriptorSetLayout, occlusionDescriptorSetLayout };
 
 	// Create pipeline layout
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
@@ -2441,18 +2898,161 @@ void Renderer::CreateCullingComputePipeline() {
 	vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
 }
 
-void Renderer::CreateFakeCullingComputePipeline() {
+void Renderer::CreateDrawCompactionPipeline() {
 	// Set up programmable shaders
-	VkShaderModule computeShaderModule = ShaderModule::Create("shaders/fakeCullingCompute.comp.spv", logicalDevice);
+	VkShaderModule computeShaderModule = ShaderModule::Create("shaders/drawCompaction.comp.spv", logicalDevice);
+
+	// Level 0 instances the meshlet draws take over
+	const uint32_t meshletInstances = meshletCulling ? MESHLET_INSTANCES : 0;
+	const VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(uint32_t) };
+	const VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(uint32_t), &meshletInstances };
 
 	VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
 	computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
 	computeShaderStageInfo.module = computeShaderModule;
 	computeShaderStageInfo.pName = "main";
+	computeShaderStageInfo.pSpecializationInfo = &specializationInfo;
 
-	// TODO: Add the compute dsecriptor set layout you create to this list
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, fakeCullingComputeDescriptorSetLayout, LODInfoDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { drawCompactionDescriptorSetLayout, LODInfoDescriptorSetLayout };
+
+	// Create pipeline layout
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = 0;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &drawCompactionPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	// Create compute pipeline
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = computeShaderStageInfo;
+	pipelineInfo.layout = drawCompactionPipelineLayout;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.flags = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &drawCompactionPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create compute pipeline");
+	}
+
+	// No need for shader modules anymore
+	vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+}
+
+void Renderer::CreateMeshletCullingPipeline() {
+	// Set up programmable shaders
+	VkShaderModule computeShaderModule = ShaderModule::Create("shaders/meshletCulling.comp.spv", logicalDevice);
+
+	const uint32_t meshletInstances = MESHLET_INSTANCES;
+	const VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(uint32_t) };
+	const VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(uint32_t), &meshletInstances };
+
+	VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+	computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeShaderStageInfo.module = computeShaderModule;
+	computeShaderStageInfo.pName = "main";
+	computeShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, meshletCullingDescriptorSetLayout, meshletDescriptorSetLayout, LODInfoDescriptorSetLayout };
+
+	// Draw kind and size of its command region
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(MeshletCullingParameters);
+
+	// Create pipeline layout
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &meshletCullingPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	// Create compute pipeline
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = computeShaderStageInfo;
+	pipelineInfo.layout = meshletCullingPipelineLayout;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.flags = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &meshletCullingPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create compute pipeline");
+	}
+
+	// No need for shader modules anymore
+	vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+}
+
+void Renderer::CreateDepthPyramidPipeline() {
+	// Set up programmable shaders
+	VkShaderModule computeShaderModule = ShaderModule::Create("shaders/depthPyramid.comp.spv", logicalDevice);
+
+	VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+	computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeShaderStageInfo.module = computeShaderModule;
+	computeShaderStageInfo.pName = "main";
+
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { depthPyramidDescriptorSetLayout };
+
+	// Create pipeline layout
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = 0;
+
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &depthPyramidPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	// Create compute pipeline
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = computeShaderStageInfo;
+	pipelineInfo.layout = depthPyramidPipelineLayout;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.flags = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &depthPyramidPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create compute pipeline");
+	}
+
+	// No need for shader modules anymore
+	vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+}
+
+void Renderer::CreateLateCullingComputePipeline() {
+	// Set up programmable shaders
+	VkShaderModule computeShaderModule = ShaderModule::Create("shaders/lateCullingCompute.comp.spv", logicalDevice);
+
+	VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+	computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computeShaderStageInfo.module = computeShaderModule;
+	computeShaderStageInfo.pName = "main";
+	computeShaderStageInfo.pSpecializationInfo = &WORKGROUP_SIZE_SPECIALIZATION;
+
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, lateCullingComputeDescriptorSetLayout, occlusionDescriptorSetLayout, LODInfoDescriptorSetLayout };
 
 	// Create pipeline layout
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
@@ -2462,7 +3062,7 @@ void Renderer::CreateFakeCullingComputePipeline() {
 	pipelineLayoutInfo.pushConstantRangeCount = 0;
 	pipelineLayoutInfo.pPushConstantRanges = 0;
 
-	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &fakeCullingComputePipelineLayout) != VK_SUCCESS) {
+	if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &lateCullingComputePipelineLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create pipeline layout");
 	}
 
@@ -2470,13 +3070,13 @@ void Renderer::CreateFakeCullingComputePipeline() {
 	VkComputePipelineCreateInfo pipelineInfo = {};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
 	pipelineInfo.stage = computeShaderStageInfo;
-	pipelineInfo.layout = fakeCullingComputePipelineLayout;
+	pipelineInfo.layout = lateCullingComputePipelineLayout;
 	pipelineInfo.pNext = nullptr;
 	pipelineInfo.flags = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
 
-	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &fakeCullingComputePipeline) != VK_SUCCESS) {
+	if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &lateCullingComputePipeline) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create compute pipeline");
 	}
 
@@ -2509,11 +3109,22 @@ void Renderer::CreateTerrainPipeline() {
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	// The grid patch, then the selected chunks one per instance
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = { Vertex::getBindingDescription(), {} };
+	bindingDescriptions[1].binding = 1;
+	bindingDescriptions[1].stride = sizeof(TerrainChunk);
+	bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	// Only the patch position is read, the chunk follows the locations Vertex uses
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
+	attributeDescriptions[0] = Vertex::getAttributeDescriptions()[0];
+	attributeDescriptions[1].binding = 1;
+	attributeDescriptions[1].location = 6;
+	attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	attributeDescriptions[1].offset = offsetof(TerrainChunk, offsetSizeLevel);
+
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -2834,14 +3445,14 @@ void Renderer::CreateFrameResources() {
 		}
 	}
 
-	VkFormat depthFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	VkFormat depthFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 	// CREATE DEPTH IMAGE
 	Image::Create(device,
 		swapChain->GetVkExtent().width,
 		swapChain->GetVkExtent().height,
 		depthFormat,
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		depthImage,
 		depthImageMemory
@@ -2875,6 +3486,89 @@ void Renderer::CreateFrameResources() {
 		}
 
 	}
+
+	// CREATE DEPTH PYRAMIDS
+	// Level 0 is the largest power of two that fits, so every further level halves the previous one exactly
+	depthPyramidWidth = PreviousPowerOfTwo(swapChain->GetVkExtent().width);
+	depthPyramidHeight = PreviousPowerOfTwo(swapChain->GetVkExtent().height);
+	depthPyramidLevels = 1;
+	while (depthPyramidLevels < MAX_DEPTH_PYRAMID_LEVELS && (std::max(depthPyramidWidth, depthPyramidHeight) >> depthPyramidLevels) > 0) {
+		depthPyramidLevels++;
+	}
+
+	// Built on the graphics queue and read by the culling queue
+	std::vector<uint32_t> queueFamilies = { device->GetQueueIndex(QueueFlags::Graphics) };
+	if (asyncCompute) {
+		queueFamilies.push_back(device->GetQueueIndex(QueueFlags::Compute));
+	}
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		Image::CreateMipmapped(device, depthPyramidWidth, depthPyramidHeight, depthPyramidLevels, VK_FORMAT_R32_SFLOAT,
+			VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			queueFamilies, depthPyramids[frame], depthPyramidMemories[frame]);
+		depthPyramidViews[frame] = Image::CreateMipView(device, depthPyramids[frame], VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, depthPyramidLevels);
+		depthPyramidLevelViews[frame].resize(depthPyramidLevels);
+		for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+			depthPyramidLevelViews[frame][level] = Image::CreateMipView(device, depthPyramids[frame], VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+		}
+	}
+
+	// The pyramids stay in the general layout. Until one is built it holds the far plane, so nothing counts as occluded
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = graphicsCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffers");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	VkImageSubresourceRange range = {};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = depthPyramidLevels;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+	VkClearColorValue farPlane = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = depthPyramids[frame];
+		barrier.subresourceRange = range;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		vkCmdClearColorImage(commandBuffer, depthPyramids[frame], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &farPlane, 1, &range);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
+
+	vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, 1, &commandBuffer);
+
+	UpdateDepthPyramidDescriptorSets();
 }
 
 void Renderer::DestroyFrameResources() {
@@ -2883,15 +3577,26 @@ void Renderer::DestroyFrameResources() {
 	}
 
 	vkDestroyImageView(logicalDevice, depthImageView, nullptr);
-	vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
-	vkDestroyImage(logicalDevice, depthImage, nullptr);
+	Image::Destroy(device, depthImage);
 
 	for (size_t i = 0; i < framebuffers.size(); i++) {
 		vkDestroyFramebuffer(logicalDevice, framebuffers[i], nullptr);
 	}
+
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		for (VkImageView view : depthPyramidLevelViews[frame]) {
+			vkDestroyImageView(logicalDevice, view, nullptr);
+		}
+		depthPyramidLevelViews[frame].clear();
+		vkDestroyImageView(logicalDevice, depthPyramidViews[frame], nullptr);
+		Image::Destroy(device, depthPyramids[frame]);
+	}
 }
 
 void Renderer::RecreateFrameResources() {
+	// Command buffers of the frames in flight may still be executing
+	vkDeviceWaitIdle(logicalDevice);
+
 	vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, grassPipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, barkPipeline, nullptr);
@@ -2910,6 +3615,13 @@ void Renderer::RecreateFrameResources() {
 
 
 	vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+	// The culling command buffers sample the depth pyramids, whose descriptors are rewritten below
+	vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
+	vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(cullingReuseCommandBuffers.size()), cullingReuseCommandBuffers.data());
+	// New pyramids start out empty, every slot culls again before it reuses anything
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		culledInputsValid[frame] = false;
+	}
 
 	DestroyFrameResources();
 	CreateFrameResources();
@@ -2921,162 +3633,428 @@ void Renderer::RecreateFrameResources() {
 	CreateSkyboxPipeline();
 	CreateTerrainPipeline();
 	RecordCommandBuffers();
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		RecordComputeCommandBuffer(frame);
+		RecordCullingReuseCommandBuffer(frame);
+	}
 }
 
-void Renderer::RecordComputeCommandBuffer() {
-	// Specify the command pool and number of buffers to allocate
+void Renderer::RecordCullingOutputBarrier(VkCommandBuffer commandBuffer, uint32_t frame, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+	VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex) {
+	// Culled instances and indirect commands of the forest for this frame, plus the occluded trees and counters the
+	// late culling pass picks up on the graphics queue and the meshlet commands
+	const ForestInstanceBuffer* forest = scene->GetForest();
+	std::vector<VkBuffer> buffers = {
+		forest->GetCulledInstanceDataBuffer(frame),
+		forest->GetDrawCommandBuffer(frame),
+		forest->GetCompactedDrawCommandBuffer(frame),
+		forest->GetDrawCountBuffer(frame),
+		forest->GetOccludedInstanceBuffer(frame),
+		forest->GetCullingStatsBuffer(frame),
+		forest->GetMeshletCommandBuffer(frame),
+		forest->GetMeshletDrawCountBuffer(frame)
+	};
+
+	std::vector<VkBufferMemoryBarrier> barriers(buffers.size());
+	for (size_t j = 0; j < buffers.size(); ++j) {
+		barriers[j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barriers[j].srcAccessMask = srcAccessMask;
+		barriers[j].dstAccessMask = dstAccessMask;
+		barriers[j].srcQueueFamilyIndex = srcQueueFamilyIndex;
+		barriers[j].dstQueueFamilyIndex = dstQueueFamilyIndex;
+		barriers[j].buffer = buffers[j];
+		barriers[j].offset = 0;
+		barriers[j].size = VK_WHOLE_SIZE;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void Renderer::ReleaseCullingOutputsToCompute() {
+	// The indirect commands were uploaded on the graphics queue. Give every frame's outputs to the compute
+	// queue once, so the steady state is always "compute acquires, graphics acquires, graphics releases". The static
+	// culling inputs are shared by both queue families (BUFFER_SHARING_GRAPHICS_COMPUTE) and never change hands
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = computeCommandPool;
+	allocInfo.commandPool = graphicsCommandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	allocInfo.commandBufferCount = 1;
 
-	if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeCommandBuffer) != VK_SUCCESS) {
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate command buffers");
 	}
 
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-	beginInfo.pInheritanceInfo = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-	// ~ Start recording ~
-	if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to begin recording compute command buffer");
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		RecordCullingOutputBarrier(commandBuffer, frame, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, 0, device->GetQueueIndex(QueueFlags::Graphics), device->GetQueueIndex(QueueFlags::Compute));
 	}
+	vkEndCommandBuffer(commandBuffer);
 
-#if LOD_FRUSTUM_CULLING
-
-	std::vector<VkBufferMemoryBarrier> barriers(scene->GetInstanceBuffer().size() * 3 + scene->GetFakeInstanceBuffer().size());
-	for (uint32_t j = 0; j < scene->GetInstanceBuffer().size(); ++j) {
-		barriers[3 * j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[3 * j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[3 * j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[3 * j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[3 * j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[3 * j].buffer = scene->GetInstanceBuffer()[j]->GetNumInstanceDataBuffer(0);
-		barriers[3 * j].offset = 0;
-		barriers[3 * j].size = sizeof(VkDrawIndexedIndirectCommand);
-
-		barriers[3 * j + 1].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[3 * j + 1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[3 * j + 1].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[3 * j + 1].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[3 * j + 1].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[3 * j + 1].buffer = scene->GetInstanceBuffer()[j]->GetNumInstanceDataBuffer(1);
-		barriers[3 * j + 1].offset = 0;
-		barriers[3 * j + 1].size = sizeof(VkDrawIndexedIndirectCommand);
-
-		barriers[3 * j + 2].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[3 * j + 2].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[3 * j + 2].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[3 * j + 2].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[3 * j + 2].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[3 * j + 2].buffer = scene->GetInstanceBuffer()[j]->GetNumInstanceDataBuffer(2);
-		barriers[3 * j + 2].offset = 0;
-		barriers[3 * j + 2].size = sizeof(VkDrawIndexedIndirectCommand);
-	}
-
-// Fake Trees Barriers
-	for (uint32_t j = 0; j < scene->GetFakeInstanceBuffer().size(); ++j) {
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].buffer = scene->GetFakeInstanceBuffer()[j]->GetNumInstanceDataBuffer();
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].offset = 0;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].size = sizeof(VkDrawIndexedIndirectCommand);
-	}
-
-	vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
-
-//Real Trees LOD
-	// Bind to the compute pipeline
-	vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipeline);
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
 
-	// Bind camera descriptor set
-	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+	vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, 1, &commandBuffer);
+}
 
-	// Bind descriptor set for time uniforms
-	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 1, 1, &timeDescriptorSet, 0, nullptr);
+void Renderer::CreateVisibleCountBuffers() {
+	// Copy of the forest's indirect commands, the instance counts are the visible trees of every group and level
+	VkDeviceSize size = TREE_DRAW_SLOT_COUNT * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand);
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		VkDeviceMemory memory;
+		BufferUtils::CreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, visibleCountBuffers[frame], memory);
+		visibleCountData[frame] = static_cast<VkDrawIndexedIndirectCommand*>(BufferUtils::MapBuffer(device, visibleCountBuffers[frame]));
+		memset(visibleCountData[frame], 0, static_cast<size_t>(size));
+	}
+}
 
-	for (int i = 0; i < scene->GetInstanceBuffer().size(); ++i) {
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 2, 1, &cullingComputeDescriptorSets[i], 0, nullptr);
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 3, 1, &LODInfoDescriptorSets[i], 0, nullptr);
-		vkCmdDispatch(computeCommandBuffer, (int)(scene->GetInstanceBuffer()[i]->GetInstanceCount() / WORKGROUP_SIZE + 1), 1, 1);
+void Renderer::CreateTerrainChunkBuffers() {
+	const Terrain* terrain = scene->GetTerrain();
+	VkDeviceSize size = terrain->GetMaxChunkCount() * sizeof(TerrainChunk);
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		VkDeviceMemory memory;
+		BufferUtils::CreateBuffer(device, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, terrainChunkBuffers[frame], memory);
+		terrainChunkData[frame] = static_cast<TerrainChunk*>(BufferUtils::MapBuffer(device, terrainChunkBuffers[frame]));
+
+		BufferUtils::CreateBuffer(device, sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, terrainDrawBuffers[frame], memory);
+		terrainDrawData[frame] = static_cast<VkDrawIndexedIndirectCommand*>(BufferUtils::MapBuffer(device, terrainDrawBuffers[frame]));
+		// Nothing is drawn until a frame has selected its chunks
+		terrainDrawData[frame]->indexCount = static_cast<uint32_t>(terrain->getIndices().size());
+		terrainDrawData[frame]->instanceCount = 0;
+		terrainDrawData[frame]->firstIndex = 0;
+		terrainDrawData[frame]->vertexOffset = 0;
+		terrainDrawData[frame]->firstInstance = 0;
 	}
-	// TODO: For each group of blades bind its descriptor set and dispatch
-	/*for (int i = 0; i < scene->GetBlades().size(); ++i) {
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 2, 1, &computeDescriptorSets[i], 0, nullptr);
-		vkCmdDispatch(computeCommandBuffer, (int)(NUM_BLADES / WORKGROUP_SIZE + 1), 1, 1);
-	}*/
+}
 
-// Fake Trees
-	// Bind to the compute pipeline
-	vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fakeCullingComputePipeline);
+void Renderer::RecordVisibleCountCopy(VkCommandBuffer commandBuffer, uint32_t frame) {
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy region = {};
+	region.srcOffset = 0;
+	region.dstOffset = 0;
+	region.size = TREE_DRAW_SLOT_COUNT * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdCopyBuffer(commandBuffer, scene->GetForest()->GetDrawCommandBuffer(frame), visibleCountBuffers[frame], 1, &region);
+
+	// Host reads it after the frame's fence
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
 
-	// Bind camera descriptor set
-	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fakeCullingComputePipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+void Renderer::CreateOcclusionCullingResources() {
+	// Only texelFetch reads the pyramids, the sampler just has to be valid
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = static_cast<float>(MAX_DEPTH_PYRAMID_LEVELS);
+
+	if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &depthPyramidSampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create sampler");
+	}
 
-	// Bind descriptor set for time uniforms
-	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fakeCullingComputePipelineLayout, 1, 1, &timeDescriptorSet, 0, nullptr);
-
-	for (int i = 0; i < scene->GetFakeInstanceBuffer().size(); ++i) {
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fakeCullingComputePipelineLayout, 2, 1, &fakeCullingComputeDescriptorSets[i], 0, nullptr);
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fakeCullingComputePipelineLayout, 3, 1, &LODInfoDescriptorSets[scene->GetInstanceBuffer().size() + i], 0, nullptr);
-		vkCmdDispatch(computeCommandBuffer, (int)(scene->GetFakeInstanceBuffer()[i]->GetInstanceCount() / WORKGROUP_SIZE + 1), 1, 1);
-	}
-	for (uint32_t j = 0; j < scene->GetInstanceBuffer().size(); ++j) {
-		barriers[3 * j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[3 * j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[3 * j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[3 * j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[3 * j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[3 * j].buffer = scene->GetInstanceBuffer()[j]->GetNumInstanceDataBuffer(0);
-		barriers[3 * j].offset = 0;
-		barriers[3 * j].size = sizeof(VkDrawIndexedIndirectCommand);
-
-		barriers[3 * j + 1].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[3 * j + 1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[3 * j + 1].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[3 * j + 1].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[3 * j + 1].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[3 * j + 1].buffer = scene->GetInstanceBuffer()[j]->GetNumInstanceDataBuffer(1);
-		barriers[3 * j + 1].offset = 0;
-		barriers[3 * j + 1].size = sizeof(VkDrawIndexedIndirectCommand);
-
-		barriers[3 * j + 2].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[3 * j + 2].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[3 * j + 2].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[3 * j + 2].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[3 * j + 2].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[3 * j + 2].buffer = scene->GetInstanceBuffer()[j]->GetNumInstanceDataBuffer(2);
-		barriers[3 * j + 2].offset = 0;
-		barriers[3 * j + 2].size = sizeof(VkDrawIndexedIndirectCommand);
-	}
-
-	for (uint32_t j = 0; j < scene->GetFakeInstanceBuffer().size(); ++j) {
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].buffer = scene->GetFakeInstanceBuffer()[j]->GetNumInstanceDataBuffer();
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].offset = 0;
-		barriers[scene->GetInstanceBuffer().size() * 3 + j].size = sizeof(VkDrawIndexedIndirectCommand);
-	}
-
-	vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
-#endif
-	// ~ End recording ~
-	if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to record compute command buffer");
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		VkDeviceMemory memory;
+		BufferUtils::CreateBuffer(device, sizeof(OcclusionInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, occlusionInfoBuffers[frame], memory);
+		occlusionInfoData[frame] = static_cast<OcclusionInfo*>(BufferUtils::MapBuffer(device, occlusionInfoBuffers[frame]));
+		occlusionInfoData[frame]->viewProj = glm::mat4(1.0f);
+		occlusionInfoData[frame]->pyramidSize = glm::vec4(0.0f);
+		depthPyramidViewProj[frame] = glm::mat4(1.0f);
+
+		// Counters of every tree group
+		const size_t count = std::max<size_t>(scene->GetTreeGroups().size(), 1);
+		VkDeviceSize size = count * sizeof(CullingStats);
+		BufferUtils::CreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullingStatsReadbackBuffers[frame], memory);
+		cullingStatsData[frame] = static_cast<CullingStats*>(BufferUtils::MapBuffer(device, cullingStatsReadbackBuffers[frame]));
+		std::fill_n(cullingStatsData[frame], count, CullingStats());
+	}
+}
+
+void Renderer::RecordDepthPyramid(VkCommandBuffer commandBuffer, uint32_t frame) {
+	// The early pass' outgoing dependency made its depth readable, each level is reduced from the one before
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
+	for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout, 0, 1, &depthPyramidDescriptorSets[frame * MAX_DEPTH_PYRAMID_LEVELS + level], 0, nullptr);
+		uint32_t width = std::max(depthPyramidWidth >> level, 1u);
+		uint32_t height = std::max(depthPyramidHeight >> level, 1u);
+		vkCmdDispatch(commandBuffer, (width + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, (height + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+}
+
+void Renderer::RecordLateCulling(VkCommandBuffer commandBuffer, uint32_t frame) {
+	uint32_t frameOffset = uniformRing->GetDynamicOffset(frame);
+	const ForestInstanceBuffer* forest = scene->GetForest();
+
+	// Only the instance counts change, the rest of the late commands comes from the empty copy
+	VkBufferCopy region = {};
+	region.size = 2 * MAX_TREE_LODS * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdCopyBuffer(commandBuffer, forest->GetEmptyDrawCommandBuffer(), forest->GetLateDrawCommandBuffer(frame), 1, &region);
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lateCullingComputePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lateCullingComputePipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lateCullingComputePipelineLayout, 1, 1, &lateCullingComputeDescriptorSets[frame], 0, nullptr);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lateCullingComputePipelineLayout, 2, 1, &occlusionDescriptorSets[frame], 0, nullptr);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lateCullingComputePipelineLayout, 3, 1, &LODInfoDescriptorSet, 1, &frameOffset);
+	// Sized for the worst case, invocations past the occluded count return right away
+	vkCmdDispatch(commandBuffer, (int)(forest->GetInstanceCount() / WORKGROUP_SIZE + 1), 1, 1);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Renderer::RecordCullingStatsCopy(VkCommandBuffer commandBuffer, uint32_t frame) {
+	// Ordered after the late culling pass by its final barrier
+	// Fake trees only count their LOD transitions
+	if (!scene->GetTreeGroups().empty()) {
+		VkBufferCopy region = {};
+		region.srcOffset = 0;
+		region.dstOffset = 0;
+		region.size = scene->GetTreeGroups().size() * sizeof(CullingStats);
+		vkCmdCopyBuffer(commandBuffer, scene->GetForest()->GetCullingStatsBuffer(frame), cullingStatsReadbackBuffers[frame], 1, &region);
+	}
+
+	// Host reads it after the frame's fence
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Renderer::RecordTreeDraws(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount) {
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (drawIndexedIndirectCount && countBuffer != VK_NULL_HANDLE) {
+		drawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+	}
+	else if (multiDrawIndirect) {
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, maxDrawCount, stride);
+	}
+	else {
+		// Without multiDrawIndirect the draw count has to be 0 or 1
+		for (uint32_t j = 0; j < maxDrawCount; j++) {
+			vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset + j * stride, 1, stride);
+		}
+	}
+}
+
+void Renderer::RecordComputeCommandBuffer(uint32_t frame) {
+	// Specify the command pool and number of buffers to allocate
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = computeCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeCommandBuffers[frame]) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffers");
+	}
+	VkCommandBuffer computeCommandBuffer = computeCommandBuffers[frame];
+
+	// Uniforms of this frame live in its slice of the ring
+	uint32_t frameOffset = uniformRing->GetDynamicOffset(frame);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+
+	// ~ Start recording ~
+	if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to begin recording compute command buffer");
+	}
+
+	profiler->RecordReset(computeCommandBuffer, frame, ProfilerScope::CullTrees, ProfilerScope::Frame);
+
+#if LOD_FRUSTUM_CULLING
+	// Take this frame's culling outputs back from the graphics queue, which released them after drawing
+	if (asyncCompute) {
+		RecordCullingOutputBarrier(computeCommandBuffer, frame, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, device->GetQueueIndex(QueueFlags::Graphics), device->GetQueueIndex(QueueFlags::Compute));
+	}
+
+	// Culling counters start from zero every frame, the occluded count doubles as the late pass' input size.
+	// Instance counts of the indirect commands are reset from the zero count template, they sit between the other
+	// command fields so a fill would wipe those too. Both happen here so every workgroup sees them cleared
+	const ForestInstanceBuffer* forest = scene->GetForest();
+	vkCmdFillBuffer(computeCommandBuffer, forest->GetCullingStatsBuffer(frame), 0, VK_WHOLE_SIZE, 0);
+	vkCmdFillBuffer(computeCommandBuffer, forest->GetOccludedInstanceBuffer(frame), 0, sizeof(uint32_t), 0);
+	if (meshletCulling) {
+		vkCmdFillBuffer(computeCommandBuffer, forest->GetMeshletDrawCountBuffer(frame), 0, VK_WHOLE_SIZE, 0);
+	}
+	{
+		VkBufferCopy region = {};
+		region.size = TREE_DRAW_SLOT_COUNT * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand);
+		vkCmdCopyBuffer(computeCommandBuffer, forest->GetEmptyDrawCommandBuffer(), forest->GetDrawCommandBuffer(frame), 1, &region);
+	}
+	{
+		// The LOD states were last written by the culling pass submitted before this one, on the same queue
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Every tree species and fake tree group in one dispatch
+	// Bind to the compute pipeline
+	vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipeline);
+
+	// Bind camera descriptor set
+	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+
+	// Bind descriptor set for time uniforms
+	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 1, 1, &timeDescriptorSet, 1, &frameOffset);
+
+	// Forest buffers of this frame and the LOD table of every group
+	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 2, 1, &cullingComputeDescriptorSets[frame], 0, nullptr);
+	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 3, 1, &LODInfoDescriptorSet, 1, &frameOffset);
+
+	// Depth pyramid and view-projection of the last frame that used this slot
+	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingComputePipelineLayout, 4, 1, &occlusionDescriptorSets[frame], 0, nullptr);
+
+	profiler->RecordBegin(computeCommandBuffer, frame, ProfilerScope::CullTrees);
+	vkCmdDispatch(computeCommandBuffer, (int)(forest->GetInstanceCount() / WORKGROUP_SIZE + 1), 1, 1);
+
+	if (drawIndexedIndirectCount) {
+		// Pack the commands of visible groups so the draws only walk those
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		if (meshletCulling) {
+			// Meshlets of up to MESHLET_INSTANCES visible level 0 instances of every species, one workgroup per instance, bark and leaf in turn. Only
+			// reads the indirect commands, so it needs no barrier against the compaction below
+			vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullingPipeline);
+			vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullingPipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+			vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullingPipelineLayout, 1, 1, &meshletCullingDescriptorSets[frame], 0, nullptr);
+			vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullingPipelineLayout, 3, 1, &LODInfoDescriptorSet, 1, &frameOffset);
+			for (uint32_t kind = TREE_DRAW_BARK; kind <= TREE_DRAW_LEAF; kind++) {
+				MeshletCullingParameters parameters = { kind, forest->GetMeshletDrawCapacity() };
+				vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullingPipelineLayout, 2, 1, &meshletDescriptorSets[kind], 0, nullptr);
+				vkCmdPushConstants(computeCommandBuffer, meshletCullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullingParameters), &parameters);
+				vkCmdDispatch(computeCommandBuffer, MESHLET_INSTANCES, static_cast<uint32_t>(scene->GetNumSpecies()), 1);
+			}
+		}
+
+		vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, drawCompactionPipeline);
+		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, drawCompactionPipelineLayout, 0, 1, &drawCompactionDescriptorSets[frame], 0, nullptr);
+		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, drawCompactionPipelineLayout, 1, 1, &LODInfoDescriptorSet, 1, &frameOffset);
+		vkCmdDispatch(computeCommandBuffer, 1, 1, 1);
+	}
+	profiler->RecordEnd(computeCommandBuffer, frame, ProfilerScope::CullTrees);
+	// TODO: For each group of blades bind its descriptor set and dispatch
+	/*for (int i = 0; i < scene->GetBlades().size(); ++i) {
+		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 2, 1, &computeDescriptorSets[i], 0, nullptr);
+		vkCmdDispatch(computeCommandBuffer, (int)(NUM_BLADES / WORKGROUP_SIZE + 1), 1, 1);
+	}*/
+
+	RecordVisibleCountCopy(computeCommandBuffer, frame);
+
+	if (asyncCompute) {
+		// Release to the graphics queue, the cullingFinished semaphore orders it before the matching acquire
+		RecordCullingOutputBarrier(computeCommandBuffer, frame, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, 0, device->GetQueueIndex(QueueFlags::Compute), device->GetQueueIndex(QueueFlags::Graphics));
+	}
+	else {
+		RecordCullingOutputBarrier(computeCommandBuffer, frame, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+	}
+#endif
+	// ~ End recording ~
+	if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to record compute command buffer");
+	}
+}
+
+void Renderer::RecordCullingReuseCommandBuffer(uint32_t frame) {
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = computeCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &cullingReuseCommandBuffers[frame]) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffers");
+	}
+	VkCommandBuffer commandBuffer = cullingReuseCommandBuffers[frame];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to begin recording compute command buffer");
+	}
+
+	// The culling pass still gets its timestamps, so skipped frames show up as a pass that took no time
+	profiler->RecordReset(commandBuffer, frame, ProfilerScope::CullTrees, ProfilerScope::Frame);
+	profiler->RecordBegin(commandBuffer, frame, ProfilerScope::CullTrees);
+
+#if LOD_FRUSTUM_CULLING
+	// Same ownership transfers as the culling command buffer, the graphics side does not know culling was skipped
+	if (asyncCompute) {
+		RecordCullingOutputBarrier(commandBuffer, frame, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT, device->GetQueueIndex(QueueFlags::Graphics), device->GetQueueIndex(QueueFlags::Compute));
+	}
+
+	// The late pass of this frame counts its rescued trees again, the other counters belong to the kept results
+	for (uint32_t g = 0; g < static_cast<uint32_t>(scene->GetNumSpecies()); g++) {
+		vkCmdFillBuffer(commandBuffer, scene->GetForest()->GetCullingStatsBuffer(frame), g * sizeof(CullingStats) + offsetof(CullingStats, rescued), sizeof(uint32_t), 0);
+	}
+
+	if (asyncCompute) {
+		RecordCullingOutputBarrier(commandBuffer, frame, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, 0, device->GetQueueIndex(QueueFlags::Compute), device->GetQueueIndex(QueueFlags::Graphics));
+	}
+	else {
+		RecordCullingOutputBarrier(commandBuffer, frame, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+	}
+#endif
+	profiler->RecordEnd(commandBuffer, frame, ProfilerScope::CullTrees);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to record compute command buffer");
 	}
 }
 
 void Renderer::RecordCommandBuffers() {
-	commandBuffers.resize(swapChain->GetCount());
+	// One command buffer per (frame in flight, swap chain image), indexed frame * imageCount + image
+	commandBuffers.resize(MAX_FRAMES_IN_FLIGHT * swapChain->GetCount());
 
 	// Specify the command pool and number of buffers to allocate
 	VkCommandBufferAllocateInfo allocInfo = {};
@@ -3091,6 +4069,9 @@ void Renderer::RecordCommandBuffers() {
 
 	// Start command buffer recording
 	for (size_t i = 0; i < commandBuffers.size(); i++) {
+		uint32_t frame = static_cast<uint32_t>(i / swapChain->GetCount());
+		uint32_t frameOffset = uniformRing->GetDynamicOffset(frame);
+
 		VkCommandBufferBeginInfo beginInfo = {};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
@@ -3101,6 +4082,21 @@ void Renderer::RecordCommandBuffers() {
 			throw std::runtime_error("Failed to begin recording command buffer");
 		}
 
+		// Queries must be reset outside of the render pass
+		profiler->RecordReset(commandBuffers[i], frame, ProfilerScope::Frame, ProfilerScope::Count);
+		profiler->RecordBegin(commandBuffers[i], frame, ProfilerScope::Frame);
+
+#if LOD_FRUSTUM_CULLING
+		// Acquire the culling outputs released by this frame's compute command buffer.
+		// Source stage matches the DRAW_INDIRECT wait on cullingFinished so the two chain
+		if (asyncCompute) {
+			RecordCullingOutputBarrier(commandBuffers[i], frame, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				device->GetQueueIndex(QueueFlags::Compute), device->GetQueueIndex(QueueFlags::Graphics));
+		}
+#endif
+
 		// Begin the render pass
 		VkRenderPassBeginInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -3119,31 +4115,33 @@ void Renderer::RecordCommandBuffers() {
 
 		//Terrain: terrain
 		{
+			profiler->RecordBegin(commandBuffers[i], frame, ProfilerScope::Terrain);
 			// Bind the terrain pipeline
 			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipeline);
 
-			// Bind the vertex and index buffers
-			VkBuffer vertexBuffers[] = { scene->GetTerrain()->getVertexBuffer() };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+			// Bind the patch and the chunks this frame selected
+			VkBuffer vertexBuffers[] = { scene->GetTerrain()->getVertexBuffer(), terrainChunkBuffers[frame] };
+			VkDeviceSize offsets[] = { 0, 0 };
+			vkCmdBindVertexBuffers(commandBuffers[i], 0, 2, vertexBuffers, offsets);
 
-			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetTerrain()->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetTerrain()->getIndexBuffer(), 0, scene->GetTerrain()->getIndexType());
 
 			// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
 			// Bind the descriptor set for terrain
 			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 1, 1, &terrainDescriptorSet, 0, nullptr);
 			// Bind the descriptor set for terrain
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 2, 1, &timeDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 2, 1, &timeDescriptorSet, 1, &frameOffset);
 			// Bind the descriptor set for terrain
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 3, 1, &dayNightDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout, 3, 1, &dayNightDescriptorSet, 1, &frameOffset);
 
-			// Draw
-			std::vector<uint32_t> indices = scene->GetTerrain()->getIndices();
-			vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+			// Draw, one patch instance per chunk
+			vkCmdDrawIndexedIndirect(commandBuffers[i], terrainDrawBuffers[frame], 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+			profiler->RecordEnd(commandBuffers[i], frame, ProfilerScope::Terrain);
 		}
 		// Skybox: skybox
 		{
+			profiler->RecordBegin(commandBuffers[i], frame, ProfilerScope::Skybox);
 			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline);
 
 			// Bind the vertex and index buffers
@@ -3151,25 +4149,216 @@ void Renderer::RecordCommandBuffers() {
 			VkDeviceSize offsets[] = { 0 };
 			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
 
-			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetSkybox()->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetSkybox()->getIndexBuffer(), 0, scene->GetSkybox()->getIndexType());
 
 			// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
 
 			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 1, 1, &skyboxDescriptorSet, 0, nullptr);
 			
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 2, 1, &timeDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 2, 1, &timeDescriptorSet, 1, &frameOffset);
 
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 3, 1, &dayNightDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 3, 1, &dayNightDescriptorSet, 1, &frameOffset);
 
 			// Draw
 			std::vector<uint32_t> indices = scene->GetSkybox()->getIndices();
 			vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+			profiler->RecordEnd(commandBuffers[i], frame, ProfilerScope::Skybox);
+		}
+
+		//Planes: graphics
+		{
+			// Bind the graphics pipeline
+			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+			// Bind the vertex and index buffers
+			VkBuffer vertexBuffers[] = { scene->GetModels()[0]->getVertexBuffer() };
+			VkDeviceSize offsets[] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+
+			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[0]->getIndexBuffer(), 0, scene->GetModels()[0]->getIndexType());
+
+			// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+			// Bind the descriptor set for each model
+			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 1, 1, &modelDescriptorSets[0], 0, nullptr);
 
+			// Draw
+			std::vector<uint32_t> indices = scene->GetModels()[0]->getIndices();
+			//vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
 		}
 
+
+		// Trees. One multi-draw per list walks every group, the vertex shader picks the group's textures and LOD
+		// from the instance index. Every mesh level has its own bark and leaf lists, bound at the level's region of the
+		// culled instances. Fake trees are billboards in their own list so they keep their profiler scope
+		{
+			const ForestInstanceBuffer* forest = scene->GetForest();
+			const uint32_t numSpecies = scene->GetNumSpecies();
+			const uint32_t numGroups = static_cast<uint32_t>(scene->GetTreeGroups().size());
+			const uint32_t meshLevels = scene->GetMaxMeshLevels();
+			VkPipeline pipelines[] = { barkPipeline, leafPipeline, billboardPipeline };
+			VkPipelineLayout pipelineLayouts[] = { barkPipelineLayout, leafPipelineLayout, billboardPipelineLayout };
+			ProfilerScope scopes[] = { ProfilerScope::Bark, ProfilerScope::Leaf, ProfilerScope::Billboard };
+
+			for (uint32_t list = 0; list < TREE_LIST_COUNT; list++) {
+				// Species occupy the first groups, fake trees the rest
+				const uint32_t slot = list == TREE_LIST_FAKE ? TreeDrawSlot(TREE_DRAW_BILLBOARD, 0) : list;
+				const TreeDrawKind kind = slot == TreeDrawSlot(TREE_DRAW_BILLBOARD, 0) ? TREE_DRAW_BILLBOARD : TreeDrawKind(slot % 2);
+				const uint32_t level = kind == TREE_DRAW_BILLBOARD ? TREE_LOD_BILLBOARD : slot / 2;
+				const uint32_t firstGroup = list == TREE_LIST_FAKE ? numSpecies : 0;
+				const uint32_t maxDrawCount = list == TREE_LIST_FAKE ? numGroups - numSpecies : numSpecies;
+				if (maxDrawCount == 0 || (kind != TREE_DRAW_BILLBOARD && level >= meshLevels)) {
+					continue;
+				}
+				const ModelBatch* batch = scene->GetModelBatch(kind);
+				// Mesh levels add up in their kind's scope, one profiler slot each
+				const ProfilerScope scope = list == TREE_LIST_FAKE ? ProfilerScope::FakeTrees : scopes[kind];
+				const uint32_t profilerSlot = kind == TREE_DRAW_BILLBOARD ? 0 : level;
+
+				profiler->RecordBegin(commandBuffers[i], frame, scope, profilerSlot);
+				vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[kind]);
+
+				// Bind the vertex and index buffers
+				VkBuffer vertexBuffers[] = { batch->GetVertexBuffer() };
+#if LOD_FRUSTUM_CULLING
+				VkBuffer instanceBuffer[] = { forest->GetCulledInstanceDataBuffer(frame) };
+				VkDeviceSize instanceOffsets[] = { forest->GetCulledInstanceDataOffset(level) };
+#else
+				VkBuffer instanceBuffer[] = { forest->GetInstanceDataBuffer() };
+				VkDeviceSize instanceOffsets[] = { 0 };
+#endif
+				VkDeviceSize offsets[] = { 0 };
+				vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+				// Bind Instance Buffer
+				vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, instanceBuffer, instanceOffsets);
+				vkCmdBindIndexBuffer(commandBuffers[i], batch->GetIndexBuffer(), 0, batch->GetIndexType());
+
+				// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[kind], 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+				// Bind the textures of every group
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[kind], 1, 1, &forestMaterialDescriptorSets[kind], 0, nullptr);
+				// Bind the time descriptor.
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[kind], 2, 1, &timeDescriptorSet, 1, &frameOffset);
+				// Bind the LOD descriptor
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[kind], 3, 1, &LODInfoDescriptorSet, 1, &frameOffset);
+				// Bind the Day Night descriptor
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[kind], 4, 1, &dayNightDescriptorSet, 1, &frameOffset);
+				if (kind != TREE_DRAW_BILLBOARD) {
+					// Bind the Wind descriptor
+					vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[kind], 5, 1, &windDescriptorSet, 1, &frameOffset);
+				}
+
+#if LOD_FRUSTUM_CULLING
+				// Indirect Draw
+				if (drawIndexedIndirectCount) {
+					RecordTreeDraws(commandBuffers[i], forest->GetCompactedDrawCommandBuffer(frame), list * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand),
+						forest->GetDrawCountBuffer(frame), list * sizeof(uint32_t), maxDrawCount);
+				}
+				else {
+					RecordTreeDraws(commandBuffers[i], forest->GetDrawCommandBuffer(frame), (slot * MAX_TREE_GROUPS + firstGroup) * sizeof(VkDrawIndexedIndirectCommand),
+						VK_NULL_HANDLE, 0, maxDrawCount);
+				}
+				if (meshletCulling && kind != TREE_DRAW_BILLBOARD && level == 0) {
+					// The level 0 instances the list above left out, one meshlet per command
+					const uint32_t capacity = forest->GetMeshletDrawCapacity();
+					RecordTreeDraws(commandBuffers[i], forest->GetMeshletCommandBuffer(frame), kind * capacity * sizeof(VkDrawIndexedIndirectCommand),
+						forest->GetMeshletDrawCountBuffer(frame), kind * sizeof(uint32_t), capacity);
+				}
+#else
+				// Every instance of every group
+				RecordTreeDraws(commandBuffers[i], forest->GetAllDrawCommandBuffer(), (slot * MAX_TREE_GROUPS + firstGroup) * sizeof(VkDrawIndexedIndirectCommand),
+					VK_NULL_HANDLE, 0, maxDrawCount);
+#endif
+				profiler->RecordEnd(commandBuffers[i], frame, scope, profilerSlot);
+			}
+		}
+
+		//// Grass
+		//vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipeline);
+
+		//for (uint32_t j = 0; j < scene->GetBlades().size(); ++j) {
+		//	VkBuffer vertexBuffers[] = { scene->GetBlades()[j]->GetCulledBladesBuffer() };
+		//	//VkBuffer vertexBuffers[] = { scene->GetBlades()[j]->GetBladesBuffer() };
+
+		//	VkDeviceSize offsets[] = { 0 };
+		//	// TODO: Uncomment this when the buffers are populated
+		//	vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+
+		//	// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
+		//	vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+		//	// TODO: Bind the descriptor set for each grass blades model
+		//	vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 1, 1, &grassDescriptorSets[j], 0, nullptr);
+
+		//	// Draw
+		//	// TODO: Uncomment this when the buffers are populated
+		//	//vkCmdDrawIndirect(commandBuffers[i], scene->GetBlades()[j]->GetNumBladesBuffer(), 0, 1, sizeof(BladeDrawIndirect));
+		//}
+
+		// End render pass
+		vkCmdEndRenderPass(commandBuffers[i]);
+
+#if LOD_FRUSTUM_CULLING
+		// Build the depth pyramid from what was just drawn and retest the trees that were hidden in the old one
+		profiler->RecordBegin(commandBuffers[i], frame, ProfilerScope::DepthPyramid);
+		RecordDepthPyramid(commandBuffers[i], frame);
+		profiler->RecordEnd(commandBuffers[i], frame, ProfilerScope::DepthPyramid);
+
+		profiler->RecordBegin(commandBuffers[i], frame, ProfilerScope::CullOccluded);
+		RecordLateCulling(commandBuffers[i], frame);
+		profiler->RecordEnd(commandBuffers[i], frame, ProfilerScope::CullOccluded);
+		RecordCullingStatsCopy(commandBuffers[i], frame);
+#endif
+
+		// Late render pass, keeps the first pass' color and depth
+		renderPassInfo.renderPass = lateRenderPass;
+		renderPassInfo.clearValueCount = 0;
+		renderPassInfo.pClearValues = nullptr;
+		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+#if LOD_FRUSTUM_CULLING
+		// Full trees that became visible this frame, at every mesh level. Timed in the profiler slot after the ones of
+		// the first pass so Bark and Leaf still add up to all the full trees. The late commands are not compacted,
+		// culled groups are drawn without instances
+		if (scene->GetNumSpecies() > 0) {
+			const ForestInstanceBuffer* forest = scene->GetForest();
+			VkPipeline pipelines[] = { barkPipeline, leafPipeline };
+			VkPipelineLayout pipelineLayouts[] = { barkPipelineLayout, leafPipelineLayout };
+			TreeDrawKind kinds[] = { TREE_DRAW_BARK, TREE_DRAW_LEAF };
+			ProfilerScope scopes[] = { ProfilerScope::Bark, ProfilerScope::Leaf };
+			for (int j = 0; j < 2; j++) {
+				const ModelBatch* batch = scene->GetModelBatch(kinds[j]);
+				profiler->RecordBegin(commandBuffers[i], frame, scopes[j], MAX_TREE_LODS);
+				vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[j]);
+
+				VkBuffer vertexBuffers[] = { batch->GetVertexBuffer() };
+				VkDeviceSize offsets[] = { 0 };
+				vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+				vkCmdBindIndexBuffer(commandBuffers[i], batch->GetIndexBuffer(), 0, batch->GetIndexType());
+
+				// Same descriptor sets as in the first pass
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[j], 0, 1, &cameraDescriptorSet, 1, &frameOffset);
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[j], 1, 1, &forestMaterialDescriptorSets[kinds[j]], 0, nullptr);
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[j], 2, 1, &timeDescriptorSet, 1, &frameOffset);
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[j], 3, 1, &LODInfoDescriptorSet, 1, &frameOffset);
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[j], 4, 1, &dayNightDescriptorSet, 1, &frameOffset);
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts[j], 5, 1, &windDescriptorSet, 1, &frameOffset);
+
+				for (uint32_t level = 0; level < scene->GetMaxMeshLevels(); level++) {
+					VkBuffer instanceBuffer[] = { forest->GetLateCulledInstanceDataBuffer(frame) };
+					VkDeviceSize instanceOffsets[] = { forest->GetCulledInstanceDataOffset(level) };
+					vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, instanceBuffer, instanceOffsets);
+					RecordTreeDraws(commandBuffers[i], forest->GetLateDrawCommandBuffer(frame), TreeDrawSlot(kinds[j], level) * MAX_TREE_GROUPS * sizeof(VkDrawIndexedIndirectCommand),
+						VK_NULL_HANDLE, 0, scene->GetNumSpecies());
+				}
+				profiler->RecordEnd(commandBuffers[i], frame, scopes[j], MAX_TREE_LODS);
+			}
+		}
+#endif
+
 		//Gui
 		{
+			profiler->RecordBegin(commandBuffers[i], frame, ProfilerScope::Gui);
 			ImGuiIO& io = ImGui::GetIO();
 			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, guiPipeline);
 
@@ -3234,263 +4423,268 @@ void Renderer::RecordCommandBuffers() {
 				}
 				vtx_offset += cmd_list->VtxBuffer.Size;
 			}
-
-		}
-
-		//Planes: graphics
-		{
-			// Bind the graphics pipeline
-			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-			// Bind the vertex and index buffers
-			VkBuffer vertexBuffers[] = { scene->GetModels()[0]->getVertexBuffer() };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-
-			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[0]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-			// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-			// Bind the descriptor set for each model
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 1, 1, &modelDescriptorSets[0], 0, nullptr);
-
-			// Draw
-			std::vector<uint32_t> indices = scene->GetModels()[0]->getIndices();
-			//vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+			profiler->RecordEnd(commandBuffers[i], frame, ProfilerScope::Gui);
 		}
 
+		vkCmdEndRenderPass(commandBuffers[i]);
 
-		// Iterate through different types of tree
-		for (int k = 0; k < scene->GetInstanceBuffer().size(); k++) {
-
-			//Bark: bark pipeline
-			{
-				// Bind the bark pipeline
-				vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipeline);
-				// Bind the vertex and index buffers
-				VkBuffer vertexBuffers[] = { scene->GetModels()[3 * k + 1]->getVertexBuffer() };
-				
-#if LOD_FRUSTUM_CULLING
-				VkBuffer instanceBuffer[] = { scene->GetInstanceBuffer()[k]->GetCulledInstanceDataBuffer(0) };
-#else
-				VkBuffer instanceBuffer[] = { scene->GetInstanceBuffer()[k]->GetInstanceDataBuffer() };
-#endif
-				VkDeviceSize offsets[] = { 0 };
-				vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-				// Bind Instance Buffer
-				vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, instanceBuffer, offsets);
-
-				vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[3 * k +1]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-				// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-				// Bind the descriptor set for each model
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipelineLayout, 1, 1, &modelDescriptorSets[3 * k +1], 0, nullptr);
-				// Bind the time descriptor.
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipelineLayout, 2, 1, &timeDescriptorSet, 0, nullptr);
-				// Bind the LOD descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipelineLayout, 3, 1, &LODInfoDescriptorSets[k], 0, nullptr);
-				// Bind the Day Night descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipelineLayout, 4, 1, &dayNightDescriptorSet, 0, nullptr);
-				// Bind the Wind descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, barkPipelineLayout, 5, 1, &windDescriptorSet, 0, nullptr);
-
-#if LOD_FRUSTUM_CULLING
-				// Indirect Draw
-				vkCmdDrawIndexedIndirect(commandBuffers[i], scene->GetInstanceBuffer()[k]->GetNumInstanceDataBuffer(0), 0, 1, 0);
-#else
-				// Draw
-				std::vector<uint32_t> indices = scene->GetModels()[3*k + 1]->getIndices();
-				vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), scene->GetInstanceBuffer()[k]->GetInstanceCount(), 0, 0, 0);
-#endif
-			}
-
-			//Leaf: leaf pipeline
-			{
-				// Bind the leaf pipeline
-				vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipeline);
-
-				// Bind the vertex and index buffers
-				VkBuffer vertexBuffers[] = { scene->GetModels()[3 * k +2]->getVertexBuffer() };
-#if LOD_FRUSTUM_CULLING
-				VkBuffer instanceBuffer[] = { scene->GetInstanceBuffer()[k]->GetCulledInstanceDataBuffer(0) };
-#else
-				VkBuffer instanceBuffer[] = { scene->GetInstanceBuffer()[k]->GetInstanceDataBuffer() };
-#endif
-				VkDeviceSize offsets[] = { 0 };
-				vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-				vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, instanceBuffer, offsets);
-				vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[3 * k +2]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-				// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-				// Bind the descriptor set for each model
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipelineLayout, 1, 1, &modelDescriptorSets[3 * k +2], 0, nullptr);
-				// Bind the time descriptor.
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipelineLayout, 2, 1, &timeDescriptorSet, 0, nullptr);
-				// Bind the LOD descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipelineLayout, 3, 1, &LODInfoDescriptorSets[k], 0, nullptr);
-				// Bind the Day Night descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipelineLayout, 4, 1, &dayNightDescriptorSet, 0, nullptr);
-				// Bind the Wind descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, leafPipelineLayout, 5, 1, &windDescriptorSet, 0, nullptr);
-
-#if LOD_FRUSTUM_CULLING
-				// Indirect Draw
-				vkCmdDrawIndexedIndirect(commandBuffers[i], scene->GetInstanceBuffer()[k]->GetNumInstanceDataBuffer(1), 0, 1, 0);
-#else
-				// Draw
-				std::vector<uint32_t> indices = scene->GetModels()[3 *k + 2]->getIndices();
-				vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), scene->GetInstanceBuffer()[k]->GetInstanceCount(), 0, 0, 0);
-#endif
-			}
-
-			//Billboard: billboard pipeline
-			{
-				// Bind the leaf pipeline
-				vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipeline);
-
-				// Bind the vertex and index buffers
-				VkBuffer vertexBuffers[] = { scene->GetModels()[3 * k +3]->getVertexBuffer() };
-#if LOD_FRUSTUM_CULLING
-				VkBuffer instanceBuffer[] = { scene->GetInstanceBuffer()[k]->GetCulledInstanceDataBuffer(1) };
-#else
-				VkBuffer instanceBuffer[] = { scene->GetInstanceBuffer()[k]->GetInstanceDataBuffer() };
-#endif
-				VkDeviceSize offsets[] = { 0 };
-				vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-				vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, instanceBuffer, offsets);
-				vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[3 * k +3]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-				// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-				// Bind the descriptor set for each model
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 1, 1, &modelDescriptorSets[3 * k +3], 0, nullptr);
-				// Bind the time descriptor.
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 2, 1, &timeDescriptorSet, 0, nullptr);
-				// Bind the LOD descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 3, 1, &LODInfoDescriptorSets[k], 0, nullptr);
-				// Bind the Day Night descriptor
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 4, 1, &dayNightDescriptorSet, 0, nullptr);
 #if LOD_FRUSTUM_CULLING
-				// Indirect Draw
-				vkCmdDrawIndexedIndirect(commandBuffers[i], scene->GetInstanceBuffer()[k]->GetNumInstanceDataBuffer(2), 0, 1, 0);
-#else
-				// Draw
-				std::vector<uint32_t> indices = scene->GetModels()[3*k + 3]->getIndices();
-				vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), scene->GetInstanceBuffer()[k]->GetInstanceCount(), 0, 0, 0);
-#endif
-			}
+		// Hand the culling outputs back so the next culling pass of this frame can acquire them
+		if (asyncCompute) {
+			RecordCullingOutputBarrier(commandBuffers[i], frame, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_ACCESS_SHADER_WRITE_BIT, 0, device->GetQueueIndex(QueueFlags::Graphics), device->GetQueueIndex(QueueFlags::Compute));
 		}
-
-		// Fake Tree
-		for (int k = 0; k < scene->GetFakeInstanceBuffer().size(); k++) {
-			// Bind the leaf pipeline
-			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipeline);
-
-			// Bind the vertex and index buffers
-			VkBuffer vertexBuffers[] = { scene->GetModels()[7 + k]->getVertexBuffer() };
-#if LOD_FRUSTUM_CULLING
-			VkBuffer instanceBuffer[] = { scene->GetFakeInstanceBuffer()[k]->GetCulledInstanceDataBuffer() };
-#else
-			VkBuffer instanceBuffer[] = { scene->GetFakeInstanceBuffer()[k]->GetInstanceDataBuffer() };
 #endif
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-			vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, instanceBuffer, offsets);
-			vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[7 + k]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+		profiler->RecordEnd(commandBuffers[i], frame, ProfilerScope::Frame);
 
-			// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-			// Bind the descriptor set for each model
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 1, 1, &modelDescriptorSets[7 + k], 0, nullptr);
-			// Bind the time descriptor.
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 2, 1, &timeDescriptorSet, 0, nullptr);
-			// Bind the LOD descriptor
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 3, 1, &LODInfoDescriptorSets[2 + k], 0, nullptr);
-			// Bind the Day Night descriptor
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, billboardPipelineLayout, 4, 1, &dayNightDescriptorSet, 0, nullptr);
-#if LOD_FRUSTUM_CULLING
-			// Indirect Draw
-			vkCmdDrawIndexedIndirect(commandBuffers[i], scene->GetFakeInstanceBuffer()[k]->GetNumInstanceDataBuffer(), 0, 1, 0);
-#else
-			// Draw
-			std::vector<uint32_t> indices = scene->GetModels()[3 * k + 3]->getIndices();
-			vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), scene->GetInstanceBuffer()[k]->GetInstanceCount(), 0, 0, 0);
-#endif
+		// ~ End recording ~
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to record command buffer");
 		}
-		//// Grass
-		//vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipeline);
-
-		//for (uint32_t j = 0; j < scene->GetBlades().size(); ++j) {
-		//	VkBuffer vertexBuffers[] = { scene->GetBlades()[j]->GetCulledBladesBuffer() };
-		//	//VkBuffer vertexBuffers[] = { scene->GetBlades()[j]->GetBladesBuffer() };
+	}
+}
 
-		//	VkDeviceSize offsets[] = { 0 };
-		//	// TODO: Uncomment this when the buffers are populated
-		//	vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+void Renderer::CreateSyncObjects() {
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-		//	// Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-		//	vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-		//	// TODO: Bind the descriptor set for each grass blades model
-		//	vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 1, 1, &grassDescriptorSets[j], 0, nullptr);
+	// Fences start signaled so the first use of every frame does not block
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-		//	// Draw
-		//	// TODO: Uncomment this when the buffers are populated
-		//	//vkCmdDrawIndirect(commandBuffers[i], scene->GetBlades()[j]->GetNumBladesBuffer(), 0, 1, sizeof(BladeDrawIndirect));
-		//}
-
-		// End render pass
-		vkCmdEndRenderPass(commandBuffers[i]);
-
-		// ~ End recording ~
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to record command buffer");
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &cullingFinishedSemaphores[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create semaphores");
+		}
+		if (vkCreateFence(logicalDevice, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create fence");
 		}
 	}
 }
 
-void Renderer::Frame() {
+bool Renderer::Frame() {
+	// Block until the GPU is done with this frame's command buffers and uniform slice
+	vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	// Timestamps written by the last submit of this frame are complete now
+	profiler->Collect(currentFrame);
+
+	// Bark commands of every mesh level count the full trees of every species, billboard commands the LOD1 and fake trees
+	const VkDrawIndexedIndirectCommand* commands = visibleCountData[currentFrame];
+	const uint32_t numSpecies = scene->GetNumSpecies();
+	const CullingStats* stats = cullingStatsData[currentFrame];
+	visibleInstanceCounts = VisibleInstanceCounts();
+	cullingStats = CullingStats();
+	visibleInstanceCounts.species = numSpecies;
+	visibleInstanceCounts.groups = static_cast<uint32_t>(scene->GetTreeGroups().size());
+	for (uint32_t g = 0; g < visibleInstanceCounts.groups; g++) {
+		const uint32_t billboards = commands[TreeDrawSlot(TREE_DRAW_BILLBOARD, 0) * MAX_TREE_GROUPS + g].instanceCount;
+		visibleInstanceCounts.groupBillboard[g] = billboards;
+		cullingStats.transitioning += stats[g].transitioning;
+		if (g < numSpecies) {
+			cullingStats.distance += stats[g].distance;
+			cullingStats.frustum += stats[g].frustum;
+			cullingStats.occluded += stats[g].occluded;
+			cullingStats.rescued += stats[g].rescued;
+			cullingStats.meshlets += stats[g].meshlets;
+			cullingStats.meshletsCulled += stats[g].meshletsCulled;
+			visibleInstanceCounts.groupLevelCount[g] = static_cast<uint32_t>(scene->GetTreeGroups()[g].levels.size());
+			for (uint32_t l = 0; l < MAX_TREE_LODS; l++) {
+				visibleInstanceCounts.groupLevels[g][l] = commands[TreeDrawSlot(TREE_DRAW_BARK, l) * MAX_TREE_GROUPS + g].instanceCount;
+				visibleInstanceCounts.groupFull[g] += visibleInstanceCounts.groupLevels[g][l];
+			}
+			// Trees drawn by the late pass were not in the count copied after the first culling pass
+			visibleInstanceCounts.groupFull[g] += stats[g].rescued;
+			visibleInstanceCounts.full += visibleInstanceCounts.groupFull[g];
+			visibleInstanceCounts.billboard += billboards;
+		}
+		else {
+			visibleInstanceCounts.fake += billboards;
+		}
+	}
+	if (lodCheck && culledInputsValid[currentFrame] && culledInputs[currentFrame].LODEpoch == scene->GetLODEpoch()) {
+		CheckLodSelection(commands, stats, culledInputs[currentFrame]);
+	}
+
+	if (!swapChain->Acquire(imageAvailableSemaphores[currentFrame])) {
+		RecreateFrameResources();
+		return false;
+	}
+	vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]);
+
+	uniformRing->Flush(currentFrame);
+
+	// The submit below makes the host writes visible to the draw
+	const Terrain* terrain = scene->GetTerrain();
+	terrainSelection = terrain->SelectChunks(camera->GetFrustumPlanes(), camera->GetEyePos(), terrainChunkData[currentFrame], terrain->GetMaxChunkCount());
+	terrainDrawData[currentFrame]->instanceCount = terrainSelection.chunks;
+
+	// This frame culls against the pyramid its slot built last time, with the camera it was built from
+	occlusionInfoData[currentFrame]->viewProj = depthPyramidViewProj[currentFrame];
+	occlusionInfoData[currentFrame]->pyramidSize = glm::vec4(float(depthPyramidWidth), float(depthPyramidHeight), float(depthPyramidLevels), occlusionCulling ? 1.0f : 0.0f);
+	depthPyramidViewProj[currentFrame] = camera->GetViewProj();
+
+	// A slot culled with the same camera, pyramid camera and LOD distances would produce the same indirect commands,
+	// keep the ones it has. The pyramid camera has to match too, otherwise a camera that just stopped keeps results
+	// tested against a pyramid from while it was moving. Cross-fades only advance in the culling pass, so a slot whose
+	// results still had some running culls again until they are done
+	CullingInputs inputs;
+	inputs.viewProj = depthPyramidViewProj[currentFrame];
+	inputs.pyramidViewProj = occlusionInfoData[currentFrame]->viewProj;
+	inputs.LODEpoch = scene->GetLODEpoch();
+	inputs.occlusionCulling = occlusionCulling;
+	inputs.eye = camera->GetEyePos();
+	inputs.pixelsPerUnit = camera->GetPixelsPerUnit();
+	const CullingInputs& culled = culledInputs[currentFrame];
+	cullingReused = temporalCulling && culledInputsValid[currentFrame] && culled.LODEpoch == inputs.LODEpoch && culled.occlusionCulling == inputs.occlusionCulling &&
+		cullingStats.transitioning == 0 && NearlyEqual(culled.viewProj, inputs.viewProj) && NearlyEqual(culled.pyramidViewProj, inputs.pyramidViewProj);
+	if (!cullingReused) {
+		culledInputs[currentFrame] = inputs;
+		culledInputsValid[currentFrame] = true;
+	}
 
+	// Culling outputs are per frame and the fence above already covers their last use, so culling of this
+	// frame needs no wait and overlaps whatever the graphics queue is still drawing for the previous frame
 	VkSubmitInfo computeSubmitInfo = {};
 	computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	computeSubmitInfo.commandBufferCount = 1;
-	computeSubmitInfo.pCommandBuffers = &computeCommandBuffer;
+	computeSubmitInfo.pCommandBuffers = cullingReused ? &cullingReuseCommandBuffers[currentFrame] : &computeCommandBuffers[currentFrame];
 
-	if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to submit draw command buffer");
-	}
+	computeSubmitInfo.signalSemaphoreCount = 1;
+	computeSubmitInfo.pSignalSemaphores = &cullingFinishedSemaphores[currentFrame];
 
-	if (!swapChain->Acquire()) {
-		RecreateFrameResources();
-		return;
+	if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit compute command buffer");
 	}
 
 	// Submit the command buffer
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore waitSemaphores[] = { swapChain->GetImageAvailableVkSemaphore() };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
+	VkSemaphore waitSemaphores[] = { cullingFinishedSemaphores[currentFrame], imageAvailableSemaphores[currentFrame] };
+	// Late culling on this queue reads the occluded trees from the culling pass
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	// Nothing signals image availability without a surface
+	submitInfo.waitSemaphoreCount = swapChain->IsHeadless() ? 1 : 2;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[swapChain->GetIndex()];
+	submitInfo.pCommandBuffers = &commandBuffers[currentFrame * swapChain->GetCount() + swapChain->GetIndex()];
 
-	VkSemaphore signalSemaphores[] = { swapChain->GetRenderFinishedVkSemaphore() };
-	submitInfo.signalSemaphoreCount = 1;
+	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
+	// Headless frames are never presented, nothing would wait on it before the slot signals it again
+	submitInfo.signalSemaphoreCount = swapChain->IsHeadless() ? 0 : 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+	if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to submit draw command buffer");
 	}
+	profiler->MarkSubmitted(currentFrame);
 
-	if (!swapChain->Present()) {
+	bool presented = swapChain->Present(renderFinishedSemaphores[currentFrame]);
+	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+	if (!presented) {
 		RecreateFrameResources();
 	}
+	return true;
+}
+
+const VisibleInstanceCounts& Renderer::GetVisibleInstanceCounts() const {
+	return visibleInstanceCounts;
+}
+
+const CullingStats& Renderer::GetCullingStats() const {
+	return cullingStats;
+}
+
+const TerrainSelection& Renderer::GetTerrainSelection() const {
+	return terrainSelection;
+}
+
+void Renderer::SetOcclusionCulling(bool enabled) {
+	occlusionCulling = enabled;
+}
+
+void Renderer::SetTemporalCulling(bool enabled) {
+	temporalCulling = enabled;
+}
+
+bool Renderer::IsCullingReused() const {
+	return cullingReused;
+}
+
+void Renderer::SetLodCheck(bool enabled) {
+	lodCheck = enabled;
+}
+
+void Renderer::CheckLodSelection(const VkDrawIndexedIndirectCommand* commands, const CullingStats* stats, const CullingInputs& inputs) {
+	glm::vec4 planes[6];
+	Culling::ExtractFrustumPlanes(inputs.viewProj, planes);
+	const std::vector<TreeGroup>& groups = scene->GetTreeGroups();
+	const uint32_t numSpecies = scene->GetNumSpecies();
+	for (uint32_t g = 0; g < groups.size(); g++) {
+		const LODInfo& info = scene->GetLODInfo(g);
+		const bool fullTrees = g < numSpecies && !groups[g].levels.empty();
+		Culling::BoundingSphere billboardSphere;
+		billboardSphere.centerY = info.Bounds.z;
+		billboardSphere.radius = info.Bounds.w;
+		Culling::BoundingSphere lodSphere = billboardSphere;
+		if (g < numSpecies) {
+			lodSphere.centerY = info.Bounds.x;
+			lodSphere.radius = info.Bounds.y;
+			lodSphere.scaled = true;
+			// Species' impostors cover the full model's sphere
+			billboardSphere = lodSphere;
+		}
+
+		// The batch culler the frustum counts below could come from, against its scalar reference
+		const uint32_t cullMismatches = Culling::CountCullMismatches(planes, groups[g].instances.data(),
+			static_cast<uint32_t>(groups[g].instances.size()), billboardSphere);
+		if (cullMismatches > 0) {
+			printf("LOD check: group %u batch frustum culling disagrees with the scalar test for %u instances\n", g, cullMismatches);
+			lodCheckMismatches++;
+		}
+
+		Culling::LodCounts expected = Culling::CountLods(planes, inputs.eye, inputs.pixelsPerUnit, groups[g].instances.data(),
+			static_cast<uint32_t>(groups[g].instances.size()), lodSphere, billboardSphere, fullTrees, info.Info[0], info.Info[1]);
+		// The culling pass counts full trees settled on their billboard as distance culled. Instances in the middle of a
+		// cross-fade draw both LODs, so each of them can take one off the LOD culled count and add one billboard
+		const uint32_t lodCulled = fullTrees ? stats[g].distance : 0;
+		const uint32_t transitioning = stats[g].transitioning;
+		const uint32_t billboards = commands[TreeDrawSlot(TREE_DRAW_BILLBOARD, 0) * MAX_TREE_GROUPS + g].instanceCount;
+		if (lodCulled + transitioning < expected.lodCulled || lodCulled > expected.lodCulled + expected.lodCulledAmbiguous ||
+			billboards < expected.billboards || billboards > expected.billboards + expected.billboardsAmbiguous + transitioning) {
+			printf("LOD check: group %u LOD culled %u (CPU %u + %u ambiguous), billboards %u (CPU %u + %u ambiguous), %u transitioning\n", g,
+				lodCulled, expected.lodCulled, expected.lodCulledAmbiguous, billboards, expected.billboards, expected.billboardsAmbiguous, transitioning);
+			lodCheckMismatches++;
+		}
+	}
+	lodCheckFrames++;
+}
+
+uint32_t Renderer::GetLodCheckFrames() const {
+	return lodCheckFrames;
+}
+
+uint32_t Renderer::GetLodCheckMismatches() const {
+	return lodCheckMismatches;
+}
+
+bool Renderer::SaveLastFrame(const char* path) {
+	if (!swapChain->IsHeadless()) {
+		printf("Frames can only be saved in headless mode\n");
+		return false;
+	}
+
+	vkDeviceWaitIdle(logicalDevice);
+	VkExtent2D extent = swapChain->GetVkExtent();
+	return Image::SaveToPng(device, graphicsCommandPool, swapChain->GetVkImage(swapChain->GetIndex()), swapChain->GetVkImageFormat(),
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, extent.width, extent.height, path);
 }
 
 Renderer::~Renderer() {
@@ -3499,7 +4693,21 @@ Renderer::~Renderer() {
 	// TODO: destroy any resources you created
 
 	vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-	vkFreeCommandBuffers(logicalDevice, computeCommandPool, 1, &computeCommandBuffer);
+	vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
+	vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(cullingReuseCommandBuffers.size()), cullingReuseCommandBuffers.data());
+
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], nullptr);
+		vkDestroySemaphore(logicalDevice, renderFinishedSemaphores[i], nullptr);
+		vkDestroySemaphore(logicalDevice, cullingFinishedSemaphores[i], nullptr);
+		vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+		BufferUtils::DestroyBuffer(device, visibleCountBuffers[i]);
+		BufferUtils::DestroyBuffer(device, occlusionInfoBuffers[i]);
+		BufferUtils::DestroyBuffer(device, cullingStatsReadbackBuffers[i]);
+		BufferUtils::DestroyBuffer(device, terrainChunkBuffers[i]);
+		BufferUtils::DestroyBuffer(device, terrainDrawBuffers[i]);
+	}
+	vkDestroySampler(logicalDevice, depthPyramidSampler, nullptr);
 
 	vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, barkPipeline, nullptr);
@@ -3510,8 +4718,11 @@ Renderer::~Renderer() {
 	vkDestroyPipeline(logicalDevice, terrainPipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, computePipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, cullingComputePipeline, nullptr);
-	vkDestroyPipeline(logicalDevice, fakeCullingComputePipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, drawCompactionPipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, guiPipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, depthPyramidPipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, lateCullingComputePipeline, nullptr);
+	vkDestroyPipeline(logicalDevice, meshletCullingPipeline, nullptr);
 
 
 	vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr);
@@ -3523,11 +4734,15 @@ Renderer::~Renderer() {
 	vkDestroyPipelineLayout(logicalDevice, terrainPipelineLayout, nullptr);
 	vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
 	vkDestroyPipelineLayout(logicalDevice, cullingComputePipelineLayout, nullptr);
-	vkDestroyPipelineLayout(logicalDevice, fakeCullingComputePipelineLayout, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, drawCompactionPipelineLayout, nullptr);
 	vkDestroyPipelineLayout(logicalDevice, guiPipelineLayout, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, depthPyramidPipelineLayout, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, lateCullingComputePipelineLayout, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, meshletCullingPipelineLayout, nullptr);
 
 	vkDestroyDescriptorSetLayout(logicalDevice, cameraDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, modelDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, forestMaterialDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, timeDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, windDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, dayNightDescriptorSetLayout, nullptr);
@@ -3536,12 +4751,19 @@ Renderer::~Renderer() {
 	vkDestroyDescriptorSetLayout(logicalDevice, terrainDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, computeDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, cullingComputeDescriptorSetLayout, nullptr);
-	vkDestroyDescriptorSetLayout(logicalDevice, fakeCullingComputeDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, drawCompactionDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, GuiDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, LODInfoDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, depthPyramidDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, occlusionDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, lateCullingComputeDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, meshletCullingDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, meshletDescriptorSetLayout, nullptr);
 
 	vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
 
 	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+	vkDestroyRenderPass(logicalDevice, lateRenderPass, nullptr);
 	DestroyFrameResources();
 	vkDestroyCommandPool(logicalDevice, computeCommandPool, nullptr);
 	vkDestroyCommandPool(logicalDevice, graphicsCommandPool, nullptr);
@@ -4,11 +4,66 @@
 #include "SwapChain.h"
 #include "Scene.h"
 #include "Camera.h"
+#include "UniformRing.h"
+#include "FrameConfig.h"
+#include "GpuProfiler.h"
+
+// Trees that survived culling in one frame, read back from the indirect draw commands
+struct VisibleInstanceCounts {
+	uint32_t full = 0;
+	uint32_t billboard = 0;
+	uint32_t fake = 0;
+	// Per tree group, species first. Fake tree groups only have billboards, counted in groupBillboard
+	uint32_t species = 0;
+	uint32_t groups = 0;
+	uint32_t groupFull[MAX_TREE_GROUPS] = {};
+	// Full trees of the first pass at each of the groupLevelCount mesh levels, groupFull also has the ones the late pass
+	// rescued
+	uint32_t groupLevelCount[MAX_TREE_GROUPS] = {};
+	uint32_t groupLevels[MAX_TREE_GROUPS][MAX_TREE_LODS] = {};
+	uint32_t groupBillboard[MAX_TREE_GROUPS] = {};
+};
+
+// Full trees removed by each culling stage in one frame, summed over the species. Same layout as the counters of one
+// group on the GPU
+struct CullingStats {
+	uint32_t distance = 0;
+	uint32_t frustum = 0;
+	// Hidden in the depth pyramid of MAX_FRAMES_IN_FLIGHT frames ago
+	uint32_t occluded = 0;
+	// Occluded ones that showed up in the pyramid of their own frame and were drawn in the late pass
+	uint32_t rescued = 0;
+	// Instances of every tree group, fake trees included, in the middle of a LOD cross-fade. They are drawn with
+	// both LODs
+	uint32_t transitioning = 0;
+	// Bark and leaf meshlets of the level 0 instances tested by the meshlet culling pass, and the ones it culled
+	uint32_t meshlets = 0;
+	uint32_t meshletsCulled = 0;
+};
+
+// Camera and size of the depth pyramid the early culling pass tests against, one per frame in flight
+struct OcclusionInfo {
+	glm::mat4 viewProj;
+	// Width, height, levels, 1 if occlusion culling is enabled
+	glm::vec4 pyramidSize;
+};
+
+// Everything the early culling pass of a frame depends on besides the forest itself
+struct CullingInputs {
+	glm::mat4 viewProj;
+	// Camera the depth pyramid it tests against was built from
+	glm::mat4 pyramidViewProj;
+	uint32_t LODEpoch;
+	bool occlusionCulling;
+	// Follow from viewProj, kept for checking the LOD selection on the CPU
+	glm::vec3 eye;
+	float pixelsPerUnit;
+};
 
 class Renderer {
 public:
     Renderer() = delete;
-    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera);
+    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, GpuProfiler* profiler);
     ~Renderer();
 
     void CreateCommandPools();
@@ -18,17 +73,22 @@ public:
 // Funcs: Descriptor Set Layout
     void CreateCameraDescriptorSetLayout();
     void CreateModelDescriptorSetLayout();
+	void CreateForestMaterialDescriptorSetLayout();
     void CreateGrassDescriptorSetLayout();
 	void CreateTimeDescriptorSetLayout();
 	void CreateWindDescriptorSetLayout();
 	void CreateDayNightDescriptorSetLayout();
 	void CreateComputeDescriptorSetLayout();
 	void CreateCullingComputeDescriptorSetLayout();
-	void CreateFakeCullingComputeDescriptorSetLayout();
+	void CreateDrawCompactionDescriptorSetLayout();
 	void CreateSkyboxDescriptorSetLayout();
 	void CreateTerrainDescriptorSetLayout();
 	void CreateLODInfoDescriptorSetLayout();
 	void CreateGuiDescriptorSetLayout();
+	void CreateDepthPyramidDescriptorSetLayout();
+	void CreateOcclusionDescriptorSetLayout();
+	void CreateLateCullingComputeDescriptorSetLayout();
+	void CreateMeshletCullingDescriptorSetLayouts();
 
 
     void CreateDescriptorPool();
@@ -36,39 +96,87 @@ public:
 // Funcs: Descriptor Set
     void CreateCameraDescriptorSet();
     void CreateModelDescriptorSets();
+	void CreateForestMaterialDescriptorSets();
     void CreateGrassDescriptorSets();
 	void CreateTimeDescriptorSet();
 	void CreateWindDescriptorSet();
 	void CreateDayNightDescriptorSet();
 	void CreateComputeDescriptorSets();
 	void CreateCullingComputeDescriptorSets();
-	void CreateFakeCullingComputeDescriptorSets();
+	void CreateDrawCompactionDescriptorSets();
 	void CreateSkyboxDescriptorSet();
 	void CreateTerrainDescriptorSet();
 	void CreateLODInfoDescriptorSets();
 	void CreateGuiDescriptorSets();
+	void CreateDepthPyramidDescriptorSets();
+	void CreateOcclusionDescriptorSets();
+	void CreateLateCullingComputeDescriptorSets();
+	void CreateMeshletCullingDescriptorSets();
+	// Points the pyramid descriptors at the current depth buffer and pyramids, after every CreateFrameResources
+	void UpdateDepthPyramidDescriptorSets();
 
 // Funcs: Pipeline(Correspond to how many different shaders)
     void CreateGraphicsPipeline();
     void CreateGrassPipeline();
     void CreateComputePipeline();
 	void CreateCullingComputePipeline();
-	void CreateFakeCullingComputePipeline();
+	void CreateDrawCompactionPipeline();
 	void CreateBarkPipeline();
 	void CreateLeafPipeline();
 	void CreateBillboardPipeline();
 	void CreateSkyboxPipeline();
 	void CreateTerrainPipeline();
 	void CreateGuiPipeline();
+	void CreateDepthPyramidPipeline();
+	void CreateLateCullingComputePipeline();
+	void CreateMeshletCullingPipeline();
 
     void CreateFrameResources();
     void DestroyFrameResources();
     void RecreateFrameResources();
+    void CreateOcclusionCullingResources();
 
     void RecordCommandBuffers();
-    void RecordComputeCommandBuffer();
+    void RecordComputeCommandBuffer(uint32_t frame);
+    // Stands in for the compute command buffer when the frame reuses its culling results
+    void RecordCullingReuseCommandBuffer(uint32_t frame);
+    void RecordCullingOutputBarrier(VkCommandBuffer commandBuffer, uint32_t frame, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex);
+    void ReleaseCullingOutputsToCompute();
+    void CreateVisibleCountBuffers();
+    void CreateTerrainChunkBuffers();
+    void RecordVisibleCountCopy(VkCommandBuffer commandBuffer, uint32_t frame);
+    void RecordDepthPyramid(VkCommandBuffer commandBuffer, uint32_t frame);
+    void RecordLateCulling(VkCommandBuffer commandBuffer, uint32_t frame);
+    void RecordCullingStatsCopy(VkCommandBuffer commandBuffer, uint32_t frame);
+    // Draws up to maxDrawCount commands starting at offset, with the GPU written count if countBuffer is given and
+    // the device can, otherwise with one multi-draw or one draw per command
+    void RecordTreeDraws(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount);
+    void CreateSyncObjects();
 
-    void Frame();
+    // False if nothing was submitted because the swap chain had to be recreated first
+    bool Frame();
+
+    // Counts of the frame whose fence was waited on last, i.e. MAX_FRAMES_IN_FLIGHT frames old
+    const VisibleInstanceCounts& GetVisibleInstanceCounts() const;
+    // Same frame as the visible counts
+    const CullingStats& GetCullingStats() const;
+    // Chunks the last Frame() selected from the terrain quadtree
+    const TerrainSelection& GetTerrainSelection() const;
+    void SetOcclusionCulling(bool enabled);
+    // Frames whose culling inputs match what their slot last culled with skip the culling pass and draw the slot's
+    // indirect commands again, unless a LOD cross-fade was still running in them
+    void SetTemporalCulling(bool enabled);
+    // True if the last Frame() skipped culling
+    bool IsCullingReused() const;
+    // Recomputes the LOD decisions of every collected frame on the CPU and compares them with the culling pass. Slow,
+    // frames whose LOD table changed since they were culled are skipped
+    void SetLodCheck(bool enabled);
+    void CheckLodSelection(const VkDrawIndexedIndirectCommand* commands, const CullingStats* stats, const CullingInputs& inputs);
+    uint32_t GetLodCheckFrames() const;
+    uint32_t GetLodCheckMismatches() const;
+    // Waits for the GPU and writes the image submitted by the last Frame() to a PNG, headless only
+    bool SaveLastFrame(const char* path);
 
 private:
     Device* device;
@@ -76,44 +184,70 @@ private:
     SwapChain* swapChain;
     Scene* scene;
     Camera* camera;
+    UniformRing* uniformRing;
+    GpuProfiler* profiler;
+    // Graphics and compute are different queue families, culling outputs change owner every frame
+    bool asyncCompute;
+    // vkCmdDrawIndexedIndirectCountKHR or the AMD original, null if the device has neither
+    PFN_vkCmdDrawIndexedIndirectCountAMD drawIndexedIndirectCount = nullptr;
+    bool multiDrawIndirect;
+    // The bark and leaf of up to MESHLET_INSTANCES level 0 instances are drawn meshlet by meshlet, needs the draw count
+    bool meshletCulling;
 
     VkCommandPool graphicsCommandPool;
     VkCommandPool computeCommandPool;
 
+    // Everything culling let through is drawn in the first pass, trees rescued by the late occlusion test in the second
     VkRenderPass renderPass;
+    VkRenderPass lateRenderPass;
 
 
 // Vars: Descriptor Set Layout
 	VkDescriptorSetLayout cameraDescriptorSetLayout;
 	VkDescriptorSetLayout modelDescriptorSetLayout;
+	VkDescriptorSetLayout forestMaterialDescriptorSetLayout;
 	VkDescriptorSetLayout grassDescriptorSetLayout;
 	VkDescriptorSetLayout timeDescriptorSetLayout;
 	VkDescriptorSetLayout windDescriptorSetLayout;
 	VkDescriptorSetLayout dayNightDescriptorSetLayout;
 	VkDescriptorSetLayout computeDescriptorSetLayout;
 	VkDescriptorSetLayout cullingComputeDescriptorSetLayout;
-	VkDescriptorSetLayout fakeCullingComputeDescriptorSetLayout;
+	VkDescriptorSetLayout drawCompactionDescriptorSetLayout;
 	VkDescriptorSetLayout skyboxDescriptorSetLayout;
 	VkDescriptorSetLayout terrainDescriptorSetLayout;
 	VkDescriptorSetLayout LODInfoDescriptorSetLayout;
 	VkDescriptorSetLayout GuiDescriptorSetLayout;
+	VkDescriptorSetLayout depthPyramidDescriptorSetLayout;
+	VkDescriptorSetLayout occlusionDescriptorSetLayout;
+	VkDescriptorSetLayout lateCullingComputeDescriptorSetLayout;
+	VkDescriptorSetLayout meshletCullingDescriptorSetLayout;
+	VkDescriptorSetLayout meshletDescriptorSetLayout;
 
 	VkDescriptorPool descriptorPool;
 
 // Vars: Descriptor Set
 	VkDescriptorSet cameraDescriptorSet;
 	std::vector<VkDescriptorSet> modelDescriptorSets;
+	// Textures of every tree group for one draw kind, indexed by TreeDrawKind
+	VkDescriptorSet forestMaterialDescriptorSets[TREE_DRAW_KIND_COUNT];
 	VkDescriptorSet timeDescriptorSet;
 	VkDescriptorSet windDescriptorSet;
 	VkDescriptorSet dayNightDescriptorSet;
 	std::vector<VkDescriptorSet> grassDescriptorSets;
 	std::vector<VkDescriptorSet> computeDescriptorSets;
-	std::vector<VkDescriptorSet> cullingComputeDescriptorSets;
-	std::vector<VkDescriptorSet> fakeCullingComputeDescriptorSets;
+	VkDescriptorSet cullingComputeDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+	VkDescriptorSet drawCompactionDescriptorSets[MAX_FRAMES_IN_FLIGHT];
 	VkDescriptorSet skyboxDescriptorSet;
 	VkDescriptorSet terrainDescriptorSet;
-	std::vector<VkDescriptorSet> LODInfoDescriptorSets;
+	VkDescriptorSet LODInfoDescriptorSet;
 	VkDescriptorSet guiDescriptorSet;
+	// One per frame in flight and pyramid level, indexed frame * MAX_DEPTH_PYRAMID_LEVELS + level
+	std::vector<VkDescriptorSet> depthPyramidDescriptorSets;
+	VkDescriptorSet occlusionDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+	VkDescriptorSet lateCullingComputeDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+	VkDescriptorSet meshletCullingDescriptorSets[MAX_FRAMES_IN_FLIGHT];
+	// Meshlets of the bark and the leaf batch
+	VkDescriptorSet meshletDescriptorSets[2];
 
 // Vars: Pipeline Layout and pipeline
 	VkPipelineLayout graphicsPipelineLayout;
@@ -123,10 +257,13 @@ private:
 	VkPipelineLayout grassPipelineLayout;
 	VkPipelineLayout computePipelineLayout;
 	VkPipelineLayout cullingComputePipelineLayout;
-	VkPipelineLayout fakeCullingComputePipelineLayout;
+	VkPipelineLayout drawCompactionPipelineLayout;
 	VkPipelineLayout skyboxPipelineLayout;
 	VkPipelineLayout terrainPipelineLayout;
 	VkPipelineLayout guiPipelineLayout;
+	VkPipelineLayout depthPyramidPipelineLayout;
+	VkPipelineLayout lateCullingComputePipelineLayout;
+	VkPipelineLayout meshletCullingPipelineLayout;
 
 	VkPipeline graphicsPipeline;
 	VkPipeline barkPipeline;
@@ -135,10 +272,13 @@ private:
 	VkPipeline grassPipeline;
 	VkPipeline computePipeline;
 	VkPipeline cullingComputePipeline;
-	VkPipeline fakeCullingComputePipeline;
+	VkPipeline drawCompactionPipeline;
 	VkPipeline skyboxPipeline;
 	VkPipeline terrainPipeline;
 	VkPipeline guiPipeline;
+	VkPipeline depthPyramidPipeline;
+	VkPipeline lateCullingComputePipeline;
+	VkPipeline meshletCullingPipeline;
 
     std::vector<VkImageView> imageViews;
     VkImage depthImage;
@@ -146,6 +286,60 @@ private:
     VkImageView depthImageView;
     std::vector<VkFramebuffer> framebuffers;
 
+// Vars: Hi-Z occlusion culling. Every frame in flight builds its own depth pyramid from the early pass depth, the late
+// culling pass of the frame and the early culling pass MAX_FRAMES_IN_FLIGHT frames later test against it
+    VkImage depthPyramids[MAX_FRAMES_IN_FLIGHT];
+    VkDeviceMemory depthPyramidMemories[MAX_FRAMES_IN_FLIGHT];
+    // All levels for sampling, one per level for writing
+    VkImageView depthPyramidViews[MAX_FRAMES_IN_FLIGHT];
+    std::vector<VkImageView> depthPyramidLevelViews[MAX_FRAMES_IN_FLIGHT];
+    uint32_t depthPyramidWidth;
+    uint32_t depthPyramidHeight;
+    uint32_t depthPyramidLevels;
+    VkSampler depthPyramidSampler;
+    glm::mat4 depthPyramidViewProj[MAX_FRAMES_IN_FLIGHT];
+    VkBuffer occlusionInfoBuffers[MAX_FRAMES_IN_FLIGHT];
+    OcclusionInfo* occlusionInfoData[MAX_FRAMES_IN_FLIGHT];
+    bool occlusionCulling = true;
+
     std::vector<VkCommandBuffer> commandBuffers;
-    VkCommandBuffer computeCommandBuffer;
+    std::vector<VkCommandBuffer> computeCommandBuffers;
+
+// Vars: Temporal coherence. A frame slot whose culling inputs still match the ones it last culled with submits its
+// reuse command buffer instead of culling, the indirect commands and culled instances of the slot stay as they are
+    std::vector<VkCommandBuffer> cullingReuseCommandBuffers;
+    CullingInputs culledInputs[MAX_FRAMES_IN_FLIGHT];
+    bool culledInputsValid[MAX_FRAMES_IN_FLIGHT] = {};
+    bool temporalCulling = true;
+    bool cullingReused = false;
+
+// Vars: LOD check against the CPU reference
+    bool lodCheck = false;
+    uint32_t lodCheckFrames = 0;
+    uint32_t lodCheckMismatches = 0;
+
+// Vars: Frames in flight
+    uint32_t currentFrame = 0;
+    VkFence inFlightFences[MAX_FRAMES_IN_FLIGHT];
+    VkSemaphore imageAvailableSemaphores[MAX_FRAMES_IN_FLIGHT];
+    VkSemaphore renderFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
+    VkSemaphore cullingFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
+
+// Vars: Visible instance readback ring, the early pass' indirect commands copied into host memory by every frame in
+// flight and read once its fence has signaled, so the CPU never waits for them
+    VkBuffer visibleCountBuffers[MAX_FRAMES_IN_FLIGHT];
+    VkDrawIndexedIndirectCommand* visibleCountData[MAX_FRAMES_IN_FLIGHT];
+    VisibleInstanceCounts visibleInstanceCounts;
+    // CullingStats of every tree group, copied after the late culling pass
+    VkBuffer cullingStatsReadbackBuffers[MAX_FRAMES_IN_FLIGHT];
+    CullingStats* cullingStatsData[MAX_FRAMES_IN_FLIGHT];
+    CullingStats cullingStats;
+
+// Vars: Terrain chunks, selected on the CPU into the slot of a frame once its fence has signaled. The chunks are the
+// instances of one indirect draw of the grid patch, whose instance count is the number selected
+    VkBuffer terrainChunkBuffers[MAX_FRAMES_IN_FLIGHT];
+    TerrainChunk* terrainChunkData[MAX_FRAMES_IN_FLIGHT];
+    VkBuffer terrainDrawBuffers[MAX_FRAMES_IN_FLIGHT];
+    VkDrawIndexedIndirectCommand* terrainDrawData[MAX_FRAMES_IN_FLIGHT];
+    TerrainSelection terrainSelection;
 };
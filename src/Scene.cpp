@@ -1,21 +1,30 @@
+#include <algorithm>
+#include <string>
 #include "Scene.h"
 #include "BufferUtils.h"
 
-Scene::Scene(Device* device) : device(device) {
-    //Time buffer Initialization
-	BufferUtils::CreateBuffer(device, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, timeBuffer, timeBufferMemory);
-    vkMapMemory(device->GetVkDevice(), timeBufferMemory, 0, sizeof(Time), 0, &mappedData);
-    memcpy(mappedData, &time, sizeof(Time));
-	//Wind buffer
-	BufferUtils::CreateBuffer(device, sizeof(WindInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, windBuffer, windBufferMemory);
-	vkMapMemory(device->GetVkDevice(), windBufferMemory, 0, sizeof(WindInfo), 0, &WindmappedData);
+// LOD thresholds are projected sizes of tens to hundreds of pixels, changes below this move next to no trees between
+// levels
+static const float LOD_EPOCH_EPSILON = 1e-4f;
+
+Scene::Scene(Device* device, UniformRing* uniformRing) : device(device), uniformRing(uniformRing) {
+    //Time, wind and day&night live in the per-frame uniform ring
+	timeOffset = uniformRing->Allocate(sizeof(Time));
+	mappedData = uniformRing->GetShadow(timeOffset);
+	memcpy(mappedData, &time, sizeof(Time));
+	windOffset = uniformRing->Allocate(sizeof(WindInfo));
+	WindmappedData = uniformRing->GetShadow(windOffset);
 	memcpy(WindmappedData, &wind, sizeof(WindInfo));
-	//Day&Night buffer
-	BufferUtils::CreateBuffer(device, sizeof(DayNightInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, dayNightBuffer, dayNightBufferMemory);
-	vkMapMemory(device->GetVkDevice(), dayNightBufferMemory, 0, sizeof(DayNightInfo), 0, &DayNightmappedData);
+	dayNightOffset = uniformRing->Allocate(sizeof(DayNightInfo));
+	DayNightmappedData = uniformRing->GetShadow(dayNightOffset);
 	memcpy(DayNightmappedData, &dayNight, sizeof(DayNightInfo));
 
 	numFakeTree = 0;
+
+	// The LOD table is one uniform, unused entries keep the invalid range
+	LODInfoOffset = uniformRing->Allocate(sizeof(LODInfo) * MAX_TREE_GROUPS);
+	LODmappedData = uniformRing->GetShadow(LODInfoOffset);
+	memcpy(LODmappedData, LODInfoVec, sizeof(LODInfoVec));
 }
 
 const Terrain* Scene::GetTerrain() const {
@@ -40,14 +49,20 @@ const std::vector<Blades*>& Scene::GetBlades() const {
   return blades;
 }
 
-const std::vector<InstanceBuffer*>& Scene::GetInstanceBuffer() const
-{
-	return instanceBuffers;
+const std::vector<TreeGroup>& Scene::GetTreeGroups() const {
+	return treeGroups;
 }
 
-const std::vector<FakeInstanceBuffer*>& Scene::GetFakeInstanceBuffer() const
-{
-	return fakeInstanceBuffers;
+int Scene::GetNumSpecies() const {
+	return numSpecies;
+}
+
+const ForestInstanceBuffer* Scene::GetForest() const {
+	return forest;
+}
+
+const ModelBatch* Scene::GetModelBatch(TreeDrawKind kind) const {
+	return modelBatches[kind];
 }
 
 void Scene::SetTerrain(Terrain* terrain) {
@@ -75,9 +90,16 @@ void Scene::AddBlades(Blades* blades) {
   this->blades.push_back(blades);
 }
 
-void Scene::AddInstanceBuffer(InstanceBuffer * Data)
-{
-	instanceBuffers.push_back(Data);
+void Scene::SetSeed(unsigned int seed) {
+	rng.seed(seed);
+}
+
+int Scene::RandomInt(int range) {
+	return static_cast<int>(rng() % static_cast<unsigned int>(range));
+}
+
+void Scene::SetFixedTimeStep(float step) {
+	fixedTimeStep = step;
 }
 
 void Scene::UpdateTime() {
@@ -85,46 +107,158 @@ void Scene::UpdateTime() {
     duration<float> nextDeltaTime = duration_cast<duration<float>>(currentTime - startTime);
     startTime = currentTime;
 
-    time.TimeInfo[0] = nextDeltaTime.count();
+    time.TimeInfo[0] = fixedTimeStep > 0.0f ? fixedTimeStep : nextDeltaTime.count();
     time.TimeInfo[1] += time.TimeInfo[0];
 
     memcpy(mappedData, &time, sizeof(Time));
 }
 
-VkBuffer Scene::GetTimeBuffer() const {
-    return timeBuffer;
+VkDeviceSize Scene::GetTimeBufferOffset() const {
+    return timeOffset;
+}
+
+void Scene::AddLODInfo(glm::vec4 info, glm::vec4 bounds) {
+	if (treeGroups.empty()) {
+		throw std::runtime_error("LOD info added before its tree group");
+	}
+	LODInfo& lodInfo = LODInfoVec[treeGroups.size() - 1];
+	lodInfo.Info = info;
+	lodInfo.Bounds = bounds;
+	UpdateLevelEnds(static_cast<uint32_t>(treeGroups.size() - 1));
+	memcpy(LODmappedData, LODInfoVec, sizeof(LODInfoVec));
+	LODEpoch++;
+}
+
+void Scene::AddMeshLOD(const Model* bark, const Model* leaf, float start) {
+	if (treeGroups.empty() || treeGroups.size() != size_t(numSpecies)) {
+		throw std::runtime_error("mesh levels have to be added right after their tree species");
+	}
+	TreeGroup& group = treeGroups.back();
+	if (group.levels.size() >= MAX_TREE_LODS) {
+		// The culling pass packs the visible count of every level into one uint, 10 bits each
+		throw std::runtime_error("too many mesh levels for one tree species, at most " + std::to_string(MAX_TREE_LODS));
+	}
+	if (start <= group.levels.back().start || start >= 1.0f) {
+		throw std::runtime_error("mesh levels have to start farther away than the one before and before LOD0");
+	}
+	TreeMeshLOD level;
+	level.bark = bark;
+	level.leaf = leaf;
+	level.start = start;
+	group.levels.push_back(level);
+	UpdateLevelEnds(static_cast<uint32_t>(treeGroups.size() - 1));
+	memcpy(LODmappedData, LODInfoVec, sizeof(LODInfoVec));
+	LODEpoch++;
+}
+
+uint32_t Scene::GetMaxMeshLevels() const {
+	size_t levels = 0;
+	for (const TreeGroup& group : treeGroups) {
+		levels = std::max(levels, group.levels.size());
+	}
+	return static_cast<uint32_t>(levels);
+}
+
+void Scene::UpdateLevelEnds(uint32_t group) {
+	const std::vector<TreeMeshLOD>& levels = treeGroups[group].levels;
+	LODInfo& lodInfo = LODInfoVec[group];
+	for (uint32_t l = 0; l < MAX_TREE_LODS; l++) {
+		// Projected sizes fall off with the inverse distance
+		lodInfo.LevelEnds[l] = l + 1 < levels.size() ? lodInfo.Info[0] / levels[l + 1].start : lodInfo.Info[0];
+	}
 }
 
-void Scene::AddLODInfoBuffer(glm::vec4 LODInfo) {
-	LODInfoVec.push_back(LODInfo);
-	void* p;
-	VkBuffer LODInfoBuf;
-	VkDeviceMemory LODInfoBufMemory;
-	BufferUtils::CreateBuffer(device, sizeof(glm::vec4), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, LODInfoBuf, LODInfoBufMemory);
-	vkMapMemory(device->GetVkDevice(), LODInfoBufMemory, 0, sizeof(glm::vec4), 0, &p);
-	memcpy(p, &LODInfoVec[LODInfoVec.size() - 1], sizeof(glm::vec4));
-	LODmappedData.push_back(p);
-	LODInfoBuffer.push_back(LODInfoBuf);
-	LODInfoBufferMemory.push_back(LODInfoBufMemory);
+VkDeviceSize Scene::GetLODInfoBufferOffset() const {
+	return LODInfoOffset;
 }
 
-std::vector<VkBuffer> Scene::GetLODInfoBuffer() const {
-	return LODInfoBuffer;
+void Scene::BuildForest(Device* device, UploadContext* uploadContext) {
+	std::vector<InstanceData> instances;
+	std::vector<uint32_t> instanceGroups;
+	std::vector<const Model*> batchModels[TREE_DRAW_KIND_COUNT];
+	const uint32_t numGroups = static_cast<uint32_t>(treeGroups.size());
+	// Bark and leaf batches hold level l of group g at l * numGroups + g, the billboard batch one model per group
+	batchModels[TREE_DRAW_BARK].resize(MAX_TREE_LODS * numGroups, nullptr);
+	batchModels[TREE_DRAW_LEAF].resize(MAX_TREE_LODS * numGroups, nullptr);
+	for (uint32_t g = 0; g < numGroups; g++) {
+		const TreeGroup& group = treeGroups[g];
+		LODInfoVec[g].Range = glm::uvec4(instances.size(), group.instances.size(), g >= uint32_t(numSpecies) ? 1u : 0u, group.levels.size());
+		instances.insert(instances.end(), group.instances.begin(), group.instances.end());
+		instanceGroups.insert(instanceGroups.end(), group.instances.size(), g);
+		for (uint32_t l = 0; l < group.levels.size(); l++) {
+			batchModels[TREE_DRAW_BARK][l * numGroups + g] = group.levels[l].bark;
+			batchModels[TREE_DRAW_LEAF][l * numGroups + g] = group.levels[l].leaf;
+		}
+		batchModels[TREE_DRAW_BILLBOARD].push_back(group.billboard);
+	}
+	memcpy(LODmappedData, LODInfoVec, sizeof(LODInfoVec));
+
+	// Leaves are drawn two-sided, their meshlets are only culled against the frustum
+	const BatchMeshlets meshlets[TREE_DRAW_KIND_COUNT] = { BATCH_MESHLETS_ONE_SIDED, BATCH_MESHLETS_TWO_SIDED, BATCH_MESHLETS_NONE };
+	for (int kind = 0; kind < TREE_DRAW_KIND_COUNT; kind++) {
+		modelBatches[kind] = new ModelBatch(device, uploadContext, batchModels[kind], kind == TREE_DRAW_BILLBOARD ? VERTEX_FORMAT_FULL : TREE_VERTEX_FORMAT, meshlets[kind]);
+	}
+
+	// Every species can have MESHLET_INSTANCES instances with all meshlets of its nearest level visible
+	uint32_t meshletDrawCapacity = 0;
+	for (int kind = TREE_DRAW_BARK; kind <= TREE_DRAW_LEAF; kind++) {
+		uint32_t meshletCount = 0;
+		for (uint32_t g = 0; g < uint32_t(numSpecies); g++) {
+			meshletCount += modelBatches[kind]->GetMeshletRange(g).meshletCount;
+		}
+		meshletDrawCapacity = std::max(meshletDrawCapacity, MESHLET_INSTANCES * meshletCount);
+	}
+
+	// Every group has one command per slot at slot * MAX_TREE_GROUPS + group. Unused slots draw nothing. Without
+	// culling every instance is drawn with its nearest mesh level and as a billboard
+	std::vector<VkDrawIndexedIndirectCommand> commands(TREE_DRAW_SLOT_COUNT * MAX_TREE_GROUPS, VkDrawIndexedIndirectCommand{});
+	for (int kind = 0; kind < TREE_DRAW_KIND_COUNT; kind++) {
+		const uint32_t levels = kind == TREE_DRAW_BILLBOARD ? 1 : MAX_TREE_LODS;
+		for (uint32_t l = 0; l < levels; l++) {
+			for (uint32_t g = 0; g < numGroups; g++) {
+				VkDrawIndexedIndirectCommand& command = commands[TreeDrawSlot(TreeDrawKind(kind), l) * MAX_TREE_GROUPS + g];
+				command = modelBatches[kind]->GetDraw(l * numGroups + g);
+				command.instanceCount = l == 0 ? LODInfoVec[g].Range.y : 0;
+				command.firstInstance = LODInfoVec[g].Range.x;
+			}
+		}
+	}
+	forest = new ForestInstanceBuffer(device, uploadContext, instances, instanceGroups, commands, meshletDrawCapacity);
 }
 
-VkBuffer Scene::GetWindBuffer() const {
-	return windBuffer;
+VkDeviceSize Scene::GetWindBufferOffset() const {
+	return windOffset;
 }
-VkBuffer Scene::GetDayNightBuffer() const {
-	return dayNightBuffer;
+VkDeviceSize Scene::GetDayNightBufferOffset() const {
+	return dayNightOffset;
 }
 
-void Scene::UpdateLODInfo(float LOD0, float LOD1) {
-	for (int i = 0; i < LODInfoVec.size(); i++) {
-		LODInfoVec[i][0] = LOD0;
-		LODInfoVec[i][1] = LOD1;
-		memcpy(LODmappedData[i], &LODInfoVec[i], sizeof(glm::vec4));
+UniformRing* Scene::GetUniformRing() const {
+	return uniformRing;
+}
+
+void Scene::UpdateLODInfo(float LOD0, float LOD1, float fakeTreeLOD) {
+	for (int i = 0; i < int(treeGroups.size()); i++) {
+		LODInfoVec[i].Info[0] = LOD0;
+		LODInfoVec[i].Info[1] = i < numSpecies ? LOD1 : fakeTreeLOD;
+		UpdateLevelEnds(i);
 	}
+	memcpy(LODmappedData, LODInfoVec, sizeof(LODInfoVec));
+
+	glm::vec3 LOD(LOD0, LOD1, fakeTreeLOD);
+	glm::vec3 delta = glm::abs(LOD - epochLOD);
+	if (std::max(delta.x, std::max(delta.y, delta.z)) > LOD_EPOCH_EPSILON) {
+		epochLOD = LOD;
+		LODEpoch++;
+	}
+}
+
+uint32_t Scene::GetLODEpoch() const {
+	return LODEpoch;
+}
+
+const LODInfo& Scene::GetLODInfo(uint32_t group) const {
+	return LODInfoVec[group];
 }
 
 
@@ -140,26 +274,39 @@ void Scene::UpdateDayNightInfo(float dlen, bool act) {
 	memcpy(DayNightmappedData, &dayNight, sizeof(DayNightInfo));
 }
 
-bool Scene::InsertRandomTrees(int numTrees, float treeBaseScale, int modelId, Device* device, VkCommandPool commandPool) {
+bool Scene::InsertRandomTrees(int numTrees, float treeBaseScale, int modelId) {
+	if (treeGroups.size() != size_t(numSpecies)) {
+		throw std::runtime_error("tree species have to be inserted before the fake trees");
+	}
+	if (treeGroups.size() >= MAX_TREE_GROUPS) {
+		throw std::runtime_error("too many tree groups");
+	}
 	std::vector<InstanceData> instanceData;
 	int randRange = terrain->GetTerrainDim() - 2;
 	for (int i = 0; i < numTrees; i++) {
-		float posX = (rand() % (randRange * 5)) / 5.0f;
-		float posZ = (rand() % (randRange * 5)) / 5.0f;
+		float posX = (RandomInt(randRange * 5)) / 5.0f;
+		float posZ = (RandomInt(randRange * 5)) / 5.0f;
 		float posY = terrain->GetHeight(posX, posZ);
 		glm::vec3 position(posX, posY, posZ);
-		float scale = 0.9f + float(rand() % 200) / 1000.0f;
+		float scale = 0.9f + float(RandomInt(200)) / 1000.0f;
 		scale *= treeBaseScale;
-		float r = (175 + float(rand() % 80)) / 255.0f;
-		float g = (175 + float(rand() % 80)) / 255.0f;
-		float b = (175 + float(rand() % 80)) / 255.0f;
-		float theta = float(rand() % 3145) / 1000.0f;
+		float r = (175 + float(RandomInt(80))) / 255.0f;
+		float g = (175 + float(RandomInt(80))) / 255.0f;
+		float b = (175 + float(RandomInt(80))) / 255.0f;
+		float theta = float(RandomInt(3145)) / 1000.0f;
 		printf("|| Tree No.%d: <position: %f %f %f> <scale: %f> <theta: %f> <tintColor: %f %f %f>||\n", i, posX, posY, posZ, scale, theta, r, g, b);
 		instanceData.push_back(InstanceData(glm::vec4(position, scale), glm::vec4(r, g, b, theta)));
 		UpdateDensityDistribution(int(posX), int(posZ));
 	}
-	InstanceBuffer* instanceBuffer = new InstanceBuffer(device, commandPool, instanceData, models[modelId]->getIndices().size(), models[modelId+1]->getIndices().size(), models[modelId+2]->getIndices().size());
-	AddInstanceBuffer(instanceBuffer);
+	TreeGroup group;
+	group.instances = instanceData;
+	TreeMeshLOD level;
+	level.bark = models[modelId];
+	level.leaf = models[modelId + 1];
+	group.levels.push_back(level);
+	group.billboard = models[modelId + 2];
+	treeGroups.push_back(group);
+	numSpecies++;
 	return true;
 }
 
@@ -218,7 +365,10 @@ void Scene::UpdateDensityDistribution(int x, int z) {
 			}
 		}
 
-	std::random_shuffle(squares.begin(), squares.end());
+	// Fisher-Yates on rng() directly, std::shuffle differs between standard libraries for the same seed
+	for (int i = int(squares.size()) - 1; i > 0; i--) {
+		std::swap(squares[i], squares[RandomInt(i + 1)]);
+	}
 	maxNumNearbyFake = glm::min(maxNumNearbyFake, int(squares.size()));
 	for (int i = 0; i < maxNumNearbyFake; i++) {
 		if (GetDensityMeshValue(squares[i].x, squares[i].y) == 0) { // can insert fake tree
@@ -234,7 +384,10 @@ void Scene::UpdateDensityDistribution(int x, int z) {
 	}
 }
 
-void Scene::GatherFakeTrees(Device* device, VkCommandPool commandPool) {
+void Scene::GatherFakeTrees(int fakeModelId, glm::vec4 fakeTreeBounds) {
+	if (treeGroups.size() + 2 > MAX_TREE_GROUPS) {
+		throw std::runtime_error("too many tree groups");
+	}
 	std::vector<InstanceData> instanceData;
 	std::vector<InstanceData> instanceData2;
 	for(int i = 0; i < meshDim; i++)
@@ -242,10 +395,10 @@ void Scene::GatherFakeTrees(Device* device, VkCommandPool commandPool) {
 			if (GetDensityMeshValue(i, j) > 1) {
 				float height = terrain->GetHeight(i, j);
 				glm::vec3 position(i, height, j);
-				float scale = 0.9f + float(rand() % 200) / 1000.0f;
-				float r = (175 + float(rand() % 80)) / 255.0f;
-				float g = (175 + float(rand() % 80)) / 255.0f;
-				float b = (175 + float(rand() % 80)) / 255.0f;
+				float scale = 0.9f + float(RandomInt(200)) / 1000.0f;
+				float r = (175 + float(RandomInt(80))) / 255.0f;
+				float g = (175 + float(RandomInt(80))) / 255.0f;
+				float b = (175 + float(RandomInt(80))) / 255.0f;
 				// theta = -1 means fake trees
 				float theta = -1;
 				if(GetDensityMeshValue(i, j)%10 < 7)
@@ -254,21 +407,20 @@ void Scene::GatherFakeTrees(Device* device, VkCommandPool commandPool) {
 					instanceData2.push_back(InstanceData(glm::vec4(position, scale), glm::vec4(r, g, b, theta)));
 			}
 		}
-	FakeInstanceBuffer* fakeInstanceBuffer = new FakeInstanceBuffer(device, commandPool, instanceData);
-	FakeInstanceBuffer* fakeInstanceBuffer2 = new FakeInstanceBuffer(device, commandPool, instanceData2);
-	AddFakeInstanceBuffer(fakeInstanceBuffer);
-	AddLODInfoBuffer(glm::vec4(0.65, 0.48, 20.0f, instanceData.size()));
-	AddFakeInstanceBuffer(fakeInstanceBuffer2);
-	AddLODInfoBuffer(glm::vec4(0.65, 0.48, 20.0f, instanceData2.size()));
-}
-
-void Scene::AddFakeInstanceBuffer(FakeInstanceBuffer * Data)
-{
-	fakeInstanceBuffers.push_back(Data);
+	TreeGroup group;
+	group.instances = instanceData;
+	group.billboard = models[fakeModelId];
+	treeGroups.push_back(group);
+	AddLODInfo(glm::vec4(0.65, 0.48, 20.0f, instanceData.size()), fakeTreeBounds);
+	group.instances = instanceData2;
+	group.billboard = models[fakeModelId + 1];
+	treeGroups.push_back(group);
+	AddLODInfo(glm::vec4(0.65, 0.48, 20.0f, instanceData2.size()), fakeTreeBounds);
 }
 
 Scene::~Scene() {
-	vkUnmapMemory(device->GetVkDevice(), timeBufferMemory);
-	vkDestroyBuffer(device->GetVkDevice(), timeBuffer, nullptr);
-	vkFreeMemory(device->GetVkDevice(), timeBufferMemory, nullptr);
+	delete forest;
+	for (int kind = 0; kind < TREE_DRAW_KIND_COUNT; kind++) {
+		delete modelBatches[kind];
+	}
 }
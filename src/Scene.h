@@ -4,13 +4,16 @@
 #include <chrono>
 #include <cstdlib> 
 #include <math.h>
+#include <random>
 
 #include "Model.h"
 #include "Blades.h"
 #include "InstanceData.h"
+#include "ModelBatch.h"
 #include "Terrain.h"
 #include "skybox.h"
 #include "GUI.h"
+#include "UniformRing.h"
 
 using namespace std::chrono;
 
@@ -25,6 +28,40 @@ struct WindInfo {
 	glm::vec4 WindData = glm::vec4(15.0, 12.0, 15.0, 1.0);
 };
 
+// One entry of the LOD table, the table has MAX_TREE_GROUPS of them
+struct LODInfo {
+	// 0: LOD0 1: LOD1 2: TreeHeight 3: NumTrees. LOD thresholds are projected diameters in pixels of the full model's
+	// sphere (the billboard's for fake trees): instances switch to their billboard below LOD0 and back to their full
+	// tree above LOD1, see TREE_LOD_HYSTERESIS, and cross-fade between the two
+	glm::vec4 Info;
+	// Culling spheres on the tree axis, 0: full model center height 1: full model radius (both times the instance
+	// scale, species' impostors use it too) 2: fake tree billboard center height 3: fake tree billboard radius
+	glm::vec4 Bounds;
+	// 0: first instance in the forest buffer (0xFFFFFFFF for unused entries) 1: instance count 2: 1 for fake trees
+	// 3: number of mesh levels
+	glm::uvec4 Range = glm::uvec4(0xFFFFFFFFu, 0u, 0u, 0u);
+	// Projected size in pixels down to which each mesh level is drawn, the last level ends at Info[0]
+	glm::vec4 LevelEnds = glm::vec4(0.0f);
+};
+
+// One mesh level of a species
+struct TreeMeshLOD {
+	const Model* bark = nullptr;
+	const Model* leaf = nullptr;
+	// Fraction of the species' LOD0 distance from which on this level replaces the one before, so its projected size
+	// threshold is LOD0 / start
+	float start = 0.0f;
+};
+
+// Instances of one tree species or fake tree group and the models they are drawn with. Fake trees have no mesh
+// levels
+struct TreeGroup {
+	std::vector<InstanceData> instances;
+	// Nearest first, at most MAX_TREE_LODS
+	std::vector<TreeMeshLOD> levels;
+	const Model* billboard = nullptr;
+};
+
 struct DayNightInfo {
 	//0: Daylength, 1: Activate
 	glm::vec2 DayNightData = glm::vec2(30, 1);
@@ -33,25 +70,26 @@ struct DayNightInfo {
 class Scene {
 private:
     Device* device;
+	UniformRing* uniformRing;
     //Time
-    VkBuffer timeBuffer;
-    VkDeviceMemory timeBufferMemory;
+    VkDeviceSize timeOffset;
     Time time;
-	//LOD
-	std::vector<VkBuffer> LODInfoBuffer;
-	std::vector<VkDeviceMemory> LODInfoBufferMemory;
-	std::vector<glm::vec4> LODInfoVec;
+	//LOD, one entry per tree group
+	VkDeviceSize LODInfoOffset;
+	LODInfo LODInfoVec[MAX_TREE_GROUPS];
+	// Counts changes of the LOD table, distances that moved by less than LOD_EPOCH_EPSILON since the last change do not
+	// count so culling results stay reusable
+	uint32_t LODEpoch = 0;
+	glm::vec3 epochLOD = glm::vec3(-1.0f);
 	//Wind
-	VkBuffer windBuffer;
-	VkDeviceMemory windBufferMemory;
+	VkDeviceSize windOffset;
 	WindInfo wind;
 	//Day&Night Cycle
-	VkBuffer dayNightBuffer;
-	VkDeviceMemory dayNightBufferMemory;
+	VkDeviceSize dayNightOffset;
 	DayNightInfo dayNight;
 
     void* mappedData;
-	std::vector<void*> LODmappedData;
+	void* LODmappedData;
 	void* WindmappedData;
 	void* DayNightmappedData;
 
@@ -60,8 +98,11 @@ private:
 	GUI* gui;
     std::vector<Model*> models;
     std::vector<Blades*> blades;
-	std::vector<InstanceBuffer*> instanceBuffers;
-	std::vector<FakeInstanceBuffer*> fakeInstanceBuffers;
+	// Species first, fake tree groups after them
+	std::vector<TreeGroup> treeGroups;
+	int numSpecies = 0;
+	ForestInstanceBuffer* forest = nullptr;
+	ModelBatch* modelBatches[TREE_DRAW_KIND_COUNT] = {};
 	//Density Multiplication
 	//std::vector<std::vector<int>> densityVector;
 	int *densityMesh;
@@ -69,10 +110,18 @@ private:
 	int numFakeTree;
 
 	high_resolution_clock::time_point startTime = high_resolution_clock::now();
+	// > 0: time advances by this much per update instead of the wall clock, for reproducible runs
+	float fixedTimeStep = 0.0f;
+
+	// Tree placement draws from its own engine so a seed reproduces the same forest on every platform
+	std::mt19937 rng;
+	int RandomInt(int range);
+	// Spreads the group's mesh levels over its LOD0 distance
+	void UpdateLevelEnds(uint32_t group);
 
 public:
     Scene() = delete;
-    Scene(Device* device);
+    Scene(Device* device, UniformRing* uniformRing);
     ~Scene();
 
 
@@ -81,31 +130,49 @@ public:
 	const GUI* GetGui() const;
     const std::vector<Model*>& GetModels() const;
     const std::vector<Blades*>& GetBlades() const;
-	const std::vector<InstanceBuffer*>& GetInstanceBuffer() const;
-	const std::vector<FakeInstanceBuffer*>& GetFakeInstanceBuffer() const;
+	const std::vector<TreeGroup>& GetTreeGroups() const;
+	int GetNumSpecies() const;
+	// Created by BuildForest
+	const ForestInstanceBuffer* GetForest() const;
+	const ModelBatch* GetModelBatch(TreeDrawKind kind) const;
 
 	void SetTerrain(Terrain* terrain);
 	void SetSkybox(Skybox* skybox);
 	void SetGui(GUI* gui);
     void AddModel(Model* model);
     void AddBlades(Blades* blades);
-	void AddInstanceBuffer(InstanceBuffer* Data);
-	bool InsertRandomTrees(int numTrees, float treeBaseScale, int modelId, Device* device, VkCommandPool commandPool);
-    VkBuffer GetTimeBuffer() const;
-	void AddLODInfoBuffer(glm::vec4 LODInfo);
-	std::vector<VkBuffer> GetLODInfoBuffer() const;
-	VkBuffer GetWindBuffer() const;
-	VkBuffer GetDayNightBuffer() const;
-
+	// Adds a species drawn with models modelId (bark), modelId + 1 (leaf) and modelId + 2 (billboard)
+	bool InsertRandomTrees(int numTrees, float treeBaseScale, int modelId);
+	// Uniforms are slots of the uniform ring, bound with these offsets plus the frame's dynamic offset
+	UniformRing* GetUniformRing() const;
+    VkDeviceSize GetTimeBufferOffset() const;
+	// LOD settings of the tree group added last
+	void AddLODInfo(glm::vec4 info, glm::vec4 bounds);
+	// Adds a coarser mesh level to the species added last, drawn from start times its LOD0 distance on
+	void AddMeshLOD(const Model* bark, const Model* leaf, float start);
+	// Most mesh levels of any species
+	uint32_t GetMaxMeshLevels() const;
+	// Uploads every tree group into the forest buffer and merges their models, after all groups were added
+	void BuildForest(Device* device, UploadContext* uploadContext);
+	VkDeviceSize GetLODInfoBufferOffset() const;
+	VkDeviceSize GetWindBufferOffset() const;
+	VkDeviceSize GetDayNightBufferOffset() const;
+
+    void SetSeed(unsigned int seed);
+	void SetFixedTimeStep(float step);
     void UpdateTime();
-	void UpdateLODInfo(float LOD0, float LOD1);
+	// Projected sizes in pixels. Fake tree groups come after the tree species and start at their own size
+	void UpdateLODInfo(float LOD0, float LOD1, float fakeTreeLOD);
+	uint32_t GetLODEpoch() const;
+	const LODInfo& GetLODInfo(uint32_t group) const;
 	void UpdateWindInfo(glm::vec4 dir, glm::vec4 data);
 	void UpdateDayNightInfo(float dlen, bool act);
 
 	int GetDensityMeshValue(int x, int z);
 	void SetDensityMeshValue(int x, int z, int value);
 	void UpdateDensityDistribution(int x, int z);
-	void GatherFakeTrees(Device* device, VkCommandPool commandPool);
-	void AddFakeInstanceBuffer(FakeInstanceBuffer* Data);
+	// Fake trees are billboards drawn with models fakeModelId and fakeModelId + 1, fakeTreeBounds is their culling
+	// sphere in the LODInfo::Bounds layout
+	void GatherFakeTrees(int fakeModelId, glm::vec4 fakeTreeBounds);
 	int GetNumFakeTree() { return numFakeTree; }
 };
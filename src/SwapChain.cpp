@@ -3,6 +3,7 @@
 #include "Instance.h"
 #include "Device.h"
 #include "Window.h"
+#include "Image.h"
 
 namespace {
   // Specify the color channel format and color space type
@@ -64,14 +65,26 @@ SwapChain::SwapChain(Device* device, VkSurfaceKHR vkSurface, unsigned int numBuf
   : device(device), vkSurface(vkSurface), numBuffers(numBuffers) {
     
     Create();
+}
+
+SwapChain::SwapChain(Device* device, uint32_t width, uint32_t height, unsigned int numBuffers)
+  : device(device), vkSurface(VK_NULL_HANDLE), numBuffers(numBuffers), vkSwapChain(VK_NULL_HANDLE) {
+
+    CreateOffscreen(width, height);
+}
 
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+void SwapChain::CreateOffscreen(uint32_t width, uint32_t height) {
+    // Same format a surface would most likely give us, readable by transfers for frame dumps
+    vkSwapChainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    vkSwapChainExtent = { width, height };
 
-    if (vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-        vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create semaphores");
+    vkSwapChainImages.resize(numBuffers);
+    for (VkImage& image : vkSwapChainImages) {
+        VkDeviceMemory imageMemory;
+        Image::Create(device, width, height, vkSwapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
     }
+    imageIndex = numBuffers - 1;
 }
 
 void SwapChain::Create() {
@@ -152,9 +165,20 @@ void SwapChain::Create() {
 }
 
 void SwapChain::Destroy() {
+    if (IsHeadless()) {
+        for (VkImage image : vkSwapChainImages) {
+            Image::Destroy(device, image);
+        }
+        vkSwapChainImages.clear();
+        return;
+    }
     vkDestroySwapchainKHR(device->GetVkDevice(), vkSwapChain, nullptr);
 }
 
+bool SwapChain::IsHeadless() const {
+    return vkSurface == VK_NULL_HANDLE;
+}
+
 VkSwapchainKHR SwapChain::GetVkSwapChain() const {
     return vkSwapChain;
 }
@@ -179,26 +203,24 @@ VkImage SwapChain::GetVkImage(uint32_t index) const {
     return vkSwapChainImages[index];
 }
 
-VkSemaphore SwapChain::GetImageAvailableVkSemaphore() const {
-    return imageAvailableSemaphore;
-
-}
-
-VkSemaphore SwapChain::GetRenderFinishedVkSemaphore() const {
-    return renderFinishedSemaphore;
-}
-
 void SwapChain::Recreate(float width, float height) {
     Destroy();
+    if (IsHeadless()) {
+        CreateOffscreen(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+        return;
+    }
 	glfwSetWindowSize(GetGLFWWindow(), width, height);
     Create();
 }
 
-bool SwapChain::Acquire() {
-    if (ENABLE_VALIDATION) {
-        // the validation layer implementation expects the application to explicitly synchronize with the GPU
-        vkQueueWaitIdle(device->GetQueue(QueueFlags::Present));
+bool SwapChain::Acquire(VkSemaphore imageAvailableSemaphore) {
+    // Offscreen images are simply cycled, the semaphore is left unsignaled and must not be waited on
+    if (IsHeadless()) {
+        imageIndex = (imageIndex + 1) % GetCount();
+        return true;
     }
+
+    // The renderer's per-frame fences already keep the CPU from running ahead of the GPU
     VkResult result = vkAcquireNextImageKHR(device->GetVkDevice(), vkSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
     if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("Failed to acquire swap chain image");
@@ -214,7 +236,11 @@ bool SwapChain::Acquire() {
     return true;
 }
 
-bool SwapChain::Present() {
+bool SwapChain::Present(VkSemaphore renderFinishedSemaphore) {
+    if (IsHeadless()) {
+        return true;
+    }
+
     VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
 
     // Submit result back to swap chain for presentation
@@ -246,7 +272,5 @@ bool SwapChain::Present() {
 }
 
 SwapChain::~SwapChain() {
-    vkDestroySemaphore(device->GetVkDevice(), imageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(device->GetVkDevice(), renderFinishedSemaphore, nullptr);
     Destroy();
 }
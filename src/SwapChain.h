@@ -14,17 +14,20 @@ public:
     uint32_t GetIndex() const;
     uint32_t GetCount() const;
     VkImage GetVkImage(uint32_t index) const;
-    VkSemaphore GetImageAvailableVkSemaphore() const;
-    VkSemaphore GetRenderFinishedVkSemaphore() const;
+    // Offscreen images instead of a surface: nothing is acquired or presented
+    bool IsHeadless() const;
     
     void Recreate(float width, float height);
-    bool Acquire();
-    bool Present();
+    // Semaphores belong to the caller's frame in flight
+    bool Acquire(VkSemaphore imageAvailableSemaphore);
+    bool Present(VkSemaphore renderFinishedSemaphore);
     ~SwapChain();
 
 private:
     SwapChain(Device* device, VkSurfaceKHR vkSurface, unsigned int numBuffers);
+    SwapChain(Device* device, uint32_t width, uint32_t height, unsigned int numBuffers);
     void Create();
+    void CreateOffscreen(uint32_t width, uint32_t height);
     void Destroy();
 
     Device* device;
@@ -35,7 +38,4 @@ private:
     VkFormat vkSwapChainImageFormat;
     VkExtent2D vkSwapChainExtent;
     uint32_t imageIndex = 0;
-
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
 };
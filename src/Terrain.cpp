@@ -1,51 +1,248 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include "Terrain.h"
 #include "BufferUtils.h"
+#include "Culling.h"
 #include "Image.h"
+#include "TerrainBuilder.h"
 
-Terrain::Terrain(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
-	: Model(device, commandPool,vertices, indices) {
+namespace {
+	// Distance within which level 0 is drawn, in leaf sizes. Every level doubles it along with the node size, which
+	// keeps neighbouring chunks within one level of each other
+	const float TERRAIN_LOD_RANGE = 3.0f;
+	// Part of the band between two ranges where vertices morph into the coarser grid
+	const float MORPH_START = 0.66f;
 
-	/*if (vertices.size() > 0) {
-		BufferUtils::CreateBufferFromData(device, commandPool, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+	bool BoxInSphere(glm::vec3 low, glm::vec3 high, glm::vec3 center, float radius) {
+		const glm::vec3 offset = glm::clamp(center, low, high) - center;
+		return glm::dot(offset, offset) <= radius * radius;
 	}
+}
+
+struct Terrain::SelectionContext {
+	const glm::vec4* planes;
+	glm::vec3 eye;
+	TerrainChunk* chunks;
+	uint32_t capacity;
+	TerrainSelection selection;
+};
+
+Terrain::Terrain(Device* device, UploadContext* uploadContext, int width, int height, float* heights, float terrainDim)
+	: Model(device, uploadContext, PatchVertices(), PatchIndices()), width(width), height(height), heights(heights), terrainDim(terrainDim) {
+	BuildQuadtree();
+
+	terrainBufferObject.extent = glm::vec4(width / terrainDim, height / terrainDim, terrainDim, float(levelCount));
+	float previous = 0.0f;
+	for (uint32_t l = 0; l < TERRAIN_MAX_LODS; l++) {
+		if (l + 1 < levelCount) {
+			const float start = previous + (ranges[l] - previous) * MORPH_START;
+			terrainBufferObject.morphRanges[l] = glm::vec4(start, 1.0f / (ranges[l] - start), 0.0f, 0.0f);
+			previous = ranges[l];
+		}
+		else {
+			// There is no coarser grid than the root's
+			terrainBufferObject.morphRanges[l] = glm::vec4(FLT_MAX, 0.0f, 0.0f, 0.0f);
+		}
+	}
+	BufferUtils::CreateBufferFromData(device, uploadContext, &terrainBufferObject, sizeof(TerrainBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, terrainBuffer, terrainBufferMemory);
 
-	if (indices.size() > 0) {
-		BufferUtils::CreateBufferFromData(device, commandPool, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+	Image::Create(device, width, height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, heightMap, heightMapMemory);
+	uploadContext->TransitionLayout(heightMap, VK_FORMAT_R32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false);
+	uploadContext->UploadImage(heights, VkDeviceSize(width) * height * sizeof(float), heightMap, { Image::FullCopyRegion(width, height, 0) });
+	uploadContext->TransitionLayout(heightMap, VK_FORMAT_R32_SFLOAT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false);
+	heightMapView = Image::CreateView(device, heightMap, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, false);
+
+	// terrain.vert filters the heights itself with texelFetch, 32 bit float formats need not support linear filtering
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+	if (vkCreateSampler(device->GetVkDevice(), &samplerInfo, nullptr, &heightMapSampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create texture sampler");
 	}
 
-	modelBufferObject.modelMatrix = glm::mat4(1.0f);
-	BufferUtils::CreateBufferFromData(device, commandPool, &modelBufferObject, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);*/
+	std::vector<TerrainSurfaceTexel> surface(size_t(width) * height);
+	TerrainBuilder::BuildSurface(heights, width, height, glm::vec2(terrainBufferObject.extent), surface.data());
+	Image::Create(device, width, height, VK_FORMAT_R8G8B8A8_SNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, surfaceMap, surfaceMapMemory);
+	uploadContext->TransitionLayout(surfaceMap, VK_FORMAT_R8G8B8A8_SNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false);
+	uploadContext->UploadImage(surface.data(), surface.size() * sizeof(TerrainSurfaceTexel), surfaceMap, { Image::FullCopyRegion(width, height, 0) });
+	uploadContext->TransitionLayout(surfaceMap, VK_FORMAT_R8G8B8A8_SNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false);
+	surfaceMapView = Image::CreateView(device, surfaceMap, VK_FORMAT_R8G8B8A8_SNORM, VK_IMAGE_ASPECT_COLOR_BIT, false);
+
+	// Snorm8 filters linearly on every device
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	if (vkCreateSampler(device->GetVkDevice(), &samplerInfo, nullptr, &surfaceMapSampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create texture sampler");
+	}
 }
 
 Terrain::~Terrain() {
-	//if (indices.size() > 0) {
-	//	vkDestroyBuffer(device->GetVkDevice(), indexBuffer, nullptr);
-	//	vkFreeMemory(device->GetVkDevice(), indexBufferMemory, nullptr);
-	//}
+	vkDestroySampler(device->GetVkDevice(), heightMapSampler, nullptr);
+	vkDestroyImageView(device->GetVkDevice(), heightMapView, nullptr);
+	Image::Destroy(device, heightMap);
+	vkDestroySampler(device->GetVkDevice(), surfaceMapSampler, nullptr);
+	vkDestroyImageView(device->GetVkDevice(), surfaceMapView, nullptr);
+	Image::Destroy(device, surfaceMap);
+	BufferUtils::DestroyBuffer(device, terrainBuffer);
+	delete[] heights;
+}
+
+std::vector<Vertex> Terrain::PatchVertices() {
+	std::vector<Vertex> vertices((TERRAIN_PATCH_CELLS + 1) * (TERRAIN_PATCH_CELLS + 1));
+	for (uint32_t z = 0; z <= TERRAIN_PATCH_CELLS; z++) {
+		for (uint32_t x = 0; x <= TERRAIN_PATCH_CELLS; x++) {
+			Vertex& vertex = vertices[x + z * (TERRAIN_PATCH_CELLS + 1)];
+			vertex = Vertex();
+			vertex.pos = glm::vec3(float(x), 0.0f, float(z)) / float(TERRAIN_PATCH_CELLS);
+			vertex.texCoord = glm::vec2(vertex.pos.x, vertex.pos.z);
+			vertex.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	}
+	return vertices;
+}
 
-	//if (vertices.size() > 0) {
-	//	vkDestroyBuffer(device->GetVkDevice(), vertexBuffer, nullptr);
-	//	vkFreeMemory(device->GetVkDevice(), vertexBufferMemory, nullptr);
-	//}
+std::vector<uint32_t> Terrain::PatchIndices() {
+	// Same winding as the full resolution mesh had
+	const uint32_t row = TERRAIN_PATCH_CELLS + 1;
+	std::vector<uint32_t> indices;
+	indices.reserve(6 * TERRAIN_PATCH_CELLS * TERRAIN_PATCH_CELLS);
+	for (uint32_t z = 0; z < TERRAIN_PATCH_CELLS; z++) {
+		for (uint32_t x = 0; x < TERRAIN_PATCH_CELLS; x++) {
+			indices.push_back(x + z * row);
+			indices.push_back(x + (z + 1) * row);
+			indices.push_back(x + 1 + z * row);
 
-	//vkDestroyBuffer(device->GetVkDevice(), modelBuffer, nullptr);
-	//vkFreeMemory(device->GetVkDevice(), modelBufferMemory, nullptr);
+			indices.push_back(x + (z + 1) * row);
+			indices.push_back(x + 1 + (z + 1) * row);
+			indices.push_back(x + 1 + z * row);
+		}
+	}
+	return indices;
+}
 
-	//if (diffuseMapView != VK_NULL_HANDLE) {
-	//	vkDestroyImageView(device->GetVkDevice(), diffuseMapView, nullptr);
-	//}
+void Terrain::BuildQuadtree() {
+	const glm::vec2 texelsPerUnit = glm::vec2(width, height) / terrainDim;
+	// Patch cells of a leaf are about a texel, finer would only interpolate
+	leafSize = TERRAIN_PATCH_CELLS / std::max(texelsPerUnit.x, texelsPerUnit.y);
+	levelCount = 1;
+	while (leafSize * float(1u << (levelCount - 1)) < terrainDim) {
+		if (levelCount < TERRAIN_MAX_LODS) {
+			levelCount++;
+		}
+		else {
+			leafSize *= 2.0f;
+		}
+	}
 
-	//if (diffuseMapSampler != VK_NULL_HANDLE) {
-	//	vkDestroySampler(device->GetVkDevice(), diffuseMapSampler, nullptr);
-	//}
+	nodeCount = 0;
+	for (uint32_t l = 0; l < levelCount; l++) {
+		const float size = leafSize * float(1u << l);
+		levelNodes[l] = static_cast<uint32_t>(std::ceil(terrainDim / size));
+		nodeHeights[l].assign(levelNodes[l] * levelNodes[l], glm::vec2(FLT_MAX, -FLT_MAX));
+		nodeCount += levelNodes[l] * levelNodes[l];
+		ranges[l] = l + 1 < levelCount ? TERRAIN_LOD_RANGE * size : FLT_MAX;
+	}
 
-	//if (normalMapView != VK_NULL_HANDLE) {
-	//	vkDestroyImageView(device->GetVkDevice(), normalMapView, nullptr);
-	//}
+	// Leaves from the texels under them, including the ones on their far edges that the patch shares with the next
+	const float size = leafSize;
+	for (uint32_t z = 0; z < levelNodes[0]; z++) {
+		const int z0 = std::min(static_cast<int>(std::floor(z * size * texelsPerUnit.y)), height - 1);
+		const int z1 = std::min(static_cast<int>(std::ceil((z + 1) * size * texelsPerUnit.y)), height - 1);
+		for (uint32_t x = 0; x < levelNodes[0]; x++) {
+			const int x0 = std::min(static_cast<int>(std::floor(x * size * texelsPerUnit.x)), width - 1);
+			const int x1 = std::min(static_cast<int>(std::ceil((x + 1) * size * texelsPerUnit.x)), width - 1);
+			glm::vec2& bounds = nodeHeights[0][x + z * levelNodes[0]];
+			for (int tz = z0; tz <= z1; tz++) {
+				for (int tx = x0; tx <= x1; tx++) {
+					bounds.x = std::min(bounds.x, heights[tx + tz * width]);
+					bounds.y = std::max(bounds.y, heights[tx + tz * width]);
+				}
+			}
+		}
+	}
 
-	//if (normalMapSampler != VK_NULL_HANDLE) {
-	//	vkDestroySampler(device->GetVkDevice(), normalMapSampler, nullptr);
-	//}
+	// Every other level from its children
+	for (uint32_t l = 1; l < levelCount; l++) {
+		for (uint32_t z = 0; z < levelNodes[l - 1]; z++) {
+			for (uint32_t x = 0; x < levelNodes[l - 1]; x++) {
+				const glm::vec2& child = nodeHeights[l - 1][x + z * levelNodes[l - 1]];
+				glm::vec2& bounds = nodeHeights[l][x / 2 + (z / 2) * levelNodes[l]];
+				bounds.x = std::min(bounds.x, child.x);
+				bounds.y = std::max(bounds.y, child.y);
+			}
+		}
+	}
+}
+
+void Terrain::AddChunk(SelectionContext& context, uint32_t level, uint32_t x, uint32_t z) const {
+	const float size = leafSize * float(1u << level);
+	const glm::vec3 low = glm::vec3(x * size, nodeHeights[level][x + z * levelNodes[level]].x, z * size);
+	const glm::vec3 high = glm::vec3(std::min((x + 1) * size, terrainDim), nodeHeights[level][x + z * levelNodes[level]].y, std::min((z + 1) * size, terrainDim));
+	if (!Culling::BoxInFrustum(context.planes, low, high)) {
+		context.selection.culled++;
+	}
+	else if (context.selection.chunks < context.capacity) {
+		context.chunks[context.selection.chunks++].offsetSizeLevel = glm::vec4(low.x, low.z, size, float(level));
+	}
+}
+
+bool Terrain::SelectNode(SelectionContext& context, uint32_t level, uint32_t x, uint32_t z) const {
+	const float size = leafSize * float(1u << level);
+	// The patch is clamped to the terrain in terrain.vert, nodes past its far edges only cover part of theirs
+	const glm::vec3 low = glm::vec3(x * size, nodeHeights[level][x + z * levelNodes[level]].x, z * size);
+	const glm::vec3 high = glm::vec3(std::min((x + 1) * size, terrainDim), nodeHeights[level][x + z * levelNodes[level]].y, std::min((z + 1) * size, terrainDim));
+	// Left to the parent
+	if (!BoxInSphere(low, high, context.eye, ranges[level])) {
+		return false;
+	}
+	if (!Culling::BoxInFrustum(context.planes, low, high)) {
+		context.selection.culled++;
+		return true;
+	}
+	if (level == 0 || !BoxInSphere(low, high, context.eye, ranges[level - 1])) {
+		if (context.selection.chunks < context.capacity) {
+			context.chunks[context.selection.chunks++].offsetSizeLevel = glm::vec4(low.x, low.z, size, float(level));
+		}
+		return true;
+	}
+
+	for (uint32_t i = 0; i < 4; i++) {
+		const uint32_t childX = 2 * x + (i & 1);
+		const uint32_t childZ = 2 * z + (i >> 1);
+		if (childX >= levelNodes[level - 1] || childZ >= levelNodes[level - 1]) {
+			continue;
+		}
+		// A child out of its own range is past the end of its morph everywhere, drawn at its level it has the grid of
+		// this one
+		if (!SelectNode(context, level - 1, childX, childZ)) {
+			AddChunk(context, level - 1, childX, childZ);
+		}
+	}
+	return true;
+}
+
+TerrainSelection Terrain::SelectChunks(const glm::vec4 planes[6], glm::vec3 eye, TerrainChunk* chunks, uint32_t capacity) const {
+	SelectionContext context;
+	context.planes = planes;
+	context.eye = eye;
+	context.chunks = chunks;
+	context.capacity = capacity;
+
+	// The root's range is unbounded, every root node selects itself or its children
+	const uint32_t top = levelCount - 1;
+	for (uint32_t z = 0; z < levelNodes[top]; z++) {
+		for (uint32_t x = 0; x < levelNodes[top]; x++) {
+			SelectNode(context, top, x, z);
+		}
+	}
+	return context.selection;
 }
 
 //void Terrain::SetDiffuseMap(VkImage texture) {
@@ -172,88 +369,30 @@ Terrain::~Terrain() {
 //	return normalMapSampler;
 //}
 
-Terrain* Terrain::LoadTerrain(Device* device, VkCommandPool commandPool, char *filePath, char *rawPath, float terrainDim) {
+Terrain* Terrain::LoadTerrain(Device* device, UploadContext* uploadContext, char *filePath, char *rawPath, float terrainDim) {
 	printf("Loading terrain height Map...\n");
 	int mapWidth, mapHeight, mapBpp;
-	uint8_t* rgb_image = stbi_load(filePath, &mapWidth, &mapHeight, &mapBpp, 1);
-	int size = mapHeight * mapWidth;
-	float* mapHeights = new float[size];
-	FILE *fp = fopen(rawPath, "r");
-	uint16_t *heightsBuffer = new uint16_t[size];
-	fread(heightsBuffer, sizeof(uint16_t), size, fp);
-	for (int i = 0; i<size; i++) {
-		mapHeights[i] = heightsBuffer[i] / 65536.0f * 256.0f * 0.25f - 40.0f;
+	if (!stbi_info(filePath, &mapWidth, &mapHeight, &mapBpp)) {
+		throw std::runtime_error("Failed to load terrain height map");
 	}
-	delete heightsBuffer;
-	printf("Building terrain...\n");
-	float half_width = 0.5f*(float)mapWidth;
-	float half_height = 0.5f*(float)mapHeight;
-
-	const float inv_height = 1.0f / (float)mapHeight;
-	const float inv_width = 1.0f / (float)mapWidth;
-
-	std::vector<Vertex> vertices;
-	int num_vertices = (mapHeight - 2) * (mapWidth - 2);
-	vertices.resize((mapHeight - 2) * (mapWidth - 2));
+	const size_t size = size_t(mapWidth) * mapHeight;
 
-	//vertices_data
-	for (int z = 1; z<mapHeight - 1; z++)
-	{
-		for (int x = 1; x<mapWidth - 1; x++)
-		{
-			float fx = (float)x;
-			float fz = (float)z;
-			//Vertex 1
-			//Position
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].pos.x = fx / (mapWidth / terrainDim);
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].pos.y = mapHeights[x + z*mapWidth];
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].pos.z = fz / (mapHeight / terrainDim);
-			//Color(doen't use)
-			//Position
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].color.x = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].color.y = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].color.z = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].color.z = 0;
-			//TexCoords
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].texCoord.x = fx*inv_width;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].texCoord.y = fz*inv_height;
-			//Normal(doen's use)
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].normal.x = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].normal.y = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].normal.z = 0;
-			//Tangent(doen's use)
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].tangent.x = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].tangent.y = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].tangent.z = 0;
-			//Bitangent(doen's use)
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].bitangent.x = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].bitangent.y = 0;
-			vertices[((x - 1) + (z - 1)*(mapWidth - 2))].bitangent.z = 0;
-		}
+	std::vector<uint16_t> rawHeights(size);
+	FILE *fp = fopen(rawPath, "rb");
+	if (!fp) {
+		throw std::runtime_error("Failed to open terrain heights");
 	}
-	//indices data
-	std::vector<uint32_t>indices;
-	for (int z = 1; z<mapHeight - 2; z++)
-	{
-		for (int x = 1; x<mapWidth - 2; x++)
-		{
-			indices.push_back((x - 1) + (z - 1) * (mapWidth - 2));
-			indices.push_back((x - 1) + z * (mapWidth - 2));
-			indices.push_back(x + (z - 1) * (mapWidth - 2));
-
-			indices.push_back((x - 1) + z * (mapWidth - 2));
-			indices.push_back(x + z * (mapWidth - 2));
-			indices.push_back(x + (z - 1) * (mapWidth - 2));
-		}
+	const size_t read = fread(rawHeights.data(), sizeof(uint16_t), size, fp);
+	fclose(fp);
+	if (read != size) {
+		throw std::runtime_error("Terrain heights are smaller than the height map");
 	}
-	printf("Generating new Terrain Object...\n");
+	float* mapHeights = new float[size];
+	TerrainBuilder::ConvertHeights(rawHeights.data(), size, TerrainBuilder::RAW_HEIGHT_SCALE, TerrainBuilder::RAW_HEIGHT_OFFSET, mapHeights);
 
-	Terrain* terrain = new Terrain(device, commandPool, vertices, indices);
-	terrain->width = mapWidth;
-	terrain->height = mapHeight;
-	terrain->heights = mapHeights;
-	terrain->terrainDim = terrainDim;
-	return terrain;
+	// One shared patch instead of a mesh of every texel, chunks of it are placed and displaced every frame
+	printf("Generating new Terrain Object...\n");
+	return new Terrain(device, uploadContext, mapWidth, mapHeight, mapHeights, terrainDim);
 }
 
 float Terrain::GetHeight(float x, float z) const{
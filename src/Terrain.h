@@ -9,6 +9,33 @@
 #include "Model.h"
 #include <cstdio>
 
+// Cells along each side of the grid patch every terrain chunk is drawn with, same as in terrain.vert
+#define TERRAIN_PATCH_CELLS 32
+// Levels of the chunk quadtree at most, level 0 has the finest chunks. Same as in terrain.vert
+#define TERRAIN_MAX_LODS 8
+
+// A quadtree node selected for drawing, per-instance input of terrain.vert. xy world x and z of its low corner,
+// z its size, w the level whose morph range applies
+struct TerrainChunk {
+	glm::vec4 offsetSizeLevel;
+};
+
+// Same as TerrainBufferObject in terrain.vert
+struct TerrainBufferObject {
+	// 0: heightmap texels per world unit along x 1: along z 2: world size of the terrain 3: number of levels
+	glm::vec4 extent;
+	// Per level: x distance at which the patch starts to morph into the grid of the next level, y 1 / the distance it
+	// takes to get there
+	glm::vec4 morphRanges[TERRAIN_MAX_LODS];
+};
+
+// What Terrain::SelectChunks did with the quadtree
+struct TerrainSelection {
+	uint32_t chunks = 0;
+	// Nodes outside the frustum, none of their area is drawn
+	uint32_t culled = 0;
+};
+
 class Terrain : public Model {
 protected:
 	//Device* device;
@@ -39,12 +66,47 @@ protected:
 	float *heights;
 	float terrainDim;
 
+	// The heights again, as an R32_SFLOAT image terrain.vert displaces the patch with
+	VkImage heightMap = VK_NULL_HANDLE;
+	VkDeviceMemory heightMapMemory;
+	VkImageView heightMapView = VK_NULL_HANDLE;
+	VkSampler heightMapSampler = VK_NULL_HANDLE;
+	// Normal and tangent of every texel as TerrainSurfaceTexel, for terrain.frag to light the normal map with
+	VkImage surfaceMap = VK_NULL_HANDLE;
+	VkDeviceMemory surfaceMapMemory;
+	VkImageView surfaceMapView = VK_NULL_HANDLE;
+	VkSampler surfaceMapSampler = VK_NULL_HANDLE;
+
+	TerrainBufferObject terrainBufferObject;
+	VkBuffer terrainBuffer;
+	VkDeviceMemory terrainBufferMemory;
+
+	// Chunk quadtree (CDLOD, Strugar, "Continuous Distance-Dependent Level of Detail for Rendering Heightmaps").
+	// A node of level l is leafSize * 2^l on a side, every level keeps the height range of each of its nodes, row by row
+	float leafSize;
+	uint32_t levelCount;
+	// Nodes within ranges[l] of the eye are drawn at level l or finer
+	float ranges[TERRAIN_MAX_LODS];
+	uint32_t levelNodes[TERRAIN_MAX_LODS];
+	std::vector<glm::vec2> nodeHeights[TERRAIN_MAX_LODS];
+	uint32_t nodeCount;
+
+	struct SelectionContext;
+	void BuildQuadtree();
+	bool SelectNode(SelectionContext& context, uint32_t level, uint32_t x, uint32_t z) const;
+	void AddChunk(SelectionContext& context, uint32_t level, uint32_t x, uint32_t z) const;
+
+	// Grid of (TERRAIN_PATCH_CELLS + 1)^2 vertices over [0, 1] in x and z
+	static std::vector<Vertex> PatchVertices();
+	static std::vector<uint32_t> PatchIndices();
+
 public:
 	Terrain() = delete;
-	Terrain(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+	// Takes ownership of heights, width * height of them row by row
+	Terrain(Device* device, UploadContext* uploadContext, int width, int height, float* heights, float terrainDim);
 	virtual ~Terrain();
 
-	static Terrain* LoadTerrain(Device* device, VkCommandPool commandPool, char *filePath, char *rawPath, float terrainDim);
+	static Terrain* LoadTerrain(Device* device, UploadContext* uploadContext, char *filePath, char *rawPath, float terrainDim);
 	/*void SetDiffuseMap(VkImage texture);
 	void SetNormalMap(VkImage texture);
 
@@ -66,4 +128,16 @@ public:
 
 	float GetHeight(float x, float z) const;
 	int GetTerrainDim() const { return terrainDim; }
+
+	// Walks the quadtree from the root and writes the chunks to draw, finer near eye. Nodes are skipped once they are
+	// outside the frustum, the rest is covered without gaps as long as capacity is at least GetMaxChunkCount()
+	TerrainSelection SelectChunks(const glm::vec4 planes[6], glm::vec3 eye, TerrainChunk* chunks, uint32_t capacity) const;
+	// Every node once, more than any selection
+	uint32_t GetMaxChunkCount() const { return nodeCount; }
+
+	VkBuffer GetTerrainBuffer() const { return terrainBuffer; }
+	VkImageView GetHeightMapView() const { return heightMapView; }
+	VkSampler GetHeightMapSampler() const { return heightMapSampler; }
+	VkImageView GetSurfaceMapView() const { return surfaceMapView; }
+	VkSampler GetSurfaceMapSampler() const { return surfaceMapSampler; }
 };
\ No newline at end of file
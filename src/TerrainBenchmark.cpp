@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "TerrainBenchmark.h"
+#include "TerrainBuilder.h"
+
+namespace {
+	const int MAP_SIZES[] = { 256, 512, 1024, 2048, 4096 };
+	const int MAX_MAP_SIZE = 4096;
+	// Best of this many runs, the first ones also fault in the output pages
+	const uint32_t ITERATIONS = 5;
+	// Same extent as the terrain in main.cpp
+	const float TERRAIN_DIM = 256.0f;
+
+	enum class Stage {
+		ConvertScalar,
+		ConvertSimd,
+		SurfaceSerial,
+		SurfaceParallel,
+	};
+	const Stage STAGES[] = { Stage::ConvertScalar, Stage::ConvertSimd, Stage::SurfaceSerial, Stage::SurfaceParallel };
+
+	const char* StageName(Stage stage) {
+		switch (stage) {
+		case Stage::ConvertScalar: return "convert_scalar";
+		case Stage::ConvertSimd: return "convert_simd";
+		case Stage::SurfaceSerial: return "surface_serial";
+		default: return "surface_parallel";
+		}
+	}
+
+	struct Result {
+		int mapSize;
+		Stage stage;
+		uint32_t threads;
+		float milliseconds;
+	};
+
+	// Rolling hills plus a little high frequency detail, covering most of the 16 bit range
+	void FillHeights(int size, uint16_t* raw) {
+		for (int z = 0; z < size; z++) {
+			for (int x = 0; x < size; x++) {
+				float u = float(x) / size;
+				float v = float(z) / size;
+				float h = 0.5f + 0.3f * std::sin(u * 12.0f) * std::cos(v * 9.0f) + 0.1f * std::sin((u + v) * 80.0f) + 0.05f * std::cos(u * 300.0f);
+				raw[x + z * size] = static_cast<uint16_t>(std::min(std::max(h, 0.0f), 1.0f) * 65535.0f);
+			}
+		}
+	}
+
+	// The scalar reference may be contracted into a fused multiply-add, which rounds once instead of twice
+	bool WithinOneUlp(const float* values, const float* reference, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			int32_t a, b;
+			memcpy(&a, &values[i], sizeof(a));
+			memcpy(&b, &reference[i], sizeof(b));
+			// Adjacent floats of the same sign differ by one in their bit patterns, +0 and -0 are equal
+			if (values[i] != reference[i] && ((a < 0) != (b < 0) || std::abs(int64_t(a) - int64_t(b)) > 1)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <typename Function>
+	double BestMilliseconds(Function function) {
+		double best = 0.0;
+		for (uint32_t i = 0; i < ITERATIONS; i++) {
+			auto start = std::chrono::steady_clock::now();
+			function();
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			best = i == 0 ? milliseconds : std::min(best, milliseconds);
+		}
+		return best;
+	}
+}
+
+bool RunTerrainBenchmark(const char* reportPath) {
+	const uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	// Sized once for the largest map, every size reuses the front of them
+	const size_t maxTexels = size_t(MAX_MAP_SIZE) * MAX_MAP_SIZE;
+	std::vector<uint16_t> raw(maxTexels);
+	std::vector<float> heights(maxTexels);
+	std::vector<float> referenceHeights(maxTexels);
+	std::vector<TerrainSurfaceTexel> surface(maxTexels);
+	std::vector<TerrainSurfaceTexel> referenceSurface(maxTexels);
+
+	bool correct = true;
+	std::vector<Result> results;
+	printf("%8s  %-17s %7s  %10s  %12s\n", "map", "stage", "threads", "ms", "Mtexel/s");
+	for (int mapSize : MAP_SIZES) {
+		const size_t texels = size_t(mapSize) * mapSize;
+		const glm::vec2 texelsPerUnit = glm::vec2(float(mapSize) / TERRAIN_DIM);
+		FillHeights(mapSize, raw.data());
+
+		for (Stage stage : STAGES) {
+			uint32_t threads = 1;
+			double milliseconds = 0.0;
+			switch (stage) {
+			case Stage::ConvertScalar:
+				milliseconds = BestMilliseconds([&]() {
+					TerrainBuilder::ConvertHeightsScalar(raw.data(), texels, TerrainBuilder::RAW_HEIGHT_SCALE, TerrainBuilder::RAW_HEIGHT_OFFSET, referenceHeights.data());
+				});
+				break;
+			case Stage::ConvertSimd:
+				milliseconds = BestMilliseconds([&]() {
+					TerrainBuilder::ConvertHeights(raw.data(), texels, TerrainBuilder::RAW_HEIGHT_SCALE, TerrainBuilder::RAW_HEIGHT_OFFSET, heights.data());
+				});
+				if (!WithinOneUlp(heights.data(), referenceHeights.data(), texels)) {
+					printf("SIMD heights differ by more than an ulp from the scalar ones for a %dx%d map\n", mapSize, mapSize);
+					correct = false;
+				}
+				break;
+			case Stage::SurfaceSerial:
+				milliseconds = BestMilliseconds([&]() {
+					TerrainBuilder::BuildSurface(heights.data(), mapSize, mapSize, texelsPerUnit, referenceSurface.data(), 1);
+				});
+				break;
+			case Stage::SurfaceParallel:
+				threads = hardwareThreads;
+				milliseconds = BestMilliseconds([&]() {
+					TerrainBuilder::BuildSurface(heights.data(), mapSize, mapSize, texelsPerUnit, surface.data(), threads);
+				});
+				if (memcmp(surface.data(), referenceSurface.data(), texels * sizeof(TerrainSurfaceTexel)) != 0) {
+					printf("Parallel surface differs from the serial one for a %dx%d map\n", mapSize, mapSize);
+					correct = false;
+				}
+				break;
+			}
+
+			Result result = { mapSize, stage, threads, float(milliseconds) };
+			results.push_back(result);
+			printf("%8d  %-17s %7u  %10.4f  %12.1f\n", mapSize, StageName(stage), threads, milliseconds,
+				milliseconds > 0.0 ? texels / (milliseconds * 1e3) : 0.0);
+		}
+	}
+
+	FILE* file = fopen(reportPath, "w");
+	if (!file) {
+		printf("Failed to open %s for writing\n", reportPath);
+		return false;
+	}
+	fprintf(file, "{\n");
+	fprintf(file, "  \"iterations\": %u,\n", ITERATIONS);
+	fprintf(file, "  \"hardware_threads\": %u,\n", hardwareThreads);
+	fprintf(file, "  \"correct\": %s,\n", correct ? "true" : "false");
+	fprintf(file, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		fprintf(file, "    { \"map_size\": %d, \"stage\": \"%s\", \"threads\": %u, \"ms\": %.5f }%s\n",
+			r.mapSize, StageName(r.stage), r.threads, r.milliseconds, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+	fclose(file);
+	printf("Terrain benchmark written to %s\n", reportPath);
+	return correct;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Times the terrain load path of TerrainBuilder on synthetic heightmaps of growing size: height conversion one at a
+// time against SSE2, and the surface on one thread against every hardware thread. The fast variants are checked
+// against the slow ones, the table is printed and written to reportPath as JSON. Runs on the CPU only.
+// Returns false if a variant produced different results or the report could not be written.
+bool RunTerrainBenchmark(const char* reportPath);
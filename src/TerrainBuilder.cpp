@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include "TerrainBuilder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERRAIN_SSE2 1
+#else
+#define TERRAIN_SSE2 0
+#endif
+
+namespace {
+	// Rounds half away from zero, the values are unit vector components already
+	int8_t PackSnorm(float value) {
+		float scaled = value * 127.0f;
+		return static_cast<int8_t>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+	}
+
+	void BuildSurfaceRows(const float* heights, int width, int height, glm::vec2 texelsPerUnit, TerrainSurfaceTexel* surface, int firstRow, int endRow) {
+		for (int z = firstRow; z < endRow; z++) {
+			const int z0 = std::max(z - 1, 0);
+			const int z1 = std::min(z + 1, height - 1);
+			// Rise per world unit, the differences span z1 - z0 texels
+			const float zScale = z1 > z0 ? texelsPerUnit.y / float(z1 - z0) : 0.0f;
+			const float* row = heights + size_t(z) * width;
+			const float* rowBefore = heights + size_t(z0) * width;
+			const float* rowAfter = heights + size_t(z1) * width;
+			TerrainSurfaceTexel* out = surface + size_t(z) * width;
+			for (int x = 0; x < width; x++) {
+				const int x0 = std::max(x - 1, 0);
+				const int x1 = std::min(x + 1, width - 1);
+				const float dx = x1 > x0 ? (row[x1] - row[x0]) * texelsPerUnit.x / float(x1 - x0) : 0.0f;
+				const float dz = (rowAfter[x] - rowBefore[x]) * zScale;
+
+				// Perpendicular to both (1, dx, 0) and (0, dz, 1)
+				const float normalScale = 1.0f / std::sqrt(dx * dx + 1.0f + dz * dz);
+				out[x].normal[0] = PackSnorm(-dx * normalScale);
+				out[x].normal[1] = PackSnorm(normalScale);
+				out[x].normal[2] = PackSnorm(-dz * normalScale);
+				out[x].tangentY = PackSnorm(dx / std::sqrt(1.0f + dx * dx));
+			}
+		}
+	}
+}
+
+void TerrainBuilder::ConvertHeightsScalar(const uint16_t* raw, size_t count, float scale, float offset, float* heights) {
+	for (size_t i = 0; i < count; i++) {
+		heights[i] = float(raw[i]) * scale + offset;
+	}
+}
+
+void TerrainBuilder::ConvertHeights(const uint16_t* raw, size_t count, float scale, float offset, float* heights) {
+	size_t i = 0;
+
+#if TERRAIN_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scales = _mm_set1_ps(scale);
+	const __m128 offsets = _mm_set1_ps(offset);
+	for (; i + 8 <= count; i += 8) {
+		// Zero extend eight heights into two sets of four 32 bit integers, exact as floats
+		__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(raw + i));
+		__m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero));
+		__m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero));
+		_mm_storeu_ps(heights + i, _mm_add_ps(_mm_mul_ps(low, scales), offsets));
+		_mm_storeu_ps(heights + i + 4, _mm_add_ps(_mm_mul_ps(high, scales), offsets));
+	}
+#endif
+
+	ConvertHeightsScalar(raw + i, count - i, scale, offset, heights + i);
+}
+
+void TerrainBuilder::BuildSurface(const float* heights, int width, int height, glm::vec2 texelsPerUnit, TerrainSurfaceTexel* surface, uint32_t threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	threadCount = std::min(threadCount, static_cast<uint32_t>(std::max(height, 1)));
+	if (threadCount <= 1) {
+		BuildSurfaceRows(heights, width, height, texelsPerUnit, surface, 0, height);
+		return;
+	}
+
+	// Every band only reads the heights and writes its own rows, the calling thread takes the last one
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+	for (uint32_t t = 0; t + 1 < threadCount; t++) {
+		const int firstRow = static_cast<int>(uint64_t(height) * t / threadCount);
+		const int endRow = static_cast<int>(uint64_t(height) * (t + 1) / threadCount);
+		threads.emplace_back(BuildSurfaceRows, heights, width, height, texelsPerUnit, surface, firstRow, endRow);
+	}
+	BuildSurfaceRows(heights, width, height, texelsPerUnit, surface, static_cast<int>(uint64_t(height) * (threadCount - 1) / threadCount), height);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
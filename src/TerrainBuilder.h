@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Surface of one heightmap texel for terrain.frag, an R8G8B8A8_SNORM texel. The tangent follows the surface along +x
+// and has no z, so its y is enough to rebuild it: (sqrt(1 - y^2), y, 0)
+struct TerrainSurfaceTexel {
+	int8_t normal[3];
+	int8_t tangentY;
+};
+
+// Turns the raw heightmap into what Terrain uploads. Everything writes into storage the caller sized for the whole
+// map, nothing is allocated per texel or per row.
+namespace TerrainBuilder {
+	// Heights of the .r16 heightmaps in world units: raw * RAW_HEIGHT_SCALE + RAW_HEIGHT_OFFSET
+	const float RAW_HEIGHT_SCALE = 256.0f * 0.25f / 65536.0f;
+	const float RAW_HEIGHT_OFFSET = -40.0f;
+
+	// heights[i] = raw[i] * scale + offset, eight at a time with SSE2 when available
+	void ConvertHeights(const uint16_t* raw, size_t count, float scale, float offset, float* heights);
+	// Same one at a time, the reference for the above
+	void ConvertHeightsScalar(const uint16_t* raw, size_t count, float scale, float offset, float* heights);
+
+	// Normal and tangent of every texel from central differences of the heights, one-sided on the borders.
+	// texelsPerUnit as in TerrainBufferObject::extent. Bands of rows go to threadCount threads, 0 uses every hardware
+	// thread, the result is the same for any count
+	void BuildSurface(const float* heights, int width, int height, glm::vec2 texelsPerUnit, TerrainSurfaceTexel* surface, uint32_t threadCount = 0);
+}
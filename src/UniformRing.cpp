@@ -0,0 +1,47 @@
+#include <stdexcept>
+#include <cstring>
+#include "UniformRing.h"
+#include "Instance.h"
+#include "BufferUtils.h"
+
+UniformRing::UniformRing(Device* device, uint32_t frameCount) : device(device), frameCount(frameCount) {
+	alignment = device->GetInstance()->GetPhysicalDeviceProperties().limits.minUniformBufferOffsetAlignment;
+	sliceSize = (SLICE_CAPACITY + alignment - 1) / alignment * alignment;
+	shadow.resize(static_cast<size_t>(sliceSize), 0);
+
+	BufferUtils::CreateBuffer(device, sliceSize * frameCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+	mappedData = static_cast<char*>(BufferUtils::MapBuffer(device, buffer));
+}
+
+VkDeviceSize UniformRing::Allocate(VkDeviceSize size) {
+	VkDeviceSize offset = (usedSize + alignment - 1) / alignment * alignment;
+	if (offset + size > sliceSize) {
+		throw std::runtime_error("Uniform ring slice is full");
+	}
+	usedSize = offset + size;
+	return offset;
+}
+
+void* UniformRing::GetShadow(VkDeviceSize offset) {
+	return shadow.data() + offset;
+}
+
+void UniformRing::Flush(uint32_t frame) {
+	memcpy(mappedData + frame * sliceSize, shadow.data(), static_cast<size_t>(usedSize));
+}
+
+VkBuffer UniformRing::GetBuffer() const {
+	return buffer;
+}
+
+uint32_t UniformRing::GetDynamicOffset(uint32_t frame) const {
+	return static_cast<uint32_t>(frame * sliceSize);
+}
+
+uint32_t UniformRing::GetFrameCount() const {
+	return frameCount;
+}
+
+UniformRing::~UniformRing() {
+	BufferUtils::DestroyBuffer(device, buffer);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "Device.h"
+
+// One host visible uniform buffer split into a slice per frame in flight.
+// Owners reserve a range once and write into its CPU shadow whenever they like; the renderer copies the shadow
+// into the slice of a frame only after that frame's fence has signaled, and binds the slice with a dynamic offset.
+class UniformRing {
+public:
+	static constexpr VkDeviceSize SLICE_CAPACITY = 16 * 1024;
+
+	UniformRing() = delete;
+	UniformRing(Device* device, uint32_t frameCount);
+	~UniformRing();
+
+	// Reserve a range in every slice, returns its offset inside a slice
+	VkDeviceSize Allocate(VkDeviceSize size);
+	// CPU copy of a reserved range, safe to write at any time
+	void* GetShadow(VkDeviceSize offset);
+
+	void Flush(uint32_t frame);
+
+	VkBuffer GetBuffer() const;
+	uint32_t GetDynamicOffset(uint32_t frame) const;
+	uint32_t GetFrameCount() const;
+
+private:
+	Device* device;
+	uint32_t frameCount;
+	VkDeviceSize alignment;
+	VkDeviceSize sliceSize;
+	VkDeviceSize usedSize = 0;
+
+	VkBuffer buffer;
+	VkDeviceMemory bufferMemory;
+	char* mappedData;
+	std::vector<char> shadow;
+};
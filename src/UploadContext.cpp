@@ -0,0 +1,207 @@
+#include <stdexcept>
+#include <cstring>
+#include "UploadContext.h"
+#include "Instance.h"
+#include "BufferUtils.h"
+#include "Image.h"
+
+UploadContext::UploadContext(Device* device, VkDeviceSize stagingSize) : device(device), stagingSize(stagingSize) {
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Graphics];
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device->GetVkDevice(), &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create upload command pool");
+	}
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	for (uint32_t i = 0; i < MAX_BATCHES; i++) {
+		if (vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, &batches[i].commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate upload command buffer");
+		}
+		if (vkCreateFence(device->GetVkDevice(), &fenceInfo, nullptr, &batches[i].fence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create upload fence");
+		}
+		batches[i].stagingBytes = 0;
+		freeBatches.push_back(i);
+	}
+
+	// Staging ring
+	VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	BufferUtils::CreateBuffer(device, stagingSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
+	stagingData = static_cast<char*>(BufferUtils::MapBuffer(device, stagingBuffer));
+}
+
+VkCommandBuffer UploadContext::GetCommandBuffer() {
+	if (recordingBatch < 0) {
+		if (freeBatches.empty()) {
+			RetireOldest();
+		}
+		recordingBatch = freeBatches.back();
+		freeBatches.pop_back();
+
+		Batch& batch = batches[recordingBatch];
+		batch.stagingBytes = 0;
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+	}
+	return batches[recordingBatch].commandBuffer;
+}
+
+VkDeviceSize UploadContext::Stage(const void* data, VkDeviceSize size, VkBuffer& srcBuffer) {
+	// Larger than the whole ring: give it a staging buffer of its own, released with the batch
+	if (size > stagingSize) {
+		VkDeviceMemory oversizedMemory;
+		BufferUtils::CreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, srcBuffer, oversizedMemory);
+		memcpy(BufferUtils::MapBuffer(device, srcBuffer), data, static_cast<size_t>(size));
+		GetCommandBuffer();
+		batches[recordingBatch].oversizedBuffers.push_back(srcBuffer);
+		return 0;
+	}
+
+	// 16 bytes covers the offset alignment of buffer copies and of every texel format we upload
+	const VkDeviceSize alignment = 16;
+	while (true) {
+		GetCommandBuffer();
+		if (stagingUsed == 0) {
+			stagingHead = 0;
+		}
+
+		VkDeviceSize offset = (stagingHead + alignment - 1) / alignment * alignment;
+		VkDeviceSize consumed;
+		if (offset + size <= stagingSize) {
+			consumed = offset - stagingHead + size;
+		}
+		else {
+			// Wrap around, the tail end of the ring is skipped
+			offset = 0;
+			consumed = stagingSize - stagingHead + size;
+		}
+
+		if (stagingUsed + consumed <= stagingSize) {
+			stagingHead = offset + size;
+			stagingUsed += consumed;
+			batches[recordingBatch].stagingBytes += consumed;
+			memcpy(stagingData + offset, data, static_cast<size_t>(size));
+			srcBuffer = stagingBuffer;
+			return offset;
+		}
+
+		// Ring is full: submit what has been recorded and wait for the oldest batch to give its range back
+		Flush();
+		RetireOldest();
+	}
+}
+
+void UploadContext::RetireOldest() {
+	if (pendingBatches.empty()) {
+		return;
+	}
+
+	uint32_t index = pendingBatches.front();
+	pendingBatches.pop_front();
+	Batch& batch = batches[index];
+
+	vkWaitForFences(device->GetVkDevice(), 1, &batch.fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device->GetVkDevice(), 1, &batch.fence);
+	vkResetCommandBuffer(batch.commandBuffer, 0);
+
+	// Batches retire in submission order, so the oldest staged bytes are always the ones released here
+	stagingUsed -= batch.stagingBytes;
+	batch.stagingBytes = 0;
+	for (VkBuffer buffer : batch.oversizedBuffers) {
+		BufferUtils::DestroyBuffer(device, buffer);
+	}
+	batch.oversizedBuffers.clear();
+
+	freeBatches.push_back(index);
+}
+
+void UploadContext::UploadBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset) {
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset = Stage(data, size, srcBuffer);
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(GetCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
+}
+
+void UploadContext::TransitionLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, bool cubemap) {
+	Image::RecordTransitionLayout(GetCommandBuffer(), image, format, oldLayout, newLayout, cubemap);
+}
+
+void UploadContext::UploadImage(const void* data, VkDeviceSize size, VkImage image, std::vector<VkBufferImageCopy> regions) {
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset = Stage(data, size, srcBuffer);
+
+	for (VkBufferImageCopy& region : regions) {
+		region.bufferOffset += srcOffset;
+	}
+	vkCmdCopyBufferToImage(GetCommandBuffer(), srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(regions.size()), regions.data());
+}
+
+void UploadContext::Flush() {
+	if (recordingBatch < 0) {
+		return;
+	}
+	Batch& batch = batches[recordingBatch];
+
+	// Make the transfer writes visible to whatever consumes these resources later on this queue
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkEndCommandBuffer(batch.commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+	if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit upload batch");
+	}
+
+	pendingBatches.push_back(recordingBatch);
+	recordingBatch = -1;
+	submitCount++;
+}
+
+void UploadContext::Finish() {
+	Flush();
+	while (!pendingBatches.empty()) {
+		RetireOldest();
+	}
+}
+
+uint32_t UploadContext::GetSubmitCount() const {
+	return submitCount;
+}
+
+UploadContext::~UploadContext() {
+	Finish();
+
+	for (uint32_t i = 0; i < MAX_BATCHES; i++) {
+		vkDestroyFence(device->GetVkDevice(), batches[i].fence, nullptr);
+	}
+	vkDestroyCommandPool(device->GetVkDevice(), commandPool, nullptr);
+	BufferUtils::DestroyBuffer(device, stagingBuffer);
+}
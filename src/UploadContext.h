@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <vector>
+#include "Device.h"
+
+// Batches host -> device uploads.
+// Source data is copied into a persistently mapped staging ring and the copies / layout transitions are recorded
+// into one command buffer. Flush() submits the batch with a fence and never waits, staging space of a batch is
+// reclaimed only once its fence has signaled.
+class UploadContext {
+public:
+	static constexpr VkDeviceSize DEFAULT_STAGING_SIZE = 64 * 1024 * 1024;
+	static constexpr uint32_t MAX_BATCHES = 4;
+
+	UploadContext() = delete;
+	UploadContext(Device* device, VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+	~UploadContext();
+
+	void UploadBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+	void TransitionLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, bool cubemap);
+	// Regions are relative to data, their bufferOffset is rebased onto the staging ring
+	void UploadImage(const void* data, VkDeviceSize size, VkImage image, std::vector<VkBufferImageCopy> regions);
+
+	// Submit everything recorded so far without waiting
+	void Flush();
+	// Submit and wait until every upload has landed
+	void Finish();
+
+	uint32_t GetSubmitCount() const;
+
+private:
+	struct Batch {
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		// Bytes of the staging ring consumed by this batch, including the padding skipped when wrapping
+		VkDeviceSize stagingBytes;
+		// Staging buffers for uploads that did not fit in the ring
+		std::vector<VkBuffer> oversizedBuffers;
+	};
+
+	VkCommandBuffer GetCommandBuffer();
+	VkDeviceSize Stage(const void* data, VkDeviceSize size, VkBuffer& srcBuffer);
+	void RetireOldest();
+
+	Device* device;
+	VkCommandPool commandPool;
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	char* stagingData;
+	VkDeviceSize stagingSize;
+	VkDeviceSize stagingHead = 0;
+	VkDeviceSize stagingUsed = 0;
+
+	Batch batches[MAX_BATCHES];
+	std::vector<uint32_t> freeBatches;
+	std::deque<uint32_t> pendingBatches;
+	// Batch currently being recorded, -1 if none
+	int recordingBatch = -1;
+
+	uint32_t submitCount = 0;
+};
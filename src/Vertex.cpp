@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Vertex.h"
+
+static_assert(sizeof(PackedVertex) == 24, "PackedVertex has to match its attribute descriptions");
+
+namespace {
+	// Smallest |w| a packed tangent frame keeps, so the sign of w survives snorm16 rounding
+	const float TANGENT_FRAME_BIAS = 1.0f / 32767.0f;
+
+	uint16_t QuantizeUnorm16(float value) {
+		return static_cast<uint16_t>(std::round(glm::clamp(value, 0.0f, 1.0f) * 65535.0f));
+	}
+
+	uint8_t QuantizeUnorm8(float value) {
+		return static_cast<uint8_t>(std::round(glm::clamp(value, 0.0f, 1.0f) * 255.0f));
+	}
+
+	int16_t QuantizeSnorm16(float value) {
+		return static_cast<int16_t>(std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f));
+	}
+
+	// Orthonormal frame closest to the vertex' normal and tangent. Meshes without texture coordinates have no tangents,
+	// they get any direction perpendicular to the normal
+	glm::quat TangentFrame(const Vertex& vertex) {
+		glm::vec3 normal = glm::length(vertex.normal) > 0.0f ? glm::normalize(vertex.normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::vec3 tangent = vertex.tangent - normal * glm::dot(normal, vertex.tangent);
+		if (!(glm::length(tangent) > 1e-6f)) {
+			tangent = std::abs(normal.x) < 0.9f ? glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)) : glm::cross(normal, glm::vec3(0.0f, 1.0f, 0.0f));
+		}
+		tangent = glm::normalize(tangent);
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+
+		glm::quat frame = glm::normalize(glm::quat_cast(glm::mat3(tangent, bitangent, normal)));
+		if (frame.w < 0.0f) {
+			frame = -frame;
+		}
+		if (frame.w < TANGENT_FRAME_BIAS) {
+			const float xyzScale = std::sqrt(1.0f - TANGENT_FRAME_BIAS * TANGENT_FRAME_BIAS) / glm::length(glm::vec3(frame.x, frame.y, frame.z));
+			frame = glm::quat(TANGENT_FRAME_BIAS, frame.x * xyzScale, frame.y * xyzScale, frame.z * xyzScale);
+		}
+		// Mirrored texture coordinates flip the bitangent
+		if (glm::dot(bitangent, vertex.bitangent) < 0.0f) {
+			frame = -frame;
+		}
+		return frame;
+	}
+}
+
+PositionQuantization PositionQuantization::Fit(const std::vector<Vertex>& vertices) {
+	PositionQuantization quantization;
+	if (vertices.empty()) {
+		return quantization;
+	}
+	glm::vec3 low = vertices[0].pos;
+	glm::vec3 high = vertices[0].pos;
+	for (const Vertex& vertex : vertices) {
+		low = glm::min(low, vertex.pos);
+		high = glm::max(high, vertex.pos);
+	}
+	quantization.offset = glm::vec4(low, 0.0f);
+	quantization.scale = glm::vec4(high - low, 0.0f);
+	return quantization;
+}
+
+PackedVertex PackedVertex::Pack(const Vertex& vertex, const PositionQuantization& quantization) {
+	PackedVertex packed;
+	for (int i = 0; i < 3; i++) {
+		const float scale = quantization.scale[i];
+		packed.pos[i] = scale > 0.0f ? QuantizeUnorm16((vertex.pos[i] - quantization.offset[i]) / scale) : 0;
+	}
+	packed.pos[3] = 0;
+	for (int i = 0; i < 4; i++) {
+		packed.color[i] = QuantizeUnorm8(vertex.color[i]);
+	}
+	packed.texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+	packed.texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+
+	const glm::quat frame = TangentFrame(vertex);
+	packed.tangentFrame[0] = QuantizeSnorm16(frame.x);
+	packed.tangentFrame[1] = QuantizeSnorm16(frame.y);
+	packed.tangentFrame[2] = QuantizeSnorm16(frame.z);
+	packed.tangentFrame[3] = QuantizeSnorm16(frame.w);
+	return packed;
+}
@@ -4,6 +4,10 @@
 #include <glm/glm.hpp>
 
 #include <array>
+#include <vector>
+
+// Bark and leaf batches store PackedVertex instead of Vertex, same as in bark.vert and leaf.vert
+#define PACKED_TREE_VERTICES 1
 
 struct Vertex {
 	glm::vec3 pos;
@@ -66,3 +70,82 @@ struct Vertex {
 		return attributeDescriptions;
 	}
 };
+
+// Maps quantized positions back into model space: offset + unorm * scale
+struct PositionQuantization {
+	glm::vec4 offset = glm::vec4(0.0f);
+	glm::vec4 scale = glm::vec4(1.0f);
+
+	// Smallest box around the positions
+	static PositionQuantization Fit(const std::vector<Vertex>& vertices);
+};
+
+// Vertex in 24 bytes instead of 72: position as unorm16 in a PositionQuantization box, color as unorm8, texture
+// coordinate as half floats and normal, tangent and bitangent as one snorm16 quaternion. The quaternion rotates x to
+// the tangent and z to the normal, a negative w flips the bitangent, see bark.vert
+struct PackedVertex {
+	uint16_t pos[4];
+	uint8_t color[4];
+	uint16_t texCoord[2];
+	int16_t tangentFrame[4];
+
+	// The position has to be inside the quantization box
+	static PackedVertex Pack(const Vertex& vertex, const PositionQuantization& quantization);
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(PackedVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	// Same locations as the first four of Vertex, the tangent frame takes the normal's
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(4);
+
+		// Position
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attributeDescriptions[0].offset = offsetof(PackedVertex, pos);
+
+		// Color
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+		attributeDescriptions[1].offset = offsetof(PackedVertex, color);
+
+		// Texture coordinate
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(PackedVertex, texCoord);
+
+		// Tangent frame
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R16G16B16A16_SNORM;
+		attributeDescriptions[3].offset = offsetof(PackedVertex, tangentFrame);
+
+		return attributeDescriptions;
+	}
+};
+
+enum VertexFormat {
+	VERTEX_FORMAT_FULL,
+	VERTEX_FORMAT_PACKED,
+};
+
+// Vertex buffers of the bark and leaf pipelines
+const VertexFormat TREE_VERTEX_FORMAT = PACKED_TREE_VERTICES ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FULL;
+
+// Vertex input at binding 0 of a pipeline that reads the given format
+inline VkVertexInputBindingDescription GetVertexBindingDescription(VertexFormat format) {
+	return format == VERTEX_FORMAT_PACKED ? PackedVertex::getBindingDescription() : Vertex::getBindingDescription();
+}
+
+inline std::vector<VkVertexInputAttributeDescription> GetVertexAttributeDescriptions(VertexFormat format) {
+	return format == VERTEX_FORMAT_PACKED ? PackedVertex::getAttributeDescriptions() : Vertex::getAttributeDescriptions();
+}
@@ -1,5 +1,7 @@
 #include <vulkan/vulkan.h>
 #include <ctime>
+#include <algorithm>
+#include <string>
 #include "Instance.h"
 #include "Window.h"
 #include "Renderer.h"
@@ -11,25 +13,42 @@
 #include "skybox.h"
 
 #include "GUI.h"
+#include "Benchmark.h"
+#include "CompactionBenchmark.h"
+#include "TerrainBenchmark.h"
+#include "LodController.h"
+#include "Culling.h"
+#include "MeshSimplifier.h"
+#include "ImpostorBaker.h"
 
 Device* device;
 SwapChain* swapChain;
 Renderer* renderer;
 Camera* camera;
+GpuProfiler* profiler;
+LodController* lodController;
 GUI* gui = new GUI(nullptr);
 static double       g_Time = 0.0f;
 static bool         g_MousePressed[3] = { false, false, false };
 static float        g_MouseWheel = 0.0f;
 
-static float LOD0 = 0.6;
-static float LOD1 = 0.43;
+// Projected diameters in pixels of the LOD spheres, about what 60% and 43% of the view distance gave at 1080p
+static float LOD0 = 100.0f;
+static float LOD1 = 144.0f;
+static float FakeTreeLOD = 190.0f;
+static bool AdaptiveLod = false;
+static float LodTargetMs = 16.0f;
 
 static bool DistanceCulling = true;
 static bool FrustrumCulling = true;
+static bool OcclusionCulling = true;
+static bool TemporalCulling = true;
 static bool BarkModel = true;
 static bool LeaveModel = true;
 static bool BillboardModel = true;
 
+static bool RecordGpuTimings = false;
+
 static int plotIdx = 0;
 static float fps[90] = { 0 };
 
@@ -216,6 +235,18 @@ namespace {
 	{
 		ImGuiIO& io = ImGui::GetIO();
 
+		// Headless: no input, the GUI still lays out and draws against the offscreen extent
+		if (!window)
+		{
+			VkExtent2D extent = swapChain->GetVkExtent();
+			io.DisplaySize = ImVec2((float)extent.width, (float)extent.height);
+			io.DisplayFramebufferScale = ImVec2(1.0f, 1.0f);
+			io.DeltaTime = 1.0f / 60.0f;
+			io.MousePos = ImVec2(-FLT_MAX, -FLT_MAX);
+			ImGui::NewFrame();
+			return;
+		}
+
 		// Setup display size (every frame to accommodate for window resizing)
 		int w, h;
 		int display_w, display_h;
@@ -290,10 +321,54 @@ namespace {
 	
 	void InitialGuiContent() {
 		ImGui::Text("Vulkan Forest Rendering Engine");
-		ImGui::SliderFloat("LOD0", &LOD0, 0.0f, 1.0f);
-		ImGui::SliderFloat("LOD1", &LOD1, 0.0f, 1.0f);
+		ImGui::SliderFloat("LOD0", &LOD0, 0.0f, 512.0f, "%.0f px");
+		ImGui::SliderFloat("LOD1", &LOD1, 0.0f, 512.0f, "%.0f px");
+		ImGui::SliderFloat("Fake Trees", &FakeTreeLOD, 0.0f, 512.0f, "%.0f px");
+		// Takes over the three sliders above while enabled, restarting from wherever they are
+		if (ImGui::Checkbox("Adaptive LOD", &AdaptiveLod)) {
+			*lodController = LodController({ LOD0, LOD1, FakeTreeLOD });
+			lodController->SetEnabled(AdaptiveLod);
+		}
+		ImGui::SliderFloat("GPU Target (ms)", &LodTargetMs, 2.0f, 50.0f);
+		lodController->SetTargetMs(LodTargetMs);
+		ImGui::Text("%-9s quality %.2f, gpu %.2f ms", LodController::GetStateName(lodController->GetState()), lodController->GetQuality(), std::max(0.0f, lodController->GetSmoothedMs()));
 		ImGui::Checkbox("Frustrum Culling", &FrustrumCulling);
 		ImGui::Checkbox("Distance Culling", &FrustrumCulling);
+		if (ImGui::Checkbox("Occlusion Culling", &OcclusionCulling) && renderer) {
+			renderer->SetOcclusionCulling(OcclusionCulling);
+		}
+		// Skips the culling pass while the camera and LOD distances stay put
+		if (ImGui::Checkbox("Temporal Culling", &TemporalCulling) && renderer) {
+			renderer->SetTemporalCulling(TemporalCulling);
+		}
+		ImGui::SameLine();
+		ImGui::Text("%s", renderer && renderer->IsCullingReused() ? "(reused)" : "(culled)");
+		// Full trees removed by each test, rescued ones were occluded in the old depth pyramid but not in this frame's
+		CullingStats cullingStats = renderer ? renderer->GetCullingStats() : CullingStats();
+		ImGui::Text("Culled: distance %u frustum %u occluded %u rescued %u", cullingStats.distance, cullingStats.frustum, cullingStats.occluded - cullingStats.rescued, cullingStats.rescued);
+		// Drawn with both LODs while they cross-fade
+		ImGui::Text("LOD transitions: %u", cullingStats.transitioning);
+		// Bark and leaf meshlets of level 0 trees that were outside the frustum or faced away
+		ImGui::Text("Meshlets culled: %u of %u", cullingStats.meshletsCulled, cullingStats.meshlets);
+		// Quadtree nodes drawn as grid patches and the ones left out for being outside the frustum
+		TerrainSelection terrainSelection = renderer ? renderer->GetTerrainSelection() : TerrainSelection();
+		ImGui::Text("Terrain chunks: %u, culled %u", terrainSelection.chunks, terrainSelection.culled);
+		// Visible trees per species and fake tree group, from the readback of MAX_FRAMES_IN_FLIGHT frames ago
+		VisibleInstanceCounts visible = renderer ? renderer->GetVisibleInstanceCounts() : VisibleInstanceCounts();
+		for (uint32_t g = 0; g < visible.groups; g++) {
+			if (g < visible.species) {
+				// First pass trees of each mesh level, then the billboards
+				char levels[64] = "";
+				int length = 0;
+				for (uint32_t l = 0; l < visible.groupLevelCount[g] && length < int(sizeof(levels)); l++) {
+					length += snprintf(levels + length, sizeof(levels) - length, l > 0 ? "/%u" : "%u", visible.groupLevels[g][l]);
+				}
+				ImGui::Text("Species %u: full %u (%s) billboard %u", g + 1, visible.groupFull[g], levels, visible.groupBillboard[g]);
+			}
+			else {
+				ImGui::Text("Fake trees %u: %u", g - visible.species + 1, visible.groupBillboard[g]);
+			}
+		}
 		ImGui::Checkbox("Bark Model", &BarkModel);
 		ImGui::Checkbox("Leaves Model", &LeaveModel);
 		ImGui::Checkbox("Billboard Model", &BillboardModel);
@@ -309,6 +384,22 @@ namespace {
 		ImGui::Spacing();
 		ImGui::Text("Performance");
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+		// GPU time per pass over the last frames, the same rows every frame so the GUI buffers keep their size
+		ImGui::Text("%-16s %7s %7s %7s %7s", "GPU pass (ms)", "last", "min", "avg", "p99");
+		for (uint32_t s = 0; s < static_cast<uint32_t>(ProfilerScope::Count); s++) {
+			ProfilerStats stats = profiler->GetStats(static_cast<ProfilerScope>(s));
+			ImGui::Text("%-16s %7.3f %7.3f %7.3f %7.3f", GpuProfiler::GetScopeName(static_cast<ProfilerScope>(s)), stats.last, stats.min, stats.avg, stats.p99);
+		}
+		if (ImGui::Checkbox("Record GPU timings (CSV)", &RecordGpuTimings)) {
+			if (RecordGpuTimings) {
+				char path[64];
+				sprintf(path, "gpu_timings_%lld.csv", static_cast<long long>(time(nullptr)));
+				RecordGpuTimings = profiler->StartCsv(path);
+			}
+			else {
+				profiler->StopCsv();
+			}
+		}
 		ImGui::Spacing();
 		/*if (plotIdx >= 90) plotIdx = 0;
 		fps[plotIdx] = ImGui::GetIO().Framerate;
@@ -319,50 +410,110 @@ namespace {
 	}
 	//////////////////////////////////////////////////////////////////////////////////////////
 
-}
+	// Forest drawing takes its instance ranges from the indirect commands and picks textures per draw. Multi-draw
+	// and the GPU written draw counts are optional, the renderer falls back to one draw per command without them
+	void EnableForestFeatures(Instance* instance, VkPhysicalDeviceFeatures& deviceFeatures) {
+		const VkPhysicalDeviceFeatures& supported = instance->GetPhysicalDeviceFeatures();
+		if (!supported.drawIndirectFirstInstance || !supported.shaderSampledImageArrayDynamicIndexing) {
+			throw std::runtime_error("GPU does not support indirect first instance or dynamic sampler indexing");
+		}
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+		deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+		deviceFeatures.multiDrawIndirect = supported.multiDrawIndirect;
 
+		if (!instance->RequestOptionalDeviceExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+			instance->RequestOptionalDeviceExtension(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+	}
 
-	
+}
 
 
-int main() {
-	static constexpr char* applicationName = "Vulkan Forest Render Engine";
-	int width = 1920, height = 1080;
-	InitializeWindow(width, height, applicationName);
+	
 
-	unsigned int glfwExtensionCount = 0;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	Instance* instance = new Instance(applicationName, glfwExtensionCount, glfwExtensions);
+// Simplified levels of a tree mesh, cached in <model>.lods next to the model file
+static std::vector<MeshSimplifier::Mesh> LoadTreeLodChain(const char* modelPath, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+	return MeshSimplifier::LoadOrBuildLodChain(std::string(modelPath) + ".lods", vertices, indices, MeshSimplifier::ChainSettings());
+}
 
-	VkSurfaceKHR surface;
-	if (glfwCreateWindowSurface(instance->GetVkInstance(), GetGLFWWindow(), nullptr, &surface) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create window surface");
+int main(int argc, char** argv) {
+	BenchmarkOptions benchmarkOptions;
+	if (!ParseBenchmarkOptions(argc, argv, benchmarkOptions)) {
+		return 0;
 	}
 
-	instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, surface);
+	static constexpr char* applicationName = "Vulkan Forest Render Engine";
+	int width = 1920, height = 1080;
+	bool headless = benchmarkOptions.headless;
 
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.tessellationShader = VK_TRUE;
 	deviceFeatures.fillModeNonSolid = VK_TRUE;
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 
-	device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, deviceFeatures);
+	if (!benchmarkOptions.buildLods.empty()) {
+		// Asset pipeline only, fills the LOD caches without touching Vulkan
+		for (const std::string& path : benchmarkOptions.buildLods) {
+			FbxLoader source(path);
+			LoadTreeLodChain(path.c_str(), source.vertices, source.indices);
+		}
+		return 0;
+	}
+
+	if (benchmarkOptions.terrainBenchmark) {
+		// CPU only, like the LOD cache build
+		return RunTerrainBenchmark(benchmarkOptions.output.c_str()) ? 0 : 1;
+	}
+
+	if (benchmarkOptions.compactionBenchmark) {
+		// Compute only, no window, swap chain or scene
+		Instance* benchmarkInstance = new Instance(applicationName);
+		benchmarkInstance->PickPhysicalDevice({}, QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit);
+		device = benchmarkInstance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit, deviceFeatures);
+		bool correct = RunCompactionBenchmark(device, benchmarkOptions.output.c_str());
+		delete device;
+		delete benchmarkInstance;
+		return correct ? 0 : 1;
+	}
 
-	swapChain = device->CreateSwapChain(surface, 5);
+	Instance* instance;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	if (headless) {
+		// No window system at all, so this also runs on CI machines without a display
+		instance = new Instance(applicationName);
+		instance->PickPhysicalDevice({}, QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit);
+		EnableForestFeatures(instance, deviceFeatures);
+		device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit, deviceFeatures);
+		swapChain = device->CreateOffscreenSwapChain(width, height, 3);
+	}
+	else {
+		InitializeWindow(width, height, applicationName);
 
-	camera = new Camera(device, float(width) /float(height),width,height);
+		unsigned int glfwExtensionCount = 0;
+		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	VkCommandPoolCreateInfo transferPoolInfo = {};
-	transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	transferPoolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Transfer];
-	transferPoolInfo.flags = 0;
+		instance = new Instance(applicationName, glfwExtensionCount, glfwExtensions);
 
-	VkCommandPool transferCommandPool;
-	if (vkCreateCommandPool(device->GetVkDevice(), &transferPoolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create command pool");
+		if (glfwCreateWindowSurface(instance->GetVkInstance(), GetGLFWWindow(), nullptr, &surface) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create window surface");
+		}
+
+		instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, surface);
+		EnableForestFeatures(instance, deviceFeatures);
+
+		device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, deviceFeatures);
+
+		swapChain = device->CreateSwapChain(surface, 5);
 	}
 
+	// Camera and scene uniforms get a slot in every frame's slice of the ring
+	UniformRing* uniformRing = new UniformRing(device, MAX_FRAMES_IN_FLIGHT);
+	camera = new Camera(device, uniformRing, float(width) /float(height),width,height);
+
+	// Every scene upload is batched through here and submitted in a handful of fenced submits
+	UploadContext* uploadContext = new UploadContext(device);
+
 //GUI Initialize
 	gui->device = device;
 	ImGui_ImplGlfwVulkan_Init(GetGLFWWindow());
@@ -372,7 +523,7 @@ int main() {
 	VkImage terrainImage;
 	VkDeviceMemory terrainImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/terrain/diffuseMap03.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -385,7 +536,7 @@ int main() {
 	VkImage terrainNormalImage;
 	VkDeviceMemory terrainNormalImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/terrain/normalMap03.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -399,7 +550,7 @@ int main() {
 	VkImage grassImage;
 	VkDeviceMemory grassImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"images/grass.jpg",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -413,7 +564,7 @@ int main() {
 	VkImage barkImage;
 	VkDeviceMemory barkImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Bark_png/BroadleafBark_Tex_Tree0.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -426,7 +577,7 @@ int main() {
 	VkImage barkNormalImage;
 	VkDeviceMemory barkNormalImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Bark_png/BroadleafBark_Normal_Tex_Tree0.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -440,7 +591,7 @@ int main() {
 	VkImage leafImage;
 	VkDeviceMemory leafImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Leaf_png/leaf_Tex_Tree0.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -453,7 +604,7 @@ int main() {
 	VkImage leafNormalImage;
 	VkDeviceMemory leafNormalImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Leaf_png/Normal_Tex_Tree0.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -466,7 +617,7 @@ int main() {
 	VkImage leafImage2;
 	VkDeviceMemory leafImageMemory2;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Leaf_png/leaf_Tex_Tree2.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -479,7 +630,7 @@ int main() {
 	VkImage leafNormalImage2;
 	VkDeviceMemory leafNormalImageMemory2;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Leaf_png/Normal_Tex_Tree2.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -489,64 +640,11 @@ int main() {
 		leafNormalImage2,
 		leafNormalImageMemory2
 	);
-	// Billboard
-	VkImage billboardImage;
-	VkDeviceMemory billboardImageMemory;
-	Image::FromFile(device,
-		transferCommandPool,
-		"../../media/textures/Billboard_png/Billboards_Tex_Tree0.png",
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		billboardImage,
-		billboardImageMemory
-	);
-	VkImage billboardNormalImage;
-	VkDeviceMemory billboardNormalImageMemory;
-	Image::FromFile(device,
-		transferCommandPool,
-		"../../media/textures/Billboard_png/Billboards_Normal_Tex_Tree0.png",
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		billboardNormalImage,
-		billboardNormalImageMemory
-	);
-	VkImage billboardImage2;
-	VkDeviceMemory billboardImageMemory2;
-	Image::FromFile(device,
-		transferCommandPool,
-		"../../media/textures/Billboard_png/Billboards_Tex_Tree2.png",
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		billboardImage2,
-		billboardImageMemory2
-	);
-	VkImage billboardNormalImage2;
-	VkDeviceMemory billboardNormalImageMemory2;
-	Image::FromFile(device,
-		transferCommandPool,
-		"../../media/textures/Billboard_png/Billboards_Normal_Tex_Tree2.png",
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		billboardNormalImage2,
-		billboardNormalImageMemory2
-	);
 	// Fake Trees
 	VkImage faketreeImage;
 	VkDeviceMemory faketreeImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Fake_png/fake01.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -559,7 +657,7 @@ int main() {
 	VkImage faketreeNormalImage;
 	VkDeviceMemory faketreeNormalImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Fake_png/blueNor.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -572,7 +670,7 @@ int main() {
 	VkImage faketreeImage2;
 	VkDeviceMemory faketreeImageMemory2;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Fake_png/fake02.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -585,7 +683,7 @@ int main() {
 	VkImage faketreeNormalImage2;
 	VkDeviceMemory faketreeNormalImageMemory2;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/Fake_png/blueNor.png",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -599,7 +697,7 @@ int main() {
 	VkImage noiseImage;
 	VkDeviceMemory noiseImageMemory;
 	Image::FromFile(device,
-		transferCommandPool,
+		uploadContext,
 		"../../media/textures/noise.jpg",
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -621,7 +719,7 @@ int main() {
 		"../../media/textures/Skybox_jpg/TropicalSunnyDay/TropicalSunnyDayBack2048.png",
 	};
 	Image::FromMultiFile(device,
-		transferCommandPool,
+		uploadContext,
 		cubemap_images_day,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -642,7 +740,7 @@ int main() {
 		"../../media/textures/Skybox_jpg/SunSet/SunSetBack2048.png",
 	};
 	Image::FromMultiFile(device,
-		transferCommandPool,
+		uploadContext,
 		cubemap_images_afternoon,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -663,7 +761,7 @@ int main() {
 		"../../media/textures/Skybox_jpg/FullMoon/FullMoonBack2048.png",
 	};
 	Image::FromMultiFile(device,
-		transferCommandPool,
+		uploadContext,
 		cubemap_images_night,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
@@ -677,7 +775,7 @@ int main() {
 	VkImage FontTexture;
 	VkDeviceMemory FontTextureMemory;
 	Image::FromGuiTexture(device,
-		transferCommandPool,
+		uploadContext,
 		VK_FORMAT_R8G8B8A8_UNORM,
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_SAMPLED_BIT,
@@ -691,14 +789,14 @@ int main() {
 // Terrain Initializations
 	char* terrainPath = "../../media/terrain/heightMap03.png";
 	char* rawPath = "../../media/terrain/heightMap03.r16";
-	Terrain *terrain = Terrain::LoadTerrain(device, transferCommandPool, terrainPath, rawPath, 256.0f);
+	Terrain *terrain = Terrain::LoadTerrain(device, uploadContext, terrainPath, rawPath, 256.0f);
 	terrain->SetDiffuseMap(terrainImage);
 	terrain->SetNormalMap(terrainNormalImage);
 // Model Initializations
 	// Plane
 	float planeDim = 50.f;
 	float halfWidth = planeDim * 0.5f;
-	Model* plane = new Model(device, transferCommandPool,
+	Model* plane = new Model(device, uploadContext,
 	{
 		{ { -halfWidth, 0.0f, halfWidth },{ 1.0f, 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f } },
 		{ { halfWidth, 0.0f, halfWidth },{ 0.0f, 1.0f, 0.0f, 1.0f },{ 0.0f, 0.0f } },
@@ -714,7 +812,7 @@ int main() {
 	FbxLoader *fbxloader;
 	// Bark
 	fbxloader = new FbxLoader("../../media/models/tree1_bark_LOD0.fbx");
-	Model* bark = new Model(device, transferCommandPool,
+	Model* bark = new Model(device, uploadContext,
 		fbxloader->vertices,
 		fbxloader->indices
 	);
@@ -723,32 +821,33 @@ int main() {
 	bark->SetNoiseMap(noiseImage);
 	// Leaf
 	fbxloader = new FbxLoader("../../media/models/tree1_leaf_LOD0.fbx");
-	Model* leaf = new Model(device, transferCommandPool,
+	Model* leaf = new Model(device, uploadContext,
 		fbxloader->vertices,
 		fbxloader->indices
 	);
 	leaf->SetDiffuseMap(leafImage);
 	leaf->SetNormalMap(leafNormalImage);
 	leaf->SetNoiseMap(noiseImage);
-	// Billboard
-	float billWidth = 24.0f;
-	float billheigth = 20.0f;
-	Model* billboard = new Model(device, transferCommandPool,
-	{
-		{ { -billWidth / 2.0, billheigth, 0.0f },{ 1.0f, 0.0f, 0.0f, 1.0f },{ 0.333f, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
-		{ { -billWidth / 2.0, 0.0f, 0.0f },	{ 0.0f, 1.0f, 0.0f, 1.0f },{ 0.333f, 0.333f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
-		{ { billWidth / 2.0, 0.0f, 0.0f },{ 0.0f, 0.0f, 1.0f, 1.0f },{ 0.650f, 0.333f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
-		{ { billWidth / 2.0, billheigth, 0.0f },{ 1.0f, 1.0f, 1.0f, 1.0f },{ 0.650f, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } }
-	},
-	{ 1, 2, 0, 0, 2, 3 }
+	// Coarser bark and leaf for the middle distance, same textures
+	fbxloader = new FbxLoader("../../media/models/tree1_bark_LOD1.fbx");
+	Model* barkLOD1 = new Model(device, uploadContext,
+		fbxloader->vertices,
+		fbxloader->indices
 	);
-	billboard->SetDiffuseMap(billboardImage);
-	billboard->SetNormalMap(billboardNormalImage);
-	billboard->SetNoiseMap(noiseImage);
-
+	barkLOD1->SetDiffuseMap(barkImage);
+	barkLOD1->SetNormalMap(barkNormalImage);
+	barkLOD1->SetNoiseMap(noiseImage);
+	fbxloader = new FbxLoader("../../media/models/tree1_leaf_LOD1.fbx");
+	Model* leafLOD1 = new Model(device, uploadContext,
+		fbxloader->vertices,
+		fbxloader->indices
+	);
+	leafLOD1->SetDiffuseMap(leafImage);
+	leafLOD1->SetNormalMap(leafNormalImage);
+	leafLOD1->SetNoiseMap(noiseImage);
 	// Bark
 	fbxloader = new FbxLoader("../../media/models/tree2_bark_rgba.FBX");
-	Model* bark2 = new Model(device, transferCommandPool,
+	Model* bark2 = new Model(device, uploadContext,
 		fbxloader->vertices,
 		fbxloader->indices
 	);
@@ -757,29 +856,62 @@ int main() {
 	bark2->SetNoiseMap(noiseImage);
 	// Leaf
 	fbxloader = new FbxLoader("../../media/models/tree2_leaf_rgba.FBX");
-	Model* leaf2 = new Model(device, transferCommandPool,
+	Model* leaf2 = new Model(device, uploadContext,
 		fbxloader->vertices,
 		fbxloader->indices
 	);
 	leaf2->SetDiffuseMap(leafImage2);
 	leaf2->SetNormalMap(leafNormalImage2);
 	leaf2->SetNoiseMap(noiseImage);
-	// Billboard
-	Model* billboard2 = new Model(device, transferCommandPool,
-	{
-		{ { -billWidth / 2.0, billheigth, 0.0f },{ 1.0f, 0.0f, 0.0f, 1.0f },{ 0.583f, 0.344f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
-		{ { -billWidth / 2.0, 0.0f, 0.0f },{ 0.0f, 1.0f, 0.0f, 1.0f },{ 0.583f, 0.547f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
-		{ { billWidth / 2.0, 0.0f, 0.0f },{ 0.0f, 0.0f, 1.0f, 1.0f },{ 0.861f, 0.547f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
-		{ { billWidth / 2.0, billheigth, 0.0f },{ 1.0f, 1.0f, 1.0f, 1.0f },{ 0.861f, 0.344f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } }
-	},
-	{ 1, 2, 0, 0, 2, 3 }
-	);
-	billboard2->SetDiffuseMap(billboardImage2);
-	billboard2->SetNormalMap(billboardNormalImage2);
+	// Tree 2 ships without LOD meshes, its levels are simplified from the full models and cached next to them
+	std::vector<MeshSimplifier::Mesh> bark2Chain = LoadTreeLodChain("../../media/models/tree2_bark_rgba.FBX", bark2->getVertices(), bark2->getIndices());
+	std::vector<MeshSimplifier::Mesh> leaf2Chain = LoadTreeLodChain("../../media/models/tree2_leaf_rgba.FBX", leaf2->getVertices(), leaf2->getIndices());
+	std::vector<Model*> bark2Levels;
+	std::vector<Model*> leaf2Levels;
+	for (size_t l = 0; l < std::min(bark2Chain.size(), leaf2Chain.size()); l++) {
+		Model* barkLevel = new Model(device, uploadContext, bark2Chain[l].vertices, bark2Chain[l].indices);
+		barkLevel->SetDiffuseMap(barkImage);
+		barkLevel->SetNormalMap(barkNormalImage);
+		barkLevel->SetNoiseMap(noiseImage);
+		bark2Levels.push_back(barkLevel);
+		Model* leafLevel = new Model(device, uploadContext, leaf2Chain[l].vertices, leaf2Chain[l].indices);
+		leafLevel->SetDiffuseMap(leafImage2);
+		leafLevel->SetNormalMap(leafNormalImage2);
+		leafLevel->SetNoiseMap(noiseImage);
+		leaf2Levels.push_back(leafLevel);
+	}
+
+	// Billboards of both species are impostors rendered from their full models, the culling spheres give the
+	// impostors' extent. The full models get some room for wind bending
+	Culling::BoundingSphere tree1Sphere = Culling::ComputeBoundingSphere({ bark, leaf }, true, 0.1f);
+	Culling::BoundingSphere tree2Sphere = Culling::ComputeBoundingSphere({ bark2, leaf2 }, true, 0.1f);
+	// The baker draws straight from the models' buffers and textures
+	uploadContext->Finish();
+	ImpostorBaker* impostorBaker = new ImpostorBaker(device);
+	// Alpha cutoffs and normal scales of bark.frag / leaf.frag
+	ImpostorAtlas impostor1 = impostorBaker->Bake({ { bark, 0.0f, glm::vec2(1.7f, -1.7f) }, { leaf, 0.8f, glm::vec2(1.3f, -1.3f) } }, tree1Sphere);
+	ImpostorAtlas impostor2 = impostorBaker->Bake({ { bark2, 0.0f, glm::vec2(1.7f, -1.7f) }, { leaf2, 0.8f, glm::vec2(1.3f, -1.3f) } }, tree2Sphere);
+	delete impostorBaker;
+	// Corners of the camera facing quad, billboard.vert sizes it to the species' sphere
+	const std::vector<Vertex> impostorQuad = {
+		{ { -1.0f, 1.0f, 0.0f },{ 1.0f, 1.0f, 1.0f, 1.0f },{ 0.0f, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
+		{ { -1.0f, -1.0f, 0.0f },{ 1.0f, 1.0f, 1.0f, 1.0f },{ 0.0f, 1.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
+		{ { 1.0f, -1.0f, 0.0f },{ 1.0f, 1.0f, 1.0f, 1.0f },{ 1.0f, 1.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
+		{ { 1.0f, 1.0f, 0.0f },{ 1.0f, 1.0f, 1.0f, 1.0f },{ 1.0f, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } }
+	};
+	Model* billboard = new Model(device, uploadContext, impostorQuad, { 1, 2, 0, 0, 2, 3 });
+	billboard->SetDiffuseMap(impostor1.albedo);
+	billboard->SetNormalMap(impostor1.normalDepth);
+	billboard->SetNoiseMap(noiseImage);
+	Model* billboard2 = new Model(device, uploadContext, impostorQuad, { 1, 2, 0, 0, 2, 3 });
+	billboard2->SetDiffuseMap(impostor2.albedo);
+	billboard2->SetNormalMap(impostor2.normalDepth);
 	billboard2->SetNoiseMap(noiseImage);
-	
+
 	// Fake Trees
-	Model* fakeTree = new Model(device, transferCommandPool,
+	float billWidth = 24.0f;
+	float billheigth = 20.0f;
+	Model* fakeTree = new Model(device, uploadContext,
 	{
 		{ { -billWidth / 2.0, billheigth, 0.0f },{ 1.0f, 0.0f, 0.0f, 1.0f },{ 0.020f, 0.725f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
 		{ { -billWidth / 2.0, 0.0f, 0.0f },{ 0.0f, 1.0f, 0.0f, 1.0f },{ 0.020f, 0.871f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
@@ -792,7 +924,7 @@ int main() {
 	fakeTree->SetNormalMap(faketreeNormalImage);
 	fakeTree->SetNoiseMap(noiseImage);
 
-	Model* fakeTree2 = new Model(device, transferCommandPool,
+	Model* fakeTree2 = new Model(device, uploadContext,
 	{
 		{ { -billWidth / 2.0, billheigth, 0.0f },{ 1.0f, 0.0f, 0.0f, 1.0f },{ 0.209f, 0.359f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
 		{ { -billWidth / 2.0, 0.0f, 0.0f },{ 0.0f, 1.0f, 0.0f, 1.0f },{ 0.398f, 0.359f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, -1.0f, 0.0f } },
@@ -806,7 +938,7 @@ int main() {
 	fakeTree2->SetNoiseMap(noiseImage);
 
 	//skybox
-	Skybox* skybox = new Skybox(device, transferCommandPool,
+	Skybox* skybox = new Skybox(device, uploadContext,
 	{
 		{ { 1,1,1,1 } },{ { -1,1,1,1 } },{ { -1,1,-1,1 } },{ { 1,1,-1,1 } },
 		{ { 1,-1,1,1 } },{ { -1,-1,1,1 } },{ { -1,-1,-1,1 } },{ { 1,-1,-1,1 } }
@@ -825,15 +957,21 @@ int main() {
 	gui->SetFontTextureMap(FontTexture);
 
 	//srand(213910);
-	srand((unsigned int)time(0));
+	unsigned int seed = benchmarkOptions.fixedSeed ? benchmarkOptions.seed : (unsigned int)time(0);
+	printf("Placement seed %u\n", seed);
+	srand(seed);
 	// Blades
 	printf("Building Blades\n");
-	Blades* blades = new Blades(device, transferCommandPool, planeDim, terrain);
+	Blades* blades = new Blades(device, uploadContext, planeDim, terrain);
 	printf("Finish Building Blades\n");
 
 // Scene Initialization
 
-	Scene* scene = new Scene(device);
+	Scene* scene = new Scene(device, uniformRing);
+	scene->SetSeed(seed);
+	if (benchmarkOptions.enabled || headless) {
+		scene->SetFixedTimeStep(benchmarkOptions.timeStep);
+	}
 	scene->SetTerrain(terrain);
 	scene->SetSkybox(skybox);
 	scene->SetGui(gui);
@@ -846,25 +984,61 @@ int main() {
 	scene->AddModel(billboard2);
 	scene->AddModel(fakeTree);
 	scene->AddModel(fakeTree2);
+	scene->AddModel(barkLOD1);
+	scene->AddModel(leafLOD1);
+	for (size_t l = 0; l < bark2Levels.size(); l++) {
+		scene->AddModel(bark2Levels[l]);
+		scene->AddModel(leaf2Levels[l]);
+	}
 	scene->AddBlades(blades);
 	// Insert Trees
 	//Instance Data
 	printf("Starting Insert Trees Randomly\n");
 	//srand((unsigned int)time(0));
 	printf("Tree 1\n");
-	scene->InsertRandomTrees(150, 0.015f, 1, device, transferCommandPool);
-	scene->AddLODInfoBuffer(glm::vec4(LOD0, LOD1, 20.0f, scene->GetInstanceBuffer()[0]->GetInstanceCount()));
+	// Culling sphere of the fake tree billboards, species' impostors cull with the full model's sphere
+	Culling::BoundingSphere fakeTreeSphere = Culling::ComputeBoundingSphere({ fakeTree, fakeTree2 }, false, 0.0f);
+	scene->InsertRandomTrees(150, 0.015f, 1);
+	scene->AddLODInfo(glm::vec4(LOD0, LOD1, 20.0f, scene->GetTreeGroups()[0].instances.size()),
+		glm::vec4(tree1Sphere.centerY, tree1Sphere.radius, 0.0f, 0.0f));
+	// Tree 1 switches to its coarser meshes halfway to the billboards
+	scene->AddMeshLOD(barkLOD1, leafLOD1, 0.5f);
 	printf("Tree 2\n");
-	scene->InsertRandomTrees(40, 0.021f, 4, device, transferCommandPool);
-	scene->AddLODInfoBuffer(glm::vec4(LOD0, LOD1, 20.0f, scene->GetInstanceBuffer()[1]->GetInstanceCount()));
+	scene->InsertRandomTrees(40, 0.021f, 4);
+	scene->AddLODInfo(glm::vec4(LOD0, LOD1, 20.0f, scene->GetTreeGroups()[1].instances.size()),
+		glm::vec4(tree2Sphere.centerY, tree2Sphere.radius, 0.0f, 0.0f));
+	// Generated levels split the way to the billboards evenly
+	for (size_t l = 0; l < bark2Levels.size() && l + 1 < MAX_TREE_LODS; l++) {
+		scene->AddMeshLOD(bark2Levels[l], leaf2Levels[l], float(l + 1) / float(MAX_TREE_LODS));
+	}
 	printf("Finish Insert Trees Randomly\n");
 	printf("Gathering Fake Trees\n");
-	scene->GatherFakeTrees(device, transferCommandPool);
+	scene->GatherFakeTrees(7, glm::vec4(0.0f, 0.0f, fakeTreeSphere.centerY, fakeTreeSphere.radius));
 	printf("Finish Gather Fake Trees\n");
-	vkDestroyCommandPool(device->GetVkDevice(), transferCommandPool, nullptr);
+	// All tree groups in one instance buffer, their models merged per draw kind
+	scene->BuildForest(device, uploadContext);
+	uploadContext->Finish();
+	printf("Scene uploaded in %u submits\n", uploadContext->GetSubmitCount());
+	delete uploadContext;
+	// Trees only draw from the packed batches now and the impostors are baked, so the full vertex buffers can go
+	std::vector<Model*> treeModels = { bark, leaf, bark2, leaf2, barkLOD1, leafLOD1 };
+	treeModels.insert(treeModels.end(), bark2Levels.begin(), bark2Levels.end());
+	treeModels.insert(treeModels.end(), leaf2Levels.begin(), leaf2Levels.end());
+	for (Model* model : treeModels) {
+		model->ReleaseGeometryBuffers();
+	}
 
 	//float yy = scene->GetTerrain()->GetHeight(0.25,0.25);
-	//scene->InsertRandomTrees(20, device, transferCommandPool);
+	//scene->InsertRandomTrees(20, device, uploadContext);
+
+	// Timestamp queries of every frame in flight, read back once its fence has signaled
+	profiler = new GpuProfiler(device, MAX_FRAMES_IN_FLIGHT);
+	lodController = new LodController({ LOD0, LOD1, FakeTreeLOD });
+	if (benchmarkOptions.lodTargetMs > 0.0f) {
+		AdaptiveLod = true;
+		LodTargetMs = benchmarkOptions.lodTargetMs;
+		lodController->SetEnabled(true);
+	}
 
 	//First Initialization
 	ImGui_ImplGlfwVulkan_NewFrame(GetGLFWWindow());
@@ -872,29 +1046,93 @@ int main() {
 	ImGui::Render();
 	
 
-	renderer = new Renderer(device, swapChain, scene, camera);
+	renderer = new Renderer(device, swapChain, scene, camera, profiler);
+	renderer->SetLodCheck(benchmarkOptions.verifyLod);
+	device->GetAllocator()->PrintStats();
 	gui->g_FrameIndex = (gui->g_FrameIndex + 1) % IMGUI_VK_QUEUED_FRAMES;
 	
-	glfwSetWindowSizeCallback(GetGLFWWindow(), resizeCallback);
-	glfwSetMouseButtonCallback(GetGLFWWindow(), mouseDownCallback);
-	glfwSetCursorPosCallback(GetGLFWWindow(), mouseMoveCallback);
-	glfwSetScrollCallback(GetGLFWWindow(), mouseWheelCallback);
+	if (!headless) {
+		glfwSetWindowSizeCallback(GetGLFWWindow(), resizeCallback);
+	}
+
+	// Benchmark mode replays a camera path instead of taking mouse input, and quits on its own
+	Benchmark* benchmark = nullptr;
+	if (benchmarkOptions.enabled) {
+		CameraPath path;
+		if (benchmarkOptions.cameraPath.empty()) {
+			path = CameraPath::Flyover(terrain);
+		}
+		else if (!path.Load(benchmarkOptions.cameraPath.c_str())) {
+			throw std::runtime_error("Failed to load camera path");
+		}
+		benchmark = new Benchmark(benchmarkOptions, path);
+	}
+	else if (!headless) {
+		glfwSetMouseButtonCallback(GetGLFWWindow(), mouseDownCallback);
+		glfwSetCursorPosCallback(GetGLFWWindow(), mouseMoveCallback);
+		glfwSetScrollCallback(GetGLFWWindow(), mouseWheelCallback);
+	}
+	CameraPath recordedPath;
+	double lastRecordedKey = -1.0;
+	int64_t lastLodSample = -1;
 
 	int time_start = GetTickCount();
 	int count = 0;
+	int frameNumber = 0;
 
-	while (!ShouldQuit()) {
-		glfwPollEvents();
+	while (true) {
+		if (benchmark) {
+			if (benchmark->IsFinished()) {
+				break;
+			}
+		}
+		else if (headless ? frameNumber >= benchmarkOptions.frames : ShouldQuit()) {
+			break;
+		}
+		if (!headless) {
+			glfwPollEvents();
+		}
 		ImGui_ImplGlfwVulkan_NewFrame(GetGLFWWindow());
 
 		InitialGuiContent();
 		ImGui::Render();
 
+		if (benchmark) {
+			benchmark->ApplyCamera(camera, terrain);
+		}
 		scene->UpdateTime();
-		scene->UpdateLODInfo(LOD0, LOD1);
+		scene->UpdateLODInfo(LOD0, LOD1, FakeTreeLOD);
 		scene->UpdateWindInfo(glm::vec4(WindDirection[0],  WindDirection[1], WindDirection[2], 1.0f), glm::vec4(windForce, windSpeed, waveInterval, 1.0f));
 		scene->UpdateDayNightInfo(Daylength, DayNightActivation);
-		renderer->Frame();
+		bool submitted = renderer->Frame();
+		const std::vector<int>& dumpFrames = benchmarkOptions.dumpFrames;
+		if (std::find(dumpFrames.begin(), dumpFrames.end(), frameNumber) != dumpFrames.end()) {
+			std::string framePath = "frame_" + std::to_string(frameNumber) + ".png";
+			if (renderer->SaveLastFrame(framePath.c_str())) {
+				printf("Frame %d written to %s\n", frameNumber, framePath.c_str());
+			}
+		}
+		frameNumber++;
+		// Adaptive LOD steps on every newly collected GPU frame time, the next frame picks up the new distances
+		if (profiler->GetLastCollectedSubmit() != lastLodSample) {
+			lastLodSample = profiler->GetLastCollectedSubmit();
+			if (lodController->Update(profiler->GetLastTime(ProfilerScope::Frame))) {
+				const LodSettings& settings = lodController->GetSettings();
+				LOD0 = settings.lod0;
+				LOD1 = settings.lod1;
+				FakeTreeLOD = settings.fakeTreeLod;
+			}
+		}
+		if (benchmark) {
+			// A frame that only recreated the swap chain has no sample of its own
+			if (submitted) {
+				benchmark->EndFrame(renderer, profiler);
+			}
+		}
+		else if (!headless && !benchmarkOptions.recordCameraPath.empty() && glfwGetTime() - lastRecordedKey >= 0.1) {
+			lastRecordedKey = glfwGetTime();
+			recordedPath.AddKey(float(lastRecordedKey), camera->GetEyePos(), camera->GetRefPos());
+		}
 		count++;
 		if (count == 100) {
 			int total_time = GetTickCount() - time_start;
@@ -911,76 +1149,81 @@ int main() {
 
 	vkDeviceWaitIdle(device->GetVkDevice());
 
-	vkDestroyImage(device->GetVkDevice(), grassImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), grassImageMemory, nullptr);
-
-	vkDestroyImage(device->GetVkDevice(), terrainImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), terrainImageMemory, nullptr);
-
-	vkDestroyImage(device->GetVkDevice(), barkImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), barkImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), barkNormalImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), barkNormalImageMemory, nullptr);
-
-	vkDestroyImage(device->GetVkDevice(), leafImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), leafImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), leafNormalImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), leafNormalImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), leafImage2, nullptr);
-	vkFreeMemory(device->GetVkDevice(), leafImageMemory2, nullptr);
-	vkDestroyImage(device->GetVkDevice(), leafNormalImage2, nullptr);
-	vkFreeMemory(device->GetVkDevice(), leafNormalImageMemory2, nullptr);
-
-
-	vkDestroyImage(device->GetVkDevice(), billboardImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), billboardImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), billboardNormalImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), billboardNormalImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), billboardImage2, nullptr);
-	vkFreeMemory(device->GetVkDevice(), billboardImageMemory2, nullptr);
-	vkDestroyImage(device->GetVkDevice(), billboardNormalImage2, nullptr);
-	vkFreeMemory(device->GetVkDevice(), billboardNormalImageMemory2, nullptr);
-
-	vkDestroyImage(device->GetVkDevice(), faketreeImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), faketreeImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), faketreeNormalImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), faketreeNormalImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), faketreeImage2, nullptr);
-	vkFreeMemory(device->GetVkDevice(), faketreeImageMemory2, nullptr);
-	vkDestroyImage(device->GetVkDevice(), faketreeNormalImage2, nullptr);
-	vkFreeMemory(device->GetVkDevice(), faketreeNormalImageMemory2, nullptr);
-
-
-	vkDestroyImage(device->GetVkDevice(), skyboxImageDay, nullptr);
-	vkFreeMemory(device->GetVkDevice(), skyboxImageDayMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), skyboxImageAfternoon, nullptr);
-	vkFreeMemory(device->GetVkDevice(), skyboxImageAfternoonMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), skyboxImageNight, nullptr);
-	vkFreeMemory(device->GetVkDevice(), skyboxImageNightMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), noiseImage, nullptr);
-	vkFreeMemory(device->GetVkDevice(), noiseImageMemory, nullptr);
-	vkDestroyImage(device->GetVkDevice(), FontTexture, nullptr);
-	vkFreeMemory(device->GetVkDevice(), FontTextureMemory, nullptr);
+	if (benchmark) {
+		benchmark->WriteReport(benchmarkOptions.output.c_str());
+		delete benchmark;
+	}
+	bool lodCheckFailed = false;
+	if (benchmarkOptions.verifyLod) {
+		printf("LOD check: %u frames, %u mismatches\n", renderer->GetLodCheckFrames(), renderer->GetLodCheckMismatches());
+		lodCheckFailed = renderer->GetLodCheckMismatches() > 0;
+	}
+	if (!recordedPath.IsEmpty()) {
+		if (recordedPath.Save(benchmarkOptions.recordCameraPath.c_str())) {
+			printf("Camera path written to %s\n", benchmarkOptions.recordCameraPath.c_str());
+		}
+	}
+
+	Image::Destroy(device, grassImage);
+
+	Image::Destroy(device, terrainImage);
+
+	Image::Destroy(device, barkImage);
+	Image::Destroy(device, barkNormalImage);
+
+	Image::Destroy(device, leafImage);
+	Image::Destroy(device, leafNormalImage);
+	Image::Destroy(device, leafImage2);
+	Image::Destroy(device, leafNormalImage2);
+
+
+	Image::Destroy(device, impostor1.albedo);
+	Image::Destroy(device, impostor1.normalDepth);
+	Image::Destroy(device, impostor2.albedo);
+	Image::Destroy(device, impostor2.normalDepth);
+
+	Image::Destroy(device, faketreeImage);
+	Image::Destroy(device, faketreeNormalImage);
+	Image::Destroy(device, faketreeImage2);
+	Image::Destroy(device, faketreeNormalImage2);
+
+
+	Image::Destroy(device, skyboxImageDay);
+	Image::Destroy(device, skyboxImageAfternoon);
+	Image::Destroy(device, skyboxImageNight);
+	Image::Destroy(device, noiseImage);
+	Image::Destroy(device, FontTexture);
 
 
 	delete scene;
 	delete plane;
 	delete bark;
 	delete leaf;
+	delete barkLOD1;
+	delete leafLOD1;
 	delete billboard;
 	delete bark2;
 	delete leaf2;
 	delete billboard2;
+	for (size_t l = 0; l < bark2Levels.size(); l++) {
+		delete bark2Levels[l];
+		delete leaf2Levels[l];
+	}
 	delete terrain;
 	delete skybox;
 	delete blades;
 	delete camera;
 	delete gui;
 	delete renderer;
+	delete profiler;
+	delete lodController;
+	delete uniformRing;
 	ImGui::Shutdown();
 	delete swapChain;
 	delete device;
 	delete instance;
-	DestroyWindow();
-	return 0;
+	if (!headless) {
+		DestroyWindow();
+	}
+	return lodCheckFailed ? 1 : 0;
 }
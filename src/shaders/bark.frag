@@ -1,18 +1,31 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(set = 1, binding = 1) uniform sampler2D texSampler;
-layout(set = 1, binding = 2) uniform sampler2D normalSampler;
-layout(set = 1, binding = 3) uniform sampler2D noiseSampler;
+// Same as in InstanceData.h
+#define MAX_TREE_GROUPS 16
+
+// Textures of every tree group. The group is the same for a whole draw, so indexing with it is dynamically uniform
+layout(set = 1, binding = 1) uniform sampler2D texSampler[MAX_TREE_GROUPS];
+layout(set = 1, binding = 2) uniform sampler2D normalSampler[MAX_TREE_GROUPS];
 
 layout(set = 2, binding = 0) uniform Time {
     vec2 TimeInfo;
 	// 0: deltaTime 1: totalTime
 };
 
-layout(set = 3, binding = 0) uniform LODINFO{
-	// 0: LOD0 |1: LOD1 |2: TreeHeight |3: NumTrees
+struct LODGroup {
+	// 0: LOD0 1: LOD1 2: TreeHeight 3: NumTrees
 	vec4 LODInfo;
+	// 0: full model sphere center height 1: full model radius 2: fake tree billboard center height 3: fake tree billboard radius
+	vec4 LODBounds;
+	// 0: first instance 1: instance count 2: 1 for fake trees 3: mesh levels
+	uvec4 Range;
+	// Projected size in pixels down to which each mesh level is drawn
+	vec4 LevelEnds;
+};
+
+layout(set = 3, binding = 0) uniform LODINFO{
+	LODGroup groups[MAX_TREE_GROUPS];
 };
 
 layout(set = 4, binding = 0) uniform DayNightInfo{
@@ -27,10 +40,11 @@ layout(location = 3) in vec3 worldN;
 layout(location = 4) in vec3 worldB;
 layout(location = 5) in vec3 worldT;
 layout(location = 6) in float vertAmbient;
-layout(location = 7) in float distanceLevel;
-layout(location = 8) in vec2 noiseTexCoord;
+layout(location = 7) flat in float lodFade;
 layout(location = 9) in vec3 tintColor;
 
+layout(location = 11) flat in int group;
+
 layout(location = 0) out vec4 outColor;
 
 const vec3 lightDir = vec3(-1.0, 5.0, -3.0);
@@ -38,21 +52,28 @@ const vec3 lightColorDay = vec3(1.0, 1.0, 0.94);
 const vec3 lightColorAfternoon = vec3(1.0, 0.9, 0.7);
 const vec3 lightColorNight = vec3(0.95, 1.0, 1.0);
 
+// Ordered dither threshold of the pixel, in (0, 1). Same pattern in bark.frag, leaf.frag and billboard.frag: the full
+// tree keeps the pixels whose threshold is above its fade and the billboard the rest, so an instance in the middle of
+// a cross-fade covers every pixel once
+float ditherThreshold() {
+	const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[pixel.y * 4 + pixel.x] + 0.5) / 16.0;
+}
+
 void main() {
-	// LOD Morphing
-	vec4 noiseColor = texture(noiseSampler, noiseTexCoord);
-	float dis = (distanceLevel - LODInfo.y)/(LODInfo.x - LODInfo.y);
-	if(dis >= noiseColor.x)
+	// LOD cross-fade, the full tree leaves the billboard the pixels below its fade
+	if(lodFade >= ditherThreshold())
 		discard;
 
 	// Local normal, in tangent space
 	vec3 TextureNormal_tangentspace;
-	TextureNormal_tangentspace = (texture( normalSampler, fragTexCoord ).rgb*2.0f - 1.0f);
+	TextureNormal_tangentspace = (texture( normalSampler[group], fragTexCoord ).rgb*2.0f - 1.0f);
 	TextureNormal_tangentspace.x *= 1.7f;
 	TextureNormal_tangentspace.y *= 1.7f;
 	vec3 TextureNormal_worldspace = normalize(worldT * TextureNormal_tangentspace.x + worldB * -TextureNormal_tangentspace.y + worldN * TextureNormal_tangentspace.z);
 
-    vec4 diffuseColor = texture(texSampler, fragTexCoord);
+    vec4 diffuseColor = texture(texSampler[group], fragTexCoord);
 	// Calculate the diffuse term for Lambert shading
 	float diffuseTerm = clamp(dot(TextureNormal_worldspace, normalize(lightDir)), 0.15f, 1);
 	// Avoid negative lighting values
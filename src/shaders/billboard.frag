@@ -1,18 +1,35 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(set = 1, binding = 1) uniform sampler2D texSampler;
-layout(set = 1, binding = 2) uniform sampler2D normalSampler;
-layout(set = 1, binding = 3) uniform sampler2D noiseSampler;
+// Same as in InstanceData.h
+#define MAX_TREE_GROUPS 16
+// Same as in ImpostorBaker.h
+#define IMPOSTOR_FRAMES 8
+#define IMPOSTOR_FRAME_SIZE 256
+
+// Textures of every tree group. The group is the same for a whole draw, so indexing with it is dynamically uniform
+// Species bind their impostor atlases, albedo in texSampler and normal + depth in normalSampler
+layout(set = 1, binding = 1) uniform sampler2D texSampler[MAX_TREE_GROUPS];
+layout(set = 1, binding = 2) uniform sampler2D normalSampler[MAX_TREE_GROUPS];
 
 layout(set = 2, binding = 0) uniform Time {
     vec2 TimeInfo;
 	// 0: deltaTime 1: totalTime
 };
 
-layout(set = 3, binding = 0) uniform LODINFO{
+struct LODGroup {
 	// 0: LOD0 1: LOD1 2: TreeHeight 3: NumTrees
 	vec4 LODInfo;
+	// 0: full model sphere center height 1: full model radius 2: fake tree billboard center height 3: fake tree billboard radius
+	vec4 LODBounds;
+	// 0: first instance 1: instance count 2: 1 for fake trees 3: mesh levels
+	uvec4 Range;
+	// Projected size in pixels down to which each mesh level is drawn
+	vec4 LevelEnds;
+};
+
+layout(set = 3, binding = 0) uniform LODINFO{
+	LODGroup groups[MAX_TREE_GROUPS];
 };
 
 layout(set = 4, binding = 0) uniform DayNightInfo{
@@ -27,11 +44,16 @@ layout(location = 3) in vec3 worldN;
 layout(location = 4) in vec3 worldB;
 layout(location = 5) in vec3 worldT;
 layout(location = 6) in float vertAmbient;
-layout(location = 7) in float distanceLevel;
-layout(location = 8) in vec2 noiseTexCoord;
+layout(location = 7) flat in float lodFade;
 layout(location = 9) in vec3 tintColor;
 layout(location = 10) in float flag;
 
+layout(location = 11) flat in int group;
+layout(location = 12) in vec3 impostorPos;
+layout(location = 13) flat in vec4 impostorEye;
+layout(location = 14) flat in vec3 impostorWeights;
+layout(location = 15) flat in uvec3 impostorFrames;
+
 layout(location = 0) out vec4 outColor;
 
 const vec3 lightDir = vec3(-1.0, 5.0, -3.0);
@@ -39,25 +61,91 @@ const vec3 lightColorDay = vec3(1.0, 1.0, 0.94);
 const vec3 lightColorAfternoon = vec3(1.0, 0.9, 0.7);
 const vec3 lightColorNight = vec3(0.95, 1.0, 1.0);
 
+// Same as the rotation of bark.vert / leaf.vert
+vec3 rotateY(vec3 v, float angle)
+{
+	float s = sin(angle);
+	float c = cos(angle);
+	return vec3(c * v.x - s * v.z, v.y, s * v.x + c * v.z);
+}
+
+// [0, 1]^2 to a direction with y >= 0, same as ImpostorBaker::HemiOctahedronDecode
+vec3 hemiOctahedronDecode(vec2 grid)
+{
+	vec2 a = grid * 2.0 - 1.0;
+	vec2 p = vec2(a.x + a.y, a.y - a.x) * 0.5;
+	return normalize(vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y));
+}
+
+// Atlas coordinates where the view ray hits the species in a frame. The ray is intersected with the frame's plane
+// through the sphere center first and then moved along by the baked depth, so frames seen from a slightly different
+// direction still line up
+vec2 impostorAtlasUV(uint frame, vec3 rayDir, float radius)
+{
+	vec2 cell = vec2(float(frame % uint(IMPOSTOR_FRAMES)), float(frame / uint(IMPOSTOR_FRAMES)));
+	vec3 forward = hemiOctahedronDecode(cell / float(IMPOSTOR_FRAMES - 1));
+	// Same as ImpostorBaker::FrameBasis
+	vec3 right = abs(forward.y) < 0.999 ? normalize(cross(vec3(0.0, 1.0, 0.0), forward)) : vec3(1.0, 0.0, 0.0);
+	vec3 up = cross(forward, right);
+
+	float facing = min(dot(forward, rayDir), -1e-3);
+	vec3 hit = impostorEye.xyz - rayDir * (dot(forward, impostorEye.xyz) / facing);
+	vec2 uv = vec2(0.5 + dot(hit, right) / (2.0 * radius), 0.5 - dot(hit, up) / (2.0 * radius));
+	float depth = textureLod(normalSampler[group], (cell + clamp(uv, 0.0, 1.0)) / float(IMPOSTOR_FRAMES), 0.0).a;
+	hit += rayDir * ((0.5 - depth) * 2.0 * radius / facing);
+	uv = vec2(0.5 + dot(hit, right) / (2.0 * radius), 0.5 - dot(hit, up) / (2.0 * radius));
+
+	// Keep the bilinear footprint inside the frame
+	float halfTexel = 0.5 / float(IMPOSTOR_FRAME_SIZE);
+	return (cell + clamp(uv, vec2(halfTexel), vec2(1.0 - halfTexel))) / float(IMPOSTOR_FRAMES);
+}
+
+// Ordered dither threshold of the pixel, in (0, 1). Same pattern in bark.frag, leaf.frag and billboard.frag: the full
+// tree keeps the pixels whose threshold is above its fade and the billboard the rest, so an instance in the middle of
+// a cross-fade covers every pixel once
+float ditherThreshold() {
+	const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[pixel.y * 4 + pixel.x] + 0.5) / 16.0;
+}
+
 void main() {
-	// LOD Morphing
-	vec4 noiseColor = texture(noiseSampler, noiseTexCoord);
-	float dis = (distanceLevel - LODInfo.y)/(LODInfo.x - LODInfo.y);
-	if(dis < noiseColor.x)
+	// LOD cross-fade, the billboard takes the pixels the full tree leaves
+	if(lodFade < ditherThreshold())
 		discard;
 
-	// Local normal, in tangent space
-	vec3 TextureNormal_tangentspace;
-	TextureNormal_tangentspace = (texture( normalSampler, fragTexCoord ).rgb*2.0f - 1.0f);
-	TextureNormal_tangentspace.x *= 1.1f;
-	// Modify the bugs on original texture
-	TextureNormal_tangentspace.y *= clamp(worldPosition.y/15.0f, 0.5f, 1.0f);
-	vec3 TextureNormal_worldspace = normalize(worldT * TextureNormal_tangentspace.x + worldB * TextureNormal_tangentspace.y + worldN * TextureNormal_tangentspace.z);
-
-    vec4 diffuseColor = texture(texSampler, fragTexCoord);
-	
-	//Because the alpha level fake tree billboard we use here is different with models' billboards
-	float alphaThreshold = (0.85f-0.55f*flag);
+	vec3 TextureNormal_worldspace;
+	vec4 diffuseColor;
+	float alphaThreshold;
+	if (groups[group].Range.z == 0u) {
+		// Species impostor, blend the three closest frames
+		vec3 rayDir = normalize(impostorPos - impostorEye.xyz);
+		float radius = groups[group].LODBounds.y;
+		diffuseColor = vec4(0.0);
+		vec3 normal = vec3(0.0);
+		for (int i = 0; i < 3; i++) {
+			vec2 uv = impostorAtlasUV(impostorFrames[i], rayDir, radius);
+			diffuseColor += texture(texSampler[group], uv) * impostorWeights[i];
+			normal += (texture(normalSampler[group], uv).rgb * 2.0 - 1.0) * impostorWeights[i];
+		}
+		// The cleared background is black, so filtered edges come out premultiplied
+		diffuseColor.rgb /= max(diffuseColor.a, 1e-3);
+		TextureNormal_worldspace = normalize(rotateY(normal, impostorEye.w));
+		alphaThreshold = 0.5f;
+	}
+	else {
+		// Local normal, in tangent space
+		vec3 TextureNormal_tangentspace;
+		TextureNormal_tangentspace = (texture( normalSampler[group], fragTexCoord ).rgb*2.0f - 1.0f);
+		TextureNormal_tangentspace.x *= 1.1f;
+		// Modify the bugs on original texture
+		TextureNormal_tangentspace.y *= clamp(worldPosition.y/15.0f, 0.5f, 1.0f);
+		TextureNormal_worldspace = normalize(worldT * TextureNormal_tangentspace.x + worldB * TextureNormal_tangentspace.y + worldN * TextureNormal_tangentspace.z);
+
+		diffuseColor = texture(texSampler[group], fragTexCoord);
+		//Because the alpha level fake tree billboard we use here is different with models' billboards
+		alphaThreshold = (0.85f-0.55f*flag);
+	}
 	if(diffuseColor.a < alphaThreshold)
 		discard;
 
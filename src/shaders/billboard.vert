@@ -6,6 +6,9 @@ layout(set = 0, binding = 0) uniform CameraBufferObject {
 	mat4 proj;
 	vec4 camPos;
 	vec4 camDir;
+	vec4 frustumPlanes[6];
+	// 0: width 1: height 2: pixels per world unit at distance 1
+	vec4 screen;
 } camera;
 
 layout(set = 1, binding = 0) uniform ModelBufferObject {
@@ -17,9 +20,24 @@ layout(set = 2, binding = 0) uniform Time {
 	// 0: deltaTime 1: totalTime
 };
 
-layout(set = 3, binding = 0) uniform LODINFO{
+// Same as in InstanceData.h
+#define MAX_TREE_GROUPS 16
+// Same as in ImpostorBaker.h
+#define IMPOSTOR_FRAMES 8
+
+struct LODGroup {
 	// 0: LOD0 1: LOD1 2: TreeHeight 3: NumTrees
 	vec4 LODInfo;
+	// 0: full model sphere center height 1: full model radius 2: fake tree billboard center height 3: fake tree billboard radius
+	vec4 LODBounds;
+	// 0: first instance 1: instance count 2: 1 for fake trees 3: mesh levels
+	uvec4 Range;
+	// Projected size in pixels down to which each mesh level is drawn
+	vec4 LevelEnds;
+};
+
+layout(set = 3, binding = 0) uniform LODINFO{
+	LODGroup groups[MAX_TREE_GROUPS];
 };
 
 layout(location = 0) in vec3 inPosition;
@@ -31,6 +49,7 @@ layout(location = 5) in vec3 inBitangent;
 // Instance Buffer
 layout(location = 6) in vec4 inTransformPos_Scale;
 layout(location = 7) in vec4 inTintColor_Theta;
+layout(location = 8) in vec4 inLodState;
 
 layout(location = 0) out vec3 vertColor;
 layout(location = 1) out vec2 fragTexCoord;
@@ -39,10 +58,19 @@ layout(location = 3) out vec3 worldN;
 layout(location = 4) out vec3 worldB;
 layout(location = 5) out vec3 worldT;
 layout(location = 6) out float vertAmbient;
-layout(location = 7) out float distanceLevel;
-layout(location = 8) out vec2 noiseTexCoord;
+// Cross-fade from the full tree to the billboard (from hidden for fake trees), picked by the culling pass
+layout(location = 7) flat out float lodFade;
 layout(location = 9) out vec3 tintColor;
 layout(location = 10) out float flag;
+// Tree group of the instance, picks its LOD settings and textures
+layout(location = 11) flat out int group;
+// Species are drawn as impostors. Quad position and camera in the model space of the full tree, relative to its
+// sphere center, the instance rotation in w
+layout(location = 12) out vec3 impostorPos;
+layout(location = 13) flat out vec4 impostorEye;
+// Atlas frames around the view direction and their weights
+layout(location = 14) flat out vec3 impostorWeights;
+layout(location = 15) flat out uvec3 impostorFrames;
 
 out gl_PerVertex {
     vec4 gl_Position;
@@ -67,7 +95,85 @@ float atan2(in float y, in float x)
     return mix(3.1415926/2.0 - atan(x,y), atan(y,x), s);
 }
 
+// Same as the rotation of bark.vert / leaf.vert
+vec3 rotateY(vec3 v, float angle)
+{
+	float s = sin(angle);
+	float c = cos(angle);
+	return vec3(c * v.x - s * v.z, v.y, s * v.x + c * v.z);
+}
+
+// Direction with y >= 0 to [0, 1]^2, the inverse of hemiOctahedronDecode in billboard.frag
+vec2 hemiOctahedronEncode(vec3 dir)
+{
+	dir.y = max(dir.y, 0.0);
+	vec2 p = dir.xz / (abs(dir.x) + dir.y + abs(dir.z));
+	return vec2(p.x - p.y, p.x + p.y) * 0.5 + 0.5;
+}
+
+// Every draw covers one group's instance range, gl_InstanceIndex already includes firstInstance
+int findGroup() {
+	uint instance = uint(gl_InstanceIndex);
+	for (int i = 0; i < MAX_TREE_GROUPS; i++) {
+		if (instance >= groups[i].Range.x && instance - groups[i].Range.x < groups[i].Range.y) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+void impostor() {
+	// Camera facing quad over the full model's sphere
+	vec4 LODBounds = groups[group].LODBounds;
+	float scale = inTransformPos_Scale.w;
+	vec3 center = inTransformPos_Scale.xyz + vec3(0.0, LODBounds.x * scale, 0.0);
+	vec3 forward = normalize(camera.camPos.xyz - center);
+	vec3 right = abs(forward.y) < 0.999 ? normalize(cross(vec3(0.0, 1.0, 0.0), forward)) : vec3(1.0, 0.0, 0.0);
+	vec3 up = cross(forward, right);
+	vec3 vPos = center + (right * inPosition.x + up * inPosition.y) * (LODBounds.y * scale);
+	worldN = forward;
+	worldB = up;
+	worldT = right;
+	worldPosition = vPos;
+	gl_Position = camera.proj * camera.view * vec4(vPos, 1.0);
+
+	float theta = inTintColor_Theta.w;
+	impostorPos = rotateY(vPos - center, -theta) / scale;
+	impostorEye = vec4(rotateY(camera.camPos.xyz - center, -theta) / scale, theta);
+
+	// Blend the three frames of the grid triangle the view direction falls into
+	vec2 grid = hemiOctahedronEncode(normalize(impostorEye.xyz)) * float(IMPOSTOR_FRAMES - 1);
+	vec2 cell = min(floor(grid), vec2(float(IMPOSTOR_FRAMES - 2)));
+	vec2 f = grid - cell;
+	uint base = uint(cell.x) + uint(cell.y) * uint(IMPOSTOR_FRAMES);
+	if (f.x + f.y < 1.0) {
+		impostorFrames = uvec3(base, base + 1u, base + uint(IMPOSTOR_FRAMES));
+		impostorWeights = vec3(1.0 - f.x - f.y, f.x, f.y);
+	}
+	else {
+		impostorFrames = uvec3(base + uint(IMPOSTOR_FRAMES) + 1u, base + uint(IMPOSTOR_FRAMES), base + 1u);
+		impostorWeights = vec3(f.x + f.y - 1.0, 1.0 - f.x, 1.0 - f.y);
+	}
+}
+
 void main() {
+	group = findGroup();
+	vertAmbient = inColor.a;
+	vertColor = vec3(inColor);
+	fragTexCoord = inTexCoord;
+	lodFade = inLodState.x;
+	tintColor = inTintColor_Theta.xyz;
+	impostorPos = vec3(0.0);
+	impostorEye = vec4(0.0);
+	impostorWeights = vec3(0.0);
+	impostorFrames = uvec3(0u);
+	if (groups[group].Range.z == 0u) {
+		flag = 0;
+		impostor();
+		return;
+	}
+
+	// Fake trees are hand made quads turned toward the camera
 	mat4 rotation;
 	//camDir is the right direction of the camera
 	float theta = atan2(camera.camDir.z, camera.camDir.x);
@@ -83,25 +189,13 @@ void main() {
 	worldN = normalize(inv_trans_model * inNormal);
 	worldB = normalize(inv_trans_model * inBitangent);
 	worldT = normalize(inv_trans_model * inTangent);
-	vertAmbient = inColor.a;
 
 	worldPosition = vPos;
 
 	gl_Position = camera.proj * camera.view * vec4(vPos, 1.0);
-	
-    vertColor = vec3(inColor);
-	//vertColor=vec3(w);
-    fragTexCoord = inTexCoord;
-
-//LOD Effect
-	noiseTexCoord.x = (inPosition.x - inTransformPos_Scale.x) / (LODInfo.z * 1.1f) + 0.5f;
-	noiseTexCoord.y = (inPosition.y - inTransformPos_Scale.y) / LODInfo.z;
-	//camera.camPos.w : far_near_distance
-	distanceLevel = length(vec2(camera.camPos.x, camera.camPos.z) - vec2(worldPosition.x, worldPosition.z)) / camera.camPos.w;
+
 // Fake Tree flag	
 	flag = 0;
 	if(inTintColor_Theta.w == -1)
 		flag = 1;
-// Tint Color
-	tintColor = inTintColor_Theta.xyz;
 }
@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Same as FrameConstants in ImpostorBaker.cpp
+layout(push_constant) uniform Frame {
+	// xyz: frame basis in model space, forward points at the baking camera
+	// w: sphere center height, sphere radius and the layer's alpha cutoff
+	vec4 right;
+	vec4 up;
+	vec4 forward;
+	// Tangent space normal map xy scale
+	vec4 normalScale;
+} frame;
+
+layout(set = 0, binding = 0) uniform sampler2D texSampler;
+layout(set = 0, binding = 1) uniform sampler2D normalSampler;
+
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) in vec3 modelN;
+layout(location = 2) in vec3 modelT;
+layout(location = 3) in vec3 modelB;
+
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec4 outNormalDepth;
+
+void main() {
+	vec4 diffuseColor = texture(texSampler, fragTexCoord);
+	if (diffuseColor.a < frame.forward.w)
+		discard;
+
+	// Same tangent space as bark.frag / leaf.frag, the scale carries the bitangent's sign
+	vec3 normalTangentSpace = texture(normalSampler, fragTexCoord).rgb * 2.0 - 1.0;
+	normalTangentSpace.xy *= frame.normalScale.xy;
+	vec3 normal = normalize(normalize(modelT) * normalTangentSpace.x + normalize(modelB) * normalTangentSpace.y + normalize(modelN) * normalTangentSpace.z);
+	// Leaves are lit from whichever side is seen
+	if (dot(normal, frame.forward.xyz) < 0.0)
+		normal = -normal;
+
+	outAlbedo = vec4(diffuseColor.rgb, 1.0);
+	outNormalDepth = vec4(normal * 0.5 + 0.5, gl_FragCoord.z);
+}
@@ -0,0 +1,41 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Same as FrameConstants in ImpostorBaker.cpp
+layout(push_constant) uniform Frame {
+	// xyz: frame basis in model space, forward points at the baking camera
+	// w: sphere center height, sphere radius and the layer's alpha cutoff
+	vec4 right;
+	vec4 up;
+	vec4 forward;
+	// Tangent space normal map xy scale
+	vec4 normalScale;
+} frame;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec3 inNormal;
+layout(location = 4) in vec3 inTangent;
+layout(location = 5) in vec3 inBitangent;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out vec3 modelN;
+layout(location = 2) out vec3 modelT;
+layout(location = 3) out vec3 modelB;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+	// Orthographic over the bounding sphere: x right, y down, depth 0 at the sphere's front and 1 at its back
+	vec3 p = inPosition - vec3(0.0, frame.right.w, 0.0);
+	float radius = frame.up.w;
+	gl_Position = vec4(dot(p, frame.right.xyz) / radius, -dot(p, frame.up.xyz) / radius, 0.5 - 0.5 * dot(p, frame.forward.xyz) / radius, 1.0);
+
+	fragTexCoord = inTexCoord;
+	modelN = inNormal;
+	modelT = inTangent;
+	modelB = inBitangent;
+}
@@ -6,10 +6,20 @@ layout(set = 0, binding = 0) uniform CameraBufferObject {
 	mat4 proj;
 	vec4 camPos;
 	vec4 camDir;
+	vec4 frustumPlanes[6];
+	// 0: width 1: height 2: pixels per world unit at distance 1
+	vec4 screen;
 } camera;
 
+// Same as in Vertex.h
+#define PACKED_TREE_VERTICES 1
+
+// Same as ModelBatchBufferObject in ModelBatch.h
 layout(set = 1, binding = 0) uniform ModelBufferObject {
     mat4 model;
+	// Packed positions are offset + unorm * scale
+	vec4 positionOffset;
+	vec4 positionScale;
 };
 
 layout(set = 2, binding = 0) uniform Time {
@@ -17,9 +27,22 @@ layout(set = 2, binding = 0) uniform Time {
 	// 0: deltaTime 1: totalTime
 };
 
-layout(set = 3, binding = 0) uniform LODINFO{
+// Same as in InstanceData.h
+#define MAX_TREE_GROUPS 16
+
+struct LODGroup {
 	// 0: LOD0 1: LOD1 2: TreeHeight 3: NumTrees
 	vec4 LODInfo;
+	// 0: full model sphere center height 1: full model radius 2: fake tree billboard center height 3: fake tree billboard radius
+	vec4 LODBounds;
+	// 0: first instance 1: instance count 2: 1 for fake trees 3: mesh levels
+	uvec4 Range;
+	// Projected size in pixels down to which each mesh level is drawn
+	vec4 LevelEnds;
+};
+
+layout(set = 3, binding = 0) uniform LODINFO{
+	LODGroup groups[MAX_TREE_GROUPS];
 };
 
 layout(set = 5, binding = 0) uniform WindInfo{
@@ -28,16 +51,25 @@ layout(set = 5, binding = 0) uniform WindInfo{
 	vec4 WindData;
 }windInfo;
 
+#if PACKED_TREE_VERTICES
+// PackedVertex
+layout(location = 0) in vec3 inPackedPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec4 inTangentFrame;
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec4 inColor;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in vec3 inNormal;
 layout(location = 4) in vec3 inTangent;
 layout(location = 5) in vec3 inBitangent;
+#endif
 
 // Instance Buffer
 layout(location = 6) in vec4 inTransformPos_Scale;
 layout(location = 7) in vec4 inTintColor_Theta;
+layout(location = 8) in vec4 inLodState;
 
 layout(location = 0) out vec3 vertColor;
 layout(location = 1) out vec2 fragTexCoord;
@@ -46,9 +78,11 @@ layout(location = 3) out vec3 worldN;
 layout(location = 4) out vec3 worldB;
 layout(location = 5) out vec3 worldT;
 layout(location = 6) out float vertAmbient;
-layout(location = 7) out float distanceLevel;
-layout(location = 8) out vec2 noiseTexCoord;
+// Cross-fade from the full tree to the billboard, picked by the culling pass
+layout(location = 7) flat out float lodFade;
 layout(location = 9) out vec3 tintColor;
+// Tree group of the instance, picks its LOD settings and textures
+layout(location = 11) flat out int group;
 
 out gl_PerVertex {
     vec4 gl_Position;
@@ -145,7 +179,40 @@ mat4 rotateMatrix(vec3 axis, float angle)
                 0.0,                                0.0,                                0.0,                                1.0);
 }
 
+#if PACKED_TREE_VERTICES
+// Model space position, normal, tangent and bitangent of a PackedVertex. The tangent frame quaternion rotates x to the
+// tangent and z to the normal, its w is negative where the bitangent is flipped
+void unpackVertex(out vec3 position, out vec3 normal, out vec3 tangent, out vec3 bitangent) {
+	position = positionOffset.xyz + inPackedPosition * positionScale.xyz;
+	vec4 q = inTangentFrame;
+	tangent = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+	normal = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+	bitangent = cross(normal, tangent) * (q.w < 0.0 ? -1.0 : 1.0);
+}
+#else
+void unpackVertex(out vec3 position, out vec3 normal, out vec3 tangent, out vec3 bitangent) {
+	position = inPosition;
+	normal = inNormal;
+	tangent = inTangent;
+	bitangent = inBitangent;
+}
+#endif
+
+// Every draw covers one group's instance range, gl_InstanceIndex already includes firstInstance
+int findGroup() {
+	uint instance = uint(gl_InstanceIndex);
+	for (int i = 0; i < MAX_TREE_GROUPS; i++) {
+		if (instance >= groups[i].Range.x && instance - groups[i].Range.x < groups[i].Range.y) {
+			return i;
+		}
+	}
+	return 0;
+}
+
 void main() {
+	group = findGroup();
+	vec3 position, normal, tangent, bitangent;
+	unpackVertex(position, normal, tangent, bitangent);
 	mat4 scale = mat4(1.0);
 	mat4 rotate = rotateMatrix(vec3(0,1,0), inTintColor_Theta.w);
 	mat4 translate=mat4(1.0);
@@ -160,12 +227,12 @@ void main() {
 	mat4 modelMatrix = model * translate * rotate * scale;
 
 	mat3 inv_trans_model = transpose(inverse(mat3(modelMatrix)));
-	vec3 vPos=vec3(modelMatrix * vec4(inPosition, 1.0f));
+	vec3 vPos=vec3(modelMatrix * vec4(position, 1.0f));
 
-	vec3 normalDir=normalize(inv_trans_model * inNormal);
+	vec3 normalDir=normalize(inv_trans_model * normal);
 	worldN = normalDir;
-	worldB = normalize(inv_trans_model * inBitangent);
-	worldT = normalize(inv_trans_model * inTangent);
+	worldB = normalize(inv_trans_model * bitangent);
+	worldT = normalize(inv_trans_model * tangent);
 	vertAmbient = inColor.a;
 
 
@@ -216,9 +283,7 @@ void main() {
     fragTexCoord = inTexCoord;
 
 //LOD Effect
-	noiseTexCoord.x = (vPos.x - inTransformPos_Scale.x) / (LODInfo.z/2.0f) + 0.5f;
-	noiseTexCoord.y = (vPos.y - inTransformPos_Scale.y) / LODInfo.z;
-	distanceLevel = length(vec2(camera.camPos.x, camera.camPos.z) - vec2(worldPosition.x, worldPosition.z)) / camera.camPos.w;
+	lodFade = inLodState.x;
 	
 // Tint Color
 	tintColor = inTintColor_Theta.xyz;
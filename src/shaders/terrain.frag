@@ -3,6 +3,8 @@
 
 layout(set = 1, binding = 1) uniform sampler2D texSampler;
 layout(set = 1, binding = 2) uniform sampler2D normalSampler;
+// xyz normal, w y of the tangent along +x, see TerrainSurfaceTexel in TerrainBuilder.h
+layout(set = 1, binding = 5) uniform sampler2D surfaceSampler;
 
 layout(set = 2, binding = 0) uniform Time {
     vec2 TimeInfo;
@@ -15,6 +17,7 @@ layout(set = 3, binding = 0) uniform DayNightInfo{
 };
 
 layout(location = 0) in vec2 fragTexCoord;
+layout(location = 2) in vec2 surfaceTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
@@ -27,10 +30,13 @@ void main() {
 	// Local normal, in tangent space
 	vec3 TextureNormal_tangentspace;
 	TextureNormal_tangentspace = normalize(texture( normalSampler, fragTexCoord ).rgb*2.0f - 1.0f);
-	vec3 TextureNormal_worldspace;
-	TextureNormal_worldspace.y = TextureNormal_tangentspace.z;
-	TextureNormal_worldspace.z = -TextureNormal_tangentspace.y;
-	TextureNormal_worldspace.x = TextureNormal_tangentspace.x;
+	// Tangent frame of the heightfield, on flat ground x, -z and y
+	vec4 surface = texture(surfaceSampler, surfaceTexCoord);
+	vec3 normal = normalize(surface.xyz);
+	vec3 tangent = vec3(sqrt(max(1.0 - surface.w * surface.w, 0.0)), surface.w, 0.0);
+	tangent = normalize(tangent - normal * dot(normal, tangent));
+	vec3 bitangent = cross(normal, tangent);
+	vec3 TextureNormal_worldspace = mat3(tangent, bitangent, normal) * TextureNormal_tangentspace;
 	
 	// Calculate the diffuse term for Lambert shading
 	// Calculate the diffuse term for Lambert shading
@@ -12,31 +12,78 @@ layout(set = 1, binding = 0) uniform ModelBufferObject {
     mat4 model;
 };
 
+// Same as in Terrain.h
+#define TERRAIN_PATCH_CELLS 32
+#define TERRAIN_MAX_LODS 8
+
+layout(set = 1, binding = 3) uniform TerrainBufferObject {
+	// 0: heightmap texels per world unit along x 1: along z 2: world size of the terrain 3: number of levels
+	vec4 extent;
+	// Per level: x distance at which the patch starts to morph into the grid of the next level, y 1 / the distance it
+	// takes to get there
+	vec4 morphRanges[TERRAIN_MAX_LODS];
+} terrain;
+
+// World heights, one texel per heightmap sample
+layout(set = 1, binding = 4) uniform sampler2D heightMap;
+
 layout(set = 2, binding = 0) uniform Time {
     vec2 TimeInfo;
 	// 0: deltaTime 1: totalTime
 };
 
+// Grid patch over [0, 1] in x and z
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec4 inColor;
-layout(location = 2) in vec2 inTexCoord;
-layout(location = 3) in vec3 inNormal;
-layout(location = 4) in vec3 inTangent;
-layout(location = 5) in vec3 inBitangent;
+// Per chunk, see TerrainChunk in Terrain.h: xy world x and z of its low corner, z its size, w its level
+layout(location = 6) in vec4 inChunk;
 
 layout(location = 0) out vec2 fragTexCoord;
 layout(location = 1) out vec3 worldPosition;
+// Into the surface map, which has one texel per height
+layout(location = 2) out vec2 surfaceTexCoord;
 
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
+// Bilinear between the four nearest samples, the heights are a 32 bit float format that need not filter linearly
+float terrainHeight(vec2 worldXZ) {
+	ivec2 size = textureSize(heightMap, 0);
+	vec2 texel = worldXZ * terrain.extent.xy;
+	ivec2 low = clamp(ivec2(floor(texel)), ivec2(0), size - 1);
+	ivec2 high = min(low + 1, size - 1);
+	vec2 f = clamp(texel - vec2(low), 0.0, 1.0);
+	float h00 = texelFetch(heightMap, low, 0).r;
+	float h10 = texelFetch(heightMap, ivec2(high.x, low.y), 0).r;
+	float h01 = texelFetch(heightMap, ivec2(low.x, high.y), 0).r;
+	float h11 = texelFetch(heightMap, high, 0).r;
+	return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
+
 void main() {
+	vec2 gridPos = inPosition.xz;
+	vec2 chunkOffset = inChunk.xy;
+	float chunkSize = inChunk.z;
+	int level = int(inChunk.w);
+
+	// Morph by the distance of the unmorphed vertex, so neighbouring chunks agree on their shared edges
+	vec2 worldXZ = chunkOffset + gridPos * chunkSize;
+	vec3 unmorphed = vec3(worldXZ.x, terrainHeight(worldXZ), worldXZ.y);
+	vec2 morphRange = terrain.morphRanges[level].xy;
+	float morph = clamp((distance(unmorphed, camera.camPos.xyz) - morphRange.x) * morphRange.y, 0.0, 1.0);
+
+	// Odd vertices slide onto their even neighbours, fully morphed the patch is the grid of the next level
+	vec2 fracPart = fract(gridPos * float(TERRAIN_PATCH_CELLS) * 0.5) * 2.0 / float(TERRAIN_PATCH_CELLS);
+	worldXZ = chunkOffset + (gridPos - fracPart * morph) * chunkSize;
+	// Chunks past the far edges of the terrain fold their outside onto the edge
+	worldXZ = min(worldXZ, vec2(terrain.extent.z));
+
 	mat4 modelMatrix = model;
-	vec3 vPos=vec3(modelMatrix * vec4(inPosition, 1.0f));
+	vec3 vPos = vec3(modelMatrix * vec4(worldXZ.x, terrainHeight(worldXZ), worldXZ.y, 1.0f));
 	worldPosition = vPos;
 
 	gl_Position = camera.proj * camera.view * vec4(vPos, 1.0);
-	
-    fragTexCoord = inTexCoord;
+
+	fragTexCoord = worldXZ / terrain.extent.z;
+	surfaceTexCoord = (worldXZ * terrain.extent.xy + 0.5) / vec2(textureSize(heightMap, 0));
 }
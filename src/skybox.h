@@ -38,7 +38,7 @@ protected:
 	VkSampler skyDiffuseMapSampler[3] = {};
 public:
 	Skybox() = delete;
-	Skybox(Device* device, VkCommandPool commandPool, const std::vector<Position> &vertices, const std::vector<uint32_t> &indices);
+	Skybox(Device* device, UploadContext* uploadContext, const std::vector<Position> &vertices, const std::vector<uint32_t> &indices);
 	void SetDiffuseMapIdx(VkImage texture, int idx);
 	VkImageView GetDiffuseMapViewIdx(int idx) const;
 	VkSampler GetDiffuseMapSamplerIdx(int idx) const;